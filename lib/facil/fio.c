@@ -75,6 +75,141 @@ Feel free to copy, use and enjoy according to the license provided.
 #define DEBUG_SPINLOCK 0
 #endif
 
+/* Default deadline (in seconds) for connections to drain during shutdown */
+#ifndef FIO_SHUTDOWN_TIMEOUT
+#define FIO_SHUTDOWN_TIMEOUT 30
+#endif
+
+/* Autoscaling: the worker load review interval (in milliseconds) */
+#ifndef FIO_AUTOSCALE_INTERVAL
+#define FIO_AUTOSCALE_INTERVAL 1000
+#endif
+
+/* Autoscaling: workers are overloaded above this CPU use (percent) */
+#ifndef FIO_AUTOSCALE_CPU_HIGH
+#define FIO_AUTOSCALE_CPU_HIGH 75
+#endif
+
+/* Autoscaling: workers are idle below this CPU use (percent) */
+#ifndef FIO_AUTOSCALE_CPU_LOW
+#define FIO_AUTOSCALE_CPU_LOW 25
+#endif
+
+/* Autoscaling: workers are overloaded above this task queue lag (in ms) */
+#ifndef FIO_AUTOSCALE_LAG_HIGH
+#define FIO_AUTOSCALE_LAG_HIGH 50
+#endif
+
+/* Autoscaling: consecutive overloaded reviews before spawning a worker */
+#ifndef FIO_AUTOSCALE_UP_REVIEWS
+#define FIO_AUTOSCALE_UP_REVIEWS 3
+#endif
+
+/* Autoscaling: consecutive idle reviews before retiring a worker */
+#ifndef FIO_AUTOSCALE_DOWN_REVIEWS
+#define FIO_AUTOSCALE_DOWN_REVIEWS 60
+#endif
+
+/* Binary upgrade: the time (in milliseconds) to wait for the new binary */
+#ifndef FIO_UPGRADE_TIMEOUT
+#define FIO_UPGRADE_TIMEOUT 5000
+#endif
+
+/* DNS: the hosts file used by `fio_dns_resolve` */
+#ifndef FIO_DNS_HOSTS_FILE
+#define FIO_DNS_HOSTS_FILE "/etc/hosts"
+#endif
+
+/* DNS: the resolver configuration file (nameserver and options) */
+#ifndef FIO_DNS_RESOLV_FILE
+#define FIO_DNS_RESOLV_FILE "/etc/resolv.conf"
+#endif
+
+/* DNS: the maximal time (in seconds) a resolved address is cached */
+#ifndef FIO_DNS_TTL_MAX
+#define FIO_DNS_TTL_MAX 3600
+#endif
+
+/* DNS: the time (in seconds) a failed resolution is cached */
+#ifndef FIO_DNS_NEGATIVE_TTL
+#define FIO_DNS_NEGATIVE_TTL 30
+#endif
+
+/* DNS: the maximal number of nameservers loaded from the resolver file */
+#ifndef FIO_DNS_NAMESERVERS_MAX
+#define FIO_DNS_NAMESERVERS_MAX 3
+#endif
+
+/* DNS: the maximal number of search domains loaded from the resolver file */
+#ifndef FIO_DNS_SEARCH_MAX
+#define FIO_DNS_SEARCH_MAX 6
+#endif
+
+/* DNS: the maximal number of cached names (expired names are evicted) */
+#ifndef FIO_DNS_CACHE_LIMIT
+#define FIO_DNS_CACHE_LIMIT 4096
+#endif
+
+/* SO_BUSY_POLL value (in microseconds) for sockets when busy polling */
+#ifndef FIO_BUSY_POLL_USEC
+#define FIO_BUSY_POLL_USEC 50
+#endif
+
+/* Task queue scheduling weights (tasks per round) for each task class */
+#ifndef FIO_TASK_WEIGHT_DEFAULT
+#define FIO_TASK_WEIGHT_DEFAULT 8
+#endif
+#ifndef FIO_TASK_WEIGHT_PUBSUB
+#define FIO_TASK_WEIGHT_PUBSUB 4
+#endif
+#ifndef FIO_TASK_WEIGHT_BULK
+#define FIO_TASK_WEIGHT_BULK 1
+#endif
+
+/* Maximum number of subscriptions handled by a single pub/sub delivery task */
+#ifndef FIO_PUBSUB_BATCH_SIZE
+#define FIO_PUBSUB_BATCH_SIZE 256
+#endif
+
+/* Number of pub/sub channel collections (writer locks), a power of 2 */
+#ifndef FIO_PUBSUB_CHANNEL_SHARDS
+#define FIO_PUBSUB_CHANNEL_SHARDS 32
+#endif
+
+/* Small cluster messages are coalesced into writes of up to this many bytes */
+#ifndef FIO_CLUSTER_BATCH_SIZE
+#define FIO_CLUSTER_BATCH_SIZE 16384
+#endif
+
+/* UDP: the number of datagrams read (or sent) by a single system call */
+#ifndef FIO_UDP_BATCH
+#define FIO_UDP_BATCH 32
+#endif
+
+/* UDP: the largest datagram received (longer datagrams are dropped) */
+#ifndef FIO_UDP_BUFFER_SIZE
+#define FIO_UDP_BUFFER_SIZE 4096
+#endif
+
+/* UDP: the maximal number of queued outgoing datagrams per socket */
+#ifndef FIO_UDP_QUEUE_LIMIT
+#define FIO_UDP_QUEUE_LIMIT 4096
+#endif
+
+/* UDP: use `recvmmsg` / `sendmmsg` (Linux) rather than a call per datagram */
+#ifndef FIO_UDP_MMSG
+#if defined(__linux__)
+#define FIO_UDP_MMSG 1
+#else
+#define FIO_UDP_MMSG 0
+#endif
+#endif
+
+/* Connection table page size (bits), pages are allocated on first access */
+#ifndef FIO_FD_PAGE_BITS
+#define FIO_FD_PAGE_BITS 8
+#endif
+
 /* Slowloris mitigation  (must be less than 1<<16) */
 #ifndef FIO_SLOWLORIS_LIMIT
 #define FIO_SLOWLORIS_LIMIT (1 << 10)
@@ -139,6 +274,7 @@ typedef void (*fio_uuid_link_fn)(void *);
 #define FIO_SET_NAME fio_uuid_links
 #define FIO_SET_OBJ_TYPE fio_uuid_link_fn
 #define FIO_SET_OBJ_COMPARE(o1, o2) 1
+#define FIO_SET_GROUP_PROBING 1
 #include <fio.h>
 
 /** User-space socket buffer data */
@@ -155,7 +291,7 @@ struct fio_packet_s {
   uintptr_t length;
 };
 
-/** Connection data (fd_data) */
+/** Connection data (fd_data) - hot state, used by the reactor's IO cycle */
 typedef struct {
   /* current data to be send */
   fio_packet_s *packet;
@@ -167,6 +303,10 @@ typedef struct {
   fio_protocol_s *protocol;
   /* timer handler */
   time_t active;
+  /** RW hooks. */
+  fio_rw_hook_s *rw_hooks;
+  /** RW udata. */
+  void *rw_udata;
   /** The number of pending packets that are in the queue. */
   uint16_t packet_count;
   /* timeout settings */
@@ -183,17 +323,28 @@ typedef struct {
   uint8_t open;
   /** indicated that the connection should be closed. */
   uint8_t close;
+  /** the connection is migrating to another worker (no more reading). */
+  uint8_t migrating;
+} fio_fd_data_s;
+
+/** Connection data (fd_cold) - cold state, rarely accessed */
+typedef struct {
+  /* Objects linked to the UUID */
+  fio_uuid_links_s links;
   /** peer address length */
   uint8_t addr_len;
   /** peer address length */
   uint8_t addr[48];
-  /** RW hooks. */
-  fio_rw_hook_s *rw_hooks;
-  /** RW udata. */
-  void *rw_udata;
-  /* Objects linked to the UUID */
-  fio_uuid_links_s links;
-} fio_fd_data_s;
+} fio_fd_cold_s;
+
+#define FIO_FD_PAGE_SIZE ((uintptr_t)1 << FIO_FD_PAGE_BITS)
+#define FIO_FD_PAGE_MASK (FIO_FD_PAGE_SIZE - 1)
+
+/** A page in the connection table, hot and cold data are kept apart. */
+typedef struct {
+  fio_fd_data_s hot[FIO_FD_PAGE_SIZE];
+  fio_fd_cold_s cold[FIO_FD_PAGE_SIZE];
+} fio_fd_page_s;
 
 typedef struct {
   struct timespec last_cycle;
@@ -205,6 +356,8 @@ typedef struct {
   fio_ls_s thread_ids;
   /* active workers */
   uint16_t workers;
+  /* the maximal number of workers (autoscaling) */
+  uint16_t workers_max;
   /* timer handler */
   uint16_t threads;
   /* timeout review loop flag */
@@ -215,6 +368,20 @@ typedef struct {
   uint8_t is_worker;
   /* polling and global lock */
   fio_lock_i lock;
+  /* CPU placement strategy (fio_affinity_e) */
+  uint8_t affinity;
+  /* busy polling (low latency) reactor mode */
+  uint8_t busy_poll;
+  /* listening sockets were handed off to an upgraded binary */
+  uint8_t handoff;
+  /* connection draining deadline (in seconds) during shutdown */
+  uint16_t shutdown_timeout;
+  /* the time draining started (0 while running) */
+  time_t drain_start;
+  /* the worker's index (used for CPU placement) */
+  uint16_t worker_index;
+  /* connection table page allocation lock */
+  fio_lock_i page_lock;
   /* The highest active fd with a protocol object */
   uint32_t max_protocol_fd;
   /* timer handler */
@@ -222,7 +389,8 @@ typedef struct {
 #if FIO_ENGINE_POLL
   struct pollfd *poll;
 #endif
-  fio_fd_data_s info[];
+  /* connection table pages (allocated on first access) */
+  fio_fd_page_s *volatile pages[];
 } fio_data_s;
 
 /** The logging level */
@@ -233,6 +401,11 @@ int FIO_LOG_LEVEL = FIO_LOG_LEVEL_INFO;
 #endif
 static fio_data_s *fio_data = NULL;
 
+/* true when the root process is the only (worker) process, no cluster. */
+static inline int fio_single_process(void) {
+  return fio_data->workers == 1 && fio_data->workers_max <= 1;
+}
+
 /* used for protocol locking by task type. */
 typedef struct {
   fio_lock_i locks[3];
@@ -245,8 +418,26 @@ union protocol_metadata_union_u {
   protocol_metadata_s meta;
 };
 
-#define fd_data(fd) (fio_data->info[(uintptr_t)(fd)])
+static fio_fd_page_s *fio_fd_page_alloc(uintptr_t index);
+
+/* returns the connection table page for the fd, allocating it if missing. */
+static inline fio_fd_page_s *fio_fd_page(uintptr_t fd) {
+  fio_fd_page_s *page = fio_data->pages[fd >> FIO_FD_PAGE_BITS];
+  if (!page)
+    page = fio_fd_page_alloc(fd >> FIO_FD_PAGE_BITS);
+  return page;
+}
+
+/* tests for the fd's connection table page (never allocates). */
+#define fd_page_exists(fd)                                                     \
+  (fio_data->pages[(uintptr_t)(fd) >> FIO_FD_PAGE_BITS] != NULL)
+
+#define fd_data(fd)                                                            \
+  (fio_fd_page((uintptr_t)(fd))->hot[(uintptr_t)(fd)&FIO_FD_PAGE_MASK])
 #define uuid_data(uuid) fd_data(fio_uuid2fd((uuid)))
+#define fd_cold(fd)                                                            \
+  (fio_fd_page((uintptr_t)(fd))->cold[(uintptr_t)(fd)&FIO_FD_PAGE_MASK])
+#define uuid_cold(uuid) fd_cold(fio_uuid2fd((uuid)))
 #define fd2uuid(fd)                                                            \
   ((intptr_t)((((uintptr_t)(fd)) << 8) | fd_data((fd)).counter))
 
@@ -291,7 +482,7 @@ static inline int fio_clear_fd(intptr_t fd, uint8_t is_open) {
   void *rw_udata;
   fio_uuid_links_s links;
   fio_lock(&(fd_data(fd).sock_lock));
-  links = fd_data(fd).links;
+  links = fd_cold(fd).links;
   packet = fd_data(fd).packet;
   protocol = fd_data(fd).protocol;
   rw_hooks = fd_data(fd).rw_hooks;
@@ -304,11 +495,15 @@ static inline int fio_clear_fd(intptr_t fd, uint8_t is_open) {
       .counter = fd_data(fd).counter + 1,
       .packet_last = &fd_data(fd).packet,
   };
+  fd_cold(fd).links = (fio_uuid_links_s)FIO_SET_INIT;
+  fd_cold(fd).addr_len = 0;
+  fd_cold(fd).addr[0] = 0;
   if (fio_data->max_protocol_fd < fd) {
     fio_data->max_protocol_fd = fd;
   } else {
     while (fio_data->max_protocol_fd &&
-           !fd_data(fio_data->max_protocol_fd).open)
+           (!fd_page_exists(fio_data->max_protocol_fd) ||
+            !fd_data(fio_data->max_protocol_fd).open))
       --fio_data->max_protocol_fd;
   }
   fio_unlock(&(fd_data(fd).sock_lock));
@@ -334,6 +529,28 @@ static inline int fio_clear_fd(intptr_t fd, uint8_t is_open) {
   return 0;
 }
 
+/* allocates a connection table page, initializing all it's connections. */
+static fio_fd_page_s *fio_fd_page_alloc(uintptr_t index) {
+  fio_fd_page_s *page;
+  fio_lock(&fio_data->page_lock);
+  page = fio_data->pages[index];
+  if (page)
+    goto finish;
+  page = fio_mmap(sizeof(*page));
+  FIO_ASSERT_ALLOC(page);
+  for (size_t i = 0; i < FIO_FD_PAGE_SIZE; ++i) {
+    page->hot[i] = (fio_fd_data_s){
+        .rw_hooks = (fio_rw_hook_s *)&FIO_DEFAULT_RW_HOOKS,
+        .counter = 1,
+        .packet_last = &page->hot[i].packet,
+    };
+  }
+  (void)fio_atomic_xchange(fio_data->pages + index, page);
+finish:
+  fio_unlock(&fio_data->page_lock);
+  return page;
+}
+
 static inline void fio_force_close_in_poll(intptr_t uuid) {
   uuid_data(uuid).close = 2;
   fio_force_close(uuid);
@@ -380,6 +597,7 @@ inline static void protocol_unlock(fio_protocol_s *pr,
 #define uuid_is_valid(uuid)                                                    \
   ((intptr_t)(uuid) >= 0 &&                                                    \
    ((uint32_t)fio_uuid2fd((uuid))) < fio_data->capa &&                         \
+   fd_page_exists(fio_uuid2fd((uuid))) &&                                      \
    ((uintptr_t)(uuid)&0xFF) == uuid_data((uuid)).counter)
 
 /* public API. */
@@ -429,6 +647,11 @@ void fio_stop(void) {
 /* public API. */
 int16_t fio_is_running(void) { return fio_data && fio_data->active; }
 
+/* public API. */
+size_t fio_draining(void) {
+  return (fio_data && fio_data->drain_start) ? fio_data->connection_count : 0;
+}
+
 /* public API. */
 struct timespec fio_last_tick(void) {
   return fio_data->last_cycle;
@@ -444,10 +667,10 @@ void fio_touch(intptr_t uuid) {
 
 /* public API. */
 fio_str_info_s fio_peer_addr(intptr_t uuid) {
-  if (fio_is_closed(uuid) || !uuid_data(uuid).addr_len)
+  if (fio_is_closed(uuid) || !uuid_cold(uuid).addr_len)
     return (fio_str_info_s){.data = NULL, .len = 0, .capa = 0};
-  return (fio_str_info_s){.data = (char *)uuid_data(uuid).addr,
-                          .len = uuid_data(uuid).addr_len,
+  return (fio_str_info_s){.data = (char *)uuid_cold(uuid).addr,
+                          .len = uuid_cold(uuid).addr_len,
                           .capa = 0};
 }
 
@@ -503,7 +726,7 @@ void fio_uuid_link(intptr_t uuid, void *obj, void (*on_close)(void *obj)) {
   fio_lock(&uuid_data(uuid).sock_lock);
   if (!uuid_is_valid(uuid))
     goto locked_invalid;
-  fio_uuid_links_overwrite(&uuid_data(uuid).links, (uintptr_t)obj, on_close,
+  fio_uuid_links_overwrite(&uuid_cold(uuid).links, (uintptr_t)obj, on_close,
                            NULL);
   fio_unlock(&uuid_data(uuid).sock_lock);
   return;
@@ -523,7 +746,7 @@ int fio_uuid_unlink(intptr_t uuid, void *obj) {
     goto locked_invalid;
   /* default object comparison is always true */
   int ret =
-      fio_uuid_links_remove(&uuid_data(uuid).links, (uintptr_t)obj, NULL, NULL);
+      fio_uuid_links_remove(&uuid_cold(uuid).links, (uintptr_t)obj, NULL, NULL);
   if (ret)
     errno = ENOTCONN;
   fio_unlock(&uuid_data(uuid).sock_lock);
@@ -737,11 +960,20 @@ FIO_FUNC void fio_thread_broadcast(void) {
   }
 }
 
+/* busy polling is only performed by worker processes (never the root) */
+#define fio_busy_polling() (fio_data->busy_poll && fio_data->is_worker)
+
 static size_t fio_poll(void);
 /**
  * A thread entering this function should wait for new evennts.
  */
 static void fio_defer_thread_wait(void) {
+  if (fio_busy_polling()) {
+    /* spin until a task is available (trading CPU for latency) */
+    while (!fio_defer_has_queue() && fio_is_running())
+      FIO_CPU_RELAX();
+    return;
+  }
 #if FIO_ENGINE_POLL
   fio_poll();
   return;
@@ -840,11 +1072,13 @@ struct fio_defer_queue_block_s {
 /* task queue object */
 typedef struct { /* a lock for the state machine, used for multi-threading
                     support */
-  fio_lock_i lock;
+  fio_park_lock_i lock;
   /* current active block to pop tasks */
   fio_defer_queue_block_s *reader;
   /* current active block to push tasks */
   fio_defer_queue_block_s *writer;
+  /* the number of tasks in the queue */
+  size_t count;
   /* static, built-in, queue */
   fio_defer_queue_block_s static_queue;
 } fio_task_queue_s;
@@ -854,10 +1088,32 @@ static fio_task_queue_s task_queue_normal = {
     .reader = &task_queue_normal.static_queue,
     .writer = &task_queue_normal.static_queue};
 
+static fio_task_queue_s task_queue_pubsub = {
+    .reader = &task_queue_pubsub.static_queue,
+    .writer = &task_queue_pubsub.static_queue};
+
+static fio_task_queue_s task_queue_bulk = {
+    .reader = &task_queue_bulk.static_queue,
+    .writer = &task_queue_bulk.static_queue};
+
 static fio_task_queue_s task_queue_urgent = {
     .reader = &task_queue_urgent.static_queue,
     .writer = &task_queue_urgent.static_queue};
 
+/* the task queue for each task class (`fio_task_class_e`) */
+static fio_task_queue_s *const task_queue_classes[FIO_TASK_CLASS_COUNT] = {
+    &task_queue_normal,
+    &task_queue_pubsub,
+    &task_queue_bulk,
+};
+
+/* the number of tasks each class may perform per scheduling round */
+static size_t task_queue_weights[FIO_TASK_CLASS_COUNT] = {
+    FIO_TASK_WEIGHT_DEFAULT,
+    FIO_TASK_WEIGHT_PUBSUB,
+    FIO_TASK_WEIGHT_BULK,
+};
+
 /* *****************************************************************************
 Internal Task API
 ***************************************************************************** */
@@ -878,7 +1134,7 @@ static size_t fio_defer_count_alloc, fio_defer_count_dealloc;
 
 static inline void fio_defer_push_task_fn(fio_defer_task_s task,
                                           fio_task_queue_s *queue) {
-  fio_lock(&queue->lock);
+  fio_park_lock(&queue->lock);
 
   /* test if full */
   if (queue->writer->state && queue->writer->write == queue->writer->read) {
@@ -900,16 +1156,17 @@ static inline void fio_defer_push_task_fn(fio_defer_task_s task,
 
   /* place task and finish */
   queue->writer->tasks[queue->writer->write++] = task;
+  ++queue->count;
   /* cycle buffer */
   if (queue->writer->write == DEFER_QUEUE_BLOCK_COUNT) {
     queue->writer->write = 0;
     queue->writer->state = 1;
   }
-  fio_unlock(&queue->lock);
+  fio_park_unlock(&queue->lock);
   return;
 
 critical_error:
-  fio_unlock(&queue->lock);
+  fio_park_unlock(&queue->lock);
   FIO_ASSERT_ALLOC(NULL)
 }
 
@@ -921,6 +1178,14 @@ critical_error:
     fio_defer_thread_signal();                                                 \
   } while (0)
 
+#define fio_defer_push_class(class_, func_, arg1_, arg2_)                      \
+  do {                                                                         \
+    fio_defer_push_task_fn(                                                    \
+        (fio_defer_task_s){.func = func_, .arg1 = arg1_, .arg2 = arg2_},       \
+        task_queue_classes[(class_)]);                                         \
+    fio_defer_thread_signal();                                                 \
+  } while (0)
+
 #if FIO_USE_URGENT_QUEUE
 #define fio_defer_push_urgent(func_, arg1_, arg2_)                             \
   fio_defer_push_task_fn(                                                      \
@@ -935,13 +1200,14 @@ static inline fio_defer_task_s fio_defer_pop_task(fio_task_queue_s *queue) {
   fio_defer_task_s ret = (fio_defer_task_s){.func = NULL};
   fio_defer_queue_block_s *to_free = NULL;
   /* lock the state machine, grab/create a task and place it at the tail */
-  fio_lock(&queue->lock);
+  fio_park_lock(&queue->lock);
 
   /* empty? */
   if (queue->reader->write == queue->reader->read && !queue->reader->state)
     goto finish;
   /* collect task */
   ret = queue->reader->tasks[queue->reader->read++];
+  --queue->count;
   /* cycle */
   if (queue->reader->read == DEFER_QUEUE_BLOCK_COUNT) {
     queue->reader->read = 0;
@@ -968,7 +1234,7 @@ finish:
     queue->static_queue.state = 2;
     queue->static_queue.next = NULL;
   }
-  fio_unlock(&queue->lock);
+  fio_park_unlock(&queue->lock);
 
   if (to_free && to_free != &queue->static_queue) {
     fio_free(to_free);
@@ -979,7 +1245,7 @@ finish:
 
 /* same as fio_defer_clear_queue , just inlined */
 static inline void fio_defer_clear_tasks_for_queue(fio_task_queue_s *queue) {
-  fio_lock(&queue->lock);
+  fio_park_lock(&queue->lock);
   while (queue->reader) {
     fio_defer_queue_block_s *tmp = queue->reader;
     queue->reader = queue->reader->next;
@@ -990,7 +1256,8 @@ static inline void fio_defer_clear_tasks_for_queue(fio_task_queue_s *queue) {
   }
   queue->static_queue = (fio_defer_queue_block_s){.next = NULL};
   queue->reader = queue->writer = &queue->static_queue;
-  fio_unlock(&queue->lock);
+  queue->count = 0;
+  fio_park_unlock(&queue->lock);
 }
 
 /**
@@ -1006,16 +1273,18 @@ fio_defer_perform_single_task_for_queue(fio_task_queue_s *queue) {
 }
 
 static inline void fio_defer_clear_tasks(void) {
-  fio_defer_clear_tasks_for_queue(&task_queue_normal);
+  for (size_t i = 0; i < FIO_TASK_CLASS_COUNT; ++i)
+    fio_defer_clear_tasks_for_queue(task_queue_classes[i]);
 #if FIO_USE_URGENT_QUEUE
   fio_defer_clear_tasks_for_queue(&task_queue_urgent);
 #endif
 }
 
 static void fio_defer_on_fork(void) {
-  task_queue_normal.lock = FIO_LOCK_INIT;
+  for (size_t i = 0; i < FIO_TASK_CLASS_COUNT; ++i)
+    task_queue_classes[i]->lock = FIO_PARK_LOCK_INIT;
 #if FIO_USE_URGENT_QUEUE
-  task_queue_urgent.lock = FIO_LOCK_INIT;
+  task_queue_urgent.lock = FIO_PARK_LOCK_INIT;
 #endif
 }
 
@@ -1035,48 +1304,88 @@ call_error:
   return -1;
 }
 
-/** Performs all deferred functions until the queue had been depleted. */
+/** Defers a task's execution using the task queue of the requested class. */
+int fio_defer_class(fio_task_class_e task_class,
+                    void (*func)(void *, void *), void *arg1, void *arg2) {
+  /* must have a task to defer */
+  if (!func || (size_t)task_class >= FIO_TASK_CLASS_COUNT)
+    goto call_error;
+  fio_defer_push_class(task_class, func, arg1, arg2);
+  return 0;
+
+call_error:
+  return -1;
+}
+
+/** Sets the number of tasks a class may perform per scheduling round. */
+void fio_defer_weight_set(fio_task_class_e task_class, size_t weight) {
+  if ((size_t)task_class >= FIO_TASK_CLASS_COUNT)
+    return;
+  task_queue_weights[task_class] = weight ? weight : 1;
+}
+
+/** Returns the number of tasks waiting in the class's task queue. */
+size_t fio_defer_queue_depth(fio_task_class_e task_class) {
+  if ((size_t)task_class >= FIO_TASK_CLASS_COUNT)
+    return 0;
+  return task_queue_classes[task_class]->count;
+}
+
+/**
+ * Performs all deferred functions until the queue had been depleted.
+ *
+ * Task classes are served using deficit round-robin (each task costs a single
+ * credit), so a class flooded with tasks can't starve the other classes.
+ * Urgent (IO) tasks are performed before any other task.
+ */
 void fio_defer_perform(void) {
+  size_t deficit[FIO_TASK_CLASS_COUNT] = {0};
+  size_t idle;
+  do {
+    idle = 0;
+    for (size_t i = 0; i < FIO_TASK_CLASS_COUNT; ++i) {
+      deficit[i] += task_queue_weights[i];
+      while (deficit[i]) {
 #if FIO_USE_URGENT_QUEUE
-  while (fio_defer_perform_single_task_for_queue(&task_queue_urgent) == 0 ||
-         fio_defer_perform_single_task_for_queue(&task_queue_normal) == 0)
-    ;
-#else
-  while (fio_defer_perform_single_task_for_queue(&task_queue_normal) == 0)
-    ;
+        while (fio_defer_perform_single_task_for_queue(&task_queue_urgent) == 0)
+          ;
 #endif
-  //   for (;;) {
-  // #if FIO_USE_URGENT_QUEUE
-  //     fio_defer_task_s task = fio_defer_pop_task(&task_queue_urgent);
-  //     if (!task.func)
-  //       task = fio_defer_pop_task(&task_queue_normal);
-  // #else
-  //     fio_defer_task_s task = fio_defer_pop_task(&task_queue_normal);
-  // #endif
-  //     if (!task.func)
-  //       return;
-  //     task.func(task.arg1, task.arg2);
-  //   }
+        if (fio_defer_perform_single_task_for_queue(task_queue_classes[i])) {
+          /* an empty queue doesn't accumulate credit */
+          deficit[i] = 0;
+          ++idle;
+          break;
+        }
+        --deficit[i];
+      }
+    }
+  } while (idle < FIO_TASK_CLASS_COUNT);
 }
 
 /** Returns true if there are deferred functions waiting for execution. */
 int fio_defer_has_queue(void) {
+  for (size_t i = 0; i < FIO_TASK_CLASS_COUNT; ++i) {
+    if (task_queue_classes[i]->reader != task_queue_classes[i]->writer ||
+        task_queue_classes[i]->reader->write !=
+            task_queue_classes[i]->reader->read)
+      return 1;
+  }
 #if FIO_USE_URGENT_QUEUE
   return task_queue_urgent.reader != task_queue_urgent.writer ||
-         task_queue_urgent.reader->write != task_queue_urgent.reader->read ||
-         task_queue_normal.reader != task_queue_normal.writer ||
-         task_queue_normal.reader->write != task_queue_normal.reader->read;
+         task_queue_urgent.reader->write != task_queue_urgent.reader->read;
 #else
-  return task_queue_normal.reader != task_queue_normal.writer ||
-         task_queue_normal.reader->write != task_queue_normal.reader->read;
+  return 0;
 #endif
 }
 
 /** Clears the queue. */
 void fio_defer_clear_queue(void) { fio_defer_clear_tasks(); }
 
+static void fio_affinity_thread(size_t index);
+
 /* Thread pool task */
 static void *fio_defer_cycle(void *ignr) {
+  fio_affinity_thread((size_t)(uintptr_t)ignr);
   fio_defer_on_thread_start();
   for (;;) {
     fio_defer_perform();
@@ -1111,7 +1420,7 @@ static fio_defer_thread_pool_s *fio_defer_thread_pool_new(size_t count) {
   FIO_ASSERT_ALLOC(pool);
   pool->thread_count = count;
   for (size_t i = 0; i < count; ++i) {
-    pool->threads[i] = fio_thread_new(fio_defer_cycle, NULL);
+    pool->threads[i] = fio_thread_new(fio_defer_cycle, (void *)i);
     if (!pool->threads[i]) {
       pool->thread_count = i;
       goto error;
@@ -1340,6 +1649,7 @@ Section Start Marker
 ***************************************************************************** */
 
 volatile uint8_t fio_signal_children_flag = 0;
+volatile uint8_t fio_signal_upgrade_flag = 0;
 volatile fio_lock_i fio_signal_set_flag = 0;
 /* store old signal handlers to propegate signal handling */
 static struct sigaction fio_old_sig_chld;
@@ -1348,6 +1658,7 @@ static struct sigaction fio_old_sig_term;
 static struct sigaction fio_old_sig_int;
 #if !FIO_DISABLE_HOT_RESTART
 static struct sigaction fio_old_sig_usr1;
+static struct sigaction fio_old_sig_usr2;
 #endif
 
 /*
@@ -1381,7 +1692,7 @@ void fio_reap_children(void) {
   }
 }
 
-/* handles the SIGUSR1, SIGINT and SIGTERM signals. */
+/* handles the SIGUSR1, SIGUSR2, SIGINT and SIGTERM signals. */
 static void sig_int_handler(int sig) {
   struct sigaction *old = NULL;
   switch (sig) {
@@ -1390,6 +1701,10 @@ static void sig_int_handler(int sig) {
     fio_signal_children_flag = 1;
     old = &fio_old_sig_usr1;
     break;
+  case SIGUSR2:
+    fio_signal_upgrade_flag = 1;
+    old = &fio_old_sig_usr2;
+    break;
 #endif
     /* fallthrough */
   case SIGINT:
@@ -1413,7 +1728,7 @@ static void sig_int_handler(int sig) {
     old->sa_handler(sig);
 }
 
-/* setup handling for the SIGUSR1, SIGPIPE, SIGINT and SIGTERM signals. */
+/* setup handling for the SIGUSR1, SIGUSR2, SIGPIPE, SIGINT and SIGTERM. */
 static void fio_signal_handler_setup(void) {
   /* setup signal handling */
   struct sigaction act;
@@ -1440,6 +1755,10 @@ static void fio_signal_handler_setup(void) {
     perror("couldn't set signal handler");
     return;
   };
+  if (sigaction(SIGUSR2, &act, &fio_old_sig_usr2)) {
+    perror("couldn't set signal handler");
+    return;
+  };
 #endif
 
   act.sa_handler = SIG_IGN;
@@ -1463,6 +1782,8 @@ void fio_signal_handler_reset(void) {
 #if !FIO_DISABLE_HOT_RESTART
   sigaction(SIGUSR1, &fio_old_sig_usr1, &old);
   memset(&fio_old_sig_usr1, 0, sizeof(fio_old_sig_usr1));
+  sigaction(SIGUSR2, &fio_old_sig_usr2, &old);
+  memset(&fio_old_sig_usr2, 0, sizeof(fio_old_sig_usr2));
 #endif
   memset(&fio_old_sig_int, 0, sizeof(fio_old_sig_int));
   memset(&fio_old_sig_term, 0, sizeof(fio_old_sig_term));
@@ -1487,7 +1808,7 @@ int fio_is_worker(void) { return fio_data->is_worker; }
  * Otherwise returns 0.
  */
 int fio_is_master(void) {
-  return fio_data->is_worker == 0 || fio_data->workers == 1;
+  return fio_data->is_worker == 0 || fio_single_process();
 }
 
 /** returns facil.io's parent (root) process pid. */
@@ -1584,6 +1905,148 @@ void fio_expected_concurrency(int16_t *threads, int16_t *processes) {
     *threads = 1;
 }
 
+/* *****************************************************************************
+CPU affinity (worker and thread placement)
+***************************************************************************** */
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#if defined(__linux__) && defined(CPU_SETSIZE)
+
+static void fio_malloc_arena_prefer(size_t cpu);
+
+/* the CPU cores assigned to this worker process (set by fio_affinity_worker) */
+static struct {
+  size_t count;
+  uint16_t cpus[CPU_SETSIZE];
+} fio_affinity;
+
+/* collects the CPU cores in a set into an ordered list. */
+static size_t fio_affinity_set2list(cpu_set_t *set, uint16_t *cpus) {
+  size_t count = 0;
+  for (size_t i = 0; i < CPU_SETSIZE; ++i) {
+    if (CPU_ISSET(i, set))
+      cpus[count++] = (uint16_t)i;
+  }
+  return count;
+}
+
+/* reads a NUMA node's CPU list (i.e., "0-7,16-23"), returns -1 on error. */
+static int fio_affinity_numa_node(size_t node, cpu_set_t *set) {
+  char path[64];
+  char buf[1024];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%zu/cpulist",
+           node);
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return -1;
+  size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+  fclose(f);
+  buf[len] = 0;
+  CPU_ZERO(set);
+  char *pos = buf;
+  while (*pos >= '0' && *pos <= '9') {
+    size_t start = (size_t)strtoul(pos, &pos, 10);
+    size_t end = start;
+    if (*pos == '-')
+      end = (size_t)strtoul(pos + 1, &pos, 10);
+    for (; start <= end && start < CPU_SETSIZE; ++start)
+      CPU_SET(start, set);
+    if (*pos == ',')
+      ++pos;
+  }
+  return 0;
+}
+
+/* pins the calling worker process to it's share of the CPU cores. */
+static void fio_affinity_worker(void) {
+  fio_affinity.count = 0;
+  if (!fio_data->affinity)
+    return;
+  cpu_set_t allowed, set;
+  uint16_t cpus[CPU_SETSIZE];
+  const size_t index = fio_data->worker_index;
+  /* autoscaled workers may use a slot beyond the current worker count */
+  size_t workers = fio_data->workers ? fio_data->workers : 1;
+  if (index >= workers)
+    workers = index + 1;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+    FIO_LOG_WARNING("(%d) couldn't read CPU affinity, workers aren't pinned.",
+                    (int)getpid());
+    return;
+  }
+  if (fio_data->affinity == FIO_AFFINITY_NUMA) {
+    size_t nodes = 0;
+    while (!fio_affinity_numa_node(nodes, &set))
+      ++nodes;
+    if (nodes && !fio_affinity_numa_node(index % nodes, &set)) {
+      CPU_AND(&set, &set, &allowed);
+      fio_affinity.count = fio_affinity_set2list(&set, fio_affinity.cpus);
+    }
+    if (!fio_affinity.count)
+      FIO_LOG_DEBUG("(%d) NUMA node information unavailable, pinning to cores.",
+                    (int)getpid());
+  }
+  if (!fio_affinity.count) {
+    /* split the allowed cores into (almost) evenly sized slices */
+    const size_t total = fio_affinity_set2list(&allowed, cpus);
+    if (!total)
+      return;
+    size_t start, len;
+    if (workers > total) {
+      start = index % total;
+      len = 1;
+    } else {
+      len = total / workers;
+      start = (index * len) + (index < (total % workers) ? index
+                                                         : (total % workers));
+      if (index < (total % workers))
+        ++len;
+    }
+    for (size_t i = 0; i < len; ++i)
+      fio_affinity.cpus[i] = cpus[start + i];
+    fio_affinity.count = len;
+  }
+  CPU_ZERO(&set);
+  for (size_t i = 0; i < fio_affinity.count; ++i)
+    CPU_SET(fio_affinity.cpus[i], &set);
+  if (sched_setaffinity(0, sizeof(set), &set)) {
+    FIO_LOG_WARNING("(%d) couldn't set CPU affinity, workers aren't pinned.",
+                    (int)getpid());
+    fio_affinity.count = 0;
+    return;
+  }
+  FIO_LOG_DEBUG("(%d) worker %zu pinned to %zu CPU cores (starting at %u).",
+                (int)getpid(), index, fio_affinity.count,
+                (unsigned)fio_affinity.cpus[0]);
+}
+
+/* pins the calling thread to a single CPU core within the worker's cores. */
+static void fio_affinity_thread(size_t index) {
+  if (!fio_affinity.count)
+    return;
+  const uint16_t cpu = fio_affinity.cpus[index % fio_affinity.count];
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set))
+    return;
+  fio_malloc_arena_prefer(cpu);
+}
+
+#else
+
+static void fio_affinity_worker(void) {
+  if (fio_data->affinity)
+    FIO_LOG_WARNING("CPU affinity isn't supported on this system.");
+}
+
+static void fio_affinity_thread(size_t index) { (void)index; }
+
+#endif
+
 static fio_lock_i fio_fork_lock = FIO_LOCK_INIT;
 
 /* *****************************************************************************
@@ -1712,8 +2175,14 @@ FIO_FUNC inline void fio_poll_remove_fd(intptr_t fd) {
   epoll_ctl(evio_fd[2], EPOLL_CTL_DEL, fd, &chevent);
 }
 
+static inline void fio_poll_remove_read(intptr_t fd) {
+  struct epoll_event chevent = {.events = EPOLLIN, .data.fd = fd};
+  epoll_ctl(evio_fd[1], EPOLL_CTL_DEL, fd, &chevent);
+}
+
 static size_t fio_poll(void) {
-  int timeout_millisec = fio_timer_calc_first_interval();
+  int timeout_millisec =
+      fio_busy_polling() ? 0 : fio_timer_calc_first_interval();
   struct epoll_event internal[2];
   struct epoll_event events[FIO_POLL_MAX_EVENTS];
   int total = 0;
@@ -1726,7 +2195,7 @@ static size_t fio_poll(void) {
         epoll_wait(internal[j].data.fd, events, FIO_POLL_MAX_EVENTS, 0);
     if (active_count > 0) {
       for (int i = 0; i < active_count; i++) {
-        if (events[i].events & (~(EPOLLIN | EPOLLOUT))) {
+        if (events[i].events & (~(EPOLLIN | EPOLLOUT | EPOLLRDHUP))) {
           // errors are hendled as disconnections (on_close)
           fio_force_close_in_poll(fd2uuid(events[i].data.fd));
         } else {
@@ -1735,7 +2204,8 @@ static size_t fio_poll(void) {
             fio_defer_push_urgent(deferred_on_ready,
                                   (void *)fd2uuid(events[i].data.fd), NULL);
           }
-          if (events[i].events & EPOLLIN)
+          // a half closed socket is read first, `fio_read` closes on EOF
+          if (events[i].events & (EPOLLIN | EPOLLRDHUP))
             fio_defer_push_task(deferred_on_data,
                                 (void *)fd2uuid(events[i].data.fd), NULL);
         }
@@ -1848,10 +2318,22 @@ FIO_FUNC inline void fio_poll_remove_fd(intptr_t fd) {
   } while (errno == EINTR);
 }
 
+static inline void fio_poll_remove_read(intptr_t fd) {
+  if (evio_fd < 0)
+    return;
+  struct kevent chevent[1];
+  EV_SET(chevent, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+  do {
+    errno = 0;
+    kevent(evio_fd, chevent, 1, NULL, 0, NULL);
+  } while (errno == EINTR);
+}
+
 static size_t fio_poll(void) {
   if (evio_fd < 0)
     return -1;
-  int timeout_millisec = fio_timer_calc_first_interval();
+  int timeout_millisec =
+      fio_busy_polling() ? 0 : fio_timer_calc_first_interval();
   struct kevent events[FIO_POLL_MAX_EVENTS] = {{0}};
 
   const struct timespec timeout = {
@@ -1871,7 +2353,10 @@ static size_t fio_poll(void) {
         fio_defer_push_task(deferred_on_data, (void *)fd2uuid(events[i].udata),
                             NULL);
       }
-      if (events[i].flags & (EV_EOF | EV_ERROR)) {
+      /* a half closed socket is read first, `fio_read` closes on EOF */
+      if ((events[i].flags & EV_ERROR) ||
+          ((events[i].flags & EV_EOF) &&
+           (events[i].filter != EVFILT_READ || events[i].data <= 0))) {
         fio_force_close_in_poll(fd2uuid(events[i].udata));
       }
     }
@@ -1991,7 +2476,7 @@ static size_t fio_poll(void) {
   }
   fio_unlock(&fio_data->lock);
 
-  int timeout = fio_timer_calc_first_interval();
+  int timeout = fio_busy_polling() ? 0 : fio_timer_calc_first_interval();
   size_t count = 0;
 
   if (start == end) {
@@ -2202,6 +2687,11 @@ static void deferred_on_data(void *uuid, void *arg2) {
     }
     goto postpone;
   }
+  if (uuid_data(uuid).migrating) {
+    /* the data belongs to the worker receiving the connection */
+    protocol_unlock(pr, FIO_PR_LOCK_TASK);
+    return;
+  }
   fio_unlock(&uuid_data(uuid).scheduled);
   pr->on_data((intptr_t)uuid, pr);
   protocol_unlock(pr, FIO_PR_LOCK_TASK);
@@ -2339,15 +2829,31 @@ static void fio_tcp_addr_cpy(int fd, int family, struct sockaddr *addrinfo) {
                 family == AF_INET
                     ? (void *)&(((struct sockaddr_in *)addrinfo)->sin_addr)
                     : (void *)&(((struct sockaddr_in6 *)addrinfo)->sin6_addr),
-                (char *)fd_data(fd).addr, sizeof(fd_data(fd).addr));
+                (char *)fd_cold(fd).addr, sizeof(fd_cold(fd).addr));
   if (result) {
-    fd_data(fd).addr_len = strlen((char *)fd_data(fd).addr);
+    fd_cold(fd).addr_len = strlen((char *)fd_cold(fd).addr);
   } else {
-    fd_data(fd).addr_len = 0;
-    fd_data(fd).addr[0] = 0;
+    fd_cold(fd).addr_len = 0;
+    fd_cold(fd).addr[0] = 0;
   }
 }
 
+/* lets the kernel busy poll the socket's device queue (when busy polling). */
+static inline void fio_sock_busy_poll(int fd) {
+#ifdef SO_BUSY_POLL
+  if (!fio_busy_polling())
+    return;
+  int optval = FIO_BUSY_POLL_USEC;
+  setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &optval, sizeof(optval));
+#ifdef SO_PREFER_BUSY_POLL
+  optval = 1;
+  setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &optval, sizeof(optval));
+#endif
+#else
+  (void)fd;
+#endif
+}
+
 /**
  * `fio_accept` accepts a new socket connection from a server socket - see the
  * server flag on `fio_socket`.
@@ -2390,16 +2896,17 @@ intptr_t fio_accept(intptr_t srv_uuid) {
       setsockopt(client, SOL_SOCKET, SO_RCVBUF, &optval, sizeof(optval));
     }
   }
+  fio_sock_busy_poll(client);
 
   fio_lock(&fd_data(client).protocol_lock);
   fio_clear_fd(client, 1);
   fio_unlock(&fd_data(client).protocol_lock);
   /* copy peer address */
   if (((struct sockaddr *)addrinfo)->sa_family == AF_UNIX) {
-    fd_data(client).addr_len = uuid_data(srv_uuid).addr_len;
-    if (uuid_data(srv_uuid).addr_len) {
-      memcpy(fd_data(client).addr, uuid_data(srv_uuid).addr,
-             uuid_data(srv_uuid).addr_len + 1);
+    fd_cold(client).addr_len = uuid_cold(srv_uuid).addr_len;
+    if (uuid_cold(srv_uuid).addr_len) {
+      memcpy(fd_cold(client).addr, uuid_cold(srv_uuid).addr,
+             uuid_cold(srv_uuid).addr_len + 1);
     }
   } else {
     fio_tcp_addr_cpy(client, ((struct sockaddr *)addrinfo)->sa_family,
@@ -2458,25 +2965,52 @@ static intptr_t fio_unix_socket(const char *address, uint8_t server) {
   fio_lock(&fd_data(fd).protocol_lock);
   fio_clear_fd(fd, 1);
   fio_unlock(&fd_data(fd).protocol_lock);
-  if (addr_len < sizeof(fd_data(fd).addr)) {
-    memcpy(fd_data(fd).addr, address, addr_len + 1); /* copy the NUL byte. */
-    fd_data(fd).addr_len = addr_len;
+  if (addr_len < sizeof(fd_cold(fd).addr)) {
+    memcpy(fd_cold(fd).addr, address, addr_len + 1); /* copy the NUL byte. */
+    fd_cold(fd).addr_len = addr_len;
   }
   return fd2uuid(fd);
 }
 
-/* Creates a TCP/IP socket - returning it's uuid (or -1) */
+static socklen_t fio_dns_cached(struct sockaddr_storage *dest,
+                                const char *host);
+static inline void fio_dns_port_set(struct sockaddr_storage *addr,
+                                    uint16_t port);
+static void fio_dns_prefetch(const char *host);
+
+static inline void fio_tcp_addrinfo_free(struct addrinfo *addrinfo,
+                                         struct addrinfo *cached) {
+  if (addrinfo != cached)
+    freeaddrinfo(addrinfo);
+}
+
+/* Creates a TCP/IP or UDP/IP socket - returning it's uuid (or -1) */
 static intptr_t fio_tcp_socket(const char *address, const char *port,
-                               uint8_t server) {
+                               uint8_t server, int type) {
   /* TCP/IP socket */
   // setup the address
   struct addrinfo hints = {0};
   struct addrinfo *addrinfo;       // will point to the results
   memset(&hints, 0, sizeof hints); // make sure the struct is empty
   hints.ai_family = AF_UNSPEC;     // don't care IPv4 or IPv6
-  hints.ai_socktype = SOCK_STREAM; // TCP stream sockets
+  hints.ai_socktype = type;        // TCP stream or UDP datagram sockets
   hints.ai_flags = AI_PASSIVE;     // fill in my IP for me
-  if (getaddrinfo(address, port, &hints, &addrinfo)) {
+  struct addrinfo cached = {.ai_socktype = type};
+  struct sockaddr_storage cached_addr;
+  if (!server && address &&
+      (cached.ai_addrlen = fio_dns_cached(&cached_addr, address))) {
+    /* avoid a blocking lookup for cached names */
+    char *pos = (char *)port;
+    fio_dns_port_set(&cached_addr, (uint16_t)fio_atol(&pos));
+    cached.ai_family = cached_addr.ss_family;
+    cached.ai_addr = (struct sockaddr *)&cached_addr;
+    addrinfo = &cached;
+  } else if (!server && address && fio_is_running()) {
+    /* never block the reactor, resolve the name for the next attempt */
+    fio_dns_prefetch(address);
+    errno = EAGAIN;
+    return -1;
+  } else if (getaddrinfo(address, port, &hints, &addrinfo)) {
     // perror("addr err");
     return -1;
   }
@@ -2484,12 +3018,12 @@ static intptr_t fio_tcp_socket(const char *address, const char *port,
   int fd =
       socket(addrinfo->ai_family, addrinfo->ai_socktype, addrinfo->ai_protocol);
   if (fd <= 0) {
-    freeaddrinfo(addrinfo);
+    fio_tcp_addrinfo_free(addrinfo, &cached);
     return -1;
   }
   // make sure the socket is non-blocking
   if (fio_set_non_block(fd) < 0) {
-    freeaddrinfo(addrinfo);
+    fio_tcp_addrinfo_free(addrinfo, &cached);
     close(fd);
     return -1;
   }
@@ -2507,10 +3041,12 @@ static intptr_t fio_tcp_socket(const char *address, const char *port,
     }
     if (!bound) {
       // perror("bind err");
-      freeaddrinfo(addrinfo);
+      fio_tcp_addrinfo_free(addrinfo, &cached);
       close(fd);
       return -1;
     }
+    if (type == SOCK_DGRAM)
+      goto socket_okay;
 #ifdef TCP_FASTOPEN
     {
       // support TCP Fast Open when available
@@ -2520,19 +3056,21 @@ static intptr_t fio_tcp_socket(const char *address, const char *port,
     }
 #endif
     if (listen(fd, SOMAXCONN) < 0) {
-      freeaddrinfo(addrinfo);
+      fio_tcp_addrinfo_free(addrinfo, &cached);
       close(fd);
       return -1;
     }
   } else {
     int one = 1;
-    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (type == SOCK_STREAM)
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fio_sock_busy_poll(fd);
     errno = 0;
     for (struct addrinfo *i = addrinfo; i; i = i->ai_next) {
       if (connect(fd, i->ai_addr, i->ai_addrlen) == 0 || errno == EINPROGRESS)
         goto socket_okay;
     }
-    freeaddrinfo(addrinfo);
+    fio_tcp_addrinfo_free(addrinfo, &cached);
     close(fd);
     return -1;
   }
@@ -2540,8 +3078,8 @@ socket_okay:
   fio_lock(&fd_data(fd).protocol_lock);
   fio_clear_fd(fd, 1);
   fio_unlock(&fd_data(fd).protocol_lock);
-  fio_tcp_addr_cpy(fd, addrinfo->ai_family, (void *)addrinfo);
-  freeaddrinfo(addrinfo);
+  fio_tcp_addr_cpy(fd, addrinfo->ai_family, addrinfo->ai_addr);
+  fio_tcp_addrinfo_free(addrinfo, &cached);
   return fd2uuid(fd);
 }
 
@@ -2578,7 +3116,7 @@ intptr_t fio_socket(const char *address, const char *port, uint8_t server) {
   } else {
     do {
       errno = 0;
-      uuid = fio_tcp_socket(address, port, server);
+      uuid = fio_tcp_socket(address, port, server, SOCK_STREAM);
     } while (errno == EINTR);
   }
   return uuid;
@@ -3050,6 +3588,10 @@ size_t fio_flush_all(void) {
     return 0;
   size_t count = 0;
   for (uintptr_t i = 0; i <= fio_data->max_protocol_fd; ++i) {
+    if (!fd_page_exists(i)) {
+      i |= FIO_FD_PAGE_MASK;
+      continue;
+    }
     if ((fd_data(i).open || fd_data(i).packet) && fio_flush(fd2uuid(i)) > 0)
       ++count;
   }
@@ -3194,9 +3736,9 @@ Setting the protocol
 ***************************************************************************** */
 
 /* managing the protocol pointer array and the `on_close` callback */
-static int fio_attach__internal(void *uuid_, void *protocol_) {
-  intptr_t uuid = (intptr_t)uuid_;
-  fio_protocol_s *protocol = (fio_protocol_s *)protocol_;
+/* attaches a protocol, new sockets are only polled if `poll` is set */
+static int fio_attach__internal2(intptr_t uuid, fio_protocol_s *protocol,
+                                 uint8_t poll) {
   if (protocol) {
     if (!protocol->on_close) {
       protocol->on_close = mock_on_ev;
@@ -3234,7 +3776,7 @@ static int fio_attach__internal(void *uuid_, void *protocol_) {
       fio_poll_remove_fd(fio_uuid2fd(uuid));
       fio_poll_add_write(fio_uuid2fd(uuid));
     }
-  } else if (protocol) {
+  } else if (protocol && poll) {
     /* adding a new uuid to the reactor */
     fio_poll_add(fio_uuid2fd(uuid));
   }
@@ -3253,6 +3795,10 @@ invalid_uuid_unlocked:
   return -1;
 }
 
+static int fio_attach__internal(void *uuid_, void *protocol_) {
+  return fio_attach__internal2((intptr_t)uuid_, (fio_protocol_s *)protocol_, 1);
+}
+
 /**
  * Attaches (or updates) a protocol object to a socket UUID.
  * Returns -1 on error and 0 on success.
@@ -3488,10 +4034,12 @@ Initialize the library
 ***************************************************************************** */
 
 static void fio_pubsub_on_fork(void);
+static void fio_dns_on_fork(void);
 
 /* Called within a child process after it starts. */
 static void fio_on_fork(void) {
   fio_timer_lock = FIO_LOCK_INIT;
+  fio_dns_on_fork();
   fio_data->lock = FIO_LOCK_INIT;
   fio_defer_on_fork();
   fio_malloc_after_fork();
@@ -3499,8 +4047,14 @@ static void fio_on_fork(void) {
   fio_state_callback_on_fork();
 
   /* don't pass open connections belonging to the parent onto the child. */
+  fio_data->page_lock = FIO_LOCK_INIT;
   const size_t limit = fio_data->capa;
   for (size_t i = 0; i < limit; ++i) {
+    if (!fio_data->pages[i >> FIO_FD_PAGE_BITS]) {
+      /* skip pages that were never used */
+      i |= FIO_FD_PAGE_MASK;
+      continue;
+    }
     fd_data(i).sock_lock = FIO_LOCK_INIT;
     fd_data(i).protocol_lock = FIO_LOCK_INIT;
     if (fd_data(i).protocol && fd_data(i).open) {
@@ -3518,7 +4072,25 @@ static void fio_on_fork(void) {
   fio_data->is_worker = 1;
 }
 
+#if FIO_LOCK_PROFILE
+/* the contended `fio_park_lock` call sites */
+fio_lock_profile_s *volatile fio_lock_profile_list;
+
+/** Prints the contention profile of the `fio_park_lock` call sites. */
+void fio_lock_profile_print(void) {
+  for (fio_lock_profile_s *pos = fio_lock_profile_list; pos; pos = pos->next) {
+    fprintf(stderr,
+            "(%d) lock profile %s:%zu - contended %zu / %zu, "
+            "waited %.3fms (max %.3fms)\n",
+            (int)getpid(), pos->file, pos->line, (size_t)pos->contended,
+            (size_t)pos->acquired, (double)pos->wait_ns / 1000000.0,
+            (double)pos->max_ns / 1000000.0);
+  }
+}
+#endif
+
 static void fio_mem_destroy(void);
+static void fio_dns_destroy(void);
 static void __attribute__((destructor)) fio_lib_destroy(void) {
   uint8_t add_eol = fio_is_master();
   fio_data->active = 0;
@@ -3530,9 +4102,15 @@ static void __attribute__((destructor)) fio_lib_destroy(void) {
   fio_state_callback_clear_all();
   fio_defer_perform();
   fio_poll_close();
+  for (size_t i = 0; i <= (fio_data->capa >> FIO_FD_PAGE_BITS); ++i)
+    fio_free(fio_data->pages[i]);
   fio_free(fio_data);
+  fio_dns_destroy();
   /* memory library destruction must be last */
   fio_mem_destroy();
+#if FIO_LOCK_PROFILE
+  fio_lock_profile_print();
+#endif
   FIO_LOG_DEBUG("(%d) facil.io resources released, exit complete.",
                 (int)getpid());
   if (add_eol)
@@ -3580,35 +4158,44 @@ static void __attribute__((constructor)) fio_lib_init(void) {
     FIO_LOG_INFO("facil.io " FIO_VERSION_STRING " capacity initialization:\n"
                  "*    Meximum open files %zu out of %zu\n"
                  "*    Allocating %zu bytes for state handling.\n"
-                 "*    %zu bytes per connection + %zu for state handling.",
+                 "*    %zu bytes per connection (allocated in pages of %zu).",
                  capa, (size_t)rlim.rlim_max,
-                 (sizeof(*fio_data) + (capa * (sizeof(*fio_data->poll))) +
-                  (capa * (sizeof(*fio_data->info)))),
-                 (sizeof(*fio_data->poll) + sizeof(*fio_data->info)),
-                 sizeof(*fio_data));
+                 (sizeof(*fio_data) +
+                  (((capa >> FIO_FD_PAGE_BITS) + 1) *
+                   sizeof(*fio_data->pages)) +
+                  (capa * (sizeof(*fio_data->poll)))),
+                 (sizeof(fio_fd_data_s) + sizeof(fio_fd_cold_s) +
+                  sizeof(*fio_data->poll)),
+                 (size_t)FIO_FD_PAGE_SIZE);
 #else
     FIO_LOG_INFO("facil.io " FIO_VERSION_STRING " capacity initialization:\n"
                  "*    Meximum open files %zu out of %zu\n"
                  "*    Allocating %zu bytes for state handling.\n"
-                 "*    %zu bytes per connection + %zu for state handling.",
+                 "*    %zu bytes per connection (allocated in pages of %zu).",
                  capa, (size_t)rlim.rlim_max,
-                 (sizeof(*fio_data) + (capa * (sizeof(*fio_data->info)))),
-                 (sizeof(*fio_data->info)), sizeof(*fio_data));
+                 (sizeof(*fio_data) + (((capa >> FIO_FD_PAGE_BITS) + 1) *
+                                       sizeof(*fio_data->pages))),
+                 (sizeof(fio_fd_data_s) + sizeof(fio_fd_cold_s)),
+                 (size_t)FIO_FD_PAGE_SIZE);
 #endif
 #endif
   }
 
-#if FIO_ENGINE_POLL
   /* allocate and initialize main data structures by detected capacity */
-  fio_data = fio_mmap(sizeof(*fio_data) + (capa * (sizeof(*fio_data->poll))) +
-                      (capa * (sizeof(*fio_data->info))));
+  /* (connection data is allocated lazily, a page at a time) */
+  const size_t pages_len =
+      ((capa >> FIO_FD_PAGE_BITS) + 1) * sizeof(*fio_data->pages);
+#if FIO_ENGINE_POLL
+  fio_data = fio_mmap(sizeof(*fio_data) + pages_len +
+                      (capa * (sizeof(*fio_data->poll))));
   FIO_ASSERT_ALLOC(fio_data);
   fio_data->capa = capa;
-  fio_data->poll =
-      (void *)((uintptr_t)(fio_data + 1) + (sizeof(fio_data->info[0]) * capa));
+  fio_data->poll = (void *)((uintptr_t)(fio_data + 1) + pages_len);
+  for (ssize_t i = 0; i < capa; ++i) {
+    fio_data->poll[i].fd = -1;
+  }
 #else
-  /* allocate and initialize main data structures by detected capacity */
-  fio_data = fio_mmap(sizeof(*fio_data) + (capa * (sizeof(*fio_data->info))));
+  fio_data = fio_mmap(sizeof(*fio_data) + pages_len);
   FIO_ASSERT_ALLOC(fio_data);
   fio_data->capa = capa;
 #endif
@@ -3616,13 +4203,6 @@ static void __attribute__((constructor)) fio_lib_init(void) {
   fio_data->connection_count = 0;
   fio_mark_time();
 
-  for (ssize_t i = 0; i < capa; ++i) {
-    fio_clear_fd(i, 0);
-#if FIO_ENGINE_POLL
-    fio_data->poll[i].fd = -1;
-#endif
-  }
-
   /* call initialization callbacks */
   fio_state_callback_force(FIO_CALL_ON_INITIALIZE);
   fio_state_callback_clear(FIO_CALL_ON_INITIALIZE);
@@ -3693,7 +4273,8 @@ static void fio_review_timeout(void *arg, void *ignr) {
 finish:
   do {
     fd++;
-  } while (!fd_data(fd).open && (fd <= fio_data->max_protocol_fd));
+  } while (fd <= fio_data->max_protocol_fd &&
+           (!fd_page_exists(fd) || !fd_data(fd).open));
 
   if (fio_data->max_protocol_fd < fd) {
     fio_data->need_review = 1;
@@ -3714,6 +4295,12 @@ static void fio_cycle_schedule_events(void) {
     fio_signal_children_flag = 0;
     fio_cluster_signal_children();
   }
+  if (fio_signal_upgrade_flag) {
+    /* binary upgrade support (root process only) */
+    fio_signal_upgrade_flag = 0;
+    if (fio_data->parent == getpid())
+      fio_upgrade(NULL);
+  }
   int events = fio_poll();
   if (events < 0) {
     return;
@@ -3736,10 +4323,22 @@ static void fio_cycle_schedule_events(void) {
 
 /* reactor pattern cycling during cleanup */
 static void fio_cycle_unwind(void *ignr, void *ignr2) {
+  static time_t last_report;
   if (fio_data->connection_count) {
     fio_cycle_schedule_events();
-    fio_defer_push_task(fio_cycle_unwind, ignr, ignr2);
-    return;
+    const time_t elapsed = fio_data->last_cycle.tv_sec - fio_data->drain_start;
+    if (elapsed < fio_data->shutdown_timeout) {
+      if (elapsed && elapsed != last_report) {
+        last_report = elapsed;
+        FIO_LOG_INFO("(%d) draining %u connections (%ds left).",
+                      (int)getpid(), (unsigned)fio_data->connection_count,
+                      (int)(fio_data->shutdown_timeout - elapsed));
+      }
+      fio_defer_push_task(fio_cycle_unwind, ignr, ignr2);
+      return;
+    }
+    FIO_LOG_WARNING("(%d) drain deadline passed, dropping %u connections.",
+                    (int)getpid(), (unsigned)fio_data->connection_count);
   }
   fio_stop();
   return;
@@ -3755,15 +4354,25 @@ static void fio_cycle(void *ignr, void *ignr2) {
   return;
 }
 
+/* busy polling reactor cycling (runs in a dedicated thread) */
+static void *fio_cycle_busy_poll(void *ignr) {
+  /* the thread pool is pinned first, the poller follows */
+  fio_affinity_thread(fio_data->threads);
+  while (fio_data->active) {
+    fio_cycle_schedule_events();
+  }
+  return ignr;
+}
+
 /* TODO: fixme */
 static void fio_worker_startup(void) {
   /* Call the on_start callbacks for worker processes. */
-  if (fio_data->workers == 1 || fio_data->is_worker) {
+  if (fio_single_process() || fio_data->is_worker) {
     fio_state_callback_force(FIO_CALL_ON_START);
     fio_state_callback_clear(FIO_CALL_ON_START);
   }
 
-  if (fio_data->workers == 1) {
+  if (fio_single_process()) {
     /* Single Process - the root is also a worker */
     fio_data->is_worker = 1;
   } else if (fio_data->is_worker) {
@@ -3773,17 +4382,33 @@ static void fio_worker_startup(void) {
     /* Root Process should run in single thread mode */
     fio_data->threads = 1;
   }
+  if (fio_data->is_worker)
+    fio_affinity_worker();
 
   /* require timeout review */
   fio_data->need_review = 1;
 
+  /* a dedicated thread spins on the polling engine when busy polling */
+  void *poller = NULL;
+  if (fio_busy_polling()) {
+    poller = fio_thread_new(fio_cycle_busy_poll, NULL);
+    if (!poller)
+      FIO_LOG_ERROR("(%d) couldn't spawn busy polling thread, using the "
+                    "default reactor.",
+                    (int)getpid());
+  }
+
   /* the cycle task will loop by re-scheduling until it's time to finish */
-  fio_defer_push_task(fio_cycle, NULL, NULL);
+  if (!poller)
+    fio_defer_push_task(fio_cycle, NULL, NULL);
 
-  /* A single thread doesn't need a pool. */
-  if (fio_data->threads > 1) {
+  /* A single thread doesn't need a pool (unless the reactor is elsewhere). */
+  if (fio_data->threads > 1 || poller) {
     fio_defer_thread_pool_join(fio_defer_thread_pool_new(fio_data->threads));
+    if (poller)
+      fio_thread_join(poller);
   } else {
+    fio_affinity_thread(0);
     fio_defer_perform();
   }
 }
@@ -3796,14 +4421,28 @@ static void fio_worker_cleanup(void) {
   else
     FIO_LOG_INFO("Server Detected exit signal.");
   fio_state_callback_force(FIO_CALL_ON_SHUTDOWN);
+  fio_mark_time();
+  fio_data->drain_start = fio_data->last_cycle.tv_sec;
   for (size_t i = 0; i <= fio_data->max_protocol_fd; ++i) {
+    if (!fd_page_exists(i)) {
+      i |= FIO_FD_PAGE_MASK;
+      continue;
+    }
     if (fd_data(i).protocol) {
       fio_defer_push_task(deferred_on_shutdown, (void *)fd2uuid(i), NULL);
     }
   }
   fio_defer_push_task(fio_cycle_unwind, NULL, NULL);
   fio_defer_perform();
+  if (fio_data->is_worker)
+    FIO_LOG_DEBUG("(%d) connections drained in %ds.", (int)getpid(),
+                  (int)(fio_data->last_cycle.tv_sec - fio_data->drain_start));
+  fio_data->drain_start = 0;
   for (size_t i = 0; i <= fio_data->max_protocol_fd; ++i) {
+    if (!fd_page_exists(i)) {
+      i |= FIO_FD_PAGE_MASK;
+      continue;
+    }
     if (fd_data(i).protocol || fd_data(i).open) {
       fio_force_close(fd2uuid(i));
     }
@@ -3827,10 +4466,219 @@ static void fio_worker_cleanup(void) {
   }
 }
 
+/* *****************************************************************************
+Worker autoscaling
+***************************************************************************** */
+
 static void fio_sentinel_task(void *arg1, void *arg2);
-static void *fio_sentinel_worker_thread(void *arg) {
+static void fio_cluster_send_load(uint32_t cpu, uint32_t lag);
+
+/*
+ * Root process autoscaling state. The number of workers running (not including
+ * retired workers) is `fio_data->workers` and the maximum is
+ * `fio_data->workers_max`.
+ *
+ * The slot arrays are written by the sentinel threads, always under the lock.
+ */
+static struct {
+  /* worker process ids, by worker index (0 when the slot is free) */
+  pid_t *pids;
+  /* retired workers, by worker index (these aren't respawned) */
+  uint8_t *retired;
+  /* the minimal number of workers */
+  uint16_t min;
+  /* consecutive overloaded / idle reviews */
+  uint16_t overloaded;
+  uint16_t idle;
+  /* load reports collected since the last review */
+  uint32_t reports;
+  uint32_t cpu;
+  uint32_t lag;
+  fio_lock_i lock;
+} fio_autoscale = {.lock = FIO_LOCK_INIT};
+
+/* returns a millisecond clock value (wraps around, only used for deltas) */
+static uint32_t fio_autoscale_now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint32_t)((uint64_t)t.tv_sec * 1000 + (t.tv_nsec / 1000000));
+}
+
+/* worker: a probe task measuring the time spent waiting in the task queue */
+static void fio_autoscale_probe(void *pushed, void *cpu) {
+  fio_cluster_send_load((uint32_t)(uintptr_t)cpu,
+                        fio_autoscale_now() - (uint32_t)(uintptr_t)pushed);
+}
+
+/* worker: measures CPU use and schedules a task queue lag probe */
+static void fio_autoscale_report(void) {
+  static uint64_t last_cpu;
+  static uint32_t last_wall;
+  struct rusage ru;
+  uint32_t cpu = 0;
+  const uint32_t wall = fio_autoscale_now();
+  if (getrusage(RUSAGE_SELF, &ru))
+    return;
+  const uint64_t used =
+      ((uint64_t)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+      ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+  /* busy polling workers always appear busy, only the lag is meaningful */
+  if (last_wall && wall != last_wall && !fio_busy_polling())
+    cpu = (uint32_t)((used - last_cpu) * 100 /
+                     ((uint64_t)(wall - last_wall) * 1000 *
+                      (fio_data->threads ? fio_data->threads : 1)));
+  last_cpu = used;
+  last_wall = wall;
+  fio_defer_push_task(fio_autoscale_probe, (void *)(uintptr_t)wall,
+                      (void *)(uintptr_t)cpu);
+}
+
+/* root: collects a worker's load report (called by the cluster handler) */
+static void fio_autoscale_on_report(uint32_t cpu, uint32_t lag) {
+  fio_lock(&fio_autoscale.lock);
+  ++fio_autoscale.reports;
+  fio_autoscale.cpu += cpu;
+  fio_autoscale.lag += lag;
+  fio_unlock(&fio_autoscale.lock);
+}
+
+/* root: spawns a worker in the first free slot */
+static void fio_autoscale_spawn(void) {
+  size_t i = 0;
+  fio_lock(&fio_autoscale.lock);
+  while (i < fio_data->workers_max && fio_autoscale.pids[i])
+    ++i;
+  fio_unlock(&fio_autoscale.lock);
+  if (i == fio_data->workers_max)
+    return;
+  ++fio_data->workers;
+  FIO_LOG_INFO("(autoscale) workers overloaded, spawning worker (%u/%u).",
+               (unsigned)fio_data->workers, (unsigned)fio_data->workers_max);
+  fio_sentinel_task((void *)(uintptr_t)i, NULL);
+}
+
+/* root: retires (drains) the worker in the last slot in use */
+static void fio_autoscale_retire(void) {
+  pid_t pid = 0;
+  fio_lock(&fio_autoscale.lock);
+  for (size_t i = fio_data->workers_max; i--;) {
+    if (!fio_autoscale.pids[i] || fio_autoscale.retired[i])
+      continue;
+    fio_autoscale.retired[i] = 1;
+    pid = fio_autoscale.pids[i];
+    break;
+  }
+  fio_unlock(&fio_autoscale.lock);
+  if (!pid)
+    return;
+  --fio_data->workers;
+  FIO_LOG_INFO("(autoscale) workers idle, retiring worker %d (%u/%u).",
+               (int)pid, (unsigned)fio_data->workers,
+               (unsigned)fio_data->workers_max);
+  kill(pid, SIGTERM);
+}
+
+/* root: reviews the load reports collected since the last review */
+static void fio_autoscale_review(void) {
+  fio_lock(&fio_autoscale.lock);
+  const uint32_t reports = fio_autoscale.reports;
+  const uint32_t cpu = reports ? fio_autoscale.cpu / reports : 0;
+  const uint32_t lag = reports ? fio_autoscale.lag / reports : 0;
+  fio_autoscale.reports = fio_autoscale.cpu = fio_autoscale.lag = 0;
+  fio_unlock(&fio_autoscale.lock);
+  if (!reports)
+    return;
+  if (cpu >= FIO_AUTOSCALE_CPU_HIGH || lag >= FIO_AUTOSCALE_LAG_HIGH) {
+    ++fio_autoscale.overloaded;
+    fio_autoscale.idle = 0;
+  } else if (cpu <= FIO_AUTOSCALE_CPU_LOW) {
+    ++fio_autoscale.idle;
+    fio_autoscale.overloaded = 0;
+  } else {
+    fio_autoscale.overloaded = fio_autoscale.idle = 0;
+  }
+  if (fio_autoscale.overloaded >= FIO_AUTOSCALE_UP_REVIEWS &&
+      fio_data->workers < fio_data->workers_max) {
+    fio_autoscale.overloaded = 0;
+    fio_autoscale_spawn();
+  } else if (fio_autoscale.idle >= FIO_AUTOSCALE_DOWN_REVIEWS &&
+             fio_data->workers > fio_autoscale.min) {
+    fio_autoscale.idle = 0;
+    fio_autoscale_retire();
+  }
+}
+
+/* the autoscaling timer task - workers report and the root process reviews */
+static void fio_autoscale_tick(void *ignr) {
+  if (fio_data->is_worker)
+    fio_autoscale_report();
+  else
+    fio_autoscale_review();
+  (void)ignr;
+}
+
+/* root: sets up autoscaling between `min` and `fio_data->workers_max` */
+static void fio_autoscale_init(uint16_t min) {
+  fio_autoscale.pids =
+      calloc(fio_data->workers_max, sizeof(*fio_autoscale.pids));
+  fio_autoscale.retired =
+      calloc(fio_data->workers_max, sizeof(*fio_autoscale.retired));
+  FIO_ASSERT_ALLOC(fio_autoscale.pids && fio_autoscale.retired);
+  fio_autoscale.min = min;
+  fio_data->workers = min;
+  fio_autoscale.overloaded = fio_autoscale.idle = 0;
+  fio_autoscale.reports = fio_autoscale.cpu = fio_autoscale.lag = 0;
+  fio_run_every(FIO_AUTOSCALE_INTERVAL, 0, fio_autoscale_tick, NULL, NULL);
+}
+
+/* the number of sentinel threads still watching a worker process */
+static volatile size_t fio_sentinel_count;
+
+/* root: releases the autoscaling state once the sentinels are done */
+static void fio_autoscale_destroy(void) {
+  /* sentinels may still be returning from `waitpid` (ECHILD) */
+  while (fio_sentinel_count)
+    fio_throttle_thread(1000000);
+  fio_lock(&fio_autoscale.lock);
+  free(fio_autoscale.pids);
+  free(fio_autoscale.retired);
+  fio_autoscale.pids = NULL;
+  fio_autoscale.retired = NULL;
+  fio_unlock(&fio_autoscale.lock);
+}
+
+/* root: records the pid of the worker process spawned for the slot */
+static void fio_autoscale_on_spawn(size_t index, pid_t pid) {
+  fio_lock(&fio_autoscale.lock);
+  if (fio_autoscale.pids)
+    fio_autoscale.pids[index] = pid;
+  fio_unlock(&fio_autoscale.lock);
+}
+
+/* root: returns 1 if the (exited) worker was retired, freeing it's slot */
+static int fio_autoscale_on_exit(size_t index) {
+  int retired = 0;
+  fio_lock(&fio_autoscale.lock);
+  if (fio_autoscale.pids && fio_autoscale.retired[index]) {
+    fio_autoscale.pids[index] = 0;
+    fio_autoscale.retired[index] = 0;
+    retired = 1;
+  }
+  fio_unlock(&fio_autoscale.lock);
+  return retired;
+}
+
+/* *****************************************************************************
+Worker processes (the sentinel)
+***************************************************************************** */
+
+static void fio_sentinel_watch(void *arg) {
   errno = 0;
   pid_t child = fio_fork();
+  if (!child)
+    fio_data->worker_index = (uint16_t)(uintptr_t)arg;
+  else if (child > 0)
+    fio_autoscale_on_spawn((uintptr_t)arg, child);
   /* release fork lock. */
   fio_unlock(&fio_fork_lock);
   if (child == -1) {
@@ -3838,10 +4686,14 @@ static void *fio_sentinel_worker_thread(void *arg) {
     perror("\n           errno");
     kill(fio_parent_pid(), SIGINT);
     fio_stop();
-    return NULL;
+    return;
   } else if (child) {
     int status;
     waitpid(child, &status, 0);
+    if (fio_autoscale_on_exit((uintptr_t)arg)) {
+      FIO_LOG_INFO("(autoscale) worker %d retired.", (int)child);
+      return;
+    }
 #if DEBUG
     if (fio_data->active) { /* !WIFEXITED(status) || WEXITSTATUS(status) */
       if (!WIFEXITED(status) || WEXITSTATUS(status)) {
@@ -3864,7 +4716,7 @@ static void *fio_sentinel_worker_thread(void *arg) {
         FIO_LOG_WARNING("Child worker (%d) shutdown. Respawning worker.",
                         (int)child);
       }
-      fio_defer_push_task(fio_sentinel_task, NULL, NULL);
+      fio_defer_push_task(fio_sentinel_task, arg, NULL);
       fio_unlock(&fio_fork_lock);
     }
 #endif
@@ -3876,8 +4728,12 @@ static void *fio_sentinel_worker_thread(void *arg) {
     fio_worker_cleanup();
     exit(0);
   }
+}
+
+static void *fio_sentinel_worker_thread(void *arg) {
+  fio_sentinel_watch(arg);
+  fio_atomic_sub(&fio_sentinel_count, 1);
   return NULL;
-  (void)arg;
 }
 
 static void fio_sentinel_task(void *arg1, void *arg2) {
@@ -3885,17 +4741,21 @@ static void fio_sentinel_task(void *arg1, void *arg2) {
     return;
   fio_state_callback_force(FIO_CALL_BEFORE_FORK);
   fio_lock(&fio_fork_lock); /* will wait for worker thread to release lock. */
-  void *thrd =
-      fio_thread_new(fio_sentinel_worker_thread, (void *)&fio_fork_lock);
+  /* arg1 is the worker's index (respawned workers reuse the index) */
+  fio_atomic_add(&fio_sentinel_count, 1);
+  void *thrd = fio_thread_new(fio_sentinel_worker_thread, arg1);
+  if (!thrd)
+    fio_atomic_sub(&fio_sentinel_count, 1);
   fio_thread_free(thrd);
   fio_lock(&fio_fork_lock);   /* will wait for worker thread to release lock. */
   fio_unlock(&fio_fork_lock); /* release lock for next fork. */
   fio_state_callback_force(FIO_CALL_AFTER_FORK);
   fio_state_callback_force(FIO_CALL_IN_MASTER);
-  (void)arg1;
   (void)arg2;
 }
 
+static void fio_listen_inherited_cleanup(void);
+
 FIO_FUNC void fio_start_(void) {} /* marker for SublimeText3 jump feature */
 
 /**
@@ -3909,10 +4769,19 @@ FIO_FUNC void fio_start_(void) {} /* marker for SublimeText3 jump feature */
  */
 void fio_start FIO_IGNORE_MACRO(struct fio_start_args args) {
   fio_expected_concurrency(&args.threads, &args.workers);
+  fio_listen_inherited_cleanup();
   fio_signal_handler_setup();
 
   fio_data->workers = (uint16_t)args.workers;
+  fio_data->workers_max = (uint16_t)args.workers;
+  if (args.workers_max > args.workers)
+    fio_data->workers_max = args.workers_max;
   fio_data->threads = (uint16_t)args.threads;
+  fio_data->affinity = args.affinity;
+  fio_data->busy_poll = args.busy_poll;
+  fio_data->shutdown_timeout =
+      args.shutdown_timeout ? args.shutdown_timeout : FIO_SHUTDOWN_TIMEOUT;
+  fio_data->worker_index = 0;
   fio_data->active = 1;
   fio_data->is_worker = 0;
 
@@ -3934,13 +4803,20 @@ void fio_start FIO_IGNORE_MACRO(struct fio_start_args args) {
 #endif
       fio_data->capa, (int)fio_data->parent);
 
-  if (args.workers > 1) {
+  if (fio_data->workers_max > fio_data->workers) {
+    FIO_LOG_INFO("Autoscaling between %u and %u workers.",
+                 (unsigned)fio_data->workers,
+                 (unsigned)fio_data->workers_max);
+    fio_autoscale_init(fio_data->workers);
+  }
+  if (!fio_single_process()) {
     for (int i = 0; i < args.workers && fio_data->active; ++i) {
-      fio_sentinel_task(NULL, NULL);
+      fio_sentinel_task((void *)(uintptr_t)i, NULL);
     }
   }
   fio_worker_startup();
   fio_worker_cleanup();
+  fio_autoscale_destroy();
 }
 
 /* *****************************************************************************
@@ -4476,6 +5352,7 @@ The listening protocol (use the facil.io API to make a socket and attach it)
 
 typedef struct {
   fio_protocol_s pr;
+  fio_ls_embd_s node;
   intptr_t uuid;
   void *udata;
   void (*on_open)(intptr_t uuid, void *udata);
@@ -4488,8 +5365,15 @@ typedef struct {
   void *tls;
 } fio_listen_protocol_s;
 
+/* all the listening sockets (used for binary upgrade socket handoff) */
+static fio_ls_embd_s fio_listen_list = FIO_LS_INIT(fio_listen_list);
+static fio_lock_i fio_listen_list_lock = FIO_LOCK_INIT;
+
 static void fio_listen_cleanup_task(void *pr_) {
   fio_listen_protocol_s *pr = pr_;
+  fio_lock(&fio_listen_list_lock);
+  fio_ls_embd_remove(&pr->node);
+  fio_unlock(&fio_listen_list_lock);
   if (pr->tls)
     fio_tls_destroy(pr->tls);
   if (pr->on_finish) {
@@ -4499,8 +5383,8 @@ static void fio_listen_cleanup_task(void *pr_) {
   if (pr->addr &&
       (!pr->port || *pr->port == 0 ||
        (pr->port[0] == '0' && pr->port[1] == 0)) &&
-      fio_is_master()) {
-    /* delete Unix sockets */
+      fio_is_master() && !fio_data->handoff) {
+    /* delete Unix sockets (unless an upgraded binary is using them) */
     unlink(pr->addr);
   }
   free(pr_);
@@ -4553,6 +5437,355 @@ static void fio_listen_on_data_tls_alpn(intptr_t uuid, fio_protocol_s *pr_) {
   }
 }
 
+/* *****************************************************************************
+Binary upgrade - listening socket handoff
+***************************************************************************** */
+
+/* the environment variable used to pass listening sockets to a new binary */
+#define FIO_LISTEN_FDS_ENV "FIO_LISTEN_FDS"
+
+/*
+ * The environment variable lists the inherited listening sockets as:
+ *
+ *      fd,port,address;fd,port,address;...
+ *
+ * Where port and address are the strings passed to `fio_listen` (or empty).
+ */
+
+/* finds an inherited listening socket matching the address, or returns -1. */
+static intptr_t fio_listen_inherited(const char *address, const char *port) {
+  char *pos = getenv(FIO_LISTEN_FDS_ENV);
+  if (!pos)
+    return -1;
+  const size_t addr_len = address ? strlen(address) : 0;
+  const size_t port_len = port ? strlen(port) : 0;
+  while (*pos) {
+    int64_t fd = fio_atol(&pos);
+    if (*pos != ',')
+      return -1;
+    const char *p = ++pos;
+    while (*pos && *pos != ',')
+      ++pos;
+    const size_t p_len = pos - p;
+    if (*pos != ',')
+      return -1;
+    const char *a = ++pos;
+    while (*pos && *pos != ';')
+      ++pos;
+    const size_t a_len = pos - a;
+    if (*pos)
+      ++pos;
+    if (p_len != port_len || a_len != addr_len ||
+        (port_len && memcmp(p, port, port_len)) ||
+        (addr_len && memcmp(a, address, addr_len)))
+      continue;
+    if (fd <= 2 || fd >= (int64_t)fio_data->capa || fd_data(fd).open ||
+        fcntl((int)fd, F_GETFD) == -1 || fio_set_non_block((int)fd) == -1)
+      continue;
+    intptr_t uuid = fio_fd2uuid((int)fd);
+    if (!port_len && addr_len < sizeof(fd_cold(fd).addr)) {
+      /* Unix sockets pass their address to accepted connections */
+      memcpy(fd_cold(fd).addr, address, addr_len + 1);
+      fd_cold(fd).addr_len = addr_len;
+    }
+    FIO_LOG_DEBUG("(%d) inherited listening socket %d (%s:%s)", (int)getpid(),
+                  (int)fd, (address ? address : ""), (port ? port : ""));
+    return uuid;
+  }
+  return -1;
+}
+
+/* closes inherited listening sockets that weren't claimed by `fio_listen`. */
+static void fio_listen_inherited_cleanup(void) {
+  char *pos = getenv(FIO_LISTEN_FDS_ENV);
+  if (!pos)
+    return;
+  while (*pos) {
+    int64_t fd = fio_atol(&pos);
+    if (fd > 2 && fd < (int64_t)fio_data->capa && !fd_data(fd).open) {
+      FIO_LOG_DEBUG("(%d) closing unused inherited socket %d", (int)getpid(),
+                    (int)fd);
+      close((int)fd);
+    }
+    while (*pos && *pos != ';')
+      ++pos;
+    if (*pos)
+      ++pos;
+  }
+  unsetenv(FIO_LISTEN_FDS_ENV);
+}
+
+/* reads the process command line arguments (Linux), returns NULL on error. */
+static char **fio_upgrade_read_args(void) {
+#if defined(__linux__)
+  int fd = open("/proc/self/cmdline", O_RDONLY);
+  if (fd == -1)
+    return NULL;
+  fio_str_s cmd = FIO_STR_INIT;
+  char buf[4096];
+  ssize_t r;
+  while ((r = read(fd, buf, sizeof(buf))) > 0)
+    fio_str_write(&cmd, buf, r);
+  close(fd);
+  fio_str_info_s i = fio_str_info(&cmd);
+  size_t count = 0;
+  for (size_t n = 0; n < i.len; ++n)
+    count += (i.data[n] == 0);
+  if (!count) {
+    fio_str_free(&cmd);
+    return NULL;
+  }
+  /* the pointer array and the strings share a single allocation */
+  char **args = malloc(((count + 1) * sizeof(*args)) + i.len);
+  FIO_ASSERT_ALLOC(args);
+  char *strings = (char *)(args + count + 1);
+  memcpy(strings, i.data, i.len);
+  fio_str_free(&cmd);
+  for (size_t n = 0; n < count; ++n) {
+    args[n] = strings;
+    strings += strlen(strings) + 1;
+  }
+  args[count] = NULL;
+  return args;
+#else
+  return NULL;
+#endif
+}
+
+extern char **environ;
+
+/* builds the new binary's environment before forking (execve can't malloc) */
+static char **fio_upgrade_env(char *listen_fds) {
+  size_t count = 0;
+  for (char **e = environ; e && *e; ++e)
+    ++count;
+  char **envp = malloc(sizeof(*envp) * (count + 2));
+  FIO_ASSERT_ALLOC(envp);
+  count = 0;
+  for (char **e = environ; e && *e; ++e) {
+    if (!strncmp(*e, FIO_LISTEN_FDS_ENV "=", sizeof(FIO_LISTEN_FDS_ENV)))
+      continue;
+    envp[count++] = *e;
+  }
+  envp[count++] = listen_fds;
+  envp[count] = NULL;
+  return envp;
+}
+
+/* resolves the new binary's path the way `execvp` would (NULL on error). */
+static char *fio_upgrade_binary_path(const char *name) {
+  const size_t name_len = strlen(name);
+  const char *path = getenv("PATH");
+  if (!name_len)
+    goto not_found;
+  if (strchr(name, '/')) {
+    char *r = malloc(name_len + 1);
+    FIO_ASSERT_ALLOC(r);
+    memcpy(r, name, name_len + 1);
+    return r;
+  }
+  if (!path || !*path)
+    path = "/usr/bin:/bin";
+  for (;;) {
+    const char *end = strchr(path, ':');
+    size_t len = end ? (size_t)(end - path) : strlen(path);
+    char *r = malloc(len + name_len + 2);
+    FIO_ASSERT_ALLOC(r);
+    memcpy(r, path, len);
+    if (len) /* an empty PATH entry is the current directory */
+      r[len++] = '/';
+    memcpy(r + len, name, name_len + 1);
+    if (!access(r, X_OK))
+      return r;
+    free(r);
+    if (!end)
+      break;
+    path = end + 1;
+  }
+not_found:
+  errno = ENOENT;
+  return NULL;
+}
+
+/* reads up to `len` bytes from a pipe, waiting up to `*ms` milliseconds */
+static ssize_t fio_upgrade_read(int fd, void *dest, size_t len, int *ms) {
+  size_t pos = 0;
+  while (pos < len) {
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int ready = poll(&pfd, 1, *ms);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const int64_t spent = ((end.tv_sec - start.tv_sec) * 1000) +
+                          ((end.tv_nsec - start.tv_nsec) / 1000000);
+    *ms = (spent >= *ms) ? 0 : (int)(*ms - spent);
+    if (ready == -1 && errno == EINTR)
+      continue;
+    if (ready == -1)
+      return -1;
+    if (!ready) {
+      errno = ETIMEDOUT;
+      return -1;
+    }
+    ssize_t r = read(fd, (char *)dest + pos, len - pos);
+    if (r == -1 && errno == EINTR)
+      continue;
+    if (r == -1)
+      return -1;
+    if (!r)
+      break;
+    pos += r;
+  }
+  return pos;
+}
+
+/**
+ * Starts a zero-downtime binary upgrade, see details in fio.h.
+ */
+int fio_upgrade(char *const argv[]) {
+  char **args = NULL;
+  char **envp = NULL;
+  char *path = NULL;
+  int *fds = NULL;
+  size_t fd_count = 0;
+  int err_pipe[2] = {-1, -1};
+  fio_str_s env = FIO_STR_INIT;
+  if (fio_data->parent != getpid()) {
+    errno = EPERM;
+    goto error;
+  }
+  if (!argv) {
+    argv = args = fio_upgrade_read_args();
+    if (!args) {
+      errno = ENOTSUP;
+      goto error;
+    }
+  }
+  /* collect the listening sockets */
+  fio_str_write(&env, FIO_LISTEN_FDS_ENV "=", sizeof(FIO_LISTEN_FDS_ENV));
+  fio_lock(&fio_listen_list_lock);
+  FIO_LS_EMBD_FOR(&fio_listen_list, node) { ++fd_count; }
+  fds = malloc(sizeof(*fds) * (fd_count + 1));
+  FIO_ASSERT_ALLOC(fds);
+  fd_count = 0;
+  FIO_LS_EMBD_FOR(&fio_listen_list, node) {
+    fio_listen_protocol_s *pr =
+        FIO_LS_EMBD_OBJ(fio_listen_protocol_s, node, node);
+    if (!fio_is_valid(pr->uuid))
+      continue;
+    fds[fd_count++] = fio_uuid2fd(pr->uuid);
+    fio_str_printf(&env, "%d,%s,%s;", fio_uuid2fd(pr->uuid),
+                   (pr->port_len ? pr->port : ""),
+                   (pr->addr_len ? pr->addr : ""));
+  }
+  fio_unlock(&fio_listen_list_lock);
+  if (!fd_count) {
+    FIO_LOG_WARNING("binary upgrade requested, but no sockets are listening.");
+  }
+  /* the child may only call async-signal-safe functions, prepare everything */
+  path = fio_upgrade_binary_path(argv[0]);
+  if (!path)
+    goto error;
+  envp = fio_upgrade_env(fio_str_data(&env));
+  /* exec errors are reported through a close-on-exec pipe */
+  if (pipe(err_pipe) ||
+      fcntl(err_pipe[1], F_SETFD, fcntl(err_pipe[1], F_GETFD) | FD_CLOEXEC))
+    goto error;
+
+  pid_t child = fork();
+  if (child == -1)
+    goto error;
+  if (!child) {
+    /* fork again, so the new binary isn't a child of the old root process */
+    pid_t grandchild = fork();
+    if (grandchild == -1) {
+      int e = errno;
+      if (write(err_pipe[1], &grandchild, sizeof(grandchild)) == -1 ||
+          write(err_pipe[1], &e, sizeof(e)) == -1)
+        _exit(1);
+      _exit(1);
+    }
+    if (grandchild)
+      _exit(0);
+    /* the new process reports it's pid, so a hung process can be killed */
+    grandchild = getpid();
+    if (write(err_pipe[1], &grandchild, sizeof(grandchild)) == -1)
+      _exit(1);
+    /* close everything except stdio, the listening sockets and the pipe */
+    for (int fd = 3; fd < (int)fio_data->capa; ++fd) {
+      size_t i = 0;
+      while (i < fd_count && fds[i] != fd)
+        ++i;
+      if (i < fd_count)
+        fcntl(fd, F_SETFD, 0);
+      else if (fd != err_pipe[1])
+        close(fd);
+    }
+    execve(path, argv, envp);
+    int e = errno;
+    if (write(err_pipe[1], &e, sizeof(e)) == -1)
+      _exit(1);
+    _exit(1);
+  }
+  close(err_pipe[1]);
+  err_pipe[1] = -1;
+  {
+    /* never block the reactor on a hung child, wait FIO_UPGRADE_TIMEOUT */
+    int ms = FIO_UPGRADE_TIMEOUT;
+    pid_t grandchild = -1;
+    int e = 0;
+    ssize_t r =
+        fio_upgrade_read(err_pipe[0], &grandchild, sizeof(grandchild), &ms);
+    /* the intermediate child exits right away, ECHILD == already reaped */
+    while (waitpid(child, NULL, 0) == -1 && errno == EINTR)
+      ;
+    if (r != sizeof(grandchild)) {
+      if (r >= 0)
+        errno = ECHILD;
+      goto error;
+    }
+    r = fio_upgrade_read(err_pipe[0], &e, sizeof(e), &ms);
+    if (r == sizeof(e)) {
+      /* fork or exec failed */
+      errno = e;
+      goto error;
+    }
+    if (r) {
+      /* the new process didn't exec in time */
+      e = (r == -1 ? errno : EIO);
+      if (grandchild > 0)
+        kill(grandchild, SIGKILL);
+      errno = e;
+      goto error;
+    }
+  }
+  close(err_pipe[0]);
+  FIO_LOG_INFO("(%d) binary upgrade started (%s), handing off %zu listening "
+               "sockets and shutting down.",
+               (int)getpid(), path, fd_count);
+  free(args);
+  free(envp);
+  free(path);
+  free(fds);
+  fio_str_free(&env);
+  fio_data->handoff = 1;
+  fio_stop();
+  return 0;
+error:
+  FIO_LOG_ERROR("(%d) binary upgrade failed: %s", (int)getpid(),
+                strerror(errno));
+  if (err_pipe[0] != -1)
+    close(err_pipe[0]);
+  if (err_pipe[1] != -1)
+    close(err_pipe[1]);
+  free(args);
+  free(envp);
+  free(path);
+  free(fds);
+  fio_str_free(&env);
+  return -1;
+}
+
 /* stub for editor - unused */
 void fio_listen____(void);
 /**
@@ -4585,7 +5818,10 @@ intptr_t fio_listen FIO_IGNORE_MACRO(struct fio_listen_args args) {
       goto error;
     }
   }
-  const intptr_t uuid = fio_socket(args.address, args.port, 1);
+  /* sockets might be inherited from a previous binary (see `fio_upgrade`) */
+  intptr_t uuid = fio_listen_inherited(args.address, args.port);
+  if (uuid == -1)
+    uuid = fio_socket(args.address, args.port, 1);
   if (uuid == -1)
     goto error;
 
@@ -4623,6 +5859,10 @@ intptr_t fio_listen FIO_IGNORE_MACRO(struct fio_listen_args args) {
   if (port_len)
     memcpy(pr->port, args.port, port_len + 1);
 
+  fio_lock(&fio_listen_list_lock);
+  fio_ls_embd_push(&fio_listen_list, &pr->node);
+  fio_unlock(&fio_listen_list_lock);
+
   if (fio_is_running()) {
     fio_attach(pr->uuid, &pr->pr);
   } else {
@@ -4679,6 +5919,754 @@ Section Start Marker
 
 ***************************************************************************** */
 
+/* *****************************************************************************
+DNS Resolution (non-blocking, cached)
+***************************************************************************** */
+
+/* a cached name, expires == 0 never expires, len == 0 is a negative entry */
+typedef struct {
+  time_t expires;
+  socklen_t len;
+  struct sockaddr_storage addr;
+  size_t name_len;
+  char *name;
+} fio_dns_entry_s;
+
+static inline int fio_dns_entry_cmp(fio_dns_entry_s *a, fio_dns_entry_s *b) {
+  return a->name_len == b->name_len && !memcmp(a->name, b->name, a->name_len);
+}
+
+/* cached names have a long life, so avoid fio_malloc */
+#define FIO_FORCE_MALLOC_TMP 1
+#define FIO_SET_NAME fio_dns_cache
+#define FIO_SET_OBJ_TYPE fio_dns_entry_s *
+#define FIO_SET_OBJ_COMPARE(o1, o2) fio_dns_entry_cmp((o1), (o2))
+#define FIO_SET_OBJ_DESTROY(obj) free((obj))
+#include <fio.h>
+
+typedef struct fio_dns_waiter_s fio_dns_waiter_s;
+struct fio_dns_waiter_s {
+  fio_dns_waiter_s *next;
+  void (*on_resolved)(const struct sockaddr *addr, socklen_t len, void *udata);
+  void *udata;
+};
+
+/* a pending query, lookups for the same name share a query */
+typedef struct {
+  fio_ls_embd_s node;
+  fio_dns_waiter_s *waiting;
+  time_t sent;
+  uint16_t id;
+  uint16_t type; /* 1 == A, 28 == AAAA */
+  uint8_t attempts;
+  uint8_t candidate; /* the search list position being queried */
+  uint8_t absolute;  /* names ending with a dot skip the search list */
+  size_t qname_len;
+  char qname[256]; /* the name sent to the nameserver */
+  size_t name_len;
+  char name[]; /* the name requested (and cached) */
+} fio_dns_query_s;
+
+static struct {
+  fio_dns_cache_s cache;
+  fio_ls_embd_s queries;
+  struct sockaddr_storage ns[FIO_DNS_NAMESERVERS_MAX];
+  socklen_t ns_len[FIO_DNS_NAMESERVERS_MAX];
+  uint8_t ns_count;
+  uint8_t ns_index; /* the nameserver in use */
+  intptr_t uuid;
+  fio_protocol_s *pr; /* identifies the socket (`on_close` gets a new uuid) */
+  fio_lock_i lock;
+  uint8_t timeout;
+  uint8_t attempts;
+  uint8_t loaded;
+  uint8_t ndots;
+  uint8_t search_count;
+  uint8_t search_pos[FIO_DNS_SEARCH_MAX];
+  char search[256]; /* NUL separated search domains */
+} fio_dns = {
+    .queries = FIO_LS_INIT(fio_dns.queries),
+    .uuid = -1,
+    .lock = FIO_LOCK_INIT,
+    .timeout = 5,
+    .attempts = 2,
+    .ndots = 1,
+};
+
+static inline time_t fio_dns_now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec;
+}
+
+static inline void fio_dns_port_set(struct sockaddr_storage *addr,
+                                    uint16_t port) {
+  if (addr->ss_family == AF_INET)
+    ((struct sockaddr_in *)addr)->sin_port = htons(port);
+  else
+    ((struct sockaddr_in6 *)addr)->sin6_port = htons(port);
+}
+
+/* parses a numeric IPv4 / IPv6 address, returns the address length or 0 */
+static socklen_t fio_dns_numeric(struct sockaddr_storage *dest,
+                                 const char *host) {
+  memset(dest, 0, sizeof(*dest));
+  struct sockaddr_in *a4 = (struct sockaddr_in *)dest;
+  if (inet_pton(AF_INET, host, &a4->sin_addr) == 1) {
+    a4->sin_family = AF_INET;
+    return sizeof(*a4);
+  }
+  struct sockaddr_in6 *a6 = (struct sockaddr_in6 *)dest;
+  if (inet_pton(AF_INET6, host, &a6->sin6_addr) == 1) {
+    a6->sin6_family = AF_INET6;
+    return sizeof(*a6);
+  }
+  return 0;
+}
+
+/* copies a lower case host name without the trailing dot (`dest` >= 256) */
+static size_t fio_dns_normalize(char *dest, const char *host) {
+  size_t len = 0;
+  for (; host[len]; ++len) {
+    if (len > 253)
+      return 0;
+    dest[len] = host[len];
+    if (dest[len] >= 'A' && dest[len] <= 'Z')
+      dest[len] |= 32;
+  }
+  if (len && dest[len - 1] == '.')
+    --len;
+  dest[len] = 0;
+  return len;
+}
+
+static inline uint64_t fio_dns_hash(const char *name, size_t len) {
+  return fio_risky_hash(name, len, (uintptr_t)&fio_dns);
+}
+
+/* returns a cached entry (or NULL), removing expired entries. Lock first. */
+static fio_dns_entry_s *fio_dns_cache_get(char *name, size_t len, time_t now) {
+  fio_dns_entry_s needle = {.name = name, .name_len = len};
+  const uint64_t hash = fio_dns_hash(name, len);
+  fio_dns_entry_s *e = fio_dns_cache_find(&fio_dns.cache, hash, &needle);
+  if (e && e->expires && e->expires <= now) {
+    fio_dns_cache_remove(&fio_dns.cache, hash, e, NULL);
+    e = NULL;
+  }
+  return e;
+}
+
+/* caches a name (len == 0 for a negative entry). Lock first. */
+static void fio_dns_cache_store(const char *name, size_t name_len,
+                                time_t expires,
+                                const struct sockaddr_storage *addr,
+                                socklen_t len) {
+  if (fio_dns_cache_count(&fio_dns.cache) >= FIO_DNS_CACHE_LIMIT) {
+    const time_t now = fio_dns_now();
+    FIO_SET_FOR_LOOP(&fio_dns.cache, pos) {
+      if (pos->hash && pos->obj->expires && pos->obj->expires <= now)
+        fio_dns_cache_remove(&fio_dns.cache, pos->hash, pos->obj, NULL);
+    }
+    if (fio_dns_cache_count(&fio_dns.cache) >= FIO_DNS_CACHE_LIMIT)
+      return;
+  }
+  fio_dns_entry_s *e = malloc(sizeof(*e) + name_len + 1);
+  FIO_ASSERT_ALLOC(e);
+  *e = (fio_dns_entry_s){
+      .expires = expires,
+      .len = len,
+      .name_len = name_len,
+      .name = (char *)(e + 1),
+  };
+  if (len)
+    memcpy(&e->addr, addr, len);
+  memcpy(e->name, name, name_len);
+  e->name[name_len] = 0;
+  fio_dns_cache_overwrite(&fio_dns.cache, fio_dns_hash(name, name_len), e,
+                          NULL);
+}
+
+/* loads the hosts file names (first entry wins) to the cache. Lock first. */
+static void fio_dns_load_hosts(void) {
+  FILE *f = fopen(FIO_DNS_HOSTS_FILE, "r");
+  if (!f)
+    return;
+  char line[512];
+  char name[256];
+  struct sockaddr_storage addr;
+  while (fgets(line, sizeof(line), f)) {
+    char *tmp = strchr(line, '#');
+    if (tmp)
+      *tmp = 0;
+    char *state = NULL;
+    char *token = strtok_r(line, " \t\r\n", &state);
+    socklen_t len;
+    if (!token || !(len = fio_dns_numeric(&addr, token)))
+      continue;
+    while ((token = strtok_r(NULL, " \t\r\n", &state))) {
+      size_t name_len = fio_dns_normalize(name, token);
+      if (name_len && !fio_dns_cache_get(name, name_len, 0))
+        fio_dns_cache_store(name, name_len, 0, &addr, len);
+    }
+  }
+  fclose(f);
+}
+
+/* loads the nameservers, search list and options. Lock first. */
+static void fio_dns_load_resolv(void) {
+  FILE *f = fopen(FIO_DNS_RESOLV_FILE, "r");
+  char line[512];
+  fio_dns.ns_index = 0;
+  fio_dns.search_count = 0;
+  fio_dns.ndots = 1;
+  while (f && fgets(line, sizeof(line), f)) {
+    char *state = NULL;
+    char *token = strtok_r(line, " \t\r\n", &state);
+    if (!token)
+      continue;
+    if (!strcmp(token, "nameserver")) {
+      token = strtok_r(NULL, " \t\r\n", &state);
+      const size_t i = fio_dns.ns_count;
+      if (token && i < FIO_DNS_NAMESERVERS_MAX &&
+          (fio_dns.ns_len[i] = fio_dns_numeric(fio_dns.ns + i, token))) {
+        fio_dns_port_set(fio_dns.ns + i, 53);
+        ++fio_dns.ns_count;
+      }
+    } else if (!strcmp(token, "search") || !strcmp(token, "domain")) {
+      /* the last `search` or `domain` line wins */
+      size_t pos = 0;
+      fio_dns.search_count = 0;
+      while ((token = strtok_r(NULL, " \t\r\n", &state)) &&
+             fio_dns.search_count < FIO_DNS_SEARCH_MAX) {
+        char name[256];
+        size_t len = fio_dns_normalize(name, token);
+        if (!len || pos + len + 1 > sizeof(fio_dns.search))
+          continue;
+        fio_dns.search_pos[fio_dns.search_count++] = (uint8_t)pos;
+        memcpy(fio_dns.search + pos, name, len + 1);
+        pos += len + 1;
+      }
+    } else if (!strcmp(token, "options")) {
+      while ((token = strtok_r(NULL, " \t\r\n", &state))) {
+        int n;
+        if (!strncmp(token, "timeout:", 8) && (n = atoi(token + 8)) > 0)
+          fio_dns.timeout = (n > 30 ? 30 : n);
+        else if (!strncmp(token, "attempts:", 9) && (n = atoi(token + 9)) > 0)
+          fio_dns.attempts = (n > 5 ? 5 : n);
+        else if (!strncmp(token, "ndots:", 6) && (n = atoi(token + 6)) >= 0)
+          fio_dns.ndots = (n > 15 ? 15 : n);
+      }
+    }
+  }
+  if (f)
+    fclose(f);
+  if (!fio_dns.ns_count) {
+    fio_dns.ns_len[0] = fio_dns_numeric(fio_dns.ns, "127.0.0.1");
+    fio_dns_port_set(fio_dns.ns, 53);
+    fio_dns.ns_count = 1;
+  }
+}
+
+/* sets the name sent for the query's search list position, 0 when done. */
+static size_t fio_dns_candidate(fio_dns_query_s *q) {
+  const size_t count = q->absolute ? 0 : fio_dns.search_count;
+  for (; q->candidate <= count; ++q->candidate) {
+    size_t i = q->candidate;
+    size_t dots = 0;
+    for (size_t j = 0; j < q->name_len; ++j)
+      dots += (q->name[j] == '.');
+    /* names with `ndots` dots are tried as is before the search list */
+    if (dots >= fio_dns.ndots)
+      i = (i ? i - 1 : count);
+    if (i == count) {
+      memcpy(q->qname, q->name, q->name_len + 1);
+      return (q->qname_len = q->name_len);
+    }
+    const char *domain = fio_dns.search + fio_dns.search_pos[i];
+    const size_t len = strlen(domain);
+    if (q->name_len + len + 1 > 253)
+      continue;
+    memcpy(q->qname, q->name, q->name_len);
+    q->qname[q->name_len] = '.';
+    memcpy(q->qname + q->name_len + 1, domain, len + 1);
+    return (q->qname_len = q->name_len + len + 1);
+  }
+  return 0;
+}
+
+/* writes a DNS query packet to `dest` (512 bytes), returns the length or 0 */
+static size_t fio_dns_packet(uint8_t *dest, fio_dns_query_s *q) {
+  const uint8_t header[12] = {q->id >> 8, q->id & 255, 1, 0, 0, 1};
+  memcpy(dest, header, 12);
+  size_t pos = 12;
+  const char *label = q->qname;
+  const char *end = q->qname + q->qname_len;
+  while (label < end) {
+    const char *dot = memchr(label, '.', end - label);
+    if (!dot)
+      dot = end;
+    const size_t len = dot - label;
+    if (!len || len > 63)
+      return 0;
+    dest[pos++] = (uint8_t)len;
+    memcpy(dest + pos, label, len);
+    pos += len;
+    label = dot + 1;
+  }
+  dest[pos++] = 0;
+  dest[pos++] = q->type >> 8;
+  dest[pos++] = q->type & 255;
+  dest[pos++] = 0;
+  dest[pos++] = 1; /* class IN */
+  return pos;
+}
+
+/* returns the position following a (possibly compressed) name, or 0 */
+static size_t fio_dns_skip_name(const uint8_t *buf, size_t len, size_t pos) {
+  while (pos < len) {
+    if (!buf[pos])
+      return pos + 1;
+    if ((buf[pos] & 0xC0) == 0xC0)
+      return (pos + 2 <= len) ? pos + 2 : 0;
+    if (buf[pos] & 0xC0)
+      return 0;
+    pos += buf[pos] + 1;
+  }
+  return 0;
+}
+
+static void fio_dns_send(fio_dns_query_s *q) {
+  uint8_t buf[512];
+  size_t len = fio_dns_packet(buf, q);
+  if (len && fio_dns.uuid != -1)
+    send(fio_uuid2fd(fio_dns.uuid), buf, len, 0);
+}
+
+/* calls the query's callbacks and frees the query (never call with a lock) */
+static void fio_dns_notify(fio_dns_query_s *q,
+                           const struct sockaddr_storage *addr,
+                           socklen_t len) {
+  fio_dns_waiter_s *w = q->waiting;
+  while (w) {
+    fio_dns_waiter_s *next = w->next;
+    w->on_resolved(len ? (struct sockaddr *)addr : NULL, len, w->udata);
+    fio_free(w);
+    w = next;
+  }
+  fio_free(q);
+}
+
+/* fails all pending queries */
+static void fio_dns_fail_all(void) {
+  fio_ls_embd_s failed = FIO_LS_INIT(failed);
+  fio_ls_embd_s *node;
+  fio_lock(&fio_dns.lock);
+  while ((node = fio_ls_embd_shift(&fio_dns.queries)))
+    fio_ls_embd_push(&failed, node);
+  fio_unlock(&fio_dns.lock);
+  while ((node = fio_ls_embd_shift(&failed)))
+    fio_dns_notify(FIO_LS_EMBD_OBJ(fio_dns_query_s, node, node), NULL, 0);
+}
+
+static int fio_dns_connect(void);
+
+/* moves to the next nameserver, reconnecting the socket. Lock first. */
+static void fio_dns_ns_next(void) {
+  if (fio_dns.ns_count < 2)
+    return;
+  fio_dns.ns_index = (fio_dns.ns_index + 1) % fio_dns.ns_count;
+  if (fio_dns.uuid == -1) {
+    fio_dns_connect();
+    return;
+  }
+  const struct sockaddr_storage *ns = fio_dns.ns + fio_dns.ns_index;
+  const int fd = fio_uuid2fd(fio_dns.uuid);
+  struct sockaddr_storage local;
+  socklen_t local_len = sizeof(local);
+  if (getsockname(fd, (struct sockaddr *)&local, &local_len) ||
+      local.ss_family != ns->ss_family) {
+    /* a different address family requires a new socket (same uuid) */
+    int tmp = socket(ns->ss_family, SOCK_DGRAM, 0);
+    if (tmp == -1)
+      return;
+    if (fio_set_non_block(tmp) == -1 || dup2(tmp, fd) == -1) {
+      close(tmp);
+      return;
+    }
+    close(tmp);
+    fio_poll_add_read(fd);
+  }
+  connect(fd, (struct sockaddr *)ns, fio_dns.ns_len[fio_dns.ns_index]);
+}
+
+/* retransmits timed out queries (or all queries) using the next nameserver */
+static void fio_dns_retry(uint8_t all) {
+  fio_ls_embd_s failed = FIO_LS_INIT(failed);
+  fio_ls_embd_s *node;
+  const time_t now = fio_dns_now();
+  uint8_t rotated = 0;
+  fio_lock(&fio_dns.lock);
+  /* every nameserver is tried `attempts` times */
+  const size_t limit = (size_t)fio_dns.attempts * fio_dns.ns_count;
+  node = fio_dns.queries.next;
+  while (node != &fio_dns.queries) {
+    fio_ls_embd_s *next = node->next;
+    fio_dns_query_s *q = FIO_LS_EMBD_OBJ(fio_dns_query_s, node, node);
+    node = next;
+    if (!all && q->sent + fio_dns.timeout > now)
+      continue;
+    if (!rotated) {
+      rotated = 1;
+      fio_dns_ns_next();
+    }
+    if (++q->attempts >= limit || fio_dns.uuid == -1) {
+      fio_ls_embd_remove(&q->node);
+      fio_ls_embd_push(&failed, &q->node);
+      continue;
+    }
+    q->sent = now;
+    fio_dns_send(q);
+  }
+  fio_unlock(&fio_dns.lock);
+  while ((node = fio_ls_embd_shift(&failed)))
+    fio_dns_notify(FIO_LS_EMBD_OBJ(fio_dns_query_s, node, node), NULL, 0);
+}
+
+/* handles a response packet */
+static void fio_dns_on_response(const uint8_t *buf, size_t len) {
+  if (len < 12 || !(buf[2] & 0x80) || buf[4] || buf[5] != 1)
+    return;
+  const uint16_t id = ((uint16_t)buf[0] << 8) | buf[1];
+  uint8_t packet[512];
+  size_t pos = 0;
+  fio_dns_query_s *q = NULL;
+  fio_lock(&fio_dns.lock);
+  FIO_LS_EMBD_FOR(&fio_dns.queries, node) {
+    fio_dns_query_s *tmp = FIO_LS_EMBD_OBJ(fio_dns_query_s, node, node);
+    if (tmp->id != id)
+      continue;
+    pos = fio_dns_packet(packet, tmp);
+    if (pos && pos <= len && !memcmp(packet + 12, buf + 12, pos - 12)) {
+      q = tmp;
+      break;
+    }
+  }
+  if (!q) {
+    fio_unlock(&fio_dns.lock);
+    return;
+  }
+  const uint8_t rcode = buf[3] & 15;
+  size_t answers = ((size_t)buf[6] << 8) | buf[7];
+  struct sockaddr_storage addr = {0};
+  socklen_t addr_len = 0;
+  uint32_t ttl = FIO_DNS_TTL_MAX;
+  /* walk the answers (and CNAME chain) for the first matching address */
+  while (!rcode && answers-- && (pos = fio_dns_skip_name(buf, len, pos)) &&
+         pos + 10 <= len) {
+    const uint16_t type = ((uint16_t)buf[pos] << 8) | buf[pos + 1];
+    const uint16_t class = ((uint16_t)buf[pos + 2] << 8) | buf[pos + 3];
+    const uint32_t rttl = fio_str2u32(buf + pos + 4);
+    const size_t rdlen = ((size_t)buf[pos + 8] << 8) | buf[pos + 9];
+    pos += 10;
+    if (pos + rdlen > len || class != 1)
+      break;
+    if (rttl < ttl)
+      ttl = rttl;
+    if (type == 1 && q->type == 1 && rdlen == 4) {
+      struct sockaddr_in *a4 = (struct sockaddr_in *)&addr;
+      a4->sin_family = AF_INET;
+      memcpy(&a4->sin_addr, buf + pos, 4);
+      addr_len = sizeof(*a4);
+      break;
+    }
+    if (type == 28 && q->type == 28 && rdlen == 16) {
+      struct sockaddr_in6 *a6 = (struct sockaddr_in6 *)&addr;
+      a6->sin6_family = AF_INET6;
+      memcpy(&a6->sin6_addr, buf + pos, 16);
+      addr_len = sizeof(*a6);
+      break;
+    }
+    pos += rdlen;
+  }
+  const time_t now = fio_dns_now();
+  if (addr_len) {
+    if (!ttl)
+      ttl = 1;
+    fio_dns_cache_store(q->name, q->name_len, now + ttl, &addr, addr_len);
+  } else if (!rcode && q->type == 1) {
+    /* no IPv4 address, try IPv6 */
+    q->type = 28;
+    q->id = (uint16_t)fio_rand64();
+    q->attempts = 0;
+    q->sent = now;
+    fio_dns_send(q);
+    fio_unlock(&fio_dns.lock);
+    return;
+  } else if (!rcode || rcode == 3) {
+    /* NODATA / NXDOMAIN - try the next search domain, or cache the failure */
+    ++q->candidate;
+    if (fio_dns_candidate(q)) {
+      q->type = 1;
+      q->id = (uint16_t)fio_rand64();
+      q->attempts = 0;
+      q->sent = now;
+      fio_dns_send(q);
+      fio_unlock(&fio_dns.lock);
+      return;
+    }
+    fio_dns_cache_store(q->name, q->name_len, now + FIO_DNS_NEGATIVE_TTL, NULL,
+                        0);
+  } else if (rcode == 2 || rcode == 5) {
+    /* SERVFAIL / REFUSED - retry using the next nameserver when pinged */
+    q->sent = 0;
+    fio_unlock(&fio_dns.lock);
+    return;
+  }
+  fio_ls_embd_remove(&q->node);
+  fio_unlock(&fio_dns.lock);
+  fio_dns_notify(q, &addr, addr_len);
+}
+
+static void fio_dns_on_data(intptr_t uuid, fio_protocol_s *pr) {
+  uint8_t buf[2048];
+  ssize_t len;
+  for (;;) {
+    len = recv(fio_uuid2fd(uuid), buf, sizeof(buf), 0);
+    if (len > 0) {
+      fio_dns_on_response(buf, (size_t)len);
+      continue;
+    }
+    if (len < 0 && errno == ECONNREFUSED) {
+      /* the nameserver isn't listening, try the next one */
+      fio_dns_retry(1);
+      continue;
+    }
+    if (len < 0 && errno == EINTR)
+      continue;
+    break;
+  }
+  fio_touch(uuid);
+  (void)pr;
+}
+
+/* retransmits (or fails) timed out queries, closes the socket when idle */
+static void fio_dns_ping(intptr_t uuid, fio_protocol_s *pr) {
+  uint8_t idle;
+  fio_dns_retry(0);
+  fio_lock(&fio_dns.lock);
+  idle = fio_ls_embd_is_empty(&fio_dns.queries);
+  if (idle && fio_dns.uuid == uuid)
+    fio_dns.uuid = -1;
+  fio_unlock(&fio_dns.lock);
+  if (idle)
+    fio_close(uuid);
+  else
+    fio_touch(uuid);
+  (void)pr;
+}
+
+static void fio_dns_on_close(intptr_t uuid, fio_protocol_s *pr) {
+  uint8_t owner = 0;
+  fio_lock(&fio_dns.lock);
+  if (fio_dns.uuid != -1 && fio_dns.pr == pr) {
+    fio_dns.uuid = -1;
+    owner = 1;
+  }
+  fio_unlock(&fio_dns.lock);
+  /* errors (i.e., a refused query) close the socket, try the next server */
+  if (owner && fio_dns.ns_count > 1)
+    fio_dns_retry(1);
+  else if (owner)
+    fio_dns_fail_all();
+  fio_free(pr);
+}
+
+/* loads the hosts file and resolver configuration, if required. Lock first. */
+static void fio_dns_load(void) {
+  if (!fio_dns.loaded) {
+    fio_dns.loaded = 1;
+    fio_dns_load_hosts();
+  }
+  if (!fio_dns.ns_count)
+    fio_dns_load_resolv();
+}
+
+/* opens the (connected) UDP socket used for queries. Lock first. */
+static int fio_dns_connect(void) {
+  if (fio_dns.uuid != -1)
+    return 0;
+  const struct sockaddr_storage *ns = fio_dns.ns + fio_dns.ns_index;
+  int fd = socket(ns->ss_family, SOCK_DGRAM, 0);
+  if (fd == -1)
+    return -1;
+  if (fio_set_non_block(fd) == -1 ||
+      connect(fd, (struct sockaddr *)ns, fio_dns.ns_len[fio_dns.ns_index]) ==
+          -1) {
+    close(fd);
+    return -1;
+  }
+  fio_lock(&fd_data(fd).protocol_lock);
+  fio_clear_fd(fd, 1);
+  fio_unlock(&fd_data(fd).protocol_lock);
+  fio_protocol_s *pr = fio_malloc(sizeof(*pr));
+  FIO_ASSERT_ALLOC(pr);
+  *pr = (fio_protocol_s){
+      .on_data = fio_dns_on_data,
+      .ping = fio_dns_ping,
+      .on_close = fio_dns_on_close,
+  };
+  fio_dns.uuid = fd2uuid(fd);
+  fio_dns.pr = pr;
+  fio_attach(fio_dns.uuid, pr);
+  fio_timeout_set(fio_dns.uuid, 1);
+  return 0;
+}
+
+/* fills `dest` from the cache (or hosts file), returns the length or 0 */
+static socklen_t fio_dns_cached(struct sockaddr_storage *dest,
+                                const char *host) {
+  socklen_t len = fio_dns_numeric(dest, host);
+  char name[256];
+  size_t name_len;
+  if (len || !(name_len = fio_dns_normalize(name, host)))
+    return len;
+  fio_lock(&fio_dns.lock);
+  fio_dns_load();
+  fio_dns_entry_s *e = fio_dns_cache_get(name, name_len, fio_dns_now());
+  if (e && e->len) {
+    memcpy(dest, &e->addr, e->len);
+    len = e->len;
+  }
+  fio_unlock(&fio_dns.lock);
+  return len;
+}
+
+/**
+ * Resolves a host name to an IPv4 or IPv6 address without blocking.
+ */
+void fio_dns_resolve(const char *host,
+                     void (*on_resolved)(const struct sockaddr *addr,
+                                         socklen_t len, void *udata),
+                     void *udata) {
+  struct sockaddr_storage addr;
+  socklen_t len = 0;
+  char name[256];
+  size_t name_len;
+  if (!on_resolved)
+    return;
+  if (!host || (len = fio_dns_numeric(&addr, host)) ||
+      !(name_len = fio_dns_normalize(name, host)))
+    goto finish;
+  const uint8_t absolute = (host[strlen(host) - 1] == '.');
+  const time_t now = fio_dns_now();
+  fio_lock(&fio_dns.lock);
+  fio_dns_load();
+  fio_dns_entry_s *e = fio_dns_cache_get(name, name_len, now);
+  if (e) {
+    if ((len = e->len))
+      memcpy(&addr, &e->addr, len);
+    fio_unlock(&fio_dns.lock);
+    goto finish;
+  }
+  fio_dns_waiter_s *w = fio_malloc(sizeof(*w));
+  FIO_ASSERT_ALLOC(w);
+  *w = (fio_dns_waiter_s){.on_resolved = on_resolved, .udata = udata};
+  FIO_LS_EMBD_FOR(&fio_dns.queries, node) {
+    fio_dns_query_s *q = FIO_LS_EMBD_OBJ(fio_dns_query_s, node, node);
+    if (q->name_len == name_len && !memcmp(q->name, name, name_len)) {
+      w->next = q->waiting;
+      q->waiting = w;
+      fio_unlock(&fio_dns.lock);
+      return;
+    }
+  }
+  if (fio_dns_connect()) {
+    fio_unlock(&fio_dns.lock);
+    fio_free(w);
+    goto finish;
+  }
+  fio_dns_query_s *q = fio_malloc(sizeof(*q) + name_len + 1);
+  FIO_ASSERT_ALLOC(q);
+  *q = (fio_dns_query_s){
+      .node = FIO_LS_INIT(q->node),
+      .waiting = w,
+      .sent = now,
+      .id = (uint16_t)fio_rand64(),
+      .type = 1,
+      .absolute = absolute,
+      .name_len = name_len,
+  };
+  memcpy(q->name, name, name_len + 1);
+  if (!fio_dns_candidate(q)) {
+    fio_unlock(&fio_dns.lock);
+    fio_free(w);
+    fio_free(q);
+    goto finish;
+  }
+  fio_ls_embd_push(&fio_dns.queries, &q->node);
+  fio_dns_send(q);
+  fio_unlock(&fio_dns.lock);
+  return;
+finish:
+  on_resolved(len ? (struct sockaddr *)&addr : NULL, len, udata);
+}
+
+static void fio_dns_prefetch_on_resolved(const struct sockaddr *addr,
+                                         socklen_t len, void *udata) {
+  (void)addr;
+  (void)len;
+  (void)udata;
+}
+
+/* starts resolving (and caching) a name, without waiting for the result */
+static void fio_dns_prefetch(const char *host) {
+  fio_dns_resolve(host, fio_dns_prefetch_on_resolved, NULL);
+}
+
+/**
+ * Sets the nameserver used by `fio_dns_resolve`.
+ */
+void fio_dns_nameserver(const char *address, const char *port) {
+  struct sockaddr_storage ns;
+  socklen_t len = 0;
+  if (address && !(len = fio_dns_numeric(&ns, address))) {
+    FIO_LOG_ERROR("(fio_dns_nameserver) %s isn't a numeric address.", address);
+    return;
+  }
+  fio_lock(&fio_dns.lock);
+  intptr_t old = fio_dns.uuid;
+  fio_dns.uuid = -1;
+  fio_dns.ns_count = 0;
+  fio_dns.ns_index = 0;
+  if (len) {
+    /* a single nameserver, without the resolver file's search list */
+    fio_dns.ns[0] = ns;
+    fio_dns.ns_len[0] = len;
+    fio_dns_port_set(fio_dns.ns, port ? (uint16_t)atol(port) : 53);
+    fio_dns.ns_count = 1;
+    fio_dns.search_count = 0;
+    fio_dns.ndots = 1;
+  }
+  fio_unlock(&fio_dns.lock);
+  if (old != -1)
+    fio_close(old);
+  fio_dns_fail_all();
+}
+
+/**
+ * Clears the DNS cache (the hosts file will be reloaded on the next lookup).
+ */
+void fio_dns_clear(void) {
+  fio_lock(&fio_dns.lock);
+  fio_dns_cache_free(&fio_dns.cache);
+  fio_dns.loaded = 0;
+  fio_unlock(&fio_dns.lock);
+}
+
+static void fio_dns_on_fork(void) { fio_dns.lock = FIO_LOCK_INIT; }
+
+static void fio_dns_destroy(void) { fio_dns_cache_free(&fio_dns.cache); }
+
 /* *****************************************************************************
 The connection protocol (use the facil.io API to make a socket and attach it)
 ***************************************************************************** */
@@ -4690,6 +6678,7 @@ typedef struct {
   void *tls;
   void (*on_connect)(intptr_t uuid, void *udata);
   void (*on_fail)(intptr_t uuid, void *udata);
+  uint16_t port; /* set while the address is being resolved */
 } fio_connect_protocol_s;
 
 static void fio_connect_on_close(intptr_t uuid, fio_protocol_s *pr_) {
@@ -4736,6 +6725,69 @@ static void fio_connect_on_ready_tls_alpn(intptr_t uuid, fio_protocol_s *pr_) {
   (void)uuid;
 }
 
+/* connects the reserved socket once the address was resolved */
+static void fio_connect_on_resolved(const struct sockaddr *addr, socklen_t len,
+                                    void *udata) {
+  const intptr_t uuid = (intptr_t)udata;
+  const int fd = fio_uuid2fd(uuid);
+  struct sockaddr_storage dest;
+  if (!uuid_is_valid(uuid))
+    return;
+  fio_lock(&uuid_data(uuid).protocol_lock);
+  fio_connect_protocol_s *pr =
+      (fio_connect_protocol_s *)uuid_data(uuid).protocol;
+  if (!uuid_is_valid(uuid) || !pr || pr->pr.on_close != fio_connect_on_close ||
+      !pr->port) {
+    fio_unlock(&uuid_data(uuid).protocol_lock);
+    return;
+  }
+  if (!addr)
+    goto failed;
+  memcpy(&dest, addr, len);
+  fio_dns_port_set(&dest, pr->port);
+  pr->port = 0;
+  if (dest.ss_family != AF_INET) {
+    /* the reserved socket is an IPv4 socket, replace it */
+    int tmp = socket(dest.ss_family, SOCK_STREAM, 0);
+    if (tmp == -1)
+      goto failed;
+    if (fio_set_non_block(tmp) == -1 || dup2(tmp, fd) == -1) {
+      close(tmp);
+      goto failed;
+    }
+    close(tmp);
+  }
+  {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  fio_sock_busy_poll(fd);
+  if (connect(fd, (struct sockaddr *)&dest, len) == -1 && errno != EINPROGRESS)
+    goto failed;
+  fio_tcp_addr_cpy(fd, dest.ss_family, (struct sockaddr *)&dest);
+  fio_unlock(&uuid_data(uuid).protocol_lock);
+  fio_poll_add(fd);
+  return;
+failed:
+  fio_unlock(&uuid_data(uuid).protocol_lock);
+  fio_force_close(uuid);
+}
+
+/* reserves a socket for a connection while it's address is resolved */
+static intptr_t fio_connect_reserve(void) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd == -1)
+    return -1;
+  if (fio_set_non_block(fd) == -1) {
+    close(fd);
+    return -1;
+  }
+  fio_lock(&fd_data(fd).protocol_lock);
+  fio_clear_fd(fd, 1);
+  fio_unlock(&fd_data(fd).protocol_lock);
+  return fd2uuid(fd);
+}
+
 /* stub for sublime text function navigation */
 intptr_t fio_connect___(struct fio_connect_args args);
 
@@ -4745,7 +6797,17 @@ intptr_t fio_connect FIO_IGNORE_MACRO(struct fio_connect_args args) {
     errno = EINVAL;
     goto error;
   }
-  const intptr_t uuid = fio_socket(args.address, args.port, 0);
+  uint16_t port = 0;
+  if (args.address && args.port) {
+    /* names that aren't cached are resolved without blocking */
+    struct sockaddr_storage tmp;
+    char *pos = (char *)args.port;
+    int64_t n = fio_atol(&pos);
+    if (!*pos && n > 0 && n < 65536 && !fio_dns_cached(&tmp, args.address))
+      port = (uint16_t)n;
+  }
+  const intptr_t uuid =
+      port ? fio_connect_reserve() : fio_socket(args.address, args.port, 0);
   if (uuid == -1)
     goto error;
   fio_timeout_set(uuid, args.timeout);
@@ -4770,8 +6832,16 @@ intptr_t fio_connect FIO_IGNORE_MACRO(struct fio_connect_args args) {
       .udata = args.udata,
       .on_connect = args.on_connect,
       .on_fail = args.on_fail,
+      .port = port,
   };
-  fio_attach(uuid, &pr->pr);
+  if (!port) {
+    fio_attach(uuid, &pr->pr);
+    return uuid;
+  }
+  /* the socket is polled only after it's address was resolved */
+  if (fio_attach__internal2(uuid, &pr->pr, 0))
+    return uuid;
+  fio_dns_resolve(args.address, fio_connect_on_resolved, (void *)uuid);
   return uuid;
 error:
   if (args.on_fail)
@@ -4779,6 +6849,331 @@ error:
   return -1;
 }
 
+/* *****************************************************************************
+UDP (datagram) sockets
+***************************************************************************** */
+
+/* a queued outgoing datagram */
+typedef struct fio_udp_packet_s fio_udp_packet_s;
+struct fio_udp_packet_s {
+  fio_udp_packet_s *next;
+  size_t len;
+  socklen_t addr_len;
+  struct sockaddr_storage addr;
+  char data[];
+};
+
+typedef struct {
+  fio_protocol_s pr;
+  void (*on_datagram)(intptr_t uuid, fio_str_info_s data,
+                      const struct sockaddr *from, socklen_t from_len,
+                      void *udata);
+  void (*on_finish)(intptr_t uuid, void *udata);
+  void *udata;
+  intptr_t uuid;
+  /* outgoing datagrams, protected by the lock */
+  fio_udp_packet_s *queue;
+  fio_udp_packet_s **queue_last;
+  size_t queue_count;
+  fio_lock_i lock;
+  /* set while a flush is scheduled (a task or a writable event) */
+  uint8_t flush_scheduled;
+  /* FIO_UDP_BATCH read buffers, FIO_UDP_BUFFER_SIZE + 1 bytes each */
+  char buffer[];
+} fio_udp_s;
+
+static void fio_udp_on_data(intptr_t uuid, fio_protocol_s *pr_) {
+  fio_udp_s *u = (fio_udp_s *)pr_;
+  int fd = fio_uuid2fd(uuid);
+  struct sockaddr_storage addr[FIO_UDP_BATCH];
+#if FIO_UDP_MMSG
+  struct mmsghdr msgs[FIO_UDP_BATCH];
+  struct iovec iov[FIO_UDP_BATCH];
+  for (int round = 0; round < 4; ++round) {
+    for (size_t i = 0; i < FIO_UDP_BATCH; ++i) {
+      iov[i] = (struct iovec){
+          .iov_base = u->buffer + (i * (FIO_UDP_BUFFER_SIZE + 1)),
+          .iov_len = FIO_UDP_BUFFER_SIZE,
+      };
+      msgs[i] = (struct mmsghdr){
+          .msg_hdr =
+              {
+                  .msg_name = addr + i,
+                  .msg_namelen = sizeof(addr[i]),
+                  .msg_iov = iov + i,
+                  .msg_iovlen = 1,
+              },
+      };
+    }
+    int count = recvmmsg(fd, msgs, FIO_UDP_BATCH, MSG_DONTWAIT, NULL);
+    if (count <= 0)
+      return;
+    for (int i = 0; i < count; ++i) {
+      if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+        FIO_LOG_DEBUG("(fio_udp) datagram too long (FIO_UDP_BUFFER_SIZE), "
+                      "dropped.");
+        continue;
+      }
+      char *data = iov[i].iov_base;
+      data[msgs[i].msg_len] = 0;
+      u->on_datagram(uuid,
+                     (fio_str_info_s){.data = data, .len = msgs[i].msg_len},
+                     (struct sockaddr *)(addr + i), msgs[i].msg_hdr.msg_namelen,
+                     u->udata);
+    }
+    if (count < FIO_UDP_BATCH)
+      return;
+  }
+#else
+  for (size_t i = 0; i < FIO_UDP_BATCH * 4; ++i) {
+    socklen_t addr_len = sizeof(addr[0]);
+    ssize_t len = recvfrom(fd, u->buffer, FIO_UDP_BUFFER_SIZE + 1, 0,
+                           (struct sockaddr *)addr, &addr_len);
+    if (len < 0)
+      return;
+    if (len > FIO_UDP_BUFFER_SIZE) {
+      FIO_LOG_DEBUG("(fio_udp) datagram too long (FIO_UDP_BUFFER_SIZE), "
+                    "dropped.");
+      continue;
+    }
+    u->buffer[len] = 0;
+    u->on_datagram(uuid, (fio_str_info_s){.data = u->buffer, .len = len},
+                   (struct sockaddr *)addr, addr_len, u->udata);
+  }
+#endif
+}
+
+/* pushes a list of unsent datagrams back to the head of the queue */
+static void fio_udp_requeue(fio_udp_s *u, fio_udp_packet_s *list,
+                            size_t count) {
+  fio_udp_packet_s **tail = &list;
+  while (*tail)
+    tail = &(*tail)->next;
+  fio_lock(&u->lock);
+  *tail = u->queue;
+  if (!u->queue)
+    u->queue_last = tail;
+  u->queue = list;
+  u->queue_count += count;
+  fio_unlock(&u->lock);
+}
+
+/* sends the queued datagrams (call within the protocol's write lock) */
+static void fio_udp_flush(fio_udp_s *u) {
+  int fd = fio_uuid2fd(u->uuid);
+  fio_lock(&u->lock);
+  fio_udp_packet_s *list = u->queue;
+  size_t count = u->queue_count;
+  u->queue = NULL;
+  u->queue_last = &u->queue;
+  u->queue_count = 0;
+  u->flush_scheduled = 0;
+  fio_unlock(&u->lock);
+  while (list) {
+    int sent = 0;
+#if FIO_UDP_MMSG
+    struct mmsghdr msgs[FIO_UDP_BATCH];
+    struct iovec iov[FIO_UDP_BATCH];
+    unsigned int batch = 0;
+    for (fio_udp_packet_s *p = list; p && batch < FIO_UDP_BATCH;
+         p = p->next, ++batch) {
+      iov[batch] = (struct iovec){.iov_base = p->data, .iov_len = p->len};
+      msgs[batch] = (struct mmsghdr){
+          .msg_hdr =
+              {
+                  .msg_name = p->addr_len ? &p->addr : NULL,
+                  .msg_namelen = p->addr_len,
+                  .msg_iov = iov + batch,
+                  .msg_iovlen = 1,
+              },
+      };
+    }
+    sent = sendmmsg(fd, msgs, batch, MSG_DONTWAIT);
+#else
+    sent = (sendto(fd, list->data, list->len, 0,
+                   list->addr_len ? (struct sockaddr *)&list->addr : NULL,
+                   list->addr_len) < 0)
+               ? -1
+               : 1;
+#endif
+    if (sent <= 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS ||
+          errno == EINTR) {
+        /* wait for the socket to become writable (see `on_ready`) */
+        fio_lock(&u->lock);
+        u->flush_scheduled = 1;
+        fio_unlock(&u->lock);
+        fio_udp_requeue(u, list, count);
+        fio_poll_add_write(fd);
+        return;
+      }
+      /* the datagram was rejected (i.e., ECONNREFUSED), drop it */
+      FIO_LOG_DEBUG("(fio_udp) datagram dropped: %s", strerror(errno));
+      sent = 1;
+    }
+    while (sent--) {
+      fio_udp_packet_s *tmp = list;
+      list = list->next;
+      --count;
+      fio_free(tmp);
+    }
+  }
+}
+
+static void fio_udp_on_ready(intptr_t uuid, fio_protocol_s *pr_) {
+  fio_udp_flush((fio_udp_s *)pr_);
+  (void)uuid;
+}
+
+/* a deferred (protocol locked) task that sends the queued datagrams */
+static void fio_udp_flush_task(intptr_t uuid, fio_protocol_s *pr_,
+                               void *ignr) {
+  fio_udp_flush((fio_udp_s *)pr_);
+  (void)uuid;
+  (void)ignr;
+}
+
+static void fio_udp_on_close(intptr_t uuid, fio_protocol_s *pr_) {
+  fio_udp_s *u = (fio_udp_s *)pr_;
+  if (u->on_finish)
+    u->on_finish(uuid, u->udata);
+  while (u->queue) {
+    fio_udp_packet_s *tmp = u->queue;
+    u->queue = tmp->next;
+    fio_free(tmp);
+  }
+  free(u);
+}
+
+/* closes a socket that was never attached (the reactor didn't start) */
+static void fio_udp_cleanup_task(void *u_) {
+  fio_udp_s *u = u_;
+  fio_force_close(u->uuid);
+  fio_udp_on_close(u->uuid, &u->pr);
+}
+
+static void fio_udp_on_startup(void *u_) {
+  fio_state_callback_remove(FIO_CALL_ON_SHUTDOWN, fio_udp_cleanup_task, u_);
+  fio_udp_s *u = u_;
+  fio_attach(u->uuid, &u->pr);
+}
+
+/* opens a UDP socket, attaching it once the reactor is running */
+static intptr_t fio_udp_open(struct fio_udp_args args, uint8_t server) {
+  if (!args.on_datagram || !args.port) {
+    errno = EINVAL;
+    goto error;
+  }
+  intptr_t uuid;
+  do {
+    errno = 0;
+    uuid = fio_tcp_socket(args.address, args.port, server, SOCK_DGRAM);
+  } while (uuid == -1 && errno == EINTR);
+  if (uuid == -1)
+    goto error;
+  fio_udp_s *u =
+      malloc(sizeof(*u) + (FIO_UDP_BATCH * (FIO_UDP_BUFFER_SIZE + 1)));
+  FIO_ASSERT_ALLOC(u);
+  *u = (fio_udp_s){
+      .pr =
+          {
+              .on_data = fio_udp_on_data,
+              .on_ready = fio_udp_on_ready,
+              .on_close = fio_udp_on_close,
+              .ping = mock_ping_eternal,
+          },
+      .on_datagram = args.on_datagram,
+      .on_finish = args.on_finish,
+      .udata = args.udata,
+      .uuid = uuid,
+      .lock = FIO_LOCK_INIT,
+  };
+  u->queue_last = &u->queue;
+  if (fio_is_running()) {
+    fio_attach(uuid, &u->pr);
+  } else {
+    fio_state_callback_add(FIO_CALL_ON_START, fio_udp_on_startup, u);
+    fio_state_callback_add(FIO_CALL_ON_SHUTDOWN, fio_udp_cleanup_task, u);
+  }
+  return uuid;
+error:
+  if (args.on_finish)
+    args.on_finish(-1, args.udata);
+  return -1;
+}
+
+/** Binds a UDP socket to the requested address and port. */
+intptr_t fio_udp_listen FIO_IGNORE_MACRO(struct fio_udp_args args) {
+  intptr_t uuid = fio_udp_open(args, 1);
+  if (uuid != -1)
+    FIO_LOG_INFO("Listening for UDP datagrams on port %s", args.port);
+  return uuid;
+}
+
+/** Opens a UDP socket connected to the requested address and port. */
+intptr_t fio_udp_connect FIO_IGNORE_MACRO(struct fio_udp_args args) {
+  if (!args.address) {
+    errno = EINVAL;
+    if (args.on_finish)
+      args.on_finish(-1, args.udata);
+    return -1;
+  }
+  return fio_udp_open(args, 0);
+}
+
+/** Queues a datagram to be sent (using a single system call per batch). */
+int fio_udp_send(intptr_t uuid, const void *data, size_t len,
+                 const struct sockaddr *to, socklen_t to_len) {
+  if ((!data && len) || len > 65507 ||
+      (to && to_len > sizeof(struct sockaddr_storage))) {
+    errno = EINVAL;
+    return -1;
+  }
+  fio_protocol_s *pr;
+  while (!(pr = fio_protocol_try_lock(uuid, FIO_PR_LOCK_STATE))) {
+    if (errno != EWOULDBLOCK)
+      return -1;
+    fio_reschedule_thread();
+  }
+  fio_udp_s *u = (fio_udp_s *)pr;
+  if (pr->on_data != fio_udp_on_data) {
+    fio_protocol_unlock(pr, FIO_PR_LOCK_STATE);
+    errno = EBADF;
+    return -1;
+  }
+  fio_udp_packet_s *p = fio_malloc(sizeof(*p) + len);
+  FIO_ASSERT_ALLOC(p);
+  p->next = NULL;
+  p->len = len;
+  p->addr_len = to ? to_len : 0;
+  if (to)
+    memcpy(&p->addr, to, to_len);
+  if (len)
+    memcpy(p->data, data, len);
+  uint8_t schedule = 0;
+  fio_lock(&u->lock);
+  if (u->queue_count >= FIO_UDP_QUEUE_LIMIT) {
+    fio_unlock(&u->lock);
+    fio_protocol_unlock(pr, FIO_PR_LOCK_STATE);
+    fio_free(p);
+    errno = ENOBUFS;
+    return -1;
+  }
+  *u->queue_last = p;
+  u->queue_last = &p->next;
+  ++u->queue_count;
+  if (!u->flush_scheduled) {
+    u->flush_scheduled = 1;
+    schedule = 1;
+  }
+  fio_unlock(&u->lock);
+  fio_protocol_unlock(pr, FIO_PR_LOCK_STATE);
+  if (schedule)
+    fio_defer_io_task(uuid, .type = FIO_PR_LOCK_WRITE,
+                      .task = fio_udp_flush_task);
+  return 0;
+}
+
 /* *****************************************************************************
 URL address parsing
 ***************************************************************************** */
@@ -5102,6 +7497,9 @@ typedef enum fio_cluster_message_type_e {
   FIO_CLUSTER_MSG_SHUTDOWN,
   FIO_CLUSTER_MSG_ERROR,
   FIO_CLUSTER_MSG_PING,
+  FIO_CLUSTER_MSG_LOAD,
+  FIO_CLUSTER_MSG_HELLO,
+  FIO_CLUSTER_MSG_MIGRATE,
 } fio_cluster_message_type_e;
 
 typedef struct fio_collection_s fio_collection_s;
@@ -5180,6 +7578,7 @@ static int fio_channel_cmp(channel_s *ch1, channel_s *ch2) {
 #define FIO_SET_OBJ_COMPARE(o1, o2) fio_channel_cmp((o1), (o2))
 #define FIO_SET_OBJ_DESTROY(obj) fio_channel_free((obj))
 #define FIO_SET_OBJ_COPY(dest, src) ((dest) = fio_channel_copy((src)))
+#define FIO_SET_GROUP_PROBING 1
 #include <fio.h>
 
 #define FIO_FORCE_MALLOC_TMP 1
@@ -5193,17 +7592,37 @@ static int fio_channel_cmp(channel_s *ch1, channel_s *ch2) {
 #define FIO_SET_OBJ_COMPARE(k1, k2) ((k1) == (k2))
 #include <fio.h>
 
+/* a read only copy of a channel collection, replaced (never edited) */
+typedef struct {
+  uintptr_t mask;
+  struct {
+    uintptr_t hash;
+    channel_s *ch;
+  } slots[];
+} fio_ch_snapshot_s;
+
 struct fio_collection_s {
   fio_ch_set_s channels;
-  fio_lock_i lock;
+  fio_park_lock_i lock;
+  /* lock free lookups (filters and named channels, not patterns) */
+  fio_ch_snapshot_s *volatile snapshot;
+  volatile uintptr_t epoch;
+  /* readers, counted by the parity of the epoch in which they started */
+  volatile uintptr_t readers[2];
 };
 
 #define COLLECTION_INIT                                                        \
-  { .channels = FIO_SET_INIT, .lock = FIO_LOCK_INIT }
+  { .channels = FIO_SET_INIT, .lock = FIO_PARK_LOCK_INIT }
+
+#if (FIO_PUBSUB_CHANNEL_SHARDS & (FIO_PUBSUB_CHANNEL_SHARDS - 1)) ||          \
+    FIO_PUBSUB_CHANNEL_SHARDS > 65536
+#error FIO_PUBSUB_CHANNEL_SHARDS must be a power of 2 (up to 65536)
+#endif
 
 static struct {
   fio_collection_s filters;
-  fio_collection_s pubsub;
+  /* named channels are spread across collections to minimize lock contention */
+  fio_collection_s pubsub[FIO_PUBSUB_CHANNEL_SHARDS];
   fio_collection_s patterns;
   struct {
     fio_engine_set_s set;
@@ -5215,12 +7634,88 @@ static struct {
   } meta;
 } fio_postoffice = {
     .filters = COLLECTION_INIT,
-    .pubsub = COLLECTION_INIT,
+    .pubsub = {COLLECTION_INIT},
     .patterns = COLLECTION_INIT,
     .engines.lock = FIO_LOCK_INIT,
     .meta.lock = FIO_LOCK_INIT,
 };
 
+/** Returns the named channel collection responsible for a hashed name. */
+static inline fio_collection_s *fio_postoffice_pubsub_shard(uint64_t hashed) {
+  return fio_postoffice.pubsub +
+         ((hashed >> 48) & (FIO_PUBSUB_CHANNEL_SHARDS - 1));
+}
+
+/* *****************************************************************************
+Lock free channel lookup (epoch based reclamation)
+
+Publishers never lock a collection. They look up channels in a read only
+snapshot of the collection, which writers (subscribe / unsubscribe) replace,
+within the collection's lock, whenever a channel is added or removed.
+
+Before the replaced snapshot is freed (and before a removed channel can lose
+its last reference), the writer flips the collection's epoch twice, each time
+waiting for the readers that started during the previous epoch to finish.
+***************************************************************************** */
+
+#if defined(__ATOMIC_SEQ_CST)
+#define fio_collection_load(p_obj) __atomic_load_n((p_obj), __ATOMIC_SEQ_CST)
+#else
+#define fio_collection_load(p_obj) (__sync_synchronize(), *(p_obj))
+#endif
+
+/** Enters a read section, returns the value `read_end` expects. */
+static inline uintptr_t fio_collection_read_begin(fio_collection_s *c) {
+  uintptr_t parity = c->epoch & 1;
+  fio_atomic_add(c->readers + parity, 1);
+  return parity;
+}
+
+/** Leaves a read section. */
+static inline void fio_collection_read_end(fio_collection_s *c,
+                                           uintptr_t parity) {
+  fio_atomic_sub(c->readers + parity, 1);
+}
+
+/** Waits until no reader can access memory retired before the call. */
+static void fio_collection_synchronize(fio_collection_s *c) {
+  for (size_t i = 0; i < 2; ++i) {
+    /* new readers count towards the new parity, wait for the old one */
+    uintptr_t parity = (fio_atomic_add(&c->epoch, 1) & 1) ^ 1;
+    while (fio_collection_load(c->readers + parity))
+      fio_reschedule_thread();
+  }
+}
+
+/** Replaces a collection's snapshot - call within the collection's lock. */
+static void fio_collection_snapshot_update(fio_collection_s *c) {
+  if (c == &fio_postoffice.patterns)
+    return; /* patterns are tested one by one, within the lock */
+  fio_ch_snapshot_s *s = NULL;
+  size_t count = fio_ch_set_count(&c->channels);
+  if (count) {
+    /* at least half the slots are empty, so probing always ends */
+    uintptr_t capa = 4;
+    while (capa < (count << 1))
+      capa <<= 1;
+    s = calloc(1, sizeof(*s) + (sizeof(s->slots[0]) * capa));
+    FIO_ASSERT_ALLOC(s);
+    s->mask = capa - 1;
+    FIO_SET_FOR_LOOP(&c->channels, pos) {
+      if (!pos->hash)
+        continue;
+      uintptr_t i = pos->hash & s->mask;
+      while (s->slots[i].ch)
+        i = (i + 1) & s->mask;
+      s->slots[i].hash = pos->hash;
+      s->slots[i].ch = pos->obj;
+    }
+  }
+  s = fio_atomic_xchange(&c->snapshot, s);
+  fio_collection_synchronize(c);
+  free(s);
+}
+
 /** used to contain the message before it's passed to the handler */
 typedef struct {
   fio_msg_s msg;
@@ -5376,11 +7871,14 @@ static void fio_pubsub_on_channel_destroy(channel_s *ch);
 static inline channel_s *fio_filter_dup_lock_internal(channel_s *ch,
                                                       uint64_t hashed,
                                                       fio_collection_s *c) {
-  fio_lock(&c->lock);
+  fio_park_lock(&c->lock);
+  size_t count = fio_ch_set_count(&c->channels);
   ch = fio_ch_set_insert(&c->channels, hashed, ch);
+  if (count != fio_ch_set_count(&c->channels))
+    fio_collection_snapshot_update(c);
   fio_channel_dup(ch);
   fio_lock(&ch->lock);
-  fio_unlock(&c->lock);
+  fio_park_unlock(&c->lock);
   return ch;
 }
 
@@ -5397,16 +7895,15 @@ static channel_s *fio_filter_dup_lock(uint32_t filter) {
 
 /** Creates / finds a pubsub channel, adds a reference count and locks it. */
 static channel_s *fio_channel_dup_lock(fio_str_info_s name) {
+  uint64_t hashed_name = FIO_HASH_FN(
+      name.data, name.len, &fio_postoffice.pubsub, &fio_postoffice.pubsub);
   channel_s ch = (channel_s){
       .name = name.data,
       .name_len = name.len,
-      .parent = &fio_postoffice.pubsub,
+      .parent = fio_postoffice_pubsub_shard(hashed_name),
       .ref = 8, /* avoid freeing stack memory */
   };
-  uint64_t hashed_name = FIO_HASH_FN(
-      name.data, name.len, &fio_postoffice.pubsub, &fio_postoffice.pubsub);
-  channel_s *ch_p =
-      fio_filter_dup_lock_internal(&ch, hashed_name, &fio_postoffice.pubsub);
+  channel_s *ch_p = fio_filter_dup_lock_internal(&ch, hashed_name, ch.parent);
   if (fio_ls_embd_is_empty(&ch_p->subscriptions)) {
     fio_pubsub_on_channel_create(ch_p);
   }
@@ -5442,7 +7939,7 @@ static inline void fio_subscription_free(subscription_s *s) {
     s->on_unsubscribe(s->udata1, s->udata2);
   }
   fio_channel_free(s->parent);
-  fio_free(s);
+  free(s);
 }
 
 /** SublimeText 3 marker */
@@ -5453,7 +7950,8 @@ subscription_s *fio_subscribe FIO_IGNORE_MACRO(subscribe_args_s args) {
   if (!args.on_message)
     goto error;
   channel_s *ch;
-  subscription_s *s = fio_malloc(sizeof(*s));
+  /* use `malloc`, long lived subscriptions would pin `fio_malloc` blocks */
+  subscription_s *s = malloc(sizeof(*s));
   FIO_ASSERT_ALLOC(s);
   *s = (subscription_s){
       .on_message = args.on_message,
@@ -5497,13 +7995,15 @@ void fio_unsubscribe(subscription_s *s) {
     uint64_t hashed = FIO_HASH_FN(
         ch->name, ch->name_len, &fio_postoffice.pubsub, &fio_postoffice.pubsub);
     /* lock collection */
-    fio_lock(&c->lock);
+    fio_park_lock(&c->lock);
     /* test again within lock */
     if (fio_ls_embd_is_empty(&ch->subscriptions)) {
       fio_ch_set_remove(&c->channels, hashed, ch, NULL);
+      /* the subscription's reference keeps `ch` valid for current readers */
+      fio_collection_snapshot_update(c);
       removed = (c != &fio_postoffice.filters);
     }
-    fio_unlock(&c->lock);
+    fio_park_unlock(&c->lock);
   }
   fio_unlock(&ch->lock);
   if (removed) {
@@ -5615,17 +8115,20 @@ int fio_pubsub_is_attached(fio_pubsub_engine_s *engine) {
  * exclusive subscription process.
  */
 void fio_pubsub_reattach(fio_pubsub_engine_s *eng) {
-  fio_lock(&fio_postoffice.pubsub.lock);
-  FIO_SET_FOR_LOOP(&fio_postoffice.pubsub.channels, pos) {
-    if (!pos->hash)
-      continue;
-    eng->subscribe(
-        eng,
-        (fio_str_info_s){.data = pos->obj->name, .len = pos->obj->name_len},
-        NULL);
+  for (size_t i = 0; i < FIO_PUBSUB_CHANNEL_SHARDS; ++i) {
+    fio_collection_s *c = fio_postoffice.pubsub + i;
+    fio_park_lock(&c->lock);
+    FIO_SET_FOR_LOOP(&c->channels, pos) {
+      if (!pos->hash)
+        continue;
+      eng->subscribe(
+          eng,
+          (fio_str_info_s){.data = pos->obj->name, .len = pos->obj->name_len},
+          NULL);
+    }
+    fio_park_unlock(&c->lock);
   }
-  fio_unlock(&fio_postoffice.pubsub.lock);
-  fio_lock(&fio_postoffice.patterns.lock);
+  fio_park_lock(&fio_postoffice.patterns.lock);
   FIO_SET_FOR_LOOP(&fio_postoffice.patterns.channels, pos) {
     if (!pos->hash)
       continue;
@@ -5634,7 +8137,7 @@ void fio_pubsub_reattach(fio_pubsub_engine_s *eng) {
         (fio_str_info_s){.data = pos->obj->name, .len = pos->obj->name_len},
         pos->obj->match);
   }
-  fio_unlock(&fio_postoffice.patterns.lock);
+  fio_park_unlock(&fio_postoffice.patterns.lock);
 }
 
 /* *****************************************************************************
@@ -5672,14 +8175,23 @@ void *fio_message_metadata(fio_msg_s *msg, intptr_t type_id) {
 static channel_s *fio_channel_find_dup_internal(channel_s *ch_tmp,
                                                 uint64_t hashed,
                                                 fio_collection_s *c) {
-  fio_lock(&c->lock);
-  channel_s *ch = fio_ch_set_find(&c->channels, hashed, ch_tmp);
-  if (!ch) {
-    fio_unlock(&c->lock);
-    return NULL;
+  channel_s *ch = NULL;
+  if (!hashed)
+    hashed = ~(uintptr_t)0; /* the set stores a zero hash as all bits set */
+  uintptr_t parity = fio_collection_read_begin(c);
+  fio_ch_snapshot_s *s = fio_collection_load(&c->snapshot);
+  if (s) {
+    for (uintptr_t i = hashed & s->mask; s->slots[i].ch;
+         i = (i + 1) & s->mask) {
+      if (s->slots[i].hash == (uintptr_t)hashed &&
+          fio_channel_cmp(s->slots[i].ch, ch_tmp)) {
+        ch = s->slots[i].ch;
+        fio_channel_dup(ch);
+        break;
+      }
+    }
   }
-  fio_channel_dup(ch);
-  fio_unlock(&c->lock);
+  fio_collection_read_end(c, parity);
   return ch;
 }
 
@@ -5696,8 +8208,8 @@ static channel_s *fio_channel_find_dup(fio_str_info_s name) {
   channel_s tmp = {.name = name.data, .name_len = name.len};
   uint64_t hashed_name = FIO_HASH_FN(
       name.data, name.len, &fio_postoffice.pubsub, &fio_postoffice.pubsub);
-  channel_s *ch =
-      fio_channel_find_dup_internal(&tmp, hashed_name, &fio_postoffice.pubsub);
+  channel_s *ch = fio_channel_find_dup_internal(
+      &tmp, hashed_name, fio_postoffice_pubsub_shard(hashed_name));
   return ch;
 }
 
@@ -5707,14 +8219,12 @@ void fio_message_defer(fio_msg_s *msg_) {
   cl->marker = 1;
 }
 
-/* performs the actual callback */
-static void fio_perform_subscription_callback(void *s_, void *msg_) {
-  subscription_s *s = s_;
+/* performs the actual callback, returns -1 if it should be performed later */
+static inline int fio_perform_subscription_callback_internal(
+    subscription_s *s, fio_msg_internal_s *msg) {
   if (fio_trylock(&s->lock)) {
-    fio_defer_push_task(fio_perform_subscription_callback, s_, msg_);
-    return;
+    return -1;
   }
-  fio_msg_internal_s *msg = (fio_msg_internal_s *)msg_;
   fio_msg_client_s m = {
       .msg =
           {
@@ -5733,24 +8243,78 @@ static void fio_perform_subscription_callback(void *s_, void *msg_) {
     s->on_message(&m.msg);
   }
   fio_unlock(&s->lock);
-  if (m.marker) {
-    fio_defer_push_task(fio_perform_subscription_callback, s_, msg_);
+  return (0 - (m.marker != 0));
+}
+
+/* performs the actual callback (a single subscription) */
+static void fio_perform_subscription_callback(void *s_, void *msg_) {
+  if (fio_perform_subscription_callback_internal(s_, msg_)) {
+    fio_defer_push_class(FIO_TASK_PUBSUB, fio_perform_subscription_callback,
+                         s_, msg_);
     return;
   }
-  fio_msg_internal_free(msg);
-  fio_subscription_free(s);
+  fio_msg_internal_free(msg_);
+  fio_subscription_free(s_);
+}
+
+/** a batch of subscriptions sharing a single message reference */
+typedef struct {
+  size_t count;
+  subscription_s *subscriptions[FIO_PUBSUB_BATCH_SIZE];
+} fio_subscription_batch_s;
+
+/* performs the callback for a batch of subscriptions */
+static void fio_perform_subscription_batch(void *batch_, void *msg_) {
+  fio_subscription_batch_s *batch = batch_;
+  for (size_t i = 0; i < batch->count; ++i) {
+    subscription_s *s = batch->subscriptions[i];
+    if (fio_perform_subscription_callback_internal(s, msg_)) {
+      /* busy or deferred - the subscription's reference moves to the task */
+      fio_defer_push_class(FIO_TASK_PUBSUB, fio_perform_subscription_callback,
+                           s, fio_msg_internal_dup(msg_));
+      continue;
+    }
+    fio_subscription_free(s);
+  }
+  fio_msg_internal_free(msg_);
+  fio_free(batch);
 }
 
 /** UNSAFE! publishes a message to a channel, managing the reference counts */
 static void fio_publish2channel(channel_s *ch, fio_msg_internal_s *msg) {
+  /* the first subscription is held back, avoiding a batch for a single one */
+  subscription_s *first = NULL;
+  fio_subscription_batch_s *batch = NULL;
   FIO_LS_EMBD_FOR(&ch->subscriptions, pos) {
     subscription_s *s = FIO_LS_EMBD_OBJ(subscription_s, node, pos);
     if (!s || s->on_message == fio_mock_on_message) {
       continue;
     }
     fio_atomic_add(&s->ref, 1);
-    fio_atomic_add(&msg->ref, 1);
-    fio_defer_push_task(fio_perform_subscription_callback, s, msg);
+    if (!batch) {
+      if (!first) {
+        first = s;
+        continue;
+      }
+      batch = fio_malloc(sizeof(*batch));
+      FIO_ASSERT_ALLOC(batch);
+      batch->subscriptions[0] = first;
+      batch->count = 1;
+      first = NULL;
+    }
+    batch->subscriptions[batch->count++] = s;
+    if (batch->count == FIO_PUBSUB_BATCH_SIZE) {
+      fio_defer_push_class(FIO_TASK_PUBSUB, fio_perform_subscription_batch,
+                           batch, fio_msg_internal_dup(msg));
+      batch = NULL;
+    }
+  }
+  if (batch) {
+    fio_defer_push_class(FIO_TASK_PUBSUB, fio_perform_subscription_batch,
+                         batch, fio_msg_internal_dup(msg));
+  } else if (first) {
+    fio_defer_push_class(FIO_TASK_PUBSUB, fio_perform_subscription_callback,
+                         first, fio_msg_internal_dup(msg));
   }
   fio_msg_internal_free(msg);
 }
@@ -5761,7 +8325,7 @@ static void fio_publish2channel_task(void *ch_, void *msg) {
   if (!msg)
     goto finish;
   if (fio_trylock(&ch->lock)) {
-    fio_defer_push_urgent(fio_publish2channel_task, ch, msg);
+    fio_defer_push_class(FIO_TASK_PUBSUB, fio_publish2channel_task, ch, msg);
     return;
   }
   fio_publish2channel(ch, msg);
@@ -5784,12 +8348,13 @@ static void fio_publish2process(fio_msg_internal_s *m) {
   }
   /* exact match */
   if (ch) {
-    fio_defer_push_urgent(fio_publish2channel_task, ch,
-                          fio_msg_internal_dup(m));
+    fio_defer_push_class(FIO_TASK_PUBSUB, fio_publish2channel_task, ch,
+                         fio_msg_internal_dup(m));
   }
-  if (m->filter == 0) {
+  /* an unlocked test, skipping the shared lock when there are no patterns */
+  if (m->filter == 0 && fio_ch_set_count(&fio_postoffice.patterns.channels)) {
     /* pattern matching match */
-    fio_lock(&fio_postoffice.patterns.lock);
+    fio_park_lock(&fio_postoffice.patterns.lock);
     FIO_SET_FOR_LOOP(&fio_postoffice.patterns.channels, p) {
       if (!p->hash) {
         continue;
@@ -5799,11 +8364,11 @@ static void fio_publish2process(fio_msg_internal_s *m) {
               (fio_str_info_s){.data = p->obj->name, .len = p->obj->name_len},
               m->channel)) {
         fio_channel_dup(p->obj);
-        fio_defer_push_urgent(fio_publish2channel_task, p->obj,
-                              fio_msg_internal_dup(m));
+        fio_defer_push_class(FIO_TASK_PUBSUB, fio_publish2channel_task, p->obj,
+                             fio_msg_internal_dup(m));
       }
     }
-    fio_unlock(&fio_postoffice.patterns.lock);
+    fio_park_unlock(&fio_postoffice.patterns.lock);
   }
 finish:
   fio_msg_internal_free(m);
@@ -5828,6 +8393,14 @@ finish:
 
 #define FIO_CLUSTER_NAME_LIMIT 255
 
+/* a file descriptor passed over the cluster socket (SCM_RIGHTS) */
+typedef struct fio_cluster_fd_s {
+  struct fio_cluster_fd_s *next;
+  /* the stream position of the message carrying the descriptor */
+  uint64_t pos;
+  int fd;
+} fio_cluster_fd_s;
+
 typedef struct cluster_pr_s {
   fio_protocol_s protocol;
   fio_msg_internal_s *msg;
@@ -5836,17 +8409,32 @@ typedef struct cluster_pr_s {
   fio_sub_hash_s pubsub;
   fio_sub_hash_s patterns;
   intptr_t uuid;
-  uint32_t exp_channel;
-  uint32_t exp_msg;
+  char *batch;
+  size_t batch_len;
+  /* descriptors received / waiting to be sent (guarded by `fd_lock`) */
+  fio_cluster_fd_s *fds_in;
+  fio_cluster_fd_s **fds_in_last;
+  fio_cluster_fd_s *fds_out;
+  fio_cluster_fd_s **fds_out_last;
+  /* bytes queued (guarded by `batch_lock`) and written (by the rw hook) */
+  uint64_t queued;
+  uint64_t written;
+  /* root: the worker's process id */
+  pid_t pid;
+  uint32_t expect;
   uint32_t type;
   int32_t filter;
   uint32_t length;
   fio_lock_i lock;
+  fio_lock_i batch_lock;
+  fio_lock_i fd_lock;
+  uint8_t batch_scheduled;
   uint8_t buffer[CLUSTER_READ_BUFFER];
 } cluster_pr_s;
 
 static struct cluster_data_s {
   intptr_t uuid;
+  cluster_pr_s *client;
   fio_ls_s clients;
   fio_lock_i lock;
   char name[FIO_CLUSTER_NAME_LIMIT + 1];
@@ -5861,12 +8449,13 @@ static void fio_cluster_data_cleanup(int delete_file) {
     unlink(cluster_data.name);
   }
   while (fio_ls_any(&cluster_data.clients)) {
-    intptr_t uuid = (intptr_t)fio_ls_pop(&cluster_data.clients);
-    if (uuid > 0) {
-      fio_close(uuid);
+    cluster_pr_s *pr = fio_ls_pop(&cluster_data.clients);
+    if (pr && pr->uuid > 0) {
+      fio_close(pr->uuid);
     }
   }
   cluster_data.uuid = 0;
+  cluster_data.client = NULL;
   cluster_data.lock = FIO_LOCK_INIT;
   cluster_data.clients = (fio_ls_s)FIO_LS_INIT(cluster_data.clients);
 }
@@ -5920,6 +8509,23 @@ static void fio_cluster_init(void) {
 
 static inline void fio_cluster_protocol_free(void *pr) { fio_free(pr); }
 
+static void fio_cluster_send(cluster_pr_s *pr, fio_msg_internal_s *m);
+
+/* removes the first descriptor from a descriptor queue (or returns NULL) */
+static fio_cluster_fd_s *fio_cluster_fd_shift(cluster_pr_s *pr,
+                                              fio_cluster_fd_s **head,
+                                              fio_cluster_fd_s ***last) {
+  fio_lock(&pr->fd_lock);
+  fio_cluster_fd_s *f = *head;
+  if (f) {
+    *head = f->next;
+    if (!*head)
+      *last = head;
+  }
+  fio_unlock(&pr->fd_lock);
+  return f;
+}
+
 static uint8_t fio_cluster_on_shutdown(intptr_t uuid, fio_protocol_s *pr_) {
   cluster_pr_s *p = (cluster_pr_s *)pr_;
   p->sender(fio_msg_internal_create(0, FIO_CLUSTER_MSG_SHUTDOWN,
@@ -5931,98 +8537,91 @@ static uint8_t fio_cluster_on_shutdown(intptr_t uuid, fio_protocol_s *pr_) {
   (void)uuid;
 }
 
+/* the position of the next expected payload byte (channel and data) */
+static inline char *fio_cluster_payload_pos(cluster_pr_s *c) {
+  return c->msg->channel.data +
+         (c->msg->channel.len + c->msg->data.len + 2 - c->expect);
+}
+
+/* handles a complete message */
+static inline void fio_cluster_on_message(cluster_pr_s *c) {
+  fio_postoffice_meta_update(c->msg);
+  c->handler(c);
+  fio_msg_internal_free(c->msg);
+  c->msg = NULL;
+}
+
 static void fio_cluster_on_data(intptr_t uuid, fio_protocol_s *pr_) {
   cluster_pr_s *c = (cluster_pr_s *)pr_;
-  ssize_t i =
-      fio_read(uuid, c->buffer + c->length, CLUSTER_READ_BUFFER - c->length);
+  ssize_t i;
+  if (c->expect >= CLUSTER_READ_BUFFER) {
+    /* large payloads are read directly into the message (no buffer copy) */
+    i = fio_read(uuid, fio_cluster_payload_pos(c), c->expect);
+    if (i <= 0)
+      return;
+    c->expect -= i;
+    if (c->expect)
+      return;
+    fio_cluster_on_message(c);
+  }
+  i = fio_read(uuid, c->buffer + c->length, CLUSTER_READ_BUFFER - c->length);
   if (i <= 0)
     return;
   c->length += i;
   i = 0;
   do {
-    if (!c->exp_channel && !c->exp_msg) {
+    if (!c->msg) {
       if (c->length - i < 16)
         break;
-      c->exp_channel = fio_str2u32(c->buffer + i) + 1;
-      c->exp_msg = fio_str2u32(c->buffer + i + 4) + 1;
+      uint32_t ch_len = fio_str2u32(c->buffer + i);
+      uint32_t msg_len = fio_str2u32(c->buffer + i + 4);
       c->type = fio_str2u32(c->buffer + i + 8);
       c->filter = (int32_t)fio_str2u32(c->buffer + i + 12);
-      if (c->exp_channel) {
-        if (c->exp_channel >= (1024 * 1024 * 16) + 1) {
-          FIO_LOG_FATAL("(%d) cluster message name too long (16Mb limit): %u\n",
-                        (int)getpid(), (unsigned int)c->exp_channel);
-          exit(1);
-          return;
-        }
+      if (ch_len >= (1024 * 1024 * 16)) {
+        FIO_LOG_FATAL("(%d) cluster message name too long (16Mb limit): %u\n",
+                      (int)getpid(), (unsigned int)ch_len + 1);
+        exit(1);
+        return;
       }
-      if (c->exp_msg) {
-        if (c->exp_msg >= (1024 * 1024 * 64) + 1) {
-          FIO_LOG_FATAL("(%d) cluster message data too long (64Mb limit): %u\n",
-                        (int)getpid(), (unsigned int)c->exp_msg);
-          exit(1);
-          return;
-        }
+      if (msg_len >= (1024 * 1024 * 64)) {
+        FIO_LOG_FATAL("(%d) cluster message data too long (64Mb limit): %u\n",
+                      (int)getpid(), (unsigned int)msg_len + 1);
+        exit(1);
+        return;
       }
       c->msg = fio_msg_internal_create(
-          c->filter, c->type,
-          (fio_str_info_s){.data = (char *)(c->msg + 1),
-                           .len = c->exp_channel - 1},
-          (fio_str_info_s){.data = ((char *)(c->msg + 1) + c->exp_channel + 1),
-                           .len = c->exp_msg - 1},
+          c->filter, c->type, (fio_str_info_s){.len = ch_len},
+          (fio_str_info_s){.len = msg_len},
           (int8_t)(c->type == FIO_CLUSTER_MSG_JSON ||
                    c->type == FIO_CLUSTER_MSG_ROOT_JSON),
           0);
+      c->expect = ch_len + msg_len + 2;
       i += 16;
     }
-    if (c->exp_channel) {
-      if (c->exp_channel + i > c->length) {
-        memcpy(c->msg->channel.data +
-                   ((c->msg->channel.len + 1) - c->exp_channel),
-               (char *)c->buffer + i, (size_t)(c->length - i));
-        c->exp_channel -= (c->length - i);
-        i = c->length;
-        break;
-      } else {
-        memcpy(c->msg->channel.data +
-                   ((c->msg->channel.len + 1) - c->exp_channel),
-               (char *)c->buffer + i, (size_t)(c->exp_channel));
-        i += c->exp_channel;
-        c->exp_channel = 0;
-      }
-    }
-    if (c->exp_msg) {
-      if (c->exp_msg + i > c->length) {
-        memcpy(c->msg->data.data + ((c->msg->data.len + 1) - c->exp_msg),
-               (char *)c->buffer + i, (size_t)(c->length - i));
-        c->exp_msg -= (c->length - i);
-        i = c->length;
-        break;
-      } else {
-        memcpy(c->msg->data.data + ((c->msg->data.len + 1) - c->exp_msg),
-               (char *)c->buffer + i, (size_t)(c->exp_msg));
-        i += c->exp_msg;
-        c->exp_msg = 0;
-      }
-    }
-    fio_postoffice_meta_update(c->msg);
-    c->handler(c);
-    fio_msg_internal_free(c->msg);
-    c->msg = NULL;
+    /* the channel and data are laid out in memory as they are on the wire */
+    size_t avail = c->length - i;
+    if (avail > c->expect)
+      avail = c->expect;
+    memcpy(fio_cluster_payload_pos(c), c->buffer + i, avail);
+    i += avail;
+    c->expect -= avail;
+    if (c->expect)
+      break;
+    fio_cluster_on_message(c);
   } while (c->length > i);
   c->length -= i;
   if (c->length && i) {
     memmove(c->buffer, c->buffer + i, c->length);
   }
-  (void)pr_;
 }
 
 static void fio_cluster_ping(intptr_t uuid, fio_protocol_s *pr_) {
   fio_msg_internal_s *m = fio_msg_internal_create(
       0, FIO_CLUSTER_MSG_PING, (fio_str_info_s){.len = 0},
       (fio_str_info_s){.len = 0}, 0, 1);
-  fio_msg_internal_send_dup(uuid, m);
+  fio_cluster_send((cluster_pr_s *)pr_, m);
   fio_msg_internal_free(m);
-  (void)pr_;
+  (void)uuid;
 }
 
 static void fio_cluster_on_close(intptr_t uuid, fio_protocol_s *pr_) {
@@ -6031,15 +8630,20 @@ static void fio_cluster_on_close(intptr_t uuid, fio_protocol_s *pr_) {
     /* a child was lost, respawning is handled elsewhere. */
     fio_lock(&cluster_data.lock);
     FIO_LS_FOR(&cluster_data.clients, pos) {
-      if (pos->obj == (void *)uuid) {
+      if (pos->obj == (void *)c) {
         fio_ls_remove(pos);
         break;
       }
     }
     fio_unlock(&cluster_data.lock);
-  } else if (fio_data->active) {
+  } else {
+    fio_lock(&cluster_data.lock);
+    if (cluster_data.client == c)
+      cluster_data.client = NULL;
+    fio_unlock(&cluster_data.lock);
     /* no shutdown message received - parent crashed. */
-    if (c->type != FIO_CLUSTER_MSG_SHUTDOWN && fio_is_running()) {
+    if (fio_data->active && c->type != FIO_CLUSTER_MSG_SHUTDOWN &&
+        fio_is_running()) {
       FIO_LOG_FATAL("(%d) Parent Process crash detected!", (int)getpid());
       fio_state_callback_force(FIO_CALL_ON_PARENT_CRUSH);
       fio_state_callback_clear(FIO_CALL_ON_PARENT_CRUSH);
@@ -6050,7 +8654,17 @@ static void fio_cluster_on_close(intptr_t uuid, fio_protocol_s *pr_) {
   if (c->msg)
     fio_msg_internal_free(c->msg);
   c->msg = NULL;
+  fio_free(c->batch);
+  c->batch = NULL;
+  /* close any descriptors that weren't delivered */
+  fio_cluster_fd_s *f;
+  while ((f = fio_cluster_fd_shift(c, &c->fds_in, &c->fds_in_last)) ||
+         (f = fio_cluster_fd_shift(c, &c->fds_out, &c->fds_out_last))) {
+    close(f->fd);
+    fio_free(f);
+  }
   fio_sub_hash_free(&c->pubsub);
+  fio_sub_hash_free(&c->patterns);
   fio_cluster_protocol_free(c);
   (void)uuid;
 }
@@ -6076,22 +8690,462 @@ fio_cluster_protocol_alloc(intptr_t uuid,
   p->pubsub = (fio_sub_hash_s)FIO_SET_INIT;
   p->patterns = (fio_sub_hash_s)FIO_SET_INIT;
   p->lock = FIO_LOCK_INIT;
+  p->batch_lock = FIO_LOCK_INIT;
+  p->fd_lock = FIO_LOCK_INIT;
+  p->fds_in_last = &p->fds_in;
+  p->fds_out_last = &p->fds_out;
   return &p->protocol;
 }
 
+/* *****************************************************************************
+ * Message batching
+ **************************************************************************** */
+
+/* writes the pending batch, call within the batch lock */
+static inline void fio_cluster_batch_write_unsafe(cluster_pr_s *pr) {
+  if (!pr->batch)
+    return;
+  fio_write2(pr->uuid, .data.buffer = pr->batch, .length = pr->batch_len,
+             .after.dealloc = fio_free);
+  pr->queued += pr->batch_len;
+  pr->batch = NULL;
+  pr->batch_len = 0;
+}
+
+/* a deferred (protocol locked) task that writes the pending batch */
+static void fio_cluster_batch_flush(intptr_t uuid, fio_protocol_s *pr_,
+                                    void *ignr) {
+  cluster_pr_s *pr = (cluster_pr_s *)pr_;
+  fio_lock(&pr->batch_lock);
+  pr->batch_scheduled = 0;
+  fio_cluster_batch_write_unsafe(pr);
+  fio_unlock(&pr->batch_lock);
+  (void)uuid;
+  (void)ignr;
+}
+
+/*
+ * Sends a message, small messages are copied to a batch that's written once
+ * it's full or once the task queue reaches the deferred flush task, so
+ * messages sent within the same cycle are written using a single packet.
+ *
+ * Large messages and shutdown notifications are written without a copy, after
+ * the pending batch (preserving the message order).
+ */
+static void fio_cluster_send(cluster_pr_s *pr, fio_msg_internal_s *m) {
+  size_t len = 16 + m->channel.len + m->data.len + 2;
+  char *wire = (char *)(m->meta + m->meta_len);
+  fio_lock(&pr->batch_lock);
+  if (len >= FIO_CLUSTER_BATCH_SIZE ||
+      fio_str2u32(wire + 8) == FIO_CLUSTER_MSG_SHUTDOWN) {
+    fio_cluster_batch_write_unsafe(pr);
+    fio_msg_internal_send_dup(pr->uuid, m);
+    pr->queued += len;
+    goto finish;
+  }
+  if (pr->batch_len + len > FIO_CLUSTER_BATCH_SIZE)
+    fio_cluster_batch_write_unsafe(pr);
+  if (!pr->batch) {
+    pr->batch = fio_malloc(FIO_CLUSTER_BATCH_SIZE);
+    FIO_ASSERT_ALLOC(pr->batch);
+  }
+  memcpy(pr->batch + pr->batch_len, wire, len);
+  pr->batch_len += len;
+  if (!pr->batch_scheduled) {
+    pr->batch_scheduled = 1;
+    fio_defer_io_task(pr->uuid, .type = FIO_PR_LOCK_WRITE,
+                      .task = fio_cluster_batch_flush);
+  }
+finish:
+  fio_unlock(&pr->batch_lock);
+}
+
+/* *****************************************************************************
+ * Passing connections between workers (SCM_RIGHTS)
+ **************************************************************************** */
+
+/*
+ * Cluster sockets read and write using `recvmsg` / `sendmsg`, so file
+ * descriptors can travel along with the messages.
+ *
+ * A descriptor is sent with the first byte of its message. The write hook
+ * tracks the stream position and stops short of a message that carries a
+ * descriptor, so the descriptor is always attached to the right write. The
+ * read hook queues received descriptors, which are collected (in order) by the
+ * message handlers.
+ */
+
+/* the number of descriptors a single read can collect */
+#define FIO_CLUSTER_FDS_PER_READ 8
+
+static ssize_t fio_cluster_hook_read(intptr_t uuid, void *udata, void *buf,
+                                     size_t count) {
+  cluster_pr_s *pr = udata;
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int) * FIO_CLUSTER_FDS_PER_READ)];
+  } ctrl;
+  struct iovec iov = {.iov_base = buf, .iov_len = count};
+  struct msghdr msg = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1,
+      .msg_control = ctrl.buf,
+      .msg_controllen = sizeof(ctrl.buf),
+  };
+  int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+  flags = MSG_CMSG_CLOEXEC;
+#endif
+  ssize_t ret = recvmsg(fio_uuid2fd(uuid), &msg, flags);
+  if (ret <= 0)
+    return ret;
+  if ((msg.msg_flags & MSG_CTRUNC)) {
+    FIO_LOG_ERROR("(%d) cluster socket control data truncated, "
+                  "connections might have been lost.",
+                  (int)getpid());
+  }
+  for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+    if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+      continue;
+    size_t n = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < n; ++i) {
+      fio_cluster_fd_s *f = fio_malloc(sizeof(*f));
+      FIO_ASSERT_ALLOC(f);
+      *f = (fio_cluster_fd_s){.fd = -1};
+      memcpy(&f->fd, CMSG_DATA(c) + (i * sizeof(int)), sizeof(int));
+      fio_lock(&pr->fd_lock);
+      *pr->fds_in_last = f;
+      pr->fds_in_last = &f->next;
+      fio_unlock(&pr->fd_lock);
+    }
+  }
+  return ret;
+}
+
+static ssize_t fio_cluster_hook_write(intptr_t uuid, void *udata,
+                                      const void *buf, size_t count) {
+  cluster_pr_s *pr = udata;
+  ssize_t ret;
+  int fd = -1;
+  fio_lock(&pr->fd_lock);
+  if (pr->fds_out && pr->fds_out->pos < pr->written + count) {
+    if (pr->fds_out->pos > pr->written)
+      count = (size_t)(pr->fds_out->pos - pr->written); /* up to the message */
+    else
+      fd = pr->fds_out->fd;
+  }
+  fio_unlock(&pr->fd_lock);
+  if (fd == -1) {
+    ret = write(fio_uuid2fd(uuid), buf, count);
+  } else {
+    union {
+      struct cmsghdr align;
+      char buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+    memset(&ctrl, 0, sizeof(ctrl));
+    struct iovec iov = {.iov_base = (void *)buf, .iov_len = count};
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = ctrl.buf,
+        .msg_controllen = sizeof(ctrl.buf),
+    };
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(c), &fd, sizeof(int));
+    ret = sendmsg(fio_uuid2fd(uuid), &msg, 0);
+    if (ret > 0) {
+      /* the kernel holds a reference until the descriptor is received */
+      fio_cluster_fd_s *f =
+          fio_cluster_fd_shift(pr, &pr->fds_out, &pr->fds_out_last);
+      close(f->fd);
+      fio_free(f);
+    }
+  }
+  if (ret > 0)
+    pr->written += ret;
+  return ret;
+}
+
+static fio_rw_hook_s FIO_CLUSTER_RW_HOOKS = {
+    .read = fio_cluster_hook_read,
+    .write = fio_cluster_hook_write,
+    .flush = fio_hooks_default_flush,
+    .before_close = fio_hooks_default_before_close,
+    .cleanup = fio_hooks_default_cleanup,
+};
+
+/* Sends a message with a file descriptor (closed once it was sent). */
+static void fio_cluster_send_fd(cluster_pr_s *pr, fio_msg_internal_s *m,
+                                int fd) {
+  fio_cluster_fd_s *f = fio_malloc(sizeof(*f));
+  FIO_ASSERT_ALLOC(f);
+  fio_lock(&pr->batch_lock);
+  fio_cluster_batch_write_unsafe(pr);
+  *f = (fio_cluster_fd_s){.pos = pr->queued, .fd = fd};
+  fio_lock(&pr->fd_lock);
+  *pr->fds_out_last = f;
+  pr->fds_out_last = &f->next;
+  fio_unlock(&pr->fd_lock);
+  fio_msg_internal_send_dup(pr->uuid, m);
+  pr->queued += 16 + m->channel.len + m->data.len + 2;
+  fio_unlock(&pr->batch_lock);
+}
+
+/* collects the descriptor sent with the current message (or returns -1) */
+static int fio_cluster_fd_collect(cluster_pr_s *pr) {
+  fio_cluster_fd_s *f =
+      fio_cluster_fd_shift(pr, &pr->fds_in, &pr->fds_in_last);
+  if (!f) {
+    FIO_LOG_ERROR("(%d) connection migration message without a descriptor.",
+                  (int)getpid());
+    return -1;
+  }
+  int fd = f->fd;
+  fio_free(f);
+  return fd;
+}
+
+/* root: forwards a migrated connection to the requested worker */
+static void fio_cluster_migrate_forward(cluster_pr_s *pr) {
+  int fd = fio_cluster_fd_collect(pr);
+  if (fd == -1)
+    return;
+  fio_lock(&cluster_data.lock);
+  FIO_LS_FOR(&cluster_data.clients, pos) {
+    cluster_pr_s *w = (cluster_pr_s *)pos->obj;
+    if (w->pid != (pid_t)pr->filter || w->uuid == -1)
+      continue;
+    fio_cluster_send_fd(w, pr->msg, fd);
+    fd = -1;
+    break;
+  }
+  fio_unlock(&cluster_data.lock);
+  if (fd != -1) {
+    FIO_LOG_WARNING("(%d) connection migration failed, no worker %d.",
+                    (int)getpid(), (int)pr->filter);
+    close(fd);
+  }
+}
+
+/* unread data, returned by `fio_read` before reading from the socket */
+typedef struct {
+  size_t pos;
+  size_t len;
+  char data[];
+} fio_migrate_unread_s;
+
+static ssize_t fio_migrate_hook_read(intptr_t uuid, void *udata, void *buf,
+                                     size_t count) {
+  fio_migrate_unread_s *u = udata;
+  if (count > u->len - u->pos)
+    count = u->len - u->pos;
+  memcpy(buf, u->data + u->pos, count);
+  u->pos += count;
+  if (u->pos == u->len) {
+    /* continue reading from the socket */
+    fio_rw_hook_replace_unsafe(uuid, (fio_rw_hook_s *)&FIO_DEFAULT_RW_HOOKS,
+                               NULL);
+    fio_free(u);
+  }
+  return (ssize_t)count;
+}
+
+static void fio_migrate_hook_cleanup(void *udata) { fio_free(udata); }
+
+static fio_rw_hook_s FIO_MIGRATE_RW_HOOKS = {
+    .read = fio_migrate_hook_read,
+    .write = fio_hooks_default_write,
+    .flush = fio_hooks_default_flush,
+    .before_close = fio_hooks_default_before_close,
+    .cleanup = fio_migrate_hook_cleanup,
+};
+
+static void (*fio_migrate_arrival)(intptr_t uuid, fio_str_info_s state);
+
+/* worker: attaches a migrated connection and calls the arrival callback */
+static void fio_cluster_migrate_arrive(cluster_pr_s *pr) {
+  int fd = fio_cluster_fd_collect(pr);
+  if (fd == -1)
+    return;
+  intptr_t uuid = fio_fd2uuid(fd);
+  if (!fio_migrate_arrival || uuid == -1) {
+    FIO_LOG_WARNING("(%d) migrated connection dropped (%s).", (int)getpid(),
+                    (uuid == -1 ? "too many open files"
+                                : "no fio_migrate_on_arrival callback"));
+    close(fd);
+    return;
+  }
+  {
+    /* the peer address isn't part of the migration */
+    struct sockaddr_in6 addr[2];
+    socklen_t len = sizeof(addr);
+    if (!getpeername(fd, (struct sockaddr *)addr, &len) &&
+        (((struct sockaddr *)addr)->sa_family == AF_INET ||
+         ((struct sockaddr *)addr)->sa_family == AF_INET6))
+      fio_tcp_addr_cpy(fd, ((struct sockaddr *)addr)->sa_family,
+                       (struct sockaddr *)addr);
+  }
+  if (pr->msg->channel.len) {
+    fio_migrate_unread_s *u =
+        fio_malloc(sizeof(*u) + pr->msg->channel.len);
+    FIO_ASSERT_ALLOC(u);
+    u->pos = 0;
+    u->len = pr->msg->channel.len;
+    memcpy(u->data, pr->msg->channel.data, u->len);
+    fio_rw_hook_set(uuid, &FIO_MIGRATE_RW_HOOKS, u);
+  }
+  fio_migrate_arrival(uuid, pr->msg->data);
+  if (pr->msg->channel.len)
+    fio_force_event(uuid, FIO_EVENT_ON_DATA);
+}
+
+/* Sets the callback for connections migrated to this worker. */
+void fio_migrate_on_arrival(void (*on_arrival)(intptr_t uuid,
+                                               fio_str_info_s state)) {
+  fio_migrate_arrival = on_arrival;
+}
+
+static void fio_migrate_fallback(intptr_t uuid, void *m) {
+  fio_msg_internal_free(m);
+  (void)uuid;
+}
+
+/* worker: sends the connection to the root (once the output was sent) */
+static void fio_migrate_task(intptr_t uuid, fio_protocol_s *pr, void *m_) {
+  fio_msg_internal_s *m = m_;
+  ssize_t pending = fio_flush(uuid);
+  if (pending > 0) {
+    /* wait for the pending output */
+    fio_defer_io_task(uuid, .task = fio_migrate_task, .udata = m,
+                      .fallback = fio_migrate_fallback);
+    return;
+  }
+  if (pending < 0 && fio_is_closed(uuid)) {
+    fio_msg_internal_free(m);
+    return;
+  }
+  /* a registration belongs to the open file, so the duplicate would keep it */
+  fio_poll_remove_fd(fio_uuid2fd(uuid));
+  int fd = dup(fio_uuid2fd(uuid));
+  if (fd == -1) {
+    FIO_LOG_ERROR("(%d) connection migration failed (dup): %s", (int)getpid(),
+                  strerror(errno));
+    fio_msg_internal_free(m);
+    fio_close(uuid);
+    return;
+  }
+  fio_lock(&cluster_data.lock);
+  if (cluster_data.client) {
+    fio_cluster_send_fd(cluster_data.client, m, fd);
+    fd = -1;
+  }
+  fio_unlock(&cluster_data.lock);
+  if (fd != -1) {
+    FIO_LOG_WARNING("(%d) connection migration failed, cluster disconnected.",
+                    (int)getpid());
+    close(fd);
+  }
+  fio_msg_internal_free(m);
+  /* the descriptor is still open (sent or duplicated), so this sends no FIN */
+  fio_force_close(uuid);
+  (void)pr;
+}
+
+/**
+ * Migrates a connection to another worker process.
+ */
+int fio_migrate(intptr_t uuid, pid_t worker, fio_str_info_s unread,
+                fio_str_info_s state) {
+  if (!fio_data->is_worker || fio_single_process() ||
+      !cluster_data.client) {
+    errno = ENOTCONN;
+    return -1;
+  }
+  if (worker <= 0 || worker == getpid()) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (unread.len >= (1024 * 1024 * 16) || state.len >= (1024 * 1024 * 64)) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  if (fio_is_closed(uuid)) {
+    errno = EBADF;
+    return -1;
+  }
+  if (uuid_data(uuid).rw_hooks != &FIO_DEFAULT_RW_HOOKS) {
+    /* the state of a read/write hook (i.e., TLS) can't be migrated */
+    errno = ENOTSUP;
+    return -1;
+  }
+  /* no more `on_data` events, unread data isn't read from the socket */
+  uuid_data(uuid).migrating = 1;
+  fio_suspend(uuid);
+  fio_poll_remove_read(fio_uuid2fd(uuid));
+  fio_defer_io_task(uuid, .task = fio_migrate_task,
+                    .udata = fio_msg_internal_create(
+                        (int32_t)worker, FIO_CLUSTER_MSG_MIGRATE, unread,
+                        state, 0, 1),
+                    .fallback = fio_migrate_fallback);
+  return 0;
+}
+
 /* *****************************************************************************
  * Master (server) IPC Connections
  **************************************************************************** */
 
+/* tests if a worker subscribed to the message's channel (or a pattern) */
+static int fio_cluster_is_subscribed(cluster_pr_s *pr, fio_msg_internal_s *m,
+                                     uint64_t hash) {
+  int ret = 0;
+  fio_str_s tmp = FIO_STR_INIT_EXISTING(m->channel.data, m->channel.len,
+                                        0); // don't free
+  fio_lock(&pr->lock);
+  if (fio_sub_hash_find(&pr->pubsub, hash, tmp)) {
+    ret = 1;
+    goto finish;
+  }
+  FIO_SET_FOR_LOOP(&pr->patterns, pos) {
+    if (!pos->hash || !pos->obj.obj)
+      continue;
+    channel_s *ch = pos->obj.obj->parent;
+    if (ch->match &&
+        ch->match((fio_str_info_s){.data = ch->name, .len = ch->name_len},
+                  m->channel)) {
+      ret = 1;
+      goto finish;
+    }
+  }
+finish:
+  fio_unlock(&pr->lock);
+  return ret;
+}
+
+/*
+ * Pub/Sub messages are routed only to workers that subscribed to the channel
+ * (or to a matching pattern), as reported by the PUBSUB_SUB / PATTERN_SUB
+ * messages. Filtered messages and control messages are sent to all workers.
+ */
 static void fio_cluster_server_sender(void *m_, intptr_t avoid_uuid) {
   fio_msg_internal_s *m = m_;
+  uint32_t type = fio_str2u32((char *)(m->meta + m->meta_len) + 8);
+  uint8_t route = !m->filter && (type == FIO_CLUSTER_MSG_FORWARD ||
+                                 type == FIO_CLUSTER_MSG_JSON);
+  uint64_t hash = 0;
+  if (route)
+    hash = FIO_HASH_FN(m->channel.data, m->channel.len, &fio_postoffice.pubsub,
+                       &fio_postoffice.pubsub);
   fio_lock(&cluster_data.lock);
   FIO_LS_FOR(&cluster_data.clients, pos) {
-    if ((intptr_t)pos->obj != -1) {
-      if ((intptr_t)pos->obj != avoid_uuid) {
-        fio_msg_internal_send_dup((intptr_t)pos->obj, m);
-      }
-    }
+    cluster_pr_s *pr = (cluster_pr_s *)pos->obj;
+    if (pr->uuid == -1 || pr->uuid == avoid_uuid)
+      continue;
+    if (route && !fio_cluster_is_subscribed(pr, m, hash))
+      continue;
+    fio_cluster_send(pr, m);
   }
   fio_unlock(&cluster_data.lock);
   fio_msg_internal_free(m);
@@ -6173,6 +9227,20 @@ static void fio_cluster_server_handler(struct cluster_pr_s *pr) {
     fio_publish2process(fio_msg_internal_dup(pr->msg));
     break;
 
+  case FIO_CLUSTER_MSG_LOAD:
+    if (pr->msg->data.len == 8)
+      fio_autoscale_on_report(fio_str2u32(pr->msg->data.data),
+                              fio_str2u32(pr->msg->data.data + 4));
+    break;
+
+  case FIO_CLUSTER_MSG_HELLO:
+    pr->pid = (pid_t)pr->filter;
+    break;
+
+  case FIO_CLUSTER_MSG_MIGRATE:
+    fio_cluster_migrate_forward(pr);
+    break;
+
   case FIO_CLUSTER_MSG_SHUTDOWN: /* fallthrough */
   case FIO_CLUSTER_MSG_ERROR:    /* fallthrough */
   case FIO_CLUSTER_MSG_PING:     /* fallthrough */
@@ -6187,12 +9255,13 @@ static void fio_cluster_listen_accept(intptr_t uuid, fio_protocol_s *protocol) {
   /* prevent `accept` backlog in parent */
   intptr_t client;
   while ((client = fio_accept(uuid)) != -1) {
-    fio_attach(client,
-               fio_cluster_protocol_alloc(client, fio_cluster_server_handler,
-                                          fio_cluster_server_sender));
+    fio_protocol_s *pr = fio_cluster_protocol_alloc(
+        client, fio_cluster_server_handler, fio_cluster_server_sender);
+    fio_rw_hook_set(client, &FIO_CLUSTER_RW_HOOKS, pr);
     fio_lock(&cluster_data.lock);
-    fio_ls_push(&cluster_data.clients, (void *)client);
+    fio_ls_push(&cluster_data.clients, pr);
     fio_unlock(&cluster_data.lock);
+    fio_attach(client, pr);
   }
 }
 
@@ -6247,6 +9316,9 @@ static void fio_cluster_client_handler(struct cluster_pr_s *pr) {
   case FIO_CLUSTER_MSG_JSON:
     fio_publish2process(fio_msg_internal_dup(pr->msg));
     break;
+  case FIO_CLUSTER_MSG_MIGRATE:
+    fio_cluster_migrate_arrive(pr);
+    break;
   case FIO_CLUSTER_MSG_SHUTDOWN:
     fio_stop();
   case FIO_CLUSTER_MSG_ERROR:         /* fallthrough */
@@ -6257,6 +9329,8 @@ static void fio_cluster_client_handler(struct cluster_pr_s *pr) {
   case FIO_CLUSTER_MSG_PUBSUB_UNSUB:  /* fallthrough */
   case FIO_CLUSTER_MSG_PATTERN_SUB:   /* fallthrough */
   case FIO_CLUSTER_MSG_PATTERN_UNSUB: /* fallthrough */
+  case FIO_CLUSTER_MSG_LOAD:          /* fallthrough */
+  case FIO_CLUSTER_MSG_HELLO:         /* fallthrough */
 
   default:
     break;
@@ -6270,7 +9344,12 @@ static void fio_cluster_client_sender(void *m_, intptr_t ignr_) {
                         (void *)ignr_);
     return;
   }
-  fio_msg_internal_send_dup(cluster_data.uuid, m);
+  fio_lock(&cluster_data.lock);
+  if (cluster_data.client)
+    fio_cluster_send(cluster_data.client, m);
+  else
+    fio_msg_internal_send_dup(cluster_data.uuid, m);
+  fio_unlock(&cluster_data.lock);
   fio_msg_internal_free(m);
 }
 
@@ -6285,28 +9364,43 @@ static void fio_cluster_client_sender(void *m_, intptr_t ignr_) {
  * Should either call `facil_attach` or close the connection.
  */
 static void fio_cluster_on_connect(intptr_t uuid, void *udata) {
+  fio_protocol_s *pr = fio_cluster_protocol_alloc(
+      uuid, fio_cluster_client_handler, fio_cluster_client_sender);
+  fio_rw_hook_set(uuid, &FIO_CLUSTER_RW_HOOKS, pr);
+  fio_lock(&cluster_data.lock);
+  cluster_data.client = (cluster_pr_s *)pr;
+  fio_unlock(&cluster_data.lock);
   cluster_data.uuid = uuid;
 
+  /* identify the worker (connections are migrated by process id) */
+  fio_msg_internal_s *hello = fio_msg_internal_create(
+      (int32_t)getpid(), FIO_CLUSTER_MSG_HELLO, (fio_str_info_s){.len = 0},
+      (fio_str_info_s){.len = 0}, 0, 1);
+  fio_cluster_send((cluster_pr_s *)pr, hello);
+  fio_msg_internal_free(hello);
+
   /* inform root about all existing channels */
-  fio_lock(&fio_postoffice.pubsub.lock);
-  FIO_SET_FOR_LOOP(&fio_postoffice.pubsub.channels, pos) {
-    if (!pos->hash) {
-      continue;
+  for (size_t i = 0; i < FIO_PUBSUB_CHANNEL_SHARDS; ++i) {
+    fio_collection_s *c = fio_postoffice.pubsub + i;
+    fio_park_lock(&c->lock);
+    FIO_SET_FOR_LOOP(&c->channels, pos) {
+      if (!pos->hash) {
+        continue;
+      }
+      fio_cluster_inform_root_about_channel(pos->obj, 1);
     }
-    fio_cluster_inform_root_about_channel(pos->obj, 1);
+    fio_park_unlock(&c->lock);
   }
-  fio_unlock(&fio_postoffice.pubsub.lock);
-  fio_lock(&fio_postoffice.patterns.lock);
+  fio_park_lock(&fio_postoffice.patterns.lock);
   FIO_SET_FOR_LOOP(&fio_postoffice.patterns.channels, pos) {
     if (!pos->hash) {
       continue;
     }
     fio_cluster_inform_root_about_channel(pos->obj, 1);
   }
-  fio_unlock(&fio_postoffice.patterns.lock);
+  fio_park_unlock(&fio_postoffice.patterns.lock);
 
-  fio_attach(uuid, fio_cluster_protocol_alloc(uuid, fio_cluster_client_handler,
-                                              fio_cluster_client_sender));
+  fio_attach(uuid, pr);
   (void)udata;
 }
 /**
@@ -6339,7 +9433,7 @@ static void fio_send2cluster(fio_msg_internal_s *m) {
     FIO_LOG_ERROR("facio.io cluster inactive, can't send message.");
     return;
   }
-  if (fio_data->workers == 1) {
+  if (fio_single_process()) {
     /* nowhere to send to */
     return;
   }
@@ -6350,13 +9444,27 @@ static void fio_send2cluster(fio_msg_internal_s *m) {
   }
 }
 
+/* reports a worker's load to the root process (used for autoscaling) */
+static void fio_cluster_send_load(uint32_t cpu, uint32_t lag) {
+  if (!fio_data->is_worker || fio_single_process())
+    return;
+  char buf[8];
+  fio_u2str32(buf, cpu);
+  fio_u2str32(buf + 4, lag);
+  fio_cluster_client_sender(
+      fio_msg_internal_create(0, FIO_CLUSTER_MSG_LOAD,
+                              (fio_str_info_s){.len = 0},
+                              (fio_str_info_s){.data = buf, .len = 8}, 0, 1),
+      -1);
+}
+
 /* *****************************************************************************
  * Propegation
  **************************************************************************** */
 
 static inline void fio_cluster_inform_root_about_channel(channel_s *ch,
                                                          int add) {
-  if (!fio_data->is_worker || fio_data->workers == 1 || !cluster_data.uuid ||
+  if (!fio_data->is_worker || fio_single_process() || !cluster_data.uuid ||
       !ch)
     return;
   fio_str_info_s ch_name = {.data = ch->name, .len = ch->name_len};
@@ -6411,14 +9519,20 @@ static void fio_cluster_at_exit(void *ignore) {
     fio_ch_set_pop(&fio_postoffice.patterns.channels);
   }
 
-  while (fio_ch_set_count(&fio_postoffice.pubsub.channels)) {
-    channel_s *ch = fio_ch_set_last(&fio_postoffice.pubsub.channels);
-    while (fio_ls_embd_any(&ch->subscriptions)) {
-      subscription_s *sub =
-          FIO_LS_EMBD_OBJ(subscription_s, node, ch->subscriptions.next);
-      fio_unsubscribe(sub);
+  for (size_t i = 0; i < FIO_PUBSUB_CHANNEL_SHARDS; ++i) {
+    fio_collection_s *c = fio_postoffice.pubsub + i;
+    while (fio_ch_set_count(&c->channels)) {
+      channel_s *ch = fio_ch_set_last(&c->channels);
+      while (fio_ls_embd_any(&ch->subscriptions)) {
+        subscription_s *sub =
+            FIO_LS_EMBD_OBJ(subscription_s, node, ch->subscriptions.next);
+        fio_unsubscribe(sub);
+      }
+      fio_ch_set_pop(&c->channels);
     }
-    fio_ch_set_pop(&fio_postoffice.pubsub.channels);
+    fio_ch_set_free(&c->channels);
+    free(c->snapshot);
+    c->snapshot = NULL;
   }
 
   while (fio_ch_set_count(&fio_postoffice.filters.channels)) {
@@ -6431,8 +9545,9 @@ static void fio_cluster_at_exit(void *ignore) {
     fio_ch_set_pop(&fio_postoffice.filters.channels);
   }
   fio_ch_set_free(&fio_postoffice.filters.channels);
+  free(fio_postoffice.filters.snapshot);
+  fio_postoffice.filters.snapshot = NULL;
   fio_ch_set_free(&fio_postoffice.patterns.channels);
-  fio_ch_set_free(&fio_postoffice.pubsub.channels);
 
   /* clear engines */
   FIO_PUBSUB_DEFAULT = FIO_PUBSUB_CLUSTER;
@@ -6463,9 +9578,10 @@ Cluster forking handler
 ***************************************************************************** */
 
 static void fio_pubsub_on_fork(void) {
-  fio_postoffice.filters.lock = FIO_LOCK_INIT;
-  fio_postoffice.pubsub.lock = FIO_LOCK_INIT;
-  fio_postoffice.patterns.lock = FIO_LOCK_INIT;
+  fio_postoffice.filters.lock = FIO_PARK_LOCK_INIT;
+  /* readers in other threads didn't survive the fork */
+  fio_postoffice.filters.readers[0] = fio_postoffice.filters.readers[1] = 0;
+  fio_postoffice.patterns.lock = FIO_PARK_LOCK_INIT;
   fio_postoffice.engines.lock = FIO_LOCK_INIT;
   fio_postoffice.meta.lock = FIO_LOCK_INIT;
   cluster_data.lock = FIO_LOCK_INIT;
@@ -6478,12 +9594,17 @@ static void fio_pubsub_on_fork(void) {
       FIO_LS_EMBD_OBJ(subscription_s, node, n)->lock = FIO_LOCK_INIT;
     }
   }
-  FIO_SET_FOR_LOOP(&fio_postoffice.pubsub.channels, pos) {
-    if (!pos->hash)
-      continue;
-    pos->obj->lock = FIO_LOCK_INIT;
-    FIO_LS_EMBD_FOR(&pos->obj->subscriptions, n) {
-      FIO_LS_EMBD_OBJ(subscription_s, node, n)->lock = FIO_LOCK_INIT;
+  for (size_t i = 0; i < FIO_PUBSUB_CHANNEL_SHARDS; ++i) {
+    fio_postoffice.pubsub[i].lock = FIO_PARK_LOCK_INIT;
+    fio_postoffice.pubsub[i].readers[0] = 0;
+    fio_postoffice.pubsub[i].readers[1] = 0;
+    FIO_SET_FOR_LOOP(&fio_postoffice.pubsub[i].channels, pos) {
+      if (!pos->hash)
+        continue;
+      pos->obj->lock = FIO_LOCK_INIT;
+      FIO_LS_EMBD_FOR(&pos->obj->subscriptions, n) {
+        FIO_LS_EMBD_OBJ(subscription_s, node, n)->lock = FIO_LOCK_INIT;
+      }
     }
   }
   FIO_SET_FOR_LOOP(&fio_postoffice.patterns.channels, pos) {
@@ -6568,7 +9689,7 @@ void fio_publish FIO_IGNORE_MACRO(fio_publish_args_s args) {
         args.filter,
         (args.is_json ? FIO_CLUSTER_MSG_ROOT_JSON : FIO_CLUSTER_MSG_ROOT),
         args.channel, args.message, args.is_json, 1);
-    if (fio_data->is_worker == 0 || fio_data->workers == 1) {
+    if (fio_data->is_worker == 0 || fio_single_process()) {
       fio_publish2process(m);
     } else {
       fio_cluster_client_sender(m, -1);
@@ -6690,6 +9811,10 @@ fio_match_fn FIO_MATCH_GLOB = fio_glob_match;
 static void fio_pubsub_on_fork(void) {}
 static void fio_cluster_init(void) {}
 static void fio_cluster_signal_children(void) {}
+static void fio_cluster_send_load(uint32_t cpu, uint32_t lag) {
+  (void)cpu;
+  (void)lag;
+}
 
 #endif /* FIO_PUBSUB_SUPPORT */
 
@@ -6798,6 +9923,11 @@ void *fio_realloc2(void *ptr, size_t new_size, size_t copy_length) {
 void *fio_mmap(size_t size) { return calloc(size, 1); }
 
 void fio_malloc_after_fork(void) {}
+int fio_malloc_frozen(int enable) {
+  return 0;
+  (void)enable;
+}
+static void fio_malloc_arena_prefer(size_t cpu) { (void)cpu; }
 void fio_mem_destroy(void) {}
 void fio_mem_init(void) {}
 
@@ -7004,11 +10134,11 @@ static struct {
   fio_ls_embd_s available; /* free list for memory blocks */
   // intptr_t count;          /* free list counter */
   size_t cores;    /* the number of detected CPU cores*/
-  fio_lock_i lock; /* a global lock */
+  fio_park_lock_i lock; /* a global lock */
   uint8_t forked;  /* a forked collection indicator. */
 } memory = {
     .cores = 1,
-    .lock = FIO_LOCK_INIT,
+    .lock = FIO_PARK_LOCK_INIT,
     .available = FIO_LS_INIT(memory.available),
 };
 
@@ -7076,7 +10206,25 @@ static __thread arena_s *arena_last_used;
 
 static void arena_enter(void) { arena_last_used = arena_lock(arena_last_used); }
 
-static inline void arena_exit(void) { fio_unlock(&arena_last_used->lock); }
+static inline void arena_exit(void) { fio_unlock(&arena_last_used->lock); }
+
+/* A dedicated arena for data that should remain shared across `fork`. */
+static arena_s arena_frozen = {.lock = FIO_LOCK_INIT};
+/* Routes the thread's allocations to the frozen arena. */
+static __thread uint8_t arena_frozen_mode;
+
+/** Routes the calling thread's allocations to the frozen memory region. */
+int fio_malloc_frozen(int enable) {
+  int old = arena_frozen_mode;
+  arena_frozen_mode = !!enable;
+  return old;
+}
+
+/* Prefers the arena matching a CPU core (for threads pinned to the core). */
+static void fio_malloc_arena_prefer(size_t cpu) {
+  if (arenas)
+    arena_last_used = arenas + (cpu % memory.cores);
+}
 
 /** Clears any memory locks, in case of a system call to `fork`. */
 void fio_malloc_after_fork(void) {
@@ -7084,11 +10232,14 @@ void fio_malloc_after_fork(void) {
   if (!arenas) {
     return;
   }
-  memory.lock = FIO_LOCK_INIT;
+  memory.lock = FIO_PARK_LOCK_INIT;
   memory.forked = 1;
   for (size_t i = 0; i < memory.cores; ++i) {
     arenas[i].lock = FIO_LOCK_INIT;
   }
+  /* never write to the frozen block shared with the parent process */
+  arena_frozen.lock = FIO_LOCK_INIT;
+  arena_frozen.block = NULL;
 }
 
 /* *****************************************************************************
@@ -7122,13 +10273,13 @@ static inline void block_free(block_s *blk) {
     return;
 
   memset(blk + 1, 0, (FIO_MEMORY_BLOCK_SIZE - sizeof(*blk)));
-  fio_lock(&memory.lock);
+  fio_park_lock(&memory.lock);
   fio_ls_embd_push(&memory.available, &((block_node_s *)blk)->node);
 
   blk = blk->parent;
 
   if (fio_atomic_sub(&blk->root_ref, 1)) {
-    fio_unlock(&memory.lock);
+    fio_park_unlock(&memory.lock);
     return;
   }
   // fio_unlock(&memory.lock);
@@ -7141,7 +10292,7 @@ static inline void block_free(block_s *blk) {
     fio_ls_embd_remove(&pos->node);
   }
 
-  fio_unlock(&memory.lock);
+  fio_park_unlock(&memory.lock);
   sys_free(blk, FIO_MEMORY_BLOCK_SIZE * FIO_MEMORY_BLOCKS_PER_ALLOCATION);
   FIO_LOG_DEBUG("memory allocator returned %p to the system", (void *)blk);
   FIO_MEMORY_ON_BLOCK_FREE();
@@ -7151,20 +10302,20 @@ static inline void block_free(block_s *blk) {
 static inline block_s *block_new(void) {
   block_s *blk = NULL;
 
-  fio_lock(&memory.lock);
+  fio_park_lock(&memory.lock);
   blk = (block_s *)fio_ls_embd_pop(&memory.available);
   if (blk) {
     blk = (block_s *)FIO_LS_EMBD_OBJ(block_node_s, node, blk);
     FIO_ASSERT(((uintptr_t)blk & FIO_MEMORY_BLOCK_MASK) == 0,
                "Memory allocator error! double `fio_free`?\n");
     block_init(blk); /* must be performed within lock */
-    fio_unlock(&memory.lock);
+    fio_park_unlock(&memory.lock);
     return blk;
   }
   /* collect memory from the system */
   blk = sys_alloc(FIO_MEMORY_BLOCK_SIZE * FIO_MEMORY_BLOCKS_PER_ALLOCATION, 0);
   if (!blk) {
-    fio_unlock(&memory.lock);
+    fio_park_unlock(&memory.lock);
     return NULL;
   }
   FIO_LOG_DEBUG("memory allocator allocated %p from the system", (void *)blk);
@@ -7177,7 +10328,7 @@ static inline block_s *block_new(void) {
     block_init_root((block_s *)tmp, blk);
     fio_ls_embd_push(&memory.available, &tmp->node);
   }
-  fio_unlock(&memory.lock);
+  fio_park_unlock(&memory.lock);
   /* return the root block (which isn't in the memory pool). */
   return blk;
 }
@@ -7318,6 +10469,9 @@ static void fio_mem_destroy(void) {
       block_free(arenas[i].block);
     arenas[i].block = NULL;
   }
+  if (arena_frozen.block)
+    block_free(arena_frozen.block);
+  arena_frozen.block = NULL;
   if (!memory.forked && fio_ls_embd_any(&memory.available)) {
     FIO_LOG_WARNING("facil.io detected memory traces remaining after cleanup"
                     " - memory leak?");
@@ -7353,6 +10507,16 @@ void *fio_malloc(size_t size) {
   }
   /* ceiling for 16 byte alignement, translated to 16 byte units */
   size = (size >> 4) + (!!(size & 15));
+  if (arena_frozen_mode) {
+    /* the frozen arena never shares blocks with the per-CPU arenas */
+    arena_s *prev = arena_last_used;
+    fio_lock(&arena_frozen.lock);
+    arena_last_used = &arena_frozen;
+    void *mem = block_slice(size);
+    arena_last_used = prev;
+    fio_unlock(&arena_frozen.lock);
+    return mem;
+  }
   arena_enter();
   void *mem = block_slice(size);
   arena_exit();
@@ -9214,8 +12378,8 @@ FIO_FUNC void fio_malloc_test(void) {
     FIO_ASSERT(mem, "fio_malloc failed to allocate memory!\n");
     fio_free(mem);
   }
-  /* make sure a block is assigned */
-  fio_free(fio_malloc(1));
+  /* make sure a block is assigned (`mem` was already freed) */
+  mem = fio_malloc(1);
   b = arena_last_used->block;
   size_t count = 1;
   /* count allocations within block */
@@ -9433,6 +12597,259 @@ FIO_FUNC void fio_timer_test(void) {
   fprintf(stderr, "* passed.\n");
 }
 
+/* *****************************************************************************
+Testing the connection table
+***************************************************************************** */
+
+FIO_FUNC void fio_fd_page_test(void) {
+  fprintf(stderr, "=== Testing connection table pages (%zu per page)\n",
+          (size_t)FIO_FD_PAGE_SIZE);
+  const uintptr_t last = fio_data->capa - 1;
+  if (!fd_page_exists(last)) {
+    const intptr_t uuid = (intptr_t)((last << 8) | 1);
+    FIO_ASSERT(!fio_is_valid(uuid) && fio_is_closed(uuid),
+               "a uuid in a missing connection table page should be invalid");
+    FIO_ASSERT(!fd_page_exists(last),
+               "validity checks shouldn't allocate connection table pages");
+  }
+  FIO_ASSERT(fd_data(last).counter == 1 && !fd_data(last).open &&
+                 fd_data(last).rw_hooks == &FIO_DEFAULT_RW_HOOKS &&
+                 fd_data(last).packet_last == &fd_data(last).packet,
+             "connection table page initialization error");
+  FIO_ASSERT(fio_data->pages[last >> FIO_FD_PAGE_BITS],
+             "connection table page wasn't allocated");
+  FIO_ASSERT(&fd_data(last & (~FIO_FD_PAGE_MASK)) +
+                     (last & FIO_FD_PAGE_MASK) ==
+                 &fd_data(last),
+             "connection table page layout error");
+  FIO_ASSERT(!fd_cold(last).addr_len &&
+                 !fio_uuid_links_count(&fd_cold(last).links),
+             "connection table cold data should be empty");
+  fprintf(stderr, "* passed.\n");
+}
+
+/* *****************************************************************************
+Testing binary upgrade socket handoff
+***************************************************************************** */
+
+FIO_FUNC void fio_upgrade_test(void) {
+  fprintf(stderr, "=== Testing binary upgrade socket handoff\n");
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int unused = socket(AF_INET, SOCK_STREAM, 0);
+  FIO_ASSERT(fd > 2 && unused > 2, "socket creation failed");
+  char env[128];
+  snprintf(env, sizeof(env), "%d,8765,;%d,,/tmp/fio-test-upgrade.sock;", fd,
+           unused);
+  setenv(FIO_LISTEN_FDS_ENV, env, 1);
+  FIO_ASSERT(fio_listen_inherited(NULL, "8766") == -1,
+             "inherited socket shouldn't match a different port");
+  FIO_ASSERT(fio_listen_inherited("localhost", "8765") == -1,
+             "inherited socket shouldn't match a different address");
+  intptr_t uuid = fio_listen_inherited(NULL, "8765");
+  FIO_ASSERT(uuid != -1 && fio_uuid2fd(uuid) == fd,
+             "inherited socket wasn't found");
+  FIO_ASSERT(fio_listen_inherited(NULL, "8765") == -1,
+             "inherited socket shouldn't be claimed twice");
+  fio_listen_inherited_cleanup();
+  FIO_ASSERT(!getenv(FIO_LISTEN_FDS_ENV),
+             "inherited socket environment should be cleared");
+  FIO_ASSERT(fcntl(unused, F_GETFD) == -1,
+             "unclaimed inherited socket should be closed");
+  FIO_ASSERT(fio_is_valid(uuid), "claimed inherited socket should stay open");
+  fio_force_close(uuid);
+  fio_defer_perform();
+  {
+    /* the handshake never waits on a hung process */
+    int pv[2];
+    FIO_ASSERT(!pipe(pv), "pipe failed for binary upgrade test");
+    int e = 0;
+    int ms = 50;
+    FIO_ASSERT(fio_upgrade_read(pv[0], &e, sizeof(e), &ms) == -1 &&
+                   errno == ETIMEDOUT && !ms,
+               "binary upgrade handshake should time out");
+    e = 7;
+    ms = 50;
+    FIO_ASSERT(write(pv[1], &e, sizeof(e)) == sizeof(e), "pipe write failed");
+    close(pv[1]);
+    e = 0;
+    FIO_ASSERT(fio_upgrade_read(pv[0], &e, sizeof(e), &ms) == sizeof(e) &&
+                   e == 7 && !fio_upgrade_read(pv[0], &e, sizeof(e), &ms),
+               "binary upgrade handshake read / EOF error");
+    close(pv[0]);
+  }
+  {
+    /* the exec arguments are prepared before forking */
+    char *path = fio_upgrade_binary_path("sh");
+    FIO_ASSERT(path && !access(path, X_OK) &&
+                   !strcmp(path + strlen(path) - 3, "/sh"),
+               "binary upgrade path resolution failed for sh (%s)",
+               path ? path : "NULL");
+    free(path);
+    FIO_ASSERT(!fio_upgrade_binary_path("fio-no-such-binary-X7") &&
+                   errno == ENOENT,
+               "binary upgrade path resolution should fail for missing files");
+    setenv(FIO_LISTEN_FDS_ENV, "old", 1);
+    char listen_fds[] = FIO_LISTEN_FDS_ENV "=3,8765,;";
+    char **envp = fio_upgrade_env(listen_fds);
+    size_t found = 0;
+    for (char **e = envp; *e; ++e) {
+      if (!strncmp(*e, FIO_LISTEN_FDS_ENV "=", sizeof(FIO_LISTEN_FDS_ENV))) {
+        FIO_ASSERT(*e == listen_fds,
+                   "binary upgrade environment kept the old socket list");
+        ++found;
+      }
+    }
+    FIO_ASSERT(found == 1, "binary upgrade environment socket list error");
+    free(envp);
+    unsetenv(FIO_LISTEN_FDS_ENV);
+  }
+  fprintf(stderr, "* passed.\n");
+}
+
+/* *****************************************************************************
+Testing worker autoscaling
+***************************************************************************** */
+
+FIO_FUNC void fio_autoscale_test(void) {
+  fprintf(stderr, "=== Testing worker autoscaling reviews\n");
+  const uint16_t old_workers = fio_data->workers;
+  const uint16_t old_max = fio_data->workers_max;
+  fio_data->workers_max = 3;
+  fio_autoscale_init(1);
+  FIO_ASSERT(fio_data->workers == 1,
+             "autoscaling should start with the minimal number of workers");
+  fio_autoscale_review();
+  FIO_ASSERT(fio_data->workers == 1 && !fio_autoscale.overloaded &&
+                 !fio_autoscale.idle,
+             "reviews without load reports should be ignored");
+  for (size_t i = 0; i < FIO_AUTOSCALE_UP_REVIEWS; ++i) {
+    FIO_ASSERT(fio_data->workers == 1, "worker spawned too early");
+    fio_autoscale_on_report(FIO_AUTOSCALE_CPU_HIGH - 10, 0);
+    fio_autoscale_on_report(FIO_AUTOSCALE_CPU_HIGH + 10, 0);
+    fio_autoscale_review();
+  }
+  FIO_ASSERT(fio_data->workers == 2,
+             "CPU overloaded workers should spawn a worker");
+  for (size_t i = 0; i < FIO_AUTOSCALE_UP_REVIEWS * 2; ++i) {
+    fio_autoscale_on_report(0, FIO_AUTOSCALE_LAG_HIGH);
+    fio_autoscale_review();
+  }
+  FIO_ASSERT(fio_data->workers == 3,
+             "lagging workers should spawn workers (up to the maximum)");
+  pid_t child = fork();
+  FIO_ASSERT(child != -1, "fork failed for autoscaling test");
+  if (!child) {
+    signal(SIGTERM, SIG_DFL);
+    pause();
+    _exit(0);
+  }
+  fio_autoscale.pids[2] = child;
+  for (size_t i = 0; i < FIO_AUTOSCALE_DOWN_REVIEWS; ++i) {
+    FIO_ASSERT(fio_data->workers == 3, "worker retired too early");
+    fio_autoscale_on_report(FIO_AUTOSCALE_CPU_LOW, 1);
+    fio_autoscale_review();
+  }
+  FIO_ASSERT(fio_data->workers == 2 && fio_autoscale.retired[2],
+             "idle workers should retire the last worker");
+  int status = 0;
+  FIO_ASSERT(waitpid(child, &status, 0) == child && WIFSIGNALED(status) &&
+                 WTERMSIG(status) == SIGTERM,
+             "retired worker should be signaled to shutdown");
+  FIO_ASSERT(fio_autoscale_on_exit(2) && !fio_autoscale.pids[2] &&
+                 !fio_autoscale_on_exit(1),
+             "only retired workers should free their slot on exit");
+  fio_autoscale_destroy();
+  fio_timer_clear_all();
+  fio_data->workers = old_workers;
+  fio_data->workers_max = old_max;
+  FIO_ASSERT(!fio_autoscale_on_exit(0),
+             "workers aren't retired when autoscaling is disabled");
+  fprintf(stderr, "* passed.\n");
+}
+
+/* *****************************************************************************
+Testing UDP sockets
+***************************************************************************** */
+
+static struct {
+  intptr_t client;
+  size_t echoed;
+  size_t received;
+  size_t finished;
+} fio_udp_test_state;
+
+FIO_FUNC void fio_udp_test_server(intptr_t uuid, fio_str_info_s data,
+                                  const struct sockaddr *from,
+                                  socklen_t from_len, void *udata) {
+  if (!fio_udp_send(uuid, data.data, data.len, from, from_len))
+    ++fio_udp_test_state.echoed;
+  (void)udata;
+}
+
+FIO_FUNC void fio_udp_test_client(intptr_t uuid, fio_str_info_s data,
+                                  const struct sockaddr *from,
+                                  socklen_t from_len, void *udata) {
+  FIO_ASSERT(data.len == 4 && !memcmp(data.data, "ping", 5),
+             "UDP datagram corrupted (%zu bytes)", data.len);
+  if (++fio_udp_test_state.received == FIO_UDP_BATCH * 2)
+    fio_stop();
+  (void)uuid;
+  (void)from;
+  (void)from_len;
+  (void)udata;
+}
+
+FIO_FUNC void fio_udp_test_on_finish(intptr_t uuid, void *udata) {
+  ++fio_udp_test_state.finished;
+  (void)uuid;
+  (void)udata;
+}
+
+FIO_FUNC void fio_udp_test_on_start(void *arg) {
+  for (size_t i = 0; i < FIO_UDP_BATCH * 2; ++i) {
+    FIO_ASSERT(!fio_udp_send(fio_udp_test_state.client, "ping", 4, NULL, 0),
+               "fio_udp_send failed");
+  }
+  (void)arg;
+}
+
+FIO_FUNC void fio_udp_test_timeout(void *arg) {
+  fio_stop();
+  (void)arg;
+}
+
+FIO_FUNC void fio_udp_test(void) {
+  fprintf(stderr, "=== Testing UDP sockets\n");
+  fio_udp_test_state.finished = 0;
+  FIO_ASSERT(fio_udp_listen(.port = "8763",
+                            .on_finish = fio_udp_test_on_finish) == -1 &&
+                 fio_udp_test_state.finished == 1,
+             "fio_udp_listen should fail without an on_datagram callback");
+  fio_udp_test_state = (__typeof__(fio_udp_test_state)){0};
+  intptr_t srv = fio_udp_listen(.address = "127.0.0.1", .port = "8763",
+                                .on_datagram = fio_udp_test_server,
+                                .on_finish = fio_udp_test_on_finish);
+  FIO_ASSERT(srv != -1, "Failed to bind a UDP socket on port 8763");
+  fio_udp_test_state.client = fio_udp_connect(
+      .address = "127.0.0.1", .port = "8763",
+      .on_datagram = fio_udp_test_client, .on_finish = fio_udp_test_on_finish);
+  FIO_ASSERT(fio_udp_test_state.client != -1, "fio_udp_connect failed");
+  FIO_ASSERT(fio_udp_send(fio_udp_test_state.client, "ping", 4, NULL, 0) ==
+                 -1,
+             "fio_udp_send should fail before the socket is attached");
+  fio_state_callback_add(FIO_CALL_ON_START, fio_udp_test_on_start, NULL);
+  fio_run_every(5000, 1, fio_udp_test_timeout, NULL, NULL);
+  fio_start(.threads = 1, .workers = 1);
+  fio_timer_clear_all();
+  FIO_ASSERT(fio_udp_test_state.echoed == FIO_UDP_BATCH * 2 &&
+                 fio_udp_test_state.received == FIO_UDP_BATCH * 2,
+             "UDP datagrams lost (%zu echoed, %zu received)",
+             fio_udp_test_state.echoed, fio_udp_test_state.received);
+  FIO_ASSERT(fio_udp_test_state.finished == 2,
+             "UDP sockets weren't closed (%zu)", fio_udp_test_state.finished);
+  fprintf(stderr, "* passed.\n");
+}
+
 /* *****************************************************************************
 Testing listening socket
 ***************************************************************************** */
@@ -9536,6 +12953,376 @@ FIO_FUNC void fio_socket_test(void) {
   fprintf(stderr, "* passed.\n");
 }
 
+/* *****************************************************************************
+Testing DNS resolution
+***************************************************************************** */
+
+static struct {
+  int fd;
+  volatile uint8_t stop;
+  size_t queries;
+  char last[256]; /* the last name queried (wire format) */
+} fio_dns_test_stub = {.fd = -1};
+
+/* a stub nameserver, answering A / AAAA queries for `*.test` names */
+FIO_FUNC void *fio_dns_test_server(void *arg) {
+  uint8_t buf[512];
+  struct sockaddr_storage from;
+  while (!fio_dns_test_stub.stop) {
+    socklen_t from_len = sizeof(from);
+    ssize_t len = recvfrom(fio_dns_test_stub.fd, buf, 256, 0,
+                           (struct sockaddr *)&from, &from_len);
+    if (len < 17)
+      continue;
+    fio_atomic_add(&fio_dns_test_stub.queries, 1);
+    size_t pos = 12;
+    while (pos < (size_t)len && buf[pos])
+      pos += buf[pos] + 1;
+    if (pos + 5 > (size_t)len)
+      continue;
+    const uint16_t type = ((uint16_t)buf[pos + 1] << 8) | buf[pos + 2];
+    const char *name = (char *)buf + 13;
+    memcpy(fio_dns_test_stub.last, buf + 12, pos - 11);
+    pos += 5;
+    buf[2] |= 0x80;
+    buf[3] = 0x80;
+    if (!memcmp(name, "missing", 7)) {
+      buf[3] |= 3; /* NXDOMAIN */
+    } else if ((!memcmp(name, "stub", 4) && type == 1) ||
+               (!memcmp(name, "six", 3) && type == 28)) {
+      const uint8_t answer[] = {0xC0, 12, 0, type, 0, 1, 0, 0, 0, 60};
+      memcpy(buf + pos, answer, sizeof(answer));
+      pos += sizeof(answer);
+      buf[pos++] = 0;
+      buf[pos++] = (type == 1 ? 4 : 16);
+      if (type == 1) {
+        const uint8_t ip[] = {127, 0, 0, 1};
+        memcpy(buf + pos, ip, 4);
+        pos += 4;
+      } else {
+        memset(buf + pos, 0, 15);
+        buf[pos + 15] = 1; /* ::1 */
+        pos += 16;
+      }
+      buf[7] = 1;
+    }
+    sendto(fio_dns_test_stub.fd, buf, pos, 0, (struct sockaddr *)&from,
+           from_len);
+  }
+  return arg;
+}
+
+typedef struct {
+  size_t calls;
+  struct sockaddr_storage addr;
+  socklen_t len;
+} fio_dns_test_result_s;
+
+FIO_FUNC void fio_dns_test_on_resolved(const struct sockaddr *addr,
+                                       socklen_t len, void *udata) {
+  fio_dns_test_result_s *r = udata;
+  ++r->calls;
+  r->len = len;
+  if (addr)
+    memcpy(&r->addr, addr, len);
+}
+
+FIO_FUNC void fio_dns_test_on_connect(intptr_t uuid, void *udata) {
+  *(size_t *)udata = 1;
+  fio_close(uuid);
+}
+
+FIO_FUNC void fio_dns_test_on_fail(intptr_t uuid, void *udata) {
+  *(size_t *)udata = (uuid == -1 ? 3 : 2);
+}
+
+/* cycles the reactor until the value at `flag` is set */
+FIO_FUNC void fio_dns_test_wait(size_t *flag) {
+  for (size_t i = 0; i < 32 && !*flag; ++i) {
+    fio_mark_time();
+    fio_poll();
+    fio_defer_perform();
+  }
+}
+
+FIO_FUNC void fio_dns_test(void) {
+  fprintf(stderr, "=== Testing DNS resolution (using a stub nameserver)\n");
+  struct sockaddr_in stub = {.sin_family = AF_INET};
+  socklen_t stub_len = sizeof(stub);
+  inet_pton(AF_INET, "127.0.0.1", &stub.sin_addr);
+  fio_dns_test_stub.fd = socket(AF_INET, SOCK_DGRAM, 0);
+  FIO_ASSERT(fio_dns_test_stub.fd != -1, "couldn't open stub DNS socket");
+  FIO_ASSERT(!bind(fio_dns_test_stub.fd, (struct sockaddr *)&stub, stub_len) &&
+                 !getsockname(fio_dns_test_stub.fd, (struct sockaddr *)&stub,
+                              &stub_len),
+             "couldn't bind stub DNS socket");
+  {
+    struct timeval tv = {.tv_usec = 50000};
+    setsockopt(fio_dns_test_stub.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  }
+  pthread_t thread;
+  FIO_ASSERT(!pthread_create(&thread, NULL, fio_dns_test_server, NULL),
+             "couldn't start stub DNS thread");
+  char port[16];
+  snprintf(port, sizeof(port), "%u", (unsigned)ntohs(stub.sin_port));
+  fio_dns_clear();
+  fio_dns_nameserver("127.0.0.1", port);
+
+  fio_dns_test_result_s r = {0};
+  fio_dns_resolve("10.0.0.1", fio_dns_test_on_resolved, &r);
+  FIO_ASSERT(r.calls == 1 && r.len == sizeof(struct sockaddr_in) &&
+                 r.addr.ss_family == AF_INET,
+             "numeric addresses should resolve immediately");
+
+  r = (fio_dns_test_result_s){0};
+  fio_dns_resolve("Stub.Test.", fio_dns_test_on_resolved, &r);
+  FIO_ASSERT(!r.calls, "uncached names shouldn't resolve immediately");
+  fio_dns_test_wait(&r.calls);
+  FIO_ASSERT(r.calls == 1 && r.addr.ss_family == AF_INET &&
+                 ((struct sockaddr_in *)&r.addr)->sin_addr.s_addr ==
+                     htonl(INADDR_LOOPBACK),
+             "stub.test should resolve to 127.0.0.1");
+  FIO_ASSERT(fio_dns_test_stub.queries == 1, "a single query expected (%zu)",
+             fio_dns_test_stub.queries);
+  r = (fio_dns_test_result_s){0};
+  fio_dns_resolve("stub.test", fio_dns_test_on_resolved, &r);
+  FIO_ASSERT(r.calls == 1 && r.len && fio_dns_test_stub.queries == 1,
+             "cached names should resolve immediately");
+  fprintf(stderr, "* positive answers resolved and cached.\n");
+
+  r = (fio_dns_test_result_s){0};
+  fio_dns_resolve("missing.test", fio_dns_test_on_resolved, &r);
+  fio_dns_test_wait(&r.calls);
+  FIO_ASSERT(r.calls == 1 && !r.len, "missing.test should fail");
+  r = (fio_dns_test_result_s){0};
+  fio_dns_resolve("missing.test", fio_dns_test_on_resolved, &r);
+  FIO_ASSERT(r.calls == 1 && !r.len && fio_dns_test_stub.queries == 2,
+             "failures should be cached");
+  fprintf(stderr, "* negative answers cached.\n");
+
+  r = (fio_dns_test_result_s){0};
+  fio_dns_resolve("six.test", fio_dns_test_on_resolved, &r);
+  fio_dns_test_wait(&r.calls);
+  FIO_ASSERT(r.calls == 1 && r.addr.ss_family == AF_INET6 &&
+                 IN6_IS_ADDR_LOOPBACK(&((struct sockaddr_in6 *)&r.addr)
+                                           ->sin6_addr),
+             "six.test should resolve to ::1");
+  FIO_ASSERT(fio_dns_test_stub.queries == 4,
+             "an IPv6 query should follow a missing IPv4 address (%zu)",
+             fio_dns_test_stub.queries);
+  fprintf(stderr, "* IPv6 addresses resolved when IPv4 is missing.\n");
+
+  fio_lock(&fio_dns.lock);
+  memcpy(fio_dns.search, "test", 5);
+  fio_dns.search_pos[0] = 0;
+  fio_dns.search_count = 1;
+  fio_unlock(&fio_dns.lock);
+  r = (fio_dns_test_result_s){0};
+  fio_dns_resolve("stub", fio_dns_test_on_resolved, &r);
+  fio_dns_test_wait(&r.calls);
+  FIO_ASSERT(r.calls == 1 && r.addr.ss_family == AF_INET &&
+                 !strcmp(fio_dns_test_stub.last, "\4stub\4test"),
+             "stub should resolve using the search list (stub.test)");
+  r = (fio_dns_test_result_s){0};
+  fio_dns_resolve("missing", fio_dns_test_on_resolved, &r);
+  fio_dns_test_wait(&r.calls);
+  FIO_ASSERT(r.calls == 1 && !r.len && fio_dns_test_stub.queries == 7 &&
+                 !strcmp(fio_dns_test_stub.last, "\7missing"),
+             "the name should be tried after the search list (%zu)",
+             fio_dns_test_stub.queries);
+  r = (fio_dns_test_result_s){0};
+  fio_dns_resolve("six.", fio_dns_test_on_resolved, &r);
+  fio_dns_test_wait(&r.calls);
+  FIO_ASSERT(r.calls == 1 && r.addr.ss_family == AF_INET6 &&
+                 !strcmp(fio_dns_test_stub.last, "\3six"),
+             "absolute names should skip the search list");
+  fio_lock(&fio_dns.lock);
+  fio_dns.search_count = 0;
+  fio_unlock(&fio_dns.lock);
+  fprintf(stderr, "* search domains tried.\n");
+
+  {
+    /* the first nameserver isn't listening, the second one answers */
+    int tmp = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in dead = {.sin_family = AF_INET};
+    socklen_t dead_len = sizeof(dead);
+    inet_pton(AF_INET, "127.0.0.1", &dead.sin_addr);
+    FIO_ASSERT(tmp != -1 && !bind(tmp, (struct sockaddr *)&dead, dead_len) &&
+                   !getsockname(tmp, (struct sockaddr *)&dead, &dead_len),
+               "couldn't reserve a closed UDP port");
+    close(tmp);
+    char dead_port[16];
+    snprintf(dead_port, sizeof(dead_port), "%u",
+             (unsigned)ntohs(dead.sin_port));
+    fio_dns_nameserver("127.0.0.1", dead_port);
+    fio_lock(&fio_dns.lock);
+    memcpy(fio_dns.ns + 1, &stub, stub_len);
+    fio_dns.ns_len[1] = stub_len;
+    fio_dns.ns_count = 2;
+    fio_unlock(&fio_dns.lock);
+    r = (fio_dns_test_result_s){0};
+    fio_dns_resolve("stub.second", fio_dns_test_on_resolved, &r);
+    fio_dns_test_wait(&r.calls);
+    FIO_ASSERT(r.calls == 1 && r.len && fio_dns.ns_index == 1,
+               "the second nameserver should be tried");
+    fprintf(stderr, "* nameservers tried in order.\n");
+  }
+
+  {
+    /* uncached names fail fast while the reactor is running */
+    struct sockaddr_storage tmp;
+    fio_data->active = 1;
+    errno = 0;
+    intptr_t uuid = fio_socket("stub.later", "80", 0);
+    fio_data->active = 0;
+    FIO_ASSERT(uuid == -1 && errno == EAGAIN,
+               "fio_socket shouldn't block on uncached names");
+    for (size_t i = 0; i < 32 && !fio_dns_cached(&tmp, "stub.later"); ++i) {
+      fio_mark_time();
+      fio_poll();
+      fio_defer_perform();
+    }
+    FIO_ASSERT(fio_dns_cached(&tmp, "stub.later"),
+               "fio_socket should resolve uncached names for later");
+    fprintf(stderr, "* fio_socket doesn't block on uncached names.\n");
+  }
+
+  intptr_t srv = fio_socket("127.0.0.1", "8764", 1);
+  FIO_ASSERT(srv != -1, "Failed to open TCP/IP socket on port 8764");
+  size_t state = 0;
+  fio_dns_clear();
+  intptr_t uuid = fio_connect(.address = "stub.test", .port = "8764",
+                              .on_connect = fio_dns_test_on_connect,
+                              .on_fail = fio_dns_test_on_fail, .udata = &state);
+  FIO_ASSERT(uuid != -1 && !state, "fio_connect should resolve names later");
+  fio_dns_test_wait(&state);
+  FIO_ASSERT(state == 1, "fio_connect to a resolved name failed (%zu)", state);
+  state = 0;
+  uuid = fio_connect(.address = "missing.test", .port = "8764",
+                     .on_connect = fio_dns_test_on_connect,
+                     .on_fail = fio_dns_test_on_fail, .udata = &state);
+  FIO_ASSERT(uuid != -1, "fio_connect shouldn't fail before resolving");
+  fio_dns_test_wait(&state);
+  FIO_ASSERT(state == 2, "fio_connect to a missing name should fail (%zu)",
+             state);
+  fprintf(stderr, "* fio_connect resolved names without blocking.\n");
+  fio_force_close(srv);
+  fio_defer_perform();
+
+  fio_dns_nameserver(NULL, NULL);
+  fio_dns_clear();
+  fio_defer_perform();
+  fio_dns_test_stub.stop = 1;
+  pthread_join(thread, NULL);
+  close(fio_dns_test_stub.fd);
+  fprintf(stderr, "* passed.\n");
+}
+
+/* *****************************************************************************
+Testing half closed sockets
+***************************************************************************** */
+
+typedef struct {
+  fio_protocol_s pr;
+  intptr_t uuid;
+  int peer;
+  size_t reads;
+  size_t closed;
+  size_t responded;
+  size_t len;
+  char buf[32];
+} fio_half_close_test_s;
+
+/* reads a few bytes at a time */
+FIO_FUNC void fio_half_close_test_read(intptr_t uuid, fio_protocol_s *pr) {
+  fio_half_close_test_s *t = (fio_half_close_test_s *)pr;
+  ++t->reads;
+  ssize_t r = fio_read(uuid, t->buf + t->len, 4);
+  if (r > 0)
+    t->len += r;
+}
+
+/* a paused request, it stops reading until it responds (i.e., `http_pause`) */
+FIO_FUNC void fio_half_close_test_paused(intptr_t uuid, fio_protocol_s *pr) {
+  fio_half_close_test_s *t = (fio_half_close_test_s *)pr;
+  if (!t->len || t->responded)
+    fio_half_close_test_read(uuid, pr);
+  if (!t->responded)
+    fio_suspend(uuid);
+}
+
+FIO_FUNC void fio_half_close_test_on_close(intptr_t uuid, fio_protocol_s *pr) {
+  ((fio_half_close_test_s *)pr)->closed = 1;
+  (void)uuid;
+}
+
+FIO_FUNC void fio_half_close_test_cycle(fio_half_close_test_s *t) {
+  for (size_t i = 0; i < 32 && !t->closed; ++i) {
+    fio_mark_time();
+    fio_poll();
+    fio_defer_perform();
+  }
+}
+
+/* the peer sends the data and shuts down writing */
+FIO_FUNC void fio_half_close_test_run(fio_half_close_test_s *t,
+                                      const char *data) {
+  int fds[2];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds),
+             "socketpair failed for half closed socket test");
+  fio_set_non_block(fds[0]);
+  t->uuid = fio_fd2uuid(fds[0]);
+  t->peer = fds[1];
+  fio_attach_fd(fds[0], &t->pr);
+  FIO_ASSERT(write(fds[1], data, strlen(data)) == (ssize_t)strlen(data),
+             "half closed socket test write error");
+  shutdown(fds[1], SHUT_WR);
+  fio_half_close_test_cycle(t);
+}
+
+FIO_FUNC void fio_half_close_test(void) {
+  fprintf(stderr, "=== Testing half closed sockets (peer shuts down writing)\n");
+  size_t junk;
+  /* prevent poll from hanging */
+  fio_run_every(5, 0, fio_timer_test_task, &junk, NULL);
+  fio_half_close_test_s reader = {
+      .pr =
+          {
+              .on_data = fio_half_close_test_read,
+              .on_close = fio_half_close_test_on_close,
+          },
+  };
+  fio_half_close_test_run(&reader, "data before FIN");
+  close(reader.peer);
+  FIO_ASSERT(reader.closed, "half closed socket wasn't closed");
+  FIO_ASSERT(reader.len == 15 && !memcmp(reader.buf, "data before FIN", 15),
+             "data sent before the FIN was lost (%zu: %.*s)", reader.len,
+             (int)reader.len, reader.buf);
+  fio_half_close_test_s paused = {
+      .pr =
+          {
+              .on_data = fio_half_close_test_paused,
+              .on_close = fio_half_close_test_on_close,
+          },
+  };
+  fio_half_close_test_run(&paused, "req");
+  FIO_ASSERT(!paused.closed && paused.len == 3,
+             "a suspended half closed socket should wait for the response");
+  /* the paused handler responds and resumes the connection */
+  paused.responded = 1;
+  fio_write(paused.uuid, "response", 8);
+  fio_force_event(paused.uuid, FIO_EVENT_ON_DATA);
+  fio_half_close_test_cycle(&paused);
+  FIO_ASSERT(paused.closed, "a resumed half closed socket wasn't closed");
+  char response[16];
+  FIO_ASSERT(read(paused.peer, response, 16) == 8 &&
+                 !memcmp(response, "response", 8),
+             "the response to a half closed socket was lost");
+  close(paused.peer);
+  fio_timer_clear_all();
+  fprintf(stderr, "* passed.\n");
+}
+
 /* *****************************************************************************
 Testing listening socket
 ***************************************************************************** */
@@ -9550,6 +13337,19 @@ FIO_FUNC void fio_cycle_test_task2(void *arg) {
   (void)arg;
 }
 
+FIO_FUNC uint8_t fio_cycle_test_on_shutdown(intptr_t uuid,
+                                            fio_protocol_s *pr) {
+  return 254; /* linger for as long as possible */
+  (void)uuid;
+  (void)pr;
+}
+static size_t fio_cycle_test_closed;
+FIO_FUNC void fio_cycle_test_on_close(intptr_t uuid, fio_protocol_s *pr) {
+  fio_cycle_test_closed = 1;
+  (void)uuid;
+  (void)pr;
+}
+
 FIO_FUNC void fio_cycle_test(void) {
   fprintf(stderr,
           "=== Testing facil.io cycling logic (partial - only tests timers)\n");
@@ -9563,8 +13363,81 @@ FIO_FUNC void fio_cycle_test(void) {
   fio_timer_clear_all();
   FIO_ASSERT(end.tv_sec == start.tv_sec + 1 || end.tv_sec == start.tv_sec + 2,
              "facil.io cycling error?");
+  fprintf(stderr, "* testing busy polling reactor mode.\n");
+  fio_mark_time();
+  start = fio_last_tick();
+  fio_run_every(1000, 1, fio_cycle_test_task, NULL, NULL);
+  fio_run_every(10000, 1, fio_cycle_test_task2, NULL, NULL);
+  fio_start(.threads = 1, .workers = 1, .busy_poll = 1);
+  end = fio_last_tick();
+  fio_timer_clear_all();
+  fio_data->busy_poll = 0;
+  FIO_ASSERT(end.tv_sec == start.tv_sec + 1 || end.tv_sec == start.tv_sec + 2,
+             "facil.io busy polling cycling error?");
+  fprintf(stderr, "* testing connection draining deadline.\n");
+  int fds[2];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds),
+             "socketpair failed for draining test");
+  fio_protocol_s lingering = {
+      .on_shutdown = fio_cycle_test_on_shutdown,
+      .on_close = fio_cycle_test_on_close,
+  };
+  fio_attach_fd(fds[0], &lingering);
+  fio_mark_time();
+  start = fio_last_tick();
+  fio_run_every(1000, 1, fio_cycle_test_task, NULL, NULL);
+  fio_run_every(10000, 1, fio_cycle_test_task2, NULL, NULL);
+  fio_start(.threads = 1, .workers = 1, .shutdown_timeout = 1);
+  end = fio_last_tick();
+  fio_timer_clear_all();
+  close(fds[1]);
+  FIO_ASSERT(end.tv_sec >= start.tv_sec + 2 && end.tv_sec <= start.tv_sec + 3,
+             "facil.io draining deadline error (%ds)?",
+             (int)(end.tv_sec - start.tv_sec));
+  FIO_ASSERT(fio_cycle_test_closed && !fio_draining(),
+             "lingering connection should have been closed after deadline");
+  fprintf(stderr, "* passed.\n");
+}
+/* *****************************************************************************
+Testing CPU affinity (worker placement)
+***************************************************************************** */
+
+FIO_FUNC void fio_affinity_test(void) {
+#if defined(__linux__) && defined(CPU_SETSIZE)
+  fprintf(stderr, "=== Testing CPU affinity (worker placement)\n");
+  cpu_set_t allowed, set;
+  FIO_ASSERT(!sched_getaffinity(0, sizeof(allowed), &allowed),
+             "couldn't read CPU affinity");
+  const size_t total = CPU_COUNT(&allowed);
+  const uint16_t old_workers = fio_data->workers;
+  size_t count = 0;
+  fio_data->affinity = FIO_AFFINITY_CORES;
+  fio_data->workers = 2;
+  for (size_t i = 0; i < 2; ++i) {
+    fio_data->worker_index = i;
+    fio_affinity_worker();
+    FIO_ASSERT(fio_affinity.count, "worker %zu wasn't pinned", i);
+    FIO_ASSERT(!sched_getaffinity(0, sizeof(set), &set),
+               "couldn't read CPU affinity");
+    FIO_ASSERT((size_t)CPU_COUNT(&set) == fio_affinity.count,
+               "worker %zu affinity doesn't match it's CPU list", i);
+    CPU_AND(&set, &set, &allowed);
+    FIO_ASSERT((size_t)CPU_COUNT(&set) == fio_affinity.count,
+               "worker %zu pinned to a CPU core that isn't allowed", i);
+    count += fio_affinity.count;
+    sched_setaffinity(0, sizeof(allowed), &allowed);
+  }
+  FIO_ASSERT(count == (total > 1 ? total : 2),
+             "worker slices should cover all CPU cores (%zu != %zu)", count,
+             total);
+  fio_data->affinity = FIO_AFFINITY_NONE;
+  fio_data->workers = old_workers;
+  fio_data->worker_index = 0;
+  fio_affinity.count = 0;
   fprintf(stderr, "* passed.\n");
+#endif
 }
+
 /* *****************************************************************************
 Testing fio_defer task system
 ***************************************************************************** */
@@ -9586,6 +13459,43 @@ FIO_FUNC void sched_sample_task(void *count, void *i_count) {
   }
 }
 
+/* increments a (non atomic) counter under a parking lock */
+FIO_FUNC void *fio_park_lock_test_task(void *counter) {
+  static fio_park_lock_i lock = FIO_PARK_LOCK_INIT;
+  for (size_t i = 0; i < 100000; ++i) {
+    fio_park_lock(&lock);
+    ++*(size_t *)counter;
+    fio_park_unlock(&lock);
+  }
+  return NULL;
+}
+
+FIO_FUNC void fio_park_lock_test(void) {
+  fprintf(stderr, "=== Testing adaptive (parking) locks\n");
+  fio_park_lock_i lock = FIO_PARK_LOCK_INIT;
+  FIO_ASSERT(!fio_park_trylock(&lock), "fio_park_trylock failed when unlocked");
+  FIO_ASSERT(fio_park_trylock(&lock), "fio_park_trylock succeeded twice");
+  fio_park_unlock(&lock);
+  FIO_ASSERT(lock == FIO_PARK_LOCK_INIT, "fio_park_unlock didn't unlock");
+  size_t counter = 0;
+  pthread_t threads[4];
+  for (size_t i = 0; i < 4; ++i)
+    FIO_ASSERT(!pthread_create(threads + i, NULL, fio_park_lock_test_task,
+                               &counter),
+               "couldn't create thread for fio_park_lock test");
+  for (size_t i = 0; i < 4; ++i)
+    pthread_join(threads[i], NULL);
+  FIO_ASSERT(counter == 400000, "fio_park_lock race detected (%zu != 400000)",
+             counter);
+  fprintf(stderr, "* passed.\n");
+}
+
+/* records the order in which task classes are performed */
+FIO_FUNC void fio_defer_test_class_task(void *log_, void *task_class) {
+  uintptr_t *log = log_;
+  log[++log[0]] = (uintptr_t)task_class;
+}
+
 FIO_FUNC void fio_defer_test(void) {
   const size_t cpu_cores = fio_detect_cpu_cores();
   FIO_ASSERT(cpu_cores, "couldn't detect CPU cores!");
@@ -9643,6 +13553,38 @@ FIO_FUNC void fio_defer_test(void) {
   }
   FIO_ASSERT(task_queue_normal.writer == &task_queue_normal.static_queue,
              "defer library didn't release dynamic queue (should be static)");
+  {
+    /* a flooded task class shouldn't starve the default class */
+    uintptr_t log[81] = {0};
+    fio_defer_weight_set(FIO_TASK_DEFAULT, 8);
+    fio_defer_weight_set(FIO_TASK_PUBSUB, 4);
+    for (size_t i = 0; i < 64; ++i)
+      fio_defer_class(FIO_TASK_PUBSUB, fio_defer_test_class_task, log,
+                      (void *)FIO_TASK_PUBSUB);
+    for (size_t i = 0; i < 16; ++i)
+      fio_defer_class(FIO_TASK_DEFAULT, fio_defer_test_class_task, log,
+                      (void *)FIO_TASK_DEFAULT);
+    FIO_ASSERT(fio_defer_queue_depth(FIO_TASK_PUBSUB) == 64 &&
+                   fio_defer_queue_depth(FIO_TASK_DEFAULT) == 16 &&
+                   fio_defer_queue_depth(FIO_TASK_BULK) == 0,
+               "task class queue depth error");
+    FIO_ASSERT(fio_defer_class(FIO_TASK_CLASS_COUNT, sample_task, NULL, NULL),
+               "fio_defer_class should fail for an invalid task class");
+    fio_defer_perform();
+    FIO_ASSERT(log[0] == 80 && !fio_defer_queue_depth(FIO_TASK_PUBSUB),
+               "task classes weren't performed (%zu tasks)", (size_t)log[0]);
+    size_t last_default = 0;
+    for (size_t i = 1; i <= 80; ++i) {
+      if (log[i] == FIO_TASK_DEFAULT)
+        last_default = i;
+    }
+    /* 8 default tasks, 4 pub/sub tasks, 8 default tasks */
+    FIO_ASSERT(last_default == 20,
+               "task classes weren't weighted (last default task at %zu)",
+               last_default);
+    fio_defer_weight_set(FIO_TASK_DEFAULT, FIO_TASK_WEIGHT_DEFAULT);
+    fio_defer_weight_set(FIO_TASK_PUBSUB, FIO_TASK_WEIGHT_PUBSUB);
+  }
   fprintf(stderr, "\n* passed.\n");
 }
 
@@ -9700,6 +13642,119 @@ Set data-structure Testing
 #define FIO_SET_OBJ_TYPE uintptr_t
 #include <fio.h>
 
+#define FIO_SET_NAME fio_set_group_test
+#define FIO_SET_OBJ_TYPE uintptr_t
+#define FIO_SET_OBJ_COMPARE(a, b) ((a) == (b))
+#define FIO_SET_GROUP_PROBING 1
+#include <fio.h>
+
+#define FIO_SET_NAME fio_hash_group_test
+#define FIO_SET_KEY_TYPE uintptr_t
+#define FIO_SET_OBJ_TYPE uintptr_t
+#define FIO_SET_GROUP_PROBING 1
+#include <fio.h>
+
+FIO_FUNC void fio_set_group_probing_test(void) {
+  fio_set_group_test_s s = FIO_SET_INIT;
+  fio_hash_group_test_s h = FIO_SET_INIT;
+  fprintf(stderr, "=== Testing Set group probing (FIO_SET_GROUP_PROBING)\n");
+  /* small maps (less than a single group) */
+  for (uintptr_t i = 1; i < 8; ++i) {
+    fio_set_group_test_insert(&s, i, i);
+    FIO_ASSERT(fio_set_group_test_find(&s, i, i) == i,
+               "group probing find failed on small set (%zu)", (size_t)i);
+  }
+  FIO_ASSERT(fio_set_group_test_capa(&s) < 16,
+             "group probing small set shouldn't grow to a full group (%zu)",
+             fio_set_group_test_capa(&s));
+  FIO_ASSERT(!fio_set_group_test_find(&s, 9, 9),
+             "group probing found a missing object in a small set");
+  fio_set_group_test_free(&s);
+  /* popping clears the popped object's slot */
+  for (uintptr_t i = 1; i < 8; ++i)
+    fio_set_group_test_insert(&s, i, i);
+  fio_set_group_test_pop(&s);
+  fio_set_group_test_pop(&s);
+  {
+    size_t used = 0;
+    const size_t groups =
+        ((s.capa + (s.capa >> 2)) / FIO_SET_GROUP_SIZE) + 1;
+    for (size_t g = 0; g < groups; ++g) {
+      for (size_t i = 0; i < FIO_SET_GROUP_SIZE; ++i)
+        used += (s.map[g].ctrl[i] >> 7);
+    }
+    FIO_ASSERT(used == fio_set_group_test_count(&s) && used == 5,
+               "group probing pop left stale slots (%zu used, %zu objects)",
+               used, fio_set_group_test_count(&s));
+    FIO_ASSERT(!fio_set_group_test_find(&s, 7, 7) &&
+                   fio_set_group_test_find(&s, 5, 5) == 5,
+               "group probing pop error");
+  }
+  fio_set_group_test_free(&s);
+
+  for (uintptr_t i = 1; i < FIO_SET_TEST_COUNT; ++i) {
+    fio_set_group_test_insert(&s, i, i);
+    fio_hash_group_test_insert(&h, i, i, i + 1, NULL);
+  }
+  FIO_ASSERT(fio_set_group_test_count(&s) == FIO_SET_TEST_COUNT - 1,
+             "group probing count error (%zu)", fio_set_group_test_count(&s));
+  for (uintptr_t i = 1; i < FIO_SET_TEST_COUNT; ++i) {
+    FIO_ASSERT(fio_set_group_test_find(&s, i, i) == i,
+               "group probing set find failed (%zu)", (size_t)i);
+    FIO_ASSERT(fio_hash_group_test_find(&h, i, i) == i + 1,
+               "group probing hash find failed (%zu)", (size_t)i);
+    FIO_ASSERT(!fio_set_group_test_find(&s, i + FIO_SET_TEST_COUNT,
+                                        i + FIO_SET_TEST_COUNT),
+               "group probing found a missing object (%zu)", (size_t)i);
+  }
+  {
+    uintptr_t i = 1;
+    FIO_SET_FOR_LOOP(&h, pos) {
+      FIO_ASSERT(pos->obj.key == i, "group probing order mismatch %lu != %lu.",
+                 (unsigned long)i, (unsigned long)pos->obj.key);
+      ++i;
+    }
+  }
+  for (uintptr_t i = 1; i < FIO_SET_TEST_COUNT; i += 2) {
+    FIO_ASSERT(!fio_set_group_test_remove(&s, i, i, NULL),
+               "group probing removal failed (%zu)", (size_t)i);
+    fio_hash_group_test_remove(&h, i, i, NULL);
+    FIO_ASSERT(!fio_set_group_test_find(&s, i, i),
+               "group probing removal failed in set (still exists).");
+    FIO_ASSERT(!fio_hash_group_test_find(&h, i, i),
+               "group probing removal failed in hash (still exists).");
+  }
+  for (uintptr_t i = 2; i < FIO_SET_TEST_COUNT; i += 2) {
+    FIO_ASSERT(fio_set_group_test_find(&s, i, i) == i,
+               "group probing lost an object after removals (%zu)", (size_t)i);
+  }
+  fio_set_group_test_insert(&s, 1, 1);
+  FIO_ASSERT(fio_set_group_test_find(&s, 1, 1) == 1,
+             "group probing failed to re-add a removed object");
+  fio_set_group_test_compact(&s);
+  for (uintptr_t i = 2; i < FIO_SET_TEST_COUNT; i += 2) {
+    FIO_ASSERT(fio_set_group_test_find(&s, i, i) == i,
+               "group probing lost an object after compact (%zu)", (size_t)i);
+  }
+  fio_set_group_test_free(&s);
+  fio_hash_group_test_free(&h);
+  /* full collision attack */
+  for (uintptr_t i = 0; i < FIO_SET_TEST_COUNT; ++i) {
+    fio_set_group_test_insert(&s, 1, i + 1);
+  }
+  FIO_ASSERT(fio_set_group_test_count(&s) != FIO_SET_TEST_COUNT,
+             "group probing attack success! too many full-collisions inserts!");
+  fio_set_group_test_free(&s);
+  /* partial collision attack */
+  for (uintptr_t i = 0; i < FIO_SET_TEST_COUNT; ++i) {
+    fio_set_group_test_insert(&s, ((i << 20) | 1), i + 1);
+  }
+  FIO_ASSERT(fio_set_group_test_count(&s) == FIO_SET_TEST_COUNT,
+             "group probing partial collision resolusion failed!");
+  fio_set_group_test_free(&s);
+  fprintf(stderr, "* passed.\n");
+}
+
 FIO_FUNC void fio_set_test(void) {
   fio_set_test_s s = FIO_SET_INIT;
   fio_hash_test_s h = FIO_SET_INIT;
@@ -10682,6 +14737,23 @@ FIO_FUNC void fio_pubsub_test_on_unsubscribe(void *udata1, void *udata2) {
   (void)udata2;
 }
 
+/* looks up channels without locking, while they are created and removed */
+FIO_FUNC void *fio_pubsub_test_reader(void *stop_) {
+  volatile uintptr_t *stop = stop_;
+  char name[] = "lockfree-0";
+  fio_str_info_s str = {.data = name, .len = 10};
+  for (size_t i = 0; !*stop; ++i) {
+    name[9] = '0' + (i & 7);
+    channel_s *ch = fio_channel_find_dup(str);
+    if (ch) {
+      FIO_ASSERT(ch->name_len == 10 && !memcmp(ch->name, name, 10),
+                 "lock free lookup found the wrong channel!");
+      fio_channel_free(ch);
+    }
+  }
+  return NULL;
+}
+
 FIO_FUNC void fio_pubsub_test(void) {
   fprintf(stderr, "=== Testing pub/sub (partial)\n");
   fio_data->active = 1;
@@ -10731,6 +14803,61 @@ FIO_FUNC void fio_pubsub_test(void) {
   ++expect;
   fio_defer_perform();
   FIO_ASSERT(counter == expect, "unsubscribe wasn't called for named channel!");
+  {
+    /* test batched delivery (more subscriptions than a single batch) */
+    const size_t count = (FIO_PUBSUB_BATCH_SIZE * 2) + 3;
+    subscription_s **subs = fio_malloc(sizeof(*subs) * count);
+    FIO_ASSERT_ALLOC(subs);
+    for (size_t i = 0; i < count; ++i) {
+      subs[i] = fio_subscribe(.channel = {0, 5, "batch"}, .udata1 = &counter,
+                              .on_message = fio_pubsub_test_on_message,
+                              .on_unsubscribe = fio_pubsub_test_on_unsubscribe);
+      FIO_ASSERT(subs[i], "fio_subscribe FAILED on batched subscription.");
+    }
+    fio_publish(.channel = {0, 5, "batch"});
+    expect += count;
+    fio_defer_perform();
+    FIO_ASSERT(counter == expect,
+               "batched publishing missed subscriptions (%zu != %zu)!",
+               (size_t)counter, (size_t)expect);
+    for (size_t i = 0; i < count; ++i) {
+      fio_unsubscribe(subs[i]);
+    }
+    expect += count;
+    fio_defer_perform();
+    FIO_ASSERT(counter == expect, "unsubscribe wasn't called for batch!");
+    fio_free(subs);
+  }
+  {
+    /* lock free lookups race channel creation and removal */
+    volatile uintptr_t stop = 0;
+    void *threads[4];
+    for (size_t i = 0; i < 4; ++i) {
+      threads[i] = fio_thread_new(fio_pubsub_test_reader, (void *)&stop);
+      FIO_ASSERT(threads[i], "couldn't start lock free lookup thread");
+    }
+    char name[] = "lockfree-0";
+    fio_str_info_s str = {.data = name, .len = 10};
+    for (size_t i = 0; i < 4096; ++i) {
+      name[9] = '0' + (i & 7);
+      subscription_s *tmp =
+          fio_subscribe(.channel = {0, 10, name}, .udata1 = &counter,
+                        .on_message = fio_pubsub_test_on_message,
+                        .on_unsubscribe = fio_pubsub_test_on_unsubscribe);
+      FIO_ASSERT(fio_channel_find_dup(str) == tmp->parent,
+                 "lock free lookup missed a new channel!");
+      fio_channel_free(tmp->parent);
+      fio_unsubscribe(tmp);
+      ++expect;
+    }
+    stop = 1;
+    for (size_t i = 0; i < 4; ++i)
+      fio_thread_join(threads[i]);
+    fio_defer_perform();
+    FIO_ASSERT(counter == expect, "lock free lookup test lost subscriptions!");
+    FIO_ASSERT(!fio_channel_find_dup(str),
+               "lock free lookup found a removed channel!");
+  }
   fio_data->is_worker = 0;
   fio_data->active = 0;
   fio_data->workers = 0;
@@ -10739,8 +14866,445 @@ FIO_FUNC void fio_pubsub_test(void) {
   (void)fio_pubsub_test_on_unsubscribe;
   fprintf(stderr, "* passed.\n");
 }
+
+FIO_FUNC void fio_cluster_fd_test(void) {
+  fprintf(stderr, "=== Testing cluster descriptor passing (SCM_RIGHTS)\n");
+  int sv[2], pv[2];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv) && !pipe(pv),
+             "socketpair / pipe failed");
+  fio_set_non_block(sv[0]);
+  fio_set_non_block(sv[1]);
+  intptr_t a = fio_fd2uuid(sv[0]);
+  intptr_t b = fio_fd2uuid(sv[1]);
+  cluster_pr_s *pa = (cluster_pr_s *)fio_cluster_protocol_alloc(a, NULL, NULL);
+  cluster_pr_s *pb = (cluster_pr_s *)fio_cluster_protocol_alloc(b, NULL, NULL);
+  fio_rw_hook_set(a, &FIO_CLUSTER_RW_HOOKS, pa);
+  fio_rw_hook_set(b, &FIO_CLUSTER_RW_HOOKS, pb);
+  fio_attach(a, &pa->protocol);
+  /* a batched message, followed by a message carrying the pipe's write end */
+  fio_msg_internal_s *m = fio_msg_internal_create(
+      0, FIO_CLUSTER_MSG_PING, (fio_str_info_s){.len = 0},
+      (fio_str_info_s){.len = 0}, 0, 1);
+  fio_cluster_send(pa, m);
+  fio_msg_internal_free(m);
+  m = fio_msg_internal_create(
+      1, FIO_CLUSTER_MSG_MIGRATE, (fio_str_info_s){.data = "unread", .len = 6},
+      (fio_str_info_s){.data = "state", .len = 5}, 0, 1);
+  fio_cluster_send_fd(pa, m, pv[1]);
+  fio_msg_internal_free(m);
+  FIO_ASSERT(pa->queued == 18 + 16 + 6 + 5 + 2,
+             "cluster stream position error (%zu)", (size_t)pa->queued);
+  fio_defer_perform(); /* the scheduled batch flush finds an empty batch */
+  FIO_ASSERT(!pa->batch_scheduled, "cluster batch flush wasn't performed");
+  while (fio_flush(a) > 0)
+    ;
+  FIO_ASSERT(pa->written == pa->queued && !pa->fds_out,
+             "descriptor wasn't sent with the cluster data");
+  char buf[128];
+  size_t len = 0;
+  ssize_t r;
+  while ((r = fio_read(b, buf + len, sizeof(buf) - len)) > 0)
+    len += r;
+  FIO_ASSERT(len == pa->queued, "cluster data missing (%zu)", len);
+  FIO_ASSERT(!memcmp(buf + 18 + 16, "unread", 6),
+             "migrated connection data error");
+  int fd = fio_cluster_fd_collect(pb);
+  FIO_ASSERT(fd != -1 && !pb->fds_in, "descriptor wasn't received");
+  FIO_ASSERT(write(fd, "ok", 2) == 2 && read(pv[0], buf, 2) == 2 &&
+                 !memcmp(buf, "ok", 2),
+             "received descriptor isn't the pipe's write end");
+  close(fd);
+  close(pv[0]);
+  fio_force_close(a); /* calls `on_close` for the attached protocol */
+  fio_force_close(b);
+  fio_cluster_on_close(b, &pb->protocol);
+  fio_defer_perform();
+  fprintf(stderr, "* passed.\n");
+}
+
+static struct {
+  fio_protocol_s source;
+  fio_protocol_s target;
+  pid_t worker;
+  intptr_t arrived;
+  size_t reads;
+  size_t len;
+  char buf[32];
+  uint8_t closed;
+} fio_cluster_migrate_test_data;
+
+/* source worker: reads part of the data and migrates the connection */
+FIO_FUNC void fio_cluster_migrate_test_source(intptr_t uuid,
+                                              fio_protocol_s *pr) {
+  char buf[8];
+  ++fio_cluster_migrate_test_data.reads;
+  ssize_t r = fio_read(uuid, buf, 6);
+  FIO_ASSERT(r == 6, "migration test source read error (%zd)", r);
+  /* an event that was already scheduled shouldn't reach the source */
+  fio_force_event(uuid, FIO_EVENT_ON_DATA);
+  FIO_ASSERT(!fio_migrate(uuid, fio_cluster_migrate_test_data.worker,
+                          (fio_str_info_s){.data = buf, .len = 6},
+                          (fio_str_info_s){.data = "state", .len = 5}),
+             "fio_migrate failed: %s", strerror(errno));
+  (void)pr;
+}
+
+FIO_FUNC void fio_cluster_migrate_test_source_close(intptr_t uuid,
+                                                    fio_protocol_s *pr) {
+  fio_cluster_migrate_test_data.closed = 1;
+  (void)uuid;
+  (void)pr;
+}
+
+/* target worker: reads the unread data followed by the socket's data */
+FIO_FUNC void fio_cluster_migrate_test_target(intptr_t uuid,
+                                              fio_protocol_s *pr) {
+  ssize_t r;
+  while ((r = fio_read(uuid,
+                       fio_cluster_migrate_test_data.buf +
+                           fio_cluster_migrate_test_data.len,
+                       sizeof(fio_cluster_migrate_test_data.buf) - 1 -
+                           fio_cluster_migrate_test_data.len)) > 0)
+    fio_cluster_migrate_test_data.len += r;
+  (void)pr;
+}
+
+FIO_FUNC void fio_cluster_migrate_test_arrival(intptr_t uuid,
+                                               fio_str_info_s state) {
+  FIO_ASSERT(state.len == 5 && !memcmp(state.data, "state", 5),
+             "migrated connection state error (%.*s)", (int)state.len,
+             state.data);
+  fio_cluster_migrate_test_data.arrived = uuid;
+  fio_attach(uuid, &fio_cluster_migrate_test_data.target);
+}
+
+/* links a (fake) worker to the root, both ends are in this process */
+FIO_FUNC void fio_cluster_migrate_test_link(cluster_pr_s **worker,
+                                            cluster_pr_s **root, pid_t pid) {
+  int sv[2];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv), "socketpair failed");
+  fio_set_non_block(sv[0]);
+  fio_set_non_block(sv[1]);
+  intptr_t w = fio_fd2uuid(sv[0]);
+  intptr_t r = fio_fd2uuid(sv[1]);
+  *worker = (cluster_pr_s *)fio_cluster_protocol_alloc(
+      w, fio_cluster_client_handler, fio_cluster_client_sender);
+  *root = (cluster_pr_s *)fio_cluster_protocol_alloc(
+      r, fio_cluster_server_handler, fio_cluster_server_sender);
+  (*root)->pid = pid;
+  fio_rw_hook_set(w, &FIO_CLUSTER_RW_HOOKS, *worker);
+  fio_rw_hook_set(r, &FIO_CLUSTER_RW_HOOKS, *root);
+  fio_lock(&cluster_data.lock);
+  fio_ls_push(&cluster_data.clients, *root);
+  fio_unlock(&cluster_data.lock);
+  fio_attach(w, &(*worker)->protocol);
+  fio_attach(r, &(*root)->protocol);
+}
+
+FIO_FUNC void fio_cluster_migrate_test(void) {
+  fprintf(stderr, "=== Testing connection migration (worker to worker)\n");
+  size_t junk;
+  cluster_pr_s *source, *source_root, *target, *target_root;
+  int sv[2];
+  fio_cluster_migrate_test_data.source = (fio_protocol_s){
+      .on_data = fio_cluster_migrate_test_source,
+      .on_close = fio_cluster_migrate_test_source_close,
+  };
+  fio_cluster_migrate_test_data.target = (fio_protocol_s){
+      .on_data = fio_cluster_migrate_test_target,
+  };
+  fio_cluster_migrate_test_data.worker = getpid() + 1;
+  fio_data->is_worker = 1;
+  fio_data->workers = 2;
+  fio_cluster_migrate_test_link(&source, &source_root, getpid());
+  fio_cluster_migrate_test_link(&target, &target_root,
+                                fio_cluster_migrate_test_data.worker);
+  cluster_data.client = source;
+  fio_migrate_on_arrival(fio_cluster_migrate_test_arrival);
+  /* prevent poll from hanging */
+  fio_run_every(5, 0, fio_timer_test_task, &junk, NULL);
+
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv), "socketpair failed");
+  fio_set_non_block(sv[0]);
+  fio_attach_fd(sv[0], &fio_cluster_migrate_test_data.source);
+  FIO_ASSERT(write(sv[1], "first-second", 12) == 12,
+             "migration test write error");
+  for (size_t i = 0; i < 256 && fio_cluster_migrate_test_data.len < 12; ++i) {
+    fio_mark_time();
+    fio_poll();
+    fio_defer_perform();
+  }
+  FIO_ASSERT(fio_cluster_migrate_test_data.arrived,
+             "migrated connection didn't arrive");
+  FIO_ASSERT(fio_cluster_migrate_test_data.reads == 1,
+             "the source read after migrating (%zu reads)",
+             fio_cluster_migrate_test_data.reads);
+  FIO_ASSERT(fio_cluster_migrate_test_data.closed,
+             "migrated connection wasn't closed in the source worker");
+  FIO_ASSERT(fio_cluster_migrate_test_data.len == 12 &&
+                 !memcmp(fio_cluster_migrate_test_data.buf, "first-second",
+                         12),
+             "migrated connection data error (%.*s)",
+             (int)fio_cluster_migrate_test_data.len,
+             fio_cluster_migrate_test_data.buf);
+  /* the connection is still open (the client wasn't disconnected) */
+  FIO_ASSERT(write(sv[1], "!", 1) == 1, "migrated connection was closed");
+  close(sv[1]);
+
+  fio_timer_clear_all();
+  fio_migrate_on_arrival(NULL);
+  fio_force_close(fio_cluster_migrate_test_data.arrived);
+  fio_force_close(source->uuid);
+  fio_force_close(target->uuid);
+  fio_defer_perform();
+  fio_data->is_worker = 0;
+  fio_data->workers = 0;
+  fio_force_close(source_root->uuid);
+  fio_force_close(target_root->uuid);
+  fio_defer_perform();
+  FIO_ASSERT(!cluster_data.client && !fio_ls_any(&cluster_data.clients),
+             "migration test cluster connections weren't closed");
+  fprintf(stderr, "* passed.\n");
+}
+/* root: a worker (un)subscribes, as if the message arrived from the worker */
+FIO_FUNC void fio_cluster_routing_test_sub(cluster_pr_s *pr, uint32_t type,
+                                           char *channel) {
+  char match[8];
+  fio_u2str64(match, (uintptr_t)FIO_MATCH_GLOB);
+  pr->type = type;
+  pr->msg = fio_msg_internal_create(
+      0, type, (fio_str_info_s){.data = channel, .len = strlen(channel)},
+      (fio_str_info_s){.data = match, .len = 8}, 0, 1);
+  fio_cluster_server_handler(pr);
+  fio_msg_internal_free(pr->msg);
+  pr->msg = NULL;
+}
+
+/* root: sends a message and counts the messages each worker received */
+FIO_FUNC void fio_cluster_routing_test_send(intptr_t *root, int *worker,
+                                            size_t *count, int32_t filter,
+                                            uint32_t type, char *channel) {
+  fio_cluster_server_sender(
+      fio_msg_internal_create(
+          filter, type,
+          (fio_str_info_s){.data = channel, .len = strlen(channel)},
+          (fio_str_info_s){.data = "data", .len = 4}, 0, 1),
+      -1);
+  fio_defer_perform(); /* the batch is flushed by a deferred task */
+  for (size_t i = 0; i < 2; ++i) {
+    char buf[256];
+    size_t len = 0;
+    ssize_t r;
+    while (fio_flush(root[i]) > 0)
+      ;
+    while ((r = read(worker[i], buf + len, sizeof(buf) - len)) > 0)
+      len += r;
+    count[i] = 0;
+    for (size_t pos = 0; pos + 16 <= len; ++count[i]) {
+      FIO_ASSERT(fio_str2u32(buf + pos + 8) == type &&
+                     fio_str2u32(buf + pos + 12) == (uint32_t)filter,
+                 "cluster routing test received the wrong message");
+      pos += 16 + fio_str2u32(buf + pos) + fio_str2u32(buf + pos + 4) + 2;
+    }
+  }
+}
+
+FIO_FUNC void fio_cluster_routing_test(void) {
+  fprintf(stderr, "=== Testing cluster message routing (root)\n");
+  intptr_t root[2];
+  int worker[2];
+  cluster_pr_s *pr[2];
+  size_t count[2];
+  for (size_t i = 0; i < 2; ++i) {
+    int sv[2];
+    FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv), "socketpair failed");
+    fio_set_non_block(sv[0]);
+    fio_set_non_block(sv[1]);
+    root[i] = fio_fd2uuid(sv[0]);
+    worker[i] = sv[1];
+    pr[i] = (cluster_pr_s *)fio_cluster_protocol_alloc(
+        root[i], fio_cluster_server_handler, fio_cluster_server_sender);
+    fio_rw_hook_set(root[i], &FIO_CLUSTER_RW_HOOKS, pr[i]);
+    fio_lock(&cluster_data.lock);
+    fio_ls_push(&cluster_data.clients, pr[i]);
+    fio_unlock(&cluster_data.lock);
+    fio_attach(root[i], &pr[i]->protocol);
+  }
+  fio_cluster_routing_test_sub(pr[0], FIO_CLUSTER_MSG_PUBSUB_SUB, "news");
+  fio_cluster_routing_test_sub(pr[1], FIO_CLUSTER_MSG_PATTERN_SUB, "sport*");
+
+  fio_cluster_routing_test_send(root, worker, count, 0,
+                                FIO_CLUSTER_MSG_FORWARD, "news");
+  FIO_ASSERT(count[0] == 1 && count[1] == 0,
+             "channel message routing error (%zu, %zu)", count[0], count[1]);
+  fio_cluster_routing_test_send(root, worker, count, 0, FIO_CLUSTER_MSG_JSON,
+                                "sports");
+  FIO_ASSERT(count[0] == 0 && count[1] == 1,
+             "pattern message routing error (%zu, %zu)", count[0], count[1]);
+  fio_cluster_routing_test_send(root, worker, count, 0,
+                                FIO_CLUSTER_MSG_FORWARD, "weather");
+  FIO_ASSERT(count[0] == 0 && count[1] == 0,
+             "a message without subscribers was sent (%zu, %zu)", count[0],
+             count[1]);
+  /* filter messages and control messages reach every worker */
+  fio_cluster_routing_test_send(root, worker, count, 7,
+                                FIO_CLUSTER_MSG_FORWARD, "");
+  FIO_ASSERT(count[0] == 1 && count[1] == 1,
+             "filter message wasn't sent to all workers (%zu, %zu)", count[0],
+             count[1]);
+  fio_cluster_routing_test_send(root, worker, count, 0, FIO_CLUSTER_MSG_PING,
+                                "");
+  FIO_ASSERT(count[0] == 1 && count[1] == 1,
+             "control message wasn't sent to all workers (%zu, %zu)",
+             count[0], count[1]);
+
+  fio_cluster_routing_test_sub(pr[0], FIO_CLUSTER_MSG_PUBSUB_UNSUB, "news");
+  fio_cluster_routing_test_send(root, worker, count, 0,
+                                FIO_CLUSTER_MSG_FORWARD, "news");
+  FIO_ASSERT(count[0] == 0 && count[1] == 0,
+             "message routed after unsubscribing (%zu, %zu)", count[0],
+             count[1]);
+  for (size_t i = 0; i < 2; ++i) {
+    fio_force_close(root[i]);
+    close(worker[i]);
+  }
+  fio_defer_perform();
+  FIO_ASSERT(!fio_ls_any(&cluster_data.clients),
+             "cluster routing test clients weren't removed");
+  fprintf(stderr, "* passed.\n");
+}
+typedef struct {
+  fio_str_info_s expected[5];
+  size_t count;
+} fio_cluster_parser_test_s;
+
+FIO_FUNC void fio_cluster_parser_test_on_message(fio_msg_s *msg) {
+  fio_cluster_parser_test_s *t = msg->udata1;
+  FIO_ASSERT(t->count < 5, "cluster parser test received too many messages");
+  fio_str_info_s e = t->expected[t->count++];
+  FIO_ASSERT(msg->msg.len == e.len && !memcmp(msg->msg.data, e.data, e.len),
+             "cluster message %zu corrupted (%zu bytes)", t->count - 1,
+             msg->msg.len);
+  FIO_ASSERT(msg->filter || (msg->channel.len == 6 &&
+                             !memcmp(msg->channel.data, "parser", 6)),
+             "cluster message %zu channel corrupted", t->count - 1);
+}
+
+/* writes the stream in chunks (split anywhere) and reads it using `on_data` */
+FIO_FUNC void fio_cluster_parser_test_run(fio_cluster_parser_test_s *t,
+                                          char *stream, size_t len,
+                                          uint64_t seed) {
+  int sv[2];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv), "socketpair failed");
+  fio_set_non_block(sv[1]);
+  intptr_t uuid = fio_fd2uuid(sv[1]);
+  cluster_pr_s *pr = (cluster_pr_s *)fio_cluster_protocol_alloc(
+      uuid, fio_cluster_client_handler, fio_cluster_client_sender);
+  fio_rw_hook_set(uuid, &FIO_CLUSTER_RW_HOOKS, pr);
+  t->count = 0;
+  for (size_t pos = 0; pos < len;) {
+    size_t chunk = len - pos;
+    if (seed) {
+      /* mostly short chunks, splitting headers, with a few long ones */
+      seed = (seed * 6364136223846793005ULL) + 1442695040888963407ULL;
+      size_t r = (size_t)(seed >> 33);
+      r = (r & 3) ? 1 + ((r >> 2) % 23) : 1 + ((r >> 2) % 9000);
+      if (chunk > r)
+        chunk = r;
+    }
+    FIO_ASSERT(write(sv[0], stream + pos, chunk) == (ssize_t)chunk,
+               "cluster parser test write error");
+    pos += chunk;
+    int pending = 0;
+    do {
+      pr->protocol.on_data(uuid, &pr->protocol);
+    } while (!ioctl(sv[1], FIONREAD, &pending) && pending > 0);
+    fio_defer_perform();
+  }
+  FIO_ASSERT(t->count == 5 && !pr->msg && !pr->length,
+             "cluster parser test missed messages (%zu received)", t->count);
+  close(sv[0]);
+  fio_force_close(uuid);
+  fio_cluster_on_close(uuid, &pr->protocol);
+  fio_defer_perform();
+}
+
+FIO_FUNC void fio_cluster_parser_test(void) {
+  fprintf(stderr, "=== Testing cluster message parsing (split reads)\n");
+  fio_data->is_worker = 1;
+  fio_data->workers = 1;
+  const size_t large_len = (CLUSTER_READ_BUFFER * 2) + 123;
+  char *large = fio_malloc(large_len);
+  FIO_ASSERT_ALLOC(large);
+  for (size_t i = 0; i < large_len; ++i)
+    large[i] = (char)('a' + (i % 26));
+  fio_cluster_parser_test_s t = {
+      .expected =
+          {
+              {.data = "one", .len = 3},
+              {.data = "two", .len = 3},
+              {.data = large, .len = large_len},
+              {.data = "filtered", .len = 8},
+              {.data = "last", .len = 4},
+          },
+  };
+  subscription_s *s1 =
+      fio_subscribe(.channel = {0, 6, "parser"}, .udata1 = &t,
+                    .on_message = fio_cluster_parser_test_on_message);
+  subscription_s *s2 =
+      fio_subscribe(.filter = 9, .udata1 = &t,
+                    .on_message = fio_cluster_parser_test_on_message);
+  FIO_ASSERT(s1 && s2, "cluster parser test couldn't subscribe");
+  /* a batch of messages (a ping isn't published) */
+  fio_msg_internal_s *m[6] = {
+      fio_msg_internal_create(0, FIO_CLUSTER_MSG_FORWARD,
+                              (fio_str_info_s){.data = "parser", .len = 6},
+                              t.expected[0], 0, 1),
+      fio_msg_internal_create(0, FIO_CLUSTER_MSG_FORWARD,
+                              (fio_str_info_s){.data = "parser", .len = 6},
+                              t.expected[1], 0, 1),
+      fio_msg_internal_create(0, FIO_CLUSTER_MSG_PING,
+                              (fio_str_info_s){.len = 0},
+                              (fio_str_info_s){.len = 0}, 0, 1),
+      fio_msg_internal_create(0, FIO_CLUSTER_MSG_FORWARD,
+                              (fio_str_info_s){.data = "parser", .len = 6},
+                              t.expected[2], 0, 1),
+      fio_msg_internal_create(9, FIO_CLUSTER_MSG_FORWARD,
+                              (fio_str_info_s){.len = 0}, t.expected[3], 0, 1),
+      fio_msg_internal_create(0, FIO_CLUSTER_MSG_FORWARD,
+                              (fio_str_info_s){.data = "parser", .len = 6},
+                              t.expected[4], 0, 1),
+  };
+  size_t len = 0;
+  for (size_t i = 0; i < 6; ++i)
+    len += 16 + m[i]->channel.len + m[i]->data.len + 2;
+  char *stream = fio_malloc(len);
+  FIO_ASSERT_ALLOC(stream);
+  len = 0;
+  for (size_t i = 0; i < 6; ++i) {
+    size_t l = 16 + m[i]->channel.len + m[i]->data.len + 2;
+    memcpy(stream + len, m[i]->meta + m[i]->meta_len, l);
+    len += l;
+    fio_msg_internal_free(m[i]);
+  }
+  fio_cluster_parser_test_run(&t, stream, len, 0);
+  for (uint64_t seed = 1; seed < 9; ++seed)
+    fio_cluster_parser_test_run(&t, stream, len, seed);
+  fio_unsubscribe(s1);
+  fio_unsubscribe(s2);
+  fio_data->is_worker = 0;
+  fio_data->workers = 0;
+  fio_defer_perform();
+  fio_free(stream);
+  fio_free(large);
+  fprintf(stderr, "* passed.\n");
+}
 #else
 #define fio_pubsub_test()
+#define fio_cluster_fd_test()
+#define fio_cluster_routing_test()
+#define fio_cluster_parser_test()
+#define fio_cluster_migrate_test()
 #endif
 
 /* *****************************************************************************
@@ -11018,11 +15582,20 @@ void fio_test(void) {
   fio_llist_test();
   fio_ary_test();
   fio_set_test();
+  fio_set_group_probing_test();
+  fio_park_lock_test();
   fio_defer_test();
+  fio_affinity_test();
   fio_timer_test();
   fio_poll_test();
+  fio_fd_page_test();
   fio_socket_test();
+  fio_upgrade_test();
+  fio_autoscale_test();
   fio_uuid_link_test();
+  fio_dns_test();
+  fio_half_close_test();
+  fio_udp_test();
   fio_cycle_test();
   fio_riskyhash_test();
   fio_siphash_test();
@@ -11031,6 +15604,10 @@ void fio_test(void) {
   fio_base64_test();
   fio_test_random();
   fio_pubsub_test();
+  fio_cluster_fd_test();
+  fio_cluster_routing_test();
+  fio_cluster_parser_test();
+  fio_cluster_migrate_test();
   (void)fio_sentinel_task;
   (void)deferred_on_shutdown;
   (void)fio_poll;
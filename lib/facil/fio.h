@@ -181,6 +181,22 @@ Version and helper macros
 #define FIO_PUBSUB_SUPPORT 1
 #endif
 
+#ifndef FIO_PARK_LOCK_SPIN
+/**
+ * The number of times a contended `fio_park_lock` spins (using a CPU relax
+ * hint) before the waiting thread is parked.
+ */
+#define FIO_PARK_LOCK_SPIN 128
+#endif
+
+#ifndef FIO_LOCK_PROFILE
+/**
+ * If true (1), contended `fio_park_lock` calls are profiled per call site
+ * (contention count and wait time). Each process prints the profile on exit.
+ */
+#define FIO_LOCK_PROFILE 0
+#endif
+
 #ifndef FIO_LOG_LENGTH_LIMIT
 /**
  * Since logging uses stack memory rather than dynamic allocation, it's memory
@@ -214,10 +230,16 @@ Version and helper macros
 #include <time.h>
 
 #include <fcntl.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
 #if !defined(__GNUC__) && !defined(__clang__) && !defined(FIO_GNUC_BYPASS)
 #define __attribute__(...)
 #define __has_include(...) 0
@@ -379,6 +401,22 @@ void *FIO_ALIGN_NEW fio_mmap(size_t size);
  */
 void fio_malloc_after_fork(void);
 
+/**
+ * Routes the calling thread's `fio_malloc` allocations to a dedicated "frozen"
+ * memory region (when `enable` is true) or back to the per-CPU core pools.
+ *
+ * Memory blocks in the frozen region are never shared with allocations made
+ * outside the region. Data that is allocated there before `fork` and never
+ * written to (or freed) afterwards remains physically shared by all the worker
+ * processes, instead of being copied into each worker when neighboring data
+ * is written.
+ *
+ * Memory allocated within the region is freed using `fio_free`, as usual.
+ *
+ * Returns the previous state, so nested calls can restore it.
+ */
+int fio_malloc_frozen(int enable);
+
 #undef FIO_ALIGN
 
 /* *****************************************************************************
@@ -859,6 +897,119 @@ See the `struct fio_connect_args` details for any possible named arguments.
 intptr_t fio_connect(struct fio_connect_args);
 #define fio_connect(...) fio_connect((struct fio_connect_args){__VA_ARGS__})
 
+/* *****************************************************************************
+DNS Resolution
+***************************************************************************** */
+
+/**
+ * Resolves a host name to an IPv4 or IPv6 address without blocking.
+ *
+ * The `on_resolved` callback receives the address (with a zero port) or NULL
+ * if the name couldn't be resolved.
+ *
+ * Numeric addresses, names found in the hosts file and cached names are
+ * resolved immediately (the callback is called before the function returns).
+ * Other names are sent to the nameservers (see `/etc/resolv.conf`) and the
+ * callback is called by the reactor once a response arrives (or the query
+ * times out). Concurrent lookups for the same name share a single query.
+ *
+ * Nameservers are tried in order, moving on when a nameserver times out,
+ * refuses or fails the query. Names are completed using the resolver file's
+ * `search` list (and `ndots` option). Names ending with a dot aren't.
+ *
+ * Answers are cached for their TTL (up to `FIO_DNS_TTL_MAX` seconds) and
+ * failures (a missing name) are cached for `FIO_DNS_NEGATIVE_TTL` seconds.
+ *
+ * `fio_connect` uses this function, so connecting to a host name doesn't block
+ * the reactor.
+ */
+void fio_dns_resolve(const char *host,
+                     void (*on_resolved)(const struct sockaddr *addr,
+                                         socklen_t len, void *udata),
+                     void *udata);
+
+/**
+ * Sets the nameserver's numeric address and port (defaults to port 53),
+ * overriding the `/etc/resolv.conf` settings (nameservers and search list).
+ *
+ * Setting the address to NULL reverts to the `/etc/resolv.conf` settings.
+ *
+ * Pending lookups fail.
+ */
+void fio_dns_nameserver(const char *address, const char *port);
+
+/**
+ * Clears the DNS cache (the hosts file is reloaded on the next lookup).
+ */
+void fio_dns_clear(void);
+
+/* *****************************************************************************
+UDP (datagram) sockets
+***************************************************************************** */
+
+/** Named arguments for the `fio_udp_listen` and `fio_udp_connect` functions. */
+struct fio_udp_args {
+  /**
+   * Called for each datagram received, with the sender's address.
+   *
+   * The data is NUL terminated and valid only until the callback returns.
+   * Datagrams are read in batches of up to `FIO_UDP_BATCH` datagrams per
+   * system call (using `recvmmsg` where available).
+   */
+  void (*on_datagram)(intptr_t uuid, fio_str_info_s data,
+                      const struct sockaddr *from, socklen_t from_len,
+                      void *udata);
+  /** The network service / port. Required. */
+  const char *port;
+  /**
+   * The binding address (`fio_udp_listen`, defaults to all addresses) or the
+   * remote address (`fio_udp_connect`, required).
+   */
+  const char *address;
+  /** Opaque user data. */
+  void *udata;
+  /** Called when the socket is closed (or on error, with a -1 uuid). */
+  void (*on_finish)(intptr_t uuid, void *udata);
+};
+
+/**
+ * Binds a UDP socket to the requested address and port, calling `on_datagram`
+ * for every datagram received.
+ *
+ * When called before `fio_start`, each worker process reads datagrams from the
+ * (shared) socket.
+ *
+ * Returns the socket's uuid or -1 (on error).
+ */
+intptr_t fio_udp_listen(struct fio_udp_args args);
+#define fio_udp_listen(...) fio_udp_listen((struct fio_udp_args){__VA_ARGS__})
+
+/**
+ * Opens a UDP socket connected to the requested (remote) address and port.
+ *
+ * Datagrams sent by the remote address are passed to `on_datagram`.
+ *
+ * Returns the socket's uuid or -1 (on error).
+ */
+intptr_t fio_udp_connect(struct fio_udp_args args);
+#define fio_udp_connect(...) fio_udp_connect((struct fio_udp_args){__VA_ARGS__})
+
+/**
+ * Queues a datagram to be sent using a UDP socket.
+ *
+ * The `to` address is required unless the socket was opened using
+ * `fio_udp_connect` (in which case it should be NULL).
+ *
+ * The data is copied. Queued datagrams are sent by the reactor in batches of
+ * up to `FIO_UDP_BATCH` datagrams per system call (using `sendmmsg` where
+ * available).
+ *
+ * Returns -1 on error (`errno == ENOBUFS` when `FIO_UDP_QUEUE_LIMIT` datagrams
+ * are already queued) or 0 on success.
+ */
+int fio_udp_send(intptr_t uuid, const void *data, size_t len,
+                 const struct sockaddr *to, socklen_t to_len);
+
 /* *****************************************************************************
 URL address parsing
 ***************************************************************************** */
@@ -917,6 +1068,25 @@ fio_url_s fio_url_parse(const char *url, size_t length);
 Starting the IO reactor and reviewing it's state
 ***************************************************************************** */
 
+/** CPU placement strategies for worker processes (see `fio_start`). */
+enum fio_affinity_e {
+  /** Workers and threads aren't pinned (the OS scheduler places them). */
+  FIO_AFFINITY_NONE = 0,
+  /**
+   * Each worker process is pinned to a slice of the available CPU cores and
+   * each of it's threads is pinned to a single core within that slice.
+   */
+  FIO_AFFINITY_CORES = 1,
+  /**
+   * Each worker process is pinned to the CPU cores of a single NUMA node
+   * (workers are assigned to nodes round robin) and each of it's threads is
+   * pinned to a single core within that node.
+   *
+   * Falls back to `FIO_AFFINITY_CORES` if NUMA information is unavailable.
+   */
+  FIO_AFFINITY_NUMA = 2,
+};
+
 struct fio_start_args {
   /**
    * The number of threads to run in the thread pool. Has "smart" defaults.
@@ -939,6 +1109,51 @@ struct fio_start_args {
   int16_t threads;
   /** The number of worker processes to run. See `threads`. */
   int16_t workers;
+  /**
+   * The maximal number of worker processes when autoscaling. Defaults to 0
+   * (autoscaling disabled).
+   *
+   * When greater than `workers`, the root process starts `workers` worker
+   * processes (the minimum) and spawns or retires workers within these bounds
+   * according to the load the workers report (CPU time and task queue lag).
+   * Retired workers drain their connections gracefully (see
+   * `shutdown_timeout`). Requires pub/sub (cluster) support.
+   */
+  uint16_t workers_max;
+  /**
+   * CPU placement for worker processes and their threads, a `fio_affinity_e`
+   * value. Defaults to `FIO_AFFINITY_NONE`.
+   *
+   * Pinning is only supported on Linux and is ignored elsewhere. The root
+   * process (in cluster mode) is never pinned.
+   */
+  uint8_t affinity;
+  /**
+   * Busy polling (low latency) reactor mode. Defaults to 0 (off).
+   *
+   * When set, each worker process runs a dedicated thread that spins on the
+   * polling engine (zero timeout) while the thread pool spins on the task
+   * queue, trading CPU for lower event dispatch latency. Timers and signals
+   * are handled as usual. The root process (in cluster mode) doesn't busy poll.
+   *
+   * When `affinity` is set, the polling thread is pinned after the thread pool,
+   * so a worker's CPU slice should have a core more than `threads`.
+   *
+   * On Linux, sockets are also set to `SO_BUSY_POLL` (see `FIO_BUSY_POLL_USEC`)
+   * and `SO_PREFER_BUSY_POLL` where available (this might require privileges).
+   */
+  uint8_t busy_poll;
+  /**
+   * The maximal number of seconds a process waits for its connections to drain
+   * during shutdown (including a worker restart). Defaults to
+   * `FIO_SHUTDOWN_TIMEOUT` (30 seconds).
+   *
+   * Once shutdown starts, listening sockets stop accepting and each
+   * connection's `on_shutdown` callback decides how long it may linger (i.e.,
+   * HTTP/1.1 requests in progress are completed with `connection: close`).
+   * The process exits once all connections closed or the deadline passed.
+   */
+  uint16_t shutdown_timeout;
 };
 
 /**
@@ -959,6 +1174,29 @@ void fio_start(struct fio_start_args args);
  */
 void fio_stop(void);
 
+/**
+ * Starts a zero-downtime binary upgrade (root process only).
+ *
+ * A new process is executed using `argv` (or, if `argv` is NULL, the current
+ * process's command line, which is only available on Linux). The listening
+ * sockets are inherited by the new process (listed in the `FIO_LISTEN_FDS`
+ * environment variable), where `fio_listen` reuses any socket matching the
+ * same address and port rather than opening a new one.
+ *
+ * Once the new process was executed, the current process (and it's workers)
+ * shuts down gracefully. Since the listening sockets are never closed, no
+ * connections are refused during the upgrade.
+ *
+ * Unless `FIO_DISABLE_HOT_RESTART` is set, sending the root process a SIGUSR2
+ * signal calls `fio_upgrade(NULL)`.
+ *
+ * The new process must be executed within `FIO_UPGRADE_TIMEOUT` milliseconds
+ * (5000), otherwise it's killed and the upgrade fails.
+ *
+ * Returns 0 on success or -1 on error (the current process keeps running).
+ */
+int fio_upgrade(char *const argv[]);
+
 /**
  * Returns the number of expected threads / processes to be used by facil.io.
  *
@@ -976,6 +1214,14 @@ void fio_expected_concurrency(int16_t *threads, int16_t *workers);
  */
 int16_t fio_is_running(void);
 
+/**
+ * Returns the number of connections still draining (closing gracefully) while
+ * the process is shutting down.
+ *
+ * Returns 0 while the process is running normally.
+ */
+size_t fio_draining(void);
+
 /**
  * Returns 1 if the current process is a worker process or a single process.
  *
@@ -1045,6 +1291,11 @@ Socket / Connection Functions
  *
  * Returns -1 on error. Any other value is a valid unique identifier.
  *
+ * Client sockets never block the reactor on a DNS lookup: while the reactor is
+ * running, a host name that isn't cached fails (`errno == EAGAIN`) and is
+ * resolved in the background, so a later attempt can succeed. `fio_connect`
+ * waits for the name instead (when the port is numeric).
+ *
  * Note: facil.io uses unique identifiers to protect sockets from collisions.
  *       However these identifiers can be converted to the underlying file
  *       descriptor using the `fio_uuid2fd` macro.
@@ -1550,6 +1801,45 @@ Event / Task scheduling
  */
 int fio_defer(void (*task)(void *, void *), void *udata1, void *udata2);
 
+/**
+ * Task classes, each with its own task queue.
+ *
+ * `fio_defer_perform` serves the classes using (weighted) deficit round-robin,
+ * so a flood of tasks in one class (i.e., pub/sub deliveries) can't starve the
+ * tasks of another class (i.e., HTTP requests).
+ */
+typedef enum {
+  /** `fio_defer` tasks, IO tasks and timers. */
+  FIO_TASK_DEFAULT = 0,
+  /** Pub/Sub message delivery (including WebSocket broadcasts). */
+  FIO_TASK_PUBSUB = 1,
+  /** Background (bulk) work that shouldn't delay other tasks. */
+  FIO_TASK_BULK = 2,
+} fio_task_class_e;
+
+/** The number of task classes. */
+#define FIO_TASK_CLASS_COUNT 3
+
+/**
+ * Defers a task's execution using the task queue of the requested class.
+ *
+ * Returns -1 on error, 0 on success.
+ */
+int fio_defer_class(fio_task_class_e task_class,
+                    void (*task)(void *, void *), void *udata1, void *udata2);
+
+/**
+ * Sets the number of tasks a task class may perform in each scheduling round
+ * (its weight). A weight of zero is treated as 1.
+ *
+ * The defaults are `FIO_TASK_WEIGHT_DEFAULT` (8), `FIO_TASK_WEIGHT_PUBSUB` (4)
+ * and `FIO_TASK_WEIGHT_BULK` (1).
+ */
+void fio_defer_weight_set(fio_task_class_e task_class, size_t weight);
+
+/** Returns the number of tasks waiting in the task class's queue. */
+size_t fio_defer_queue_depth(fio_task_class_e task_class);
+
 /**
  * Creates a timer to run a task at the specified interval.
  *
@@ -1870,6 +2160,44 @@ void *fio_message_metadata(fio_msg_s *msg, intptr_t type_id);
  */
 void fio_message_defer(fio_msg_s *msg);
 
+/* *****************************************************************************
+ * Connection Migration
+ **************************************************************************** */
+
+/**
+ * Migrates a connection to another worker process, identified by its process
+ * id, using the cluster's Unix socket.
+ *
+ * `unread` is data the connection's protocol read but didn't consume. It will
+ * be returned by `fio_read` (before any socket data) in the new worker.
+ *
+ * `state` is an opaque (protocol defined) blob passed to the new worker's
+ * `fio_migrate_on_arrival` callback.
+ *
+ * The connection stops reading immediately (`on_data` isn't called again, even
+ * if an event was already scheduled). Once any pending output was sent, the
+ * connection is closed in the calling worker (`on_close` is called as usual),
+ * without disconnecting the client.
+ *
+ * Connections using read/write hooks (i.e., TLS) can't be migrated.
+ *
+ * Returns -1 on error (`errno` is set) and 0 if the migration was scheduled.
+ */
+int fio_migrate(intptr_t uuid, pid_t worker, fio_str_info_s unread,
+                fio_str_info_s state);
+
+/**
+ * Sets the callback for connections migrated to the worker process.
+ *
+ * The callback should attach a protocol to the `uuid` (or close it). Any
+ * `unread` data will trigger an `on_data` event once the callback returns.
+ *
+ * Set this callback before calling `fio_start`. Migrated connections are
+ * closed if the callback isn't set.
+ */
+void fio_migrate_on_arrival(void (*on_arrival)(intptr_t uuid,
+                                               fio_str_info_s state));
+
 /* *****************************************************************************
  * Cluster / Pub/Sub Middleware and Extensions ("Engines")
  **************************************************************************** */
@@ -2087,6 +2415,44 @@ FIO_FUNC inline void fio_reschedule_thread(void);
 /** Nanosleep the thread - a blocking throttle. */
 FIO_FUNC inline void fio_throttle_thread(size_t nano_sec);
 
+/** A CPU friendly busy wait hint. */
+#if defined(__x86_64__) || defined(__i386__)
+#define FIO_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define FIO_CPU_RELAX() __asm__ volatile("yield" ::: "memory")
+#else
+#define FIO_CPU_RELAX() __asm__ volatile("" ::: "memory")
+#endif
+
+/**
+ * An adaptive lock, for contended (global) locks.
+ *
+ * A waiting thread spins briefly (`FIO_PARK_LOCK_SPIN` rounds) and is then
+ * parked (using a futex on Linux) until the lock is released, instead of
+ * rescheduling itself over and over.
+ *
+ * The value is 0 when unlocked, 1 when locked and 2 when threads might be
+ * parked.
+ */
+typedef uint32_t volatile fio_park_lock_i;
+
+/** The initail value of an unlocked parking lock. */
+#define FIO_PARK_LOCK_INIT 0
+
+/** returns 0 if the lock was acquired and a non-zero value on failure. */
+FIO_FUNC inline int fio_park_trylock(fio_park_lock_i *lock);
+
+/** Waits for the lock, spinning and then parking the thread. */
+FIO_FUNC inline void fio_park_lock(fio_park_lock_i *lock);
+
+/** Releases the lock, waking a parked thread (if any). */
+FIO_FUNC inline void fio_park_unlock(fio_park_lock_i *lock);
+
+#if FIO_LOCK_PROFILE
+/** Prints the contention profile of the `fio_park_lock` call sites. */
+void fio_lock_profile_print(void);
+#endif
+
 /* *****************************************************************************
 
 
@@ -3022,6 +3388,93 @@ FIO_FUNC inline void fio_lock(fio_lock_i *lock) {
   }
 }
 
+#if defined(__linux__) && defined(SYS_futex)
+#define FIO_PARK_WAIT(lock)                                                    \
+  syscall(SYS_futex, (lock), FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0)
+#define FIO_PARK_WAKE(lock)                                                    \
+  syscall(SYS_futex, (lock), FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0)
+#else
+#define FIO_PARK_WAIT(lock) fio_reschedule_thread()
+#define FIO_PARK_WAKE(lock)
+#endif
+
+/** returns 0 if the lock was acquired and a non-zero value on failure. */
+FIO_FUNC inline int fio_park_trylock(fio_park_lock_i *lock) {
+  return !__sync_bool_compare_and_swap(lock, 0, 1);
+}
+
+/* the contended path: spins and then parks until the lock is released. */
+FIO_FUNC void fio_park_lock_wait(fio_park_lock_i *lock) {
+  for (size_t i = 0; i < FIO_PARK_LOCK_SPIN; ++i) {
+    FIO_CPU_RELAX();
+    if (!*lock && !fio_park_trylock(lock))
+      return;
+  }
+  /* mark the lock as contended, so the unlocking thread wakes us up */
+  while (fio_atomic_xchange(lock, 2))
+    FIO_PARK_WAIT(lock);
+}
+
+/** Waits for the lock, spinning and then parking the thread. */
+FIO_FUNC inline void fio_park_lock(fio_park_lock_i *lock) {
+  if (fio_park_trylock(lock))
+    fio_park_lock_wait(lock);
+}
+
+/** Releases the lock, waking a parked thread (if any). */
+FIO_FUNC inline void fio_park_unlock(fio_park_lock_i *lock) {
+  __asm__ volatile("" ::: "memory");
+  if (fio_atomic_xchange(lock, 0) == 2)
+    FIO_PARK_WAKE(lock);
+}
+
+#if FIO_LOCK_PROFILE
+/** A `fio_park_lock` call site's contention profile. */
+typedef struct fio_lock_profile_s {
+  struct fio_lock_profile_s *next;
+  const char *file;
+  size_t line;
+  volatile size_t acquired;
+  volatile size_t contended;
+  volatile uint64_t wait_ns;
+  volatile uint64_t max_ns;
+  fio_lock_i listed;
+} fio_lock_profile_s;
+
+/** The contended call sites (a lock free stack, see fio.c). */
+extern fio_lock_profile_s *volatile fio_lock_profile_list;
+
+/** Waits for the lock, updating the call site's profile. */
+FIO_FUNC inline void fio_park_lock_profile(fio_park_lock_i *lock,
+                                           fio_lock_profile_s *site) {
+  fio_atomic_add(&site->acquired, 1);
+  if (!fio_park_trylock(lock))
+    return;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  fio_park_lock_wait(lock);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  uint64_t ns = ((uint64_t)(end.tv_sec - start.tv_sec) * 1000000000) +
+                end.tv_nsec - start.tv_nsec;
+  fio_atomic_add(&site->contended, 1);
+  fio_atomic_add(&site->wait_ns, ns);
+  if (site->max_ns < ns)
+    site->max_ns = ns; /* not atomic, the maximum is a close estimate */
+  if (fio_trylock(&site->listed))
+    return;
+  do {
+    site->next = fio_lock_profile_list;
+  } while (!__sync_bool_compare_and_swap(&fio_lock_profile_list, site->next,
+                                         site));
+}
+#define fio_park_lock(lock)                                                    \
+  do {                                                                         \
+    static fio_lock_profile_s fio_lock_profile_site___ = {                     \
+        .file = __FILE__, .line = __LINE__};                                   \
+    fio_park_lock_profile((lock), &fio_lock_profile_site___);                  \
+  } while (0)
+#endif /* FIO_LOCK_PROFILE */
+
 #if DEBUG_SPINLOCK
 /** Busy waits for a lock, reports contention. */
 FIO_FUNC inline void fio_lock_dbg(fio_lock_i *lock, const char *file,
@@ -5501,6 +5954,16 @@ Done
  *
  * Note: Before freeing the Set, FIO_SET_OBJ_DESTROY will be automatically
  *       called for every existing object.
+ *
+ * Defining FIO_SET_GROUP_PROBING (to 1) selects an alternative mapping, where
+ * the map is divided into cache line sized groups. Each group holds a control
+ * byte (a 7 bit hash tag) and an `ordered` index for up to FIO_SET_GROUP_SIZE
+ * objects. The control bytes of a group are tested together (SSE2 / NEON when
+ * available), so only objects with a matching tag are compared. This allows a
+ * smaller map with a higher load factor and a single cache miss per probe,
+ * while preserving the ordered (insertion order) iteration.
+ *
+ * Note: FIO_SET_GROUP_PROBING Sets are limited to 2^32 objects.
  */
 
 /* Used for naming functions and types, prefixing FIO_SET_NAME to the name */
@@ -5591,6 +6054,56 @@ Done
 #define FIO_SET_CUCKOO_STEPS 11
 #endif
 
+/* Opt-in: group (cache line) probing of the map, see above */
+#ifndef FIO_SET_GROUP_PROBING
+#define FIO_SET_GROUP_PROBING 0
+#endif
+
+#if FIO_SET_GROUP_PROBING && !defined(H_FIO_SET_GROUP_PROBING_HELPERS)
+#define H_FIO_SET_GROUP_PROBING_HELPERS
+/* a group's control bytes and indexes fill a 64 byte cache line */
+#define FIO_SET_GROUP_SIZE 12
+/*
+ * The group match functions return a bitmap, where a set bit at
+ * `(index << FIO_SET_GROUP_MATCH_SHIFT)` marks a matching control byte.
+ */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define FIO_SET_GROUP_MATCH_SHIFT 0
+FIO_FUNC inline uint64_t fio_set_group_match(const uint8_t *ctrl,
+                                             uint8_t value) {
+  const __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+  return (uint64_t)_mm_movemask_epi8(
+             _mm_cmpeq_epi8(g, _mm_set1_epi8((char)value))) &
+         0xFFFULL;
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FIO_SET_GROUP_MATCH_SHIFT 2
+FIO_FUNC inline uint64_t fio_set_group_match(const uint8_t *ctrl,
+                                             uint8_t value) {
+  const uint8x16_t m = vceqq_u8(vld1q_u8(ctrl), vdupq_n_u8(value));
+  /* narrowing shift leaves a nibble per byte, keep a single bit per nibble */
+  return vget_lane_u64(
+             vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0) &
+         0x888888888888ULL;
+}
+#else
+#define FIO_SET_GROUP_MATCH_SHIFT 0
+FIO_FUNC inline uint64_t fio_set_group_match(const uint8_t *ctrl,
+                                             uint8_t value) {
+  uint64_t r = 0;
+  for (size_t i = 0; i < FIO_SET_GROUP_SIZE; ++i) {
+    r |= (uint64_t)(ctrl[i] == value) << i;
+  }
+  return r;
+}
+#endif
+/** Returns the slot index of the first match in a group match bitmap. */
+#define FIO_SET_GROUP_MATCH_INDEX(match)                                       \
+  ((uintptr_t)__builtin_ctzll((match)) >> FIO_SET_GROUP_MATCH_SHIFT)
+#endif
+
 #ifdef FIO_SET_KEY_TYPE
 typedef struct {
   FIO_SET_KEY_TYPE key;
@@ -5817,10 +6330,24 @@ typedef struct FIO_NAME(_ordered_s_) {
   FIO_SET_TYPE obj;
 } FIO_NAME(_ordered_s_);
 
+#if FIO_SET_GROUP_PROBING
+/**
+ * A map group fills a single cache line, mapping up to FIO_SET_GROUP_SIZE
+ * objects.
+ *
+ * Control bytes: 0 == empty, 1 == removed ("hole"), 0x80 | tag == used.
+ */
+typedef struct FIO_NAME(_map_s_) {
+  uint8_t ctrl[FIO_SET_GROUP_SIZE];
+  uint32_t index[FIO_SET_GROUP_SIZE]; /* position in the `ordered` array */
+  uint32_t reserved;
+} FIO_NAME(_map_s_);
+#else
 typedef struct FIO_NAME(_map_s_) {
   FIO_SET_HASH_TYPE hash; /* another copy for memory cache locality */
   FIO_NAME(_ordered_s_) * pos;
 } FIO_NAME(_map_s_);
+#endif
 
 /* the information in the Hash Map structure should be considered READ ONLY. */
 struct FIO_NAME(s) {
@@ -5843,6 +6370,183 @@ struct FIO_NAME(s) {
 Set / Hash Map Internal Helpers
 ***************************************************************************** */
 
+#if FIO_SET_GROUP_PROBING
+
+/** The number of map groups used for a Set with the requested capacity. */
+#define FIO_SET_MAP_LEN(capa)                                                  \
+  ((((capa) + ((capa) >> 2)) / FIO_SET_GROUP_SIZE) + 1)
+
+/** Mixes the hash value, for the map's group selection and slot tags. */
+#define FIO_SET_GROUP_MIX(hash_value)                                          \
+  ((uint64_t)FIO_SET_HASH2UINTPTR((hash_value), 0) * 0x9E3779B97F4A7C15ULL)
+
+/** Computes a used slot's control byte (tag) from a mixed hash value. */
+#define FIO_SET_GROUP_TAG(mixed) ((uint8_t)(0x80 | (((mixed) >> 25) & 0x7F)))
+
+/**
+ * Locates an object's map group and slot in the Set.
+ *
+ * If the object exists, `group->ctrl[*i] & 0x80` will be set. Otherwise the
+ * (group, slot) couplet is an empty slot where the object should be placed.
+ *
+ * Returns NULL if no empty slot could be found within the probing limit.
+ */
+FIO_FUNC inline FIO_NAME(_map_s_) *
+    FIO_NAME(_find_map_pos_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE hash_value,
+                             FIO_SET_TYPE obj, uintptr_t *i) {
+  if (FIO_SET_HASH_COMPARE(hash_value, FIO_SET_HASH_INVALID))
+    hash_value = FIO_SET_HASH_FORCE;
+  if (!set->map)
+    return NULL;
+  /* make sure collisions don't effect seeking */
+  if (set->has_collisions && set->pos != set->count) {
+    FIO_NAME(rehash)(set);
+  }
+  size_t full_collisions_counter = 0;
+  const uint64_t mixed = FIO_SET_GROUP_MIX(hash_value);
+  const uint8_t tag = FIO_SET_GROUP_TAG(mixed);
+  const uintptr_t groups = FIO_SET_MAP_LEN(set->capa);
+  const uintptr_t limit =
+      groups < FIO_SET_MAX_MAP_SEEK ? groups : FIO_SET_MAX_MAP_SEEK;
+  /* multiply-shift maps the (mixed) hash to any number of groups */
+  uintptr_t g = (uintptr_t)(((mixed >> 32) * groups) >> 32);
+  for (uintptr_t step = 0; step < limit; ++step) {
+    FIO_NAME(_map_s_) *group = set->map + g;
+    uint64_t match = fio_set_group_match(group->ctrl, tag);
+    while (match) {
+      *i = FIO_SET_GROUP_MATCH_INDEX(match);
+      match &= match - 1;
+      FIO_NAME(_ordered_s_) *pos = set->ordered + group->index[*i];
+      if (!FIO_SET_HASH_COMPARE(pos->hash, hash_value))
+        continue;
+      if (FIO_SET_COMPARE(pos->obj, obj))
+        return group;
+      /* full hash value collision detected */
+      set->has_collisions = 1;
+      if (++full_collisions_counter >= FIO_SET_MAX_MAP_FULL_COLLISIONS) {
+        /* is the hash under attack? */
+        FIO_LOG_WARNING(
+            "(fio hash map) too many full collisions - under attack?");
+        set->under_attack = 1;
+      }
+      if (set->under_attack) {
+        return group;
+      }
+    }
+    match = fio_set_group_match(group->ctrl, 0);
+    if (match) {
+      *i = FIO_SET_GROUP_MATCH_INDEX(match);
+      return group;
+    }
+    if (++g == groups)
+      g = 0;
+  }
+  return NULL;
+  (void)obj; /* in cases where FIO_SET_OBJ_COMPARE does nothing */
+}
+
+/** Returns an existing object's entry in the `ordered` array (or NULL). */
+FIO_FUNC inline FIO_NAME(_ordered_s_) *
+    FIO_NAME(_find_ordered_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE hash_value,
+                             FIO_SET_TYPE obj) {
+  uintptr_t i = 0;
+  FIO_NAME(_map_s_) *group =
+      FIO_NAME(_find_map_pos_)(set, hash_value, obj, &i);
+  if (!group || !(group->ctrl[i] & 0x80))
+    return NULL;
+  return set->ordered + group->index[i];
+}
+
+/**
+ * Maps an object, returning its (existing or new) entry in the `ordered`
+ * array. New entries are counted and their `hash` is set, `existing` is set
+ * when the object was already in the Set.
+ *
+ * Returns NULL if the map has no room for the object.
+ */
+FIO_FUNC inline FIO_NAME(_ordered_s_) *
+    FIO_NAME(_map_seek_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE hash_value,
+                         FIO_SET_TYPE obj, uint8_t *existing) {
+  uintptr_t i = 0;
+  FIO_NAME(_map_s_) *group =
+      FIO_NAME(_find_map_pos_)(set, hash_value, obj, &i);
+  if (!group)
+    return NULL;
+  if ((*existing = (group->ctrl[i] >> 7)))
+    return set->ordered + group->index[i];
+  group->ctrl[i] = FIO_SET_GROUP_TAG(FIO_SET_GROUP_MIX(hash_value));
+  group->index[i] = (uint32_t)set->pos;
+  set->ordered[set->pos].hash = hash_value;
+  ++set->count;
+  return set->ordered + (set->pos++);
+}
+
+/**
+ * Unmaps an object, returning its entry in the `ordered` array (or NULL).
+ *
+ * The caller is expected to invalidate and destroy the `ordered` entry.
+ */
+FIO_FUNC inline FIO_NAME(_ordered_s_) *
+    FIO_NAME(_map_remove_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE hash_value,
+                           FIO_SET_TYPE obj) {
+  uintptr_t i = 0;
+  FIO_NAME(_map_s_) *group =
+      FIO_NAME(_find_map_pos_)(set, hash_value, obj, &i);
+  if (!group || !(group->ctrl[i] & 0x80))
+    return NULL;
+  /* a group with an empty slot was never full, so seeking never passed it */
+  group->ctrl[i] = fio_set_group_match(group->ctrl, 0) ? 0 : 1;
+  return set->ordered + group->index[i];
+}
+
+/** Unmaps an `ordered` entry by position (used by `pop`). */
+FIO_FUNC inline void FIO_NAME(_map_unmap_entry_)(FIO_NAME(s) * set,
+                                                 FIO_NAME(_ordered_s_) * pos) {
+  if (!set->map)
+    return;
+  const uint64_t mixed = FIO_SET_GROUP_MIX(pos->hash);
+  const uint8_t tag = FIO_SET_GROUP_TAG(mixed);
+  const uint32_t index = (uint32_t)(pos - set->ordered);
+  const uintptr_t groups = FIO_SET_MAP_LEN(set->capa);
+  const uintptr_t limit =
+      groups < FIO_SET_MAX_MAP_SEEK ? groups : FIO_SET_MAX_MAP_SEEK;
+  uintptr_t g = (uintptr_t)(((mixed >> 32) * groups) >> 32);
+  for (uintptr_t step = 0; step < limit; ++step) {
+    FIO_NAME(_map_s_) *group = set->map + g;
+    uint64_t match = fio_set_group_match(group->ctrl, tag);
+    while (match) {
+      uintptr_t i = FIO_SET_GROUP_MATCH_INDEX(match);
+      match &= match - 1;
+      if (group->index[i] != index)
+        continue;
+      group->ctrl[i] = fio_set_group_match(group->ctrl, 0) ? 0 : 1;
+      return;
+    }
+    if (fio_set_group_match(group->ctrl, 0))
+      return;
+    if (++g == groups)
+      g = 0;
+  }
+}
+
+/** Maps an existing `ordered` entry while rehashing (-1 if there's no room) */
+FIO_FUNC inline int FIO_NAME(_map_rehash_entry_)(FIO_NAME(s) * set,
+                                                 FIO_NAME(_ordered_s_) * pos) {
+  uintptr_t i = 0;
+  FIO_NAME(_map_s_) *group =
+      FIO_NAME(_find_map_pos_)(set, pos->hash, pos->obj, &i);
+  if (!group)
+    return -1;
+  group->ctrl[i] = FIO_SET_GROUP_TAG(FIO_SET_GROUP_MIX(pos->hash));
+  group->index[i] = (uint32_t)(pos - set->ordered);
+  return 0;
+}
+
+#else /* FIO_SET_GROUP_PROBING */
+
+/** The number of map slots used for a Set with the requested capacity. */
+#define FIO_SET_MAP_LEN(capa) (capa)
+
 /** Locates an object's map position in the Set, if it exists. */
 FIO_FUNC inline FIO_NAME(_map_s_) *
     FIO_NAME(_find_map_pos_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE hash_value,
@@ -5909,6 +6613,80 @@ FIO_FUNC inline FIO_NAME(_map_s_) *
   return NULL;
   (void)obj; /* in cases where FIO_SET_OBJ_COMPARE does nothing */
 }
+
+/** Returns an existing object's entry in the `ordered` array (or NULL). */
+FIO_FUNC inline FIO_NAME(_ordered_s_) *
+    FIO_NAME(_find_ordered_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE hash_value,
+                             FIO_SET_TYPE obj) {
+  FIO_NAME(_map_s_) *pos = FIO_NAME(_find_map_pos_)(set, hash_value, obj);
+  if (!pos)
+    return NULL;
+  return pos->pos;
+}
+
+/**
+ * Maps an object, returning its (existing or new) entry in the `ordered`
+ * array. New entries are counted and their `hash` is set, `existing` is set
+ * when the object was already in the Set.
+ *
+ * Returns NULL if the map has no room for the object.
+ */
+FIO_FUNC inline FIO_NAME(_ordered_s_) *
+    FIO_NAME(_map_seek_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE hash_value,
+                         FIO_SET_TYPE obj, uint8_t *existing) {
+  FIO_NAME(_map_s_) *pos = FIO_NAME(_find_map_pos_)(set, hash_value, obj);
+  if (!pos)
+    return NULL;
+  if ((*existing = (pos->pos != NULL)))
+    return pos->pos;
+  /* insert into new slot */
+  pos->pos = set->ordered + set->pos;
+  ++set->pos;
+  ++set->count;
+  pos->hash = hash_value;
+  pos->pos->hash = hash_value;
+  return pos->pos;
+}
+
+/**
+ * Unmaps an object, returning its entry in the `ordered` array (or NULL).
+ *
+ * The caller is expected to invalidate and destroy the `ordered` entry.
+ */
+FIO_FUNC inline FIO_NAME(_ordered_s_) *
+    FIO_NAME(_map_remove_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE hash_value,
+                           FIO_SET_TYPE obj) {
+  FIO_NAME(_map_s_) *pos = FIO_NAME(_find_map_pos_)(set, hash_value, obj);
+  if (!pos || !pos->pos)
+    return NULL;
+  FIO_NAME(_ordered_s_) *ordered = pos->pos;
+  if (ordered == set->pos + set->ordered - 1) {
+    /* removing last item inserted */
+    pos->hash = FIO_SET_HASH_INVALID; /* no need for a "hole" */
+  }
+  pos->pos = NULL; /* leave pos->hash set to mark "hole" */
+  return ordered;
+}
+
+/** Maps an existing `ordered` entry while rehashing (-1 if there's no room) */
+FIO_FUNC inline int FIO_NAME(_map_rehash_entry_)(FIO_NAME(s) * set,
+                                                 FIO_NAME(_ordered_s_) * pos) {
+  FIO_NAME(_map_s_) *mp = FIO_NAME(_find_map_pos_)(set, pos->hash, pos->obj);
+  if (!mp)
+    return -1;
+  mp->pos = pos;
+  mp->hash = pos->hash;
+  return 0;
+}
+
+/** Unmaps an `ordered` entry by position (the cuckoo map keeps a "hole"). */
+FIO_FUNC inline void FIO_NAME(_map_unmap_entry_)(FIO_NAME(s) * set,
+                                                 FIO_NAME(_ordered_s_) * pos) {
+  (void)set;
+  (void)pos;
+}
+
+#endif /* FIO_SET_GROUP_PROBING */
 #undef FIO_SET_CUCKOO_STEPS
 
 /** Removes "holes" from the Set's internal Array - MUST re-hash afterwards.
@@ -5933,8 +6711,9 @@ FIO_FUNC inline void FIO_NAME(_compact_ordered_array_)(FIO_NAME(s) * set) {
 /** (Re)allocates the set's internal, invalidatint the mapping (must rehash) */
 FIO_FUNC inline void FIO_NAME(_reallocate_set_mem_)(FIO_NAME(s) * set) {
   const uintptr_t new_capa = 1ULL << set->used_bits;
-  FIO_SET_FREE(set->map, set->capa * sizeof(*set->map));
-  set->map = (FIO_NAME(_map_s_) *)FIO_SET_CALLOC(sizeof(*set->map), new_capa);
+  FIO_SET_FREE(set->map, FIO_SET_MAP_LEN(set->capa) * sizeof(*set->map));
+  set->map = (FIO_NAME(_map_s_) *)FIO_SET_CALLOC(sizeof(*set->map),
+                                                 FIO_SET_MAP_LEN(new_capa));
   set->ordered = (FIO_NAME(_ordered_s_) *)FIO_SET_REALLOC(
       set->ordered, (set->capa * sizeof(*set->ordered)),
       (new_capa * sizeof(*set->ordered)), (set->pos * sizeof(*set->ordered)));
@@ -5945,6 +6724,14 @@ FIO_FUNC inline void FIO_NAME(_reallocate_set_mem_)(FIO_NAME(s) * set) {
   set->capa = new_capa;
 }
 
+/** Removes the last ("popped" / removed) holes from the `ordered` array. */
+FIO_FUNC inline void FIO_NAME(_remove_last_holes_)(FIO_NAME(s) * set) {
+  while (set->pos && FIO_SET_HASH_COMPARE(set->ordered[set->pos - 1].hash,
+                                          FIO_SET_HASH_INVALID)) {
+    --set->pos;
+  }
+}
+
 /**
  * Inserts an object to the Set, rehashing if required, returning the new
  * object's pointer.
@@ -5969,7 +6756,9 @@ FIO_NAME(_insert_or_overwrite_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE hash_value,
   }
 
   /* locate future position */
-  FIO_NAME(_map_s_) *pos = FIO_NAME(_find_map_pos_)(set, hash_value, obj);
+  uint8_t existing = 0;
+  FIO_NAME(_ordered_s_) *pos =
+      FIO_NAME(_map_seek_)(set, hash_value, obj, &existing);
 
   if (!pos) {
     /* inserting a new object, with too many holes in the map */
@@ -5982,38 +6771,32 @@ FIO_NAME(_insert_or_overwrite_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE hash_value,
   }
 
   /* overwriting / new */
-  if (pos->pos) {
+  if (existing) {
     /* overwrite existing object */
     if (!overwrite) {
       FIO_SET_DESTROY(obj);
-      return pos->pos->obj;
+      return pos->obj;
     }
 #ifdef FIO_SET_KEY_TYPE
     if (old) {
-      FIO_SET_OBJ_COPY((*old), pos->pos->obj.obj);
+      FIO_SET_OBJ_COPY((*old), pos->obj.obj);
     }
     /* no need to recreate the key object, just the value object */
-    FIO_SET_OBJ_DESTROY(pos->pos->obj.obj);
-    FIO_SET_OBJ_COPY(pos->pos->obj.obj, obj.obj);
-    return pos->pos->obj;
+    FIO_SET_OBJ_DESTROY(pos->obj.obj);
+    FIO_SET_OBJ_COPY(pos->obj.obj, obj.obj);
+    return pos->obj;
 #else
     if (old) {
-      FIO_SET_COPY((*old), pos->pos->obj);
+      FIO_SET_COPY((*old), pos->obj);
     }
-    FIO_SET_DESTROY(pos->pos->obj);
+    FIO_SET_DESTROY(pos->obj);
 #endif
-  } else {
-    /* insert into new slot */
-    pos->pos = set->ordered + set->pos;
-    ++set->pos;
-    ++set->count;
   }
   /* store object at position */
   pos->hash = hash_value;
-  pos->pos->hash = hash_value;
-  FIO_SET_COPY(pos->pos->obj, obj);
+  FIO_SET_COPY(pos->obj, obj);
 
-  return pos->pos->obj;
+  return pos->obj;
 }
 
 /* *****************************************************************************
@@ -6032,7 +6815,7 @@ FIO_FUNC void FIO_NAME_FREE()(FIO_NAME(s) * s) {
     }
   }
   /* free ordered array and hash mapping */
-  FIO_SET_FREE(s->map, s->capa * sizeof(*s->map));
+  FIO_SET_FREE(s->map, FIO_SET_MAP_LEN(s->capa) * sizeof(*s->map));
   FIO_SET_FREE(s->ordered, s->capa * sizeof(*s->ordered));
   *s = (FIO_NAME(s)){.map = NULL};
 }
@@ -6049,14 +6832,14 @@ FIO_FUNC void FIO_NAME_FREE()(FIO_NAME(s) * s) {
 FIO_FUNC FIO_SET_OBJ_TYPE FIO_NAME(find)(FIO_NAME(s) * set,
                                          const FIO_SET_HASH_TYPE hash_value,
                                          FIO_SET_KEY_TYPE key) {
-  FIO_NAME(_map_s_) *pos =
-      FIO_NAME(_find_map_pos_)(set, hash_value, (FIO_SET_TYPE){.key = key});
-  if (!pos || !pos->pos) {
+  FIO_NAME(_ordered_s_) *pos =
+      FIO_NAME(_find_ordered_)(set, hash_value, (FIO_SET_TYPE){.key = key});
+  if (!pos) {
     FIO_SET_OBJ_TYPE empty;
     memset(&empty, 0, sizeof(empty));
     return empty;
   }
-  return pos->pos->obj.obj;
+  return pos->obj.obj;
 }
 
 /**
@@ -6092,24 +6875,16 @@ FIO_FUNC inline int FIO_NAME(remove)(FIO_NAME(s) * set,
                                      const FIO_SET_HASH_TYPE hash_value,
                                      FIO_SET_KEY_TYPE key,
                                      FIO_SET_OBJ_TYPE *old) {
-  FIO_NAME(_map_s_) *pos =
-      FIO_NAME(_find_map_pos_)(set, hash_value, (FIO_SET_TYPE){.key = key});
-  if (!pos || !pos->pos)
+  FIO_NAME(_ordered_s_) *pos =
+      FIO_NAME(_map_remove_)(set, hash_value, (FIO_SET_TYPE){.key = key});
+  if (!pos)
     return -1;
   if (old)
-    FIO_SET_OBJ_COPY((*old), pos->pos->obj.obj);
-  FIO_SET_DESTROY(pos->pos->obj);
+    FIO_SET_OBJ_COPY((*old), pos->obj.obj);
+  FIO_SET_DESTROY(pos->obj);
   --set->count;
-  pos->pos->hash = FIO_SET_HASH_INVALID;
-  if (pos->pos == set->pos + set->ordered - 1) {
-    /* removing last item inserted */
-    pos->hash = FIO_SET_HASH_INVALID; /* no need for a "hole" */
-    do {
-      --set->pos;
-    } while (set->pos && FIO_SET_HASH_COMPARE(set->ordered[set->pos - 1].hash,
-                                              FIO_SET_HASH_INVALID));
-  }
-  pos->pos = NULL; /* leave pos->hash set to mark "hole" */
+  pos->hash = FIO_SET_HASH_INVALID;
+  FIO_NAME(_remove_last_holes_)(set);
   return 0;
 }
 
@@ -6121,13 +6896,13 @@ FIO_FUNC inline int FIO_NAME(remove)(FIO_NAME(s) * set,
 FIO_FUNC FIO_SET_OBJ_TYPE FIO_NAME(find)(FIO_NAME(s) * set,
                                          const FIO_SET_HASH_TYPE hash_value,
                                          FIO_SET_OBJ_TYPE obj) {
-  FIO_NAME(_map_s_) *pos = FIO_NAME(_find_map_pos_)(set, hash_value, obj);
-  if (!pos || !pos->pos) {
+  FIO_NAME(_ordered_s_) *pos = FIO_NAME(_find_ordered_)(set, hash_value, obj);
+  if (!pos) {
     FIO_SET_OBJ_TYPE empty;
     memset(&empty, 0, sizeof(empty));
     return empty;
   }
-  return pos->pos->obj;
+  return pos->obj;
 }
 
 /**
@@ -6166,23 +6941,15 @@ FIO_FUNC int FIO_NAME(remove)(FIO_NAME(s) * set,
                               FIO_SET_OBJ_TYPE obj, FIO_SET_OBJ_TYPE *old) {
   if (FIO_SET_HASH_COMPARE(hash_value, FIO_SET_HASH_INVALID))
     return -1;
-  FIO_NAME(_map_s_) *pos = FIO_NAME(_find_map_pos_)(set, hash_value, obj);
-  if (!pos || !pos->pos)
+  FIO_NAME(_ordered_s_) *pos = FIO_NAME(_map_remove_)(set, hash_value, obj);
+  if (!pos)
     return -1;
   if (old)
-    FIO_SET_COPY((*old), pos->pos->obj);
-  FIO_SET_DESTROY(pos->pos->obj);
+    FIO_SET_COPY((*old), pos->obj);
+  FIO_SET_DESTROY(pos->obj);
   --set->count;
-  pos->pos->hash = FIO_SET_HASH_INVALID;
-  if (pos->pos == set->pos + set->ordered - 1) {
-    /* removing last item inserted */
-    pos->hash = FIO_SET_HASH_INVALID; /* no need for a "hole" */
-    do {
-      --set->pos;
-    } while (set->pos && FIO_SET_HASH_COMPARE(set->ordered[set->pos - 1].hash,
-                                              FIO_SET_HASH_INVALID));
-  }
-  pos->pos = NULL; /* leave pos->hash set to mark "hole" */
+  pos->hash = FIO_SET_HASH_INVALID;
+  FIO_NAME(_remove_last_holes_)(set);
   return 0;
 }
 
@@ -6210,6 +6977,7 @@ FIO_FUNC inline FIO_SET_TYPE FIO_NAME(last)(FIO_NAME(s) * set) {
 FIO_FUNC void FIO_NAME(pop)(FIO_NAME(s) * set) {
   if (!set->ordered || !set->pos)
     return;
+  FIO_NAME(_map_unmap_entry_)(set, set->ordered + set->pos - 1);
   FIO_SET_DESTROY(set->ordered[set->pos - 1].obj);
   set->ordered[set->pos - 1].hash = FIO_SET_HASH_INVALID;
   --(set->count);
@@ -6292,14 +7060,10 @@ restart:
   {
     FIO_NAME(_ordered_s_) const *const end = set->ordered + set->pos;
     for (FIO_NAME(_ordered_s_) *pos = set->ordered; pos < end; ++pos) {
-      FIO_NAME(_map_s_) *mp =
-          FIO_NAME(_find_map_pos_)(set, pos->hash, pos->obj);
-      if (!mp) {
+      if (FIO_NAME(_map_rehash_entry_)(set, pos)) {
         ++set->used_bits;
         goto restart;
       }
-      mp->pos = pos;
-      mp->hash = pos->hash;
     }
   }
 }
@@ -6325,6 +7089,10 @@ restart:
 #undef FIO_SET_REALLOC
 #undef FIO_SET_CALLOC
 #undef FIO_SET_FREE
+#undef FIO_SET_GROUP_PROBING
+#undef FIO_SET_GROUP_MIX
+#undef FIO_SET_GROUP_TAG
+#undef FIO_SET_MAP_LEN
 #undef FIO_NAME
 #undef FIO_NAME_FROM_MACRO_STEP2
 #undef FIO_NAME_FROM_MACRO_STEP1
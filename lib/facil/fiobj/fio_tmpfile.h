@@ -17,22 +17,51 @@ License: MIT
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#ifndef FIO_TMPFILE_DIR
+#ifdef P_tmpdir
+/** the folder for temporary files */
+#define FIO_TMPFILE_DIR P_tmpdir
+#else
+#define FIO_TMPFILE_DIR "/tmp"
+#endif
+#endif
 
+/**
+ * Returns a file descriptor for an unnamed temporary file (or -1 on error).
+ *
+ * The file never appears in the directory tree (O_TMPFILE, or `memfd_create`
+ * where the folder doesn't support O_TMPFILE), so it requires no cleanup and
+ * is gone once the file descriptor is closed. On other systems, a named file
+ * is created and unlinked immediately.
+ */
 static inline int fio_tmpfile(void) {
   // create a temporary file to contain the data.
-  int fd = 0;
-#ifdef P_tmpdir
-  if (P_tmpdir[sizeof(P_tmpdir) - 1] == '/') {
-    char name_template[] = P_tmpdir "facil_io_tmpfile_XXXXXXXX";
+  int fd = -1;
+#ifdef O_TMPFILE
+  fd = open(FIO_TMPFILE_DIR, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (fd != -1)
+    return fd;
+#endif
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+  fd = memfd_create("facil_io_tmpfile", MFD_CLOEXEC);
+  if (fd != -1)
+    return fd;
+#endif
+  if (FIO_TMPFILE_DIR[sizeof(FIO_TMPFILE_DIR) - 2] == '/') {
+    char name_template[] = FIO_TMPFILE_DIR "facil_io_tmpfile_XXXXXXXX";
     fd = mkstemp(name_template);
+    if (fd != -1)
+      unlink(name_template);
   } else {
-    char name_template[] = P_tmpdir "/facil_io_tmpfile_XXXXXXXX";
+    char name_template[] = FIO_TMPFILE_DIR "/facil_io_tmpfile_XXXXXXXX";
     fd = mkstemp(name_template);
+    if (fd != -1)
+      unlink(name_template);
   }
-#else
-  char name_template[] = "/tmp/facil_io_tmpfile_XXXXXXXX";
-  fd = mkstemp(name_template);
-#endif
   return fd;
 }
 #endif
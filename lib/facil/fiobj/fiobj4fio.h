@@ -9,9 +9,14 @@
 
 static void fiobj4sock_dealloc(void *o) { fiobj_free((FIOBJ)o); }
 
-/** send a FIOBJ  object through a socket. */
+/**
+ * send a FIOBJ  object through a socket.
+ *
+ * The object is promoted (`fiobj_share`), since it's freed by the IO reactor.
+ */
 static inline __attribute__((unused)) ssize_t fiobj_send_free(intptr_t uuid,
                                                               FIOBJ o) {
+  fiobj_share(o);
   fio_str_info_s s = fiobj_obj2cstr(o);
   return fio_write2(uuid, .data.buffer = (void *)(o),
                     .offset = (uintptr_t)(((intptr_t)s.data) - ((intptr_t)(o))),
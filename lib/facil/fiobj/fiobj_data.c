@@ -25,6 +25,7 @@ License: MIT
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -47,6 +48,8 @@ typedef struct {
   size_t len;  /* length of valid data in buffer */
   size_t pos;  /* position of reader */
   int fd;      /* file descriptor (-1 if invalid). */
+  size_t map_len; /* length of the file's memory map */
+  uint8_t *map;   /* private memory map of the file (NULL if unmapped) */
 } fiobj_data_s;
 
 #define obj2io(o) ((fiobj_data_s *)(o))
@@ -151,6 +154,43 @@ retry:
   return stat.st_size;
 }
 
+/* releases a file's memory map, if any */
+static inline void fiobj_data_unmap(FIOBJ o) {
+  if (!obj2io(o)->map)
+    return;
+  munmap(obj2io(o)->map, obj2io(o)->map_len);
+  obj2io(o)->map = NULL;
+  obj2io(o)->map_len = 0;
+}
+
+/**
+ * Returns a memory map of the whole file (`size` bytes), or NULL if the file
+ * should be read using `pread` instead.
+ *
+ * The map is private and writable (copy on write), keeping the `pread` buffer
+ * contract: callers may edit the returned data without changing the file.
+ *
+ * Files that fill their last page aren't mapped, so the map is always followed
+ * by a NUL byte (the rest of the page is zero filled).
+ */
+static uint8_t *fiobj_data_map(FIOBJ o, int64_t size) {
+  static size_t page_mask;
+  if (obj2io(o)->map && obj2io(o)->map_len == (size_t)size)
+    return obj2io(o)->map;
+  fiobj_data_unmap(o);
+  if (!page_mask)
+    page_mask = (size_t)sysconf(_SC_PAGESIZE) - 1;
+  if (size < FIOBJ_DATA_MMAP_MIN || !((size_t)size & page_mask))
+    return NULL;
+  void *map = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                   obj2io(o)->fd, 0);
+  if (map == MAP_FAILED)
+    return NULL;
+  obj2io(o)->map = map;
+  obj2io(o)->map_len = (size_t)size;
+  return obj2io(o)->map;
+}
+
 static FIOBJ fiobj_data_alloc(void *buffer, int fd) {
   fiobj_data_s *io = fio_malloc(sizeof(*io));
   REQUIRE_MEM(io);
@@ -173,6 +213,7 @@ static void fiobj_data_dealloc(FIOBJ o, void (*task)(FIOBJ, void *),
     fiobj_free(obj2io(o)->source.parent);
     break;
   default:
+    fiobj_data_unmap(o);
     close(obj2io(o)->fd);
     fio_free(obj2io(o)->buffer);
     break;
@@ -210,6 +251,11 @@ static fio_str_info_s fio_io2str(const FIOBJ o) {
   if (i <= 0)
     return (fio_str_info_s){.data = (char *)obj2io(o)->buffer,
                             .len = obj2io(o)->len};
+  {
+    uint8_t *map = fiobj_data_map(o, i);
+    if (map)
+      return (fio_str_info_s){.data = (char *)map, .len = (size_t)i};
+  }
   obj2io(o)->len = 0;
   obj2io(o)->pos = 0;
   fiobj_data_pre_write((FIOBJ)o, i + 1);
@@ -865,6 +911,8 @@ static fio_str_info_s fiobj_data_pread_file(FIOBJ io, intptr_t start_at,
     start_at = size + start_at;
   if (start_at < 0)
     start_at = 0;
+  if (start_at > size)
+    start_at = size;
   if (length + start_at > (uint64_t)size)
     length = size - start_at;
   if (length == 0) {
@@ -877,6 +925,11 @@ static fio_str_info_s fiobj_data_pread_file(FIOBJ io, intptr_t start_at,
         .len = 0,
     };
   }
+  {
+    uint8_t *map = fiobj_data_map(io, size);
+    if (map)
+      return (fio_str_info_s){.data = (char *)map + start_at, .len = length};
+  }
   obj2io(io)->len = 0;
   obj2io(io)->pos = 0;
   fiobj_data_pre_write(io, length + 1);
@@ -1151,6 +1204,48 @@ void fiobj_data_test(void) {
   }
   fiobj_free(sliceio);
 
+  {
+    /* large temporary files are read in place (memory mapped) */
+    char buf[4096];
+    FIOBJ large = fiobj_data_newtmpfile();
+    FIO_ASSERT(large, "`fiobj_data_newtmpfile` failed");
+    struct stat st;
+    FIO_ASSERT(!fstat(obj2io(large)->fd, &st) && st.st_nlink == 0,
+               "temporary file shouldn't be linked to a folder");
+    for (size_t i = 0; i < sizeof(buf); ++i)
+      buf[i] = 'a' + (i % 26);
+    for (size_t i = 0; i * sizeof(buf) < FIOBJ_DATA_MMAP_MIN; ++i)
+      fiobj_data_write(large, buf, sizeof(buf));
+    fiobj_data_write(large, "end", 3);
+    const size_t len = (size_t)fiobj_data_len(large);
+    s1 = fiobj_obj2cstr(large);
+    FIO_ASSERT(s1.len == len && !memcmp(s1.data, buf, 26) &&
+                   !memcmp(s1.data + len - 3, "end", 3) && !s1.data[len],
+               "memory mapped `fiobj_obj2cstr` data error");
+    s2 = fiobj_data_pread(large, 4096, 100);
+    FIO_ASSERT(s2.data == s1.data + 4096 && s2.len == 100 &&
+                   !memcmp(s2.data, buf, 100),
+               "`fiobj_data_pread` should read large files in place");
+    s2 = fiobj_data_pread(large, len + 10, 100);
+    FIO_ASSERT(!s2.data && !s2.len, "`fiobj_data_pread` overflow");
+    /* the mapped data is writable, without changing the file */
+    s1.data[0] = 'A';
+    FIO_ASSERT(pread(obj2io(large)->fd, buf, 1, 0) == 1 && buf[0] == 'a' &&
+                   fiobj_obj2cstr(large).data[0] == 'A',
+               "editing memory mapped data shouldn't change the file");
+    s1.data[0] = 'a';
+    /* writing invalidates the map's length, so data is remapped */
+    fiobj_data_write(large, "!", 1);
+    s1 = fiobj_obj2cstr(large);
+    FIO_ASSERT(s1.len == len + 1 && s1.data[len] == '!',
+               "memory map not updated after `fiobj_data_write`");
+    s1 = fiobj_data_read(large, 3);
+    FIO_ASSERT(s1.len == 3 && !memcmp(s1.data, "abc", 3),
+               "`fiobj_data_read` error after mapping");
+    fiobj_free(large);
+    fprintf(stderr, "* memory mapped temporary files passed.\n");
+  }
+
   fprintf(stderr, "* passed.\n");
 }
 
@@ -18,6 +18,18 @@ License: MIT
 
 #include <fiobject.h>
 
+#ifndef FIOBJ_DATA_MMAP_MIN
+/**
+ * File backed Data Stream objects of at least this size (in bytes) are memory
+ * mapped when converted to a String (`fiobj_obj2cstr`) or read using
+ * `fiobj_data_pread`, instead of being copied into a memory buffer.
+ *
+ * The map is private (copy on write), so the returned buffer is writable, as
+ * it was when copied, and editing it never changes the file.
+ */
+#define FIOBJ_DATA_MMAP_MIN (16 * 1024)
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -117,6 +129,9 @@ void fiobj_data_seek(FIOBJ io, intptr_t position);
  * temporary(!) buffer object (not NUL terminated) string object. The reading
  * position is ignored and unchanged.
  *
+ * Large files (see `FIOBJ_DATA_MMAP_MIN`) are read in place, using a read only
+ * memory map of the file, so no data is copied.
+ *
  * The C string object will be invalidate the next time a function call to the
  * Data Stream object is made.
  */
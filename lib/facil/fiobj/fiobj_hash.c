@@ -31,6 +31,7 @@ License: MIT
     fiobj_free((obj));                                                         \
     (obj) = FIOBJ_INVALID;                                                     \
   } while (0)
+#define FIO_SET_GROUP_PROBING 1
 
 #include <fio.h>
 
@@ -58,6 +58,12 @@ fio_realloc2(void *ptr, size_t new_size, size_t valid_len) {
 #pragma weak fio_mmap
 void *__attribute__((weak)) fio_mmap(size_t size) { return fio_malloc(size); }
 
+#pragma weak fio_malloc_frozen
+int __attribute__((weak)) fio_malloc_frozen(int enable) {
+  return 0;
+  (void)enable;
+}
+
 /** The logging level */
 #if DEBUG
 #pragma weak FIO_LOG_LEVEL
@@ -415,6 +421,187 @@ void fiobj_free_complex_object(FIOBJ o) {
   fiobj_stack_free(&stack);
 }
 
+/* *****************************************************************************
+Thread confined (local) objects
+***************************************************************************** */
+#include <fiobj_hash.h>
+
+typedef struct {
+  fiobj_stack_s *stack;
+  uint8_t is_hash;
+} fiobj_local_task_s;
+
+/* collects a collection's members (and Hash keys) for `fiobj_local` */
+static int fiobj_local_task(FIOBJ o, void *info_) {
+  fiobj_local_task_s *info = info_;
+  fiobj_stack_push(info->stack, o);
+  if (info->is_hash)
+    fiobj_stack_push(info->stack, fiobj_hash_key_in_loop());
+  return 0;
+}
+
+/** Marks the object (and nested objects) for non-atomic reference counting. */
+FIOBJ fiobj_local(FIOBJ o) {
+  fiobj_stack_s stack = FIO_ARY_INIT;
+  fiobj_local_task_s info = {.stack = &stack};
+  FIOBJ pos = o;
+  do {
+    /* objects referenced elsewhere (including static objects) stay atomic,
+     * as do their members, which are reachable using the other reference */
+    if (!FIOBJ_IS_ALLOCATED(pos) || FIOBJECT2HEAD(pos)->frozen ||
+        FIOBJECT2HEAD(pos)->ref != 1)
+      continue;
+    FIOBJECT2HEAD(pos)->local = 1;
+    if (FIOBJECT2VTBL(pos)->each && FIOBJECT2VTBL(pos)->count(pos)) {
+      info.is_hash = FIOBJ_TYPE_IS(pos, FIOBJ_T_HASH);
+      FIOBJECT2VTBL(pos)->each(pos, 0, fiobj_local_task, &info);
+    }
+  } while (!fiobj_stack_pop(&stack, &pos));
+  fiobj_stack_free(&stack);
+  return o;
+}
+
+static inline void fiobj_share_mark(FIOBJ o) {
+  if (FIOBJ_IS_ALLOCATED(o) && !FIOBJECT2HEAD(o)->frozen)
+    FIOBJECT2HEAD(o)->local = 0;
+}
+
+static int fiobj_share_task(FIOBJ o, void *root_) {
+  fiobj_share_mark(o);
+  /* the root object isn't a Hash member, even if we're within a Hash loop */
+  if (o != (FIOBJ)root_)
+    fiobj_share_mark(fiobj_hash_key_in_loop());
+  return 0;
+}
+
+/** Promotes the object (and nested objects) to atomic reference counting. */
+FIOBJ fiobj_share(FIOBJ o) {
+  if (FIOBJ_IS_ALLOCATED(o))
+    fiobj_each2(o, fiobj_share_task, (void *)o);
+  return o;
+}
+
+/* *****************************************************************************
+Frozen (immortal) objects
+***************************************************************************** */
+#include <fiobj_ary.h>
+#include <fiobj_data.h>
+#include <fiobj_numbers.h>
+#include <fiobj_str.h>
+
+typedef struct {
+  FIOBJ copy;
+  /* (container, remaining children) pairs */
+  fiobj_stack_s stack;
+} fiobj_freeze_s;
+
+/* copies a single object (collections are copied empty) */
+static FIOBJ fiobj_freeze_copy(FIOBJ o) {
+  switch (FIOBJ_TYPE(o)) {
+  case FIOBJ_T_NUMBER:
+    return fiobj_num_new(fiobj_obj2num(o));
+  case FIOBJ_T_FLOAT:
+    return fiobj_float_new(fiobj_obj2float(o));
+  case FIOBJ_T_STRING: {
+    fio_str_info_s s = fiobj_obj2cstr(o);
+    FIOBJ c = fiobj_str_new(s.data, s.len);
+    /* cache the hash value now, so Hash lookups never write to the object */
+    fiobj_str_hash(c);
+    fiobj_str_freeze(c);
+    return c;
+  }
+  case FIOBJ_T_ARRAY:
+    return fiobj_ary_new2(fiobj_ary_count(o));
+  case FIOBJ_T_HASH:
+    return fiobj_hash_new2(fiobj_hash_count(o));
+  case FIOBJ_T_DATA: {
+    fio_str_info_s s = fiobj_obj2cstr(o);
+    char *buf = fio_malloc(s.len + 1);
+    FIO_ASSERT_ALLOC(buf);
+    if (s.len)
+      memcpy(buf, s.data, s.len);
+    return fiobj_data_newstr2(buf, s.len, fio_free);
+  }
+  case FIOBJ_T_NULL:  /* fallthrough */
+  case FIOBJ_T_TRUE:  /* fallthrough */
+  case FIOBJ_T_FALSE: /* fallthrough */
+  case FIOBJ_T_UNKNOWN:
+    break;
+  }
+  return o;
+}
+
+static int fiobj_freeze_copy_task(FIOBJ o, void *info_) {
+  fiobj_freeze_s *info = info_;
+  FIOBJ c = fiobj_freeze_copy(o);
+  if (!fiobj_stack_count(&info->stack)) {
+    /* the root object */
+    info->copy = c;
+  } else {
+    /* add the copy to the (copied) parent collection */
+    uintptr_t remaining = 0;
+    FIOBJ parent = FIOBJ_INVALID;
+    fiobj_stack_pop(&info->stack, &remaining);
+    fiobj_stack_pop(&info->stack, &parent);
+    if (FIOBJ_TYPE_IS(parent, FIOBJ_T_HASH)) {
+      FIOBJ key = fiobj_freeze_copy(fiobj_hash_key_in_loop());
+      fiobj_hash_set(parent, key, c);
+      fiobj_free(key);
+    } else {
+      fiobj_ary_push(parent, c);
+    }
+    if (--remaining) {
+      fiobj_stack_push(&info->stack, parent);
+      fiobj_stack_push(&info->stack, remaining);
+    }
+  }
+  /* nested objects will be added to this collection (fiobj_each2 order) */
+  if (FIOBJ_IS_ALLOCATED(o) && FIOBJECT2VTBL(o)->each &&
+      FIOBJECT2VTBL(o)->count(o)) {
+    fiobj_stack_push(&info->stack, c);
+    fiobj_stack_push(&info->stack, FIOBJECT2VTBL(o)->count(o));
+  }
+  return 0;
+}
+
+static int fiobj_freeze_mark_task(FIOBJ o, void *root_) {
+  if (FIOBJ_IS_ALLOCATED(o))
+    FIOBJECT2HEAD(o)->frozen = 1;
+  if (o != (FIOBJ)root_ && FIOBJ_IS_ALLOCATED(fiobj_hash_key_in_loop()))
+    FIOBJECT2HEAD(fiobj_hash_key_in_loop())->frozen = 1;
+  return 0;
+}
+
+static int fiobj_thaw_task(FIOBJ o, void *root_) {
+  if (FIOBJ_IS_ALLOCATED(o))
+    FIOBJECT2HEAD(o)->frozen = 0;
+  if (o != (FIOBJ)root_ && FIOBJ_IS_ALLOCATED(fiobj_hash_key_in_loop()))
+    FIOBJECT2HEAD(fiobj_hash_key_in_loop())->frozen = 0;
+  return 0;
+}
+
+/** Returns an immortal, frozen, copy of the object (and nested objects). */
+FIOBJ fiobj_freeze(FIOBJ o) {
+  if (!FIOBJ_IS_ALLOCATED(o) || FIOBJECT2HEAD(o)->frozen)
+    return o;
+  fiobj_freeze_s info = {.stack = FIO_ARY_INIT};
+  /* collect the copy's memory from the frozen memory region */
+  int old = fio_malloc_frozen(1);
+  fiobj_each2(o, fiobj_freeze_copy_task, &info);
+  fio_malloc_frozen(old);
+  fiobj_stack_free(&info.stack);
+  fiobj_each2(info.copy, fiobj_freeze_mark_task, (void *)info.copy);
+  fiobj_free(o);
+  return info.copy;
+}
+
+/** Reverses `fiobj_freeze`, so the object can be freed (i.e., on cleanup). */
+FIOBJ fiobj_thaw(FIOBJ o) {
+  if (FIOBJ_IS_ALLOCATED(o))
+    fiobj_each2(o, fiobj_thaw_task, (void *)o);
+  return o;
+}
+
 /* *****************************************************************************
 Is Equal?
 ***************************************************************************** */
@@ -615,6 +802,84 @@ void fiobj_test_core(void) {
   TEST_ASSERT(!fiobj_iseq(fiobj_null(), fiobj_true()),
               "fiobj_null eqal to fiobj_true!");
   fprintf(stderr, "* passed.\n");
+  fprintf(stderr, "=== Testing fiobj_local / fiobj_share\n");
+  o = fiobj_hash_new();
+  key = fiobj_str_new("my key", 6);
+  tmp = fiobj_str_new("shared", 6);
+  fiobj_hash_set(o, key, fiobj_dup(tmp));
+  fiobj_free(key);
+  key = fiobj_str_new("other key", 9);
+  fiobj_hash_set(o, key, fiobj_ary_new());
+  fiobj_free(key); /* the Hash owns the key, we can still peek at it */
+  fiobj_local(o);
+  TEST_ASSERT(FIOBJECT2HEAD(o)->local, "fiobj_local didn't mark root!\n");
+  TEST_ASSERT(FIOBJECT2HEAD(key)->local, "fiobj_local didn't mark key!\n");
+  TEST_ASSERT(FIOBJECT2HEAD(fiobj_hash_get(o, key))->local,
+              "fiobj_local didn't mark nested object!\n");
+  TEST_ASSERT(!FIOBJECT2HEAD(tmp)->local,
+              "fiobj_local marked an object referenced elsewhere!\n");
+  fiobj_dup(o);
+  TEST_ASSERT(FIOBJECT2HEAD(o)->ref == 2, "local reference count error!\n");
+  fiobj_free(o);
+  fiobj_share(o);
+  TEST_ASSERT(!FIOBJECT2HEAD(o)->local && !FIOBJECT2HEAD(key)->local &&
+                  !FIOBJECT2HEAD(fiobj_hash_get(o, key))->local,
+              "fiobj_share didn't promote all objects!\n");
+  fiobj_free(o);
+  TEST_ASSERT(FIOBJECT2HEAD(tmp)->ref == 1, "reference count error!\n");
+  fiobj_free(tmp);
+  /* members of a collection referenced elsewhere aren't marked */
+  tmp = fiobj_ary_new();
+  fiobj_ary_push(tmp, fiobj_str_new("member", 6));
+  fiobj_ary_push(tmp, fiobj_ary_new());
+  o = fiobj_hash_new();
+  key = fiobj_str_new("shared", 6);
+  fiobj_hash_set(o, key, fiobj_dup(tmp));
+  fiobj_free(key);
+  fiobj_local(o);
+  TEST_ASSERT(FIOBJECT2HEAD(o)->local && FIOBJECT2HEAD(key)->local,
+              "fiobj_local didn't mark root or key!\n");
+  TEST_ASSERT(!FIOBJECT2HEAD(tmp)->local &&
+                  !FIOBJECT2HEAD(fiobj_ary_index(tmp, 0))->local &&
+                  !FIOBJECT2HEAD(fiobj_ary_index(tmp, 1))->local,
+              "fiobj_local marked members of a shared collection!\n");
+  fiobj_free(o);
+  TEST_ASSERT(FIOBJECT2HEAD(tmp)->ref == 1, "reference count error!\n");
+  fiobj_free(tmp);
+  fprintf(stderr, "* passed.\n");
+  fprintf(stderr, "=== Testing fiobj_freeze\n");
+  o = fiobj_hash_new();
+  key = fiobj_str_new("list", 4);
+  tmp = fiobj_ary_new();
+  fiobj_ary_push(tmp, fiobj_num_new(((intptr_t)1) << 60));
+  fiobj_ary_push(tmp, fiobj_float_new(0.5));
+  fiobj_ary_push(tmp, fiobj_null());
+  fiobj_ary_push(tmp, FIOBJ_INVALID);
+  fiobj_ary_push(tmp, fiobj_hash_new());
+  fiobj_hash_set(o, key, tmp);
+  fiobj_free(key);
+  key = fiobj_str_new("name", 4);
+  fiobj_hash_set(o, key, fiobj_str_new("facil.io", 8));
+  o2 = fiobj_freeze(fiobj_dup(o));
+  TEST_ASSERT(o2 != o && fiobj_iseq(o, o2), "frozen copy isn't equal!\n");
+  TEST_ASSERT(fiobj_freeze(o2) == o2, "frozen object was copied again!\n");
+  tmp = fiobj_hash_get(o2, key);
+  TEST_ASSERT(FIOBJECT2HEAD(o2)->frozen && FIOBJECT2HEAD(tmp)->frozen,
+              "fiobj_freeze didn't mark all objects!\n");
+  fiobj_dup(o2);
+  fiobj_free(o2);
+  fiobj_free(o2);
+  TEST_ASSERT(FIOBJECT2HEAD(o2)->ref == 1 && FIOBJECT2HEAD(tmp)->ref == 1,
+              "frozen objects shouldn't be reference counted!\n");
+  TEST_ASSERT(!fiobj_str_write(tmp, "!", 1),
+              "frozen String shouldn't be editable!\n");
+  fiobj_free(o);
+  fiobj_free(key);
+  fiobj_thaw(o2);
+  TEST_ASSERT(!FIOBJECT2HEAD(o2)->frozen && !FIOBJECT2HEAD(tmp)->frozen,
+              "fiobj_thaw didn't thaw all objects!\n");
+  fiobj_free(o2);
+  fprintf(stderr, "* passed.\n");
 }
 
 #endif
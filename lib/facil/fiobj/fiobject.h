@@ -112,6 +112,67 @@ FIO_INLINE FIOBJ fiobj_dup(FIOBJ);
  */
 FIO_INLINE void fiobj_free(FIOBJ);
 
+/**
+ * Marks the object (and any nested objects) as confined to the calling thread,
+ * so reference counting uses plain (non-atomic) increments and decrements.
+ *
+ * Call this right after creating the object, before any reference is handed
+ * to another thread. Objects already referenced more than once (such as static
+ * or shared objects stored within a new collection) are left atomic, and so
+ * are their nested objects.
+ *
+ * Before the object (or a nested object) becomes reachable by another thread
+ * (i.e., stored in a global cache, or processed concurrently by a different
+ * thread), it MUST be promoted using `fiobj_share`.
+ *
+ * Passing an object between threads one at a time (i.e., by scheduling a task
+ * that takes ownership of the object) is safe.
+ *
+ * Always returns the value passed along.
+ */
+FIOBJ fiobj_local(FIOBJ);
+
+/**
+ * Promotes the object (and any nested objects) to atomic reference counting,
+ * reversing `fiobj_local`.
+ *
+ * This MUST be called by the owning thread before sharing the object.
+ *
+ * Always returns the value passed along.
+ */
+FIOBJ fiobj_share(FIOBJ);
+
+/**
+ * Returns an immortal, frozen, copy of the object (and any nested objects).
+ *
+ * `fiobj_dup` and `fiobj_free` are no-ops for frozen objects, so using them
+ * never writes to the object's memory. The copy is allocated in a dedicated
+ * memory region (see `fio_malloc_frozen`), so data frozen before the server
+ * forks its workers (i.e., templates, configuration trees or static strings)
+ * remains physically shared by all the worker processes.
+ *
+ * Frozen objects aren't deallocated (unless thawed, see `fiobj_thaw`) and
+ * MUST NOT be edited. They can be safely accessed (read) by any thread or
+ * process.
+ *
+ * The reference passed to the function is consumed (freed). Objects that are
+ * already frozen are returned as is.
+ *
+ * Data objects are copied as in-memory Data objects.
+ */
+FIOBJ fiobj_freeze(FIOBJ);
+
+/**
+ * Reverses `fiobj_freeze`, so the object (and any nested objects) can be freed
+ * using `fiobj_free` (i.e., during cleanup). Frozen Strings remain read only.
+ *
+ * Readers don't hold references to frozen objects, so the object MUST NOT be
+ * in use by any other thread once it's thawed.
+ *
+ * Always returns the value passed along.
+ */
+FIOBJ fiobj_thaw(FIOBJ);
+
 /**
  * Tests if an object evaluates as TRUE.
  *
@@ -327,6 +388,10 @@ typedef struct {
 typedef struct {
   /* must be first */
   fiobj_type_enum type;
+  /* thread confined objects use non-atomic reference counting */
+  uint8_t local;
+  /* frozen objects are immortal, reference counting is skipped */
+  uint8_t frozen;
   /* reference counter */
   uint32_t ref;
 } fiobj_object_header_s;
@@ -400,8 +465,16 @@ Atomic reference counting
 #error missing required atomic options.
 #endif
 
-#define OBJREF_ADD(o) fiobj_ref_inc(o)
-#define OBJREF_REM(o) fiobj_ref_dec(o)
+/** Reference count addition, atomic unless the object is thread confined. */
+#define OBJREF_ADD(o)                                                          \
+  (FIOBJECT2HEAD(o)->frozen                                                    \
+       ? 1                                                                     \
+       : FIOBJECT2HEAD(o)->local ? ++FIOBJECT2HEAD(o)->ref : fiobj_ref_inc(o))
+/** Reference count subtraction, atomic unless the object is thread confined. */
+#define OBJREF_REM(o)                                                          \
+  (FIOBJECT2HEAD(o)->frozen                                                    \
+       ? 1                                                                     \
+       : FIOBJECT2HEAD(o)->local ? --FIOBJECT2HEAD(o)->ref : fiobj_ref_dec(o))
 
 /* *****************************************************************************
 Inlined Functions
@@ -446,7 +519,7 @@ FIO_INLINE FIOBJ fiobj_dup(FIOBJ o) {
 FIO_INLINE void fiobj_free(FIOBJ o) {
   if (!FIOBJ_IS_ALLOCATED(o))
     return;
-  if (fiobj_ref_dec(o))
+  if (OBJREF_REM(o))
     return;
   if (FIOBJECT2VTBL(o)->each && FIOBJECT2VTBL(o)->count(o))
     fiobj_free_complex_object(o);
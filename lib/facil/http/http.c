@@ -14,6 +14,7 @@ Feel free to copy, use and enjoy according to the license provided.
 #include <fcntl.h>
 #include <signal.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -318,6 +319,296 @@ int http_set_cookie(http_s *h, http_cookie_args_s cookie) {
 #define http_set_cookie(http__req__, ...)                                      \
   http_set_cookie((http__req__), (http_cookie_args_s){__VA_ARGS__})
 
+/* *****************************************************************************
+Dynamic Response Compression
+***************************************************************************** */
+
+#if HAVE_ZLIB || HAVE_BROTLI || HAVE_ZSTD
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
+#if HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+#if HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+typedef enum {
+  HTTP_ENCODING_NONE = 0,
+  HTTP_ENCODING_GZIP = 1,
+  HTTP_ENCODING_BR = 2,
+  HTTP_ENCODING_ZSTD = 3,
+} http_encoding_e;
+
+/**
+ * Returns 1 if the `Accept-Encoding` value lists the encoding `name` without a
+ * zero quality value (`q=0`). Otherwise returns 0.
+ */
+static int http_encoding_accepted(fio_str_info_s ae, const char *name,
+                                  size_t len) {
+  const char *pos = ae.data;
+  const char *end = ae.data + ae.len;
+  while (pos < end) {
+    while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == ','))
+      ++pos;
+    const char *token = pos;
+    while (pos < end && *pos != ',' && *pos != ';' && *pos != ' ' &&
+           *pos != '\t')
+      ++pos;
+    const uint8_t match =
+        ((size_t)(pos - token) == len && !strncasecmp(token, name, len));
+    uint8_t refused = 0;
+    /* review parameters, looking for a zero quality value */
+    while (pos < end && *pos != ',') {
+      if ((*pos | 32) == 'q' && pos + 1 < end && pos[1] == '=') {
+        pos += 2;
+        refused = 1;
+        while (pos < end && *pos != ',' && *pos != ';' && *pos != ' ') {
+          if (*pos != '0' && *pos != '.')
+            refused = 0;
+          ++pos;
+        }
+        continue;
+      }
+      ++pos;
+    }
+    if (match)
+      return !refused;
+  }
+  return 0;
+}
+
+/* selects the preferred encoding accepted by the client */
+static http_encoding_e http_encoding_negotiate(http_s *h) {
+  FIOBJ tmp = fiobj_hash_get(h->headers, HTTP_HEADER_ACCEPT_ENCODING);
+  if (!tmp || !FIOBJ_TYPE_IS(tmp, FIOBJ_T_STRING))
+    return HTTP_ENCODING_NONE;
+  fio_str_info_s ae = fiobj_obj2cstr(tmp);
+#if HAVE_BROTLI
+  if (http_encoding_accepted(ae, "br", 2))
+    return HTTP_ENCODING_BR;
+#endif
+#if HAVE_ZSTD
+  if (http_encoding_accepted(ae, "zstd", 4))
+    return HTTP_ENCODING_ZSTD;
+#endif
+#if HAVE_ZLIB
+  if (http_encoding_accepted(ae, "gzip", 4))
+    return HTTP_ENCODING_GZIP;
+#endif
+  return HTTP_ENCODING_NONE;
+}
+
+/* tests if the response's content-type is worth compressing */
+static int http_compress_mime(http_s *h) {
+  FIOBJ tmp =
+      fiobj_hash_get(h->private_data.out_headers, HTTP_HEADER_CONTENT_TYPE);
+  if (!tmp)
+    return 1;
+  if (!FIOBJ_TYPE_IS(tmp, FIOBJ_T_STRING))
+    return 0;
+  fio_str_info_s t = fiobj_obj2cstr(tmp);
+  return ((t.len >= 5 && !strncasecmp(t.data, "text/", 5)) ||
+          strstr(t.data, "json") || strstr(t.data, "javascript") ||
+          strstr(t.data, "xml") || strstr(t.data, "svg"));
+}
+
+/* compresses `data` into a new String, FIOBJ_INVALID if it doesn't pay off */
+static FIOBJ http_compress_data(http_encoding_e encoding, uint8_t level,
+                                void *data, size_t len) {
+  FIOBJ out = FIOBJ_INVALID;
+  size_t out_len = 0;
+  switch (encoding) {
+#if HAVE_ZLIB
+  case HTTP_ENCODING_GZIP: {
+    z_stream z = {.zalloc = Z_NULL, .zfree = Z_NULL, .opaque = Z_NULL};
+    /* window bits + 16 selects the gzip wrapper */
+    if (deflateInit2(&z, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) !=
+        Z_OK)
+      return FIOBJ_INVALID;
+    out_len = deflateBound(&z, len);
+    out = fiobj_str_buf(out_len);
+    z.next_in = data;
+    z.avail_in = len;
+    z.next_out = (Bytef *)fiobj_obj2cstr(out).data;
+    z.avail_out = out_len;
+    if (deflate(&z, Z_FINISH) != Z_STREAM_END)
+      out_len = len; /* marks failure */
+    else
+      out_len -= z.avail_out;
+    deflateEnd(&z);
+    break;
+  }
+#endif
+#if HAVE_BROTLI
+  case HTTP_ENCODING_BR:
+    out_len = BrotliEncoderMaxCompressedSize(len);
+    if (!out_len)
+      return FIOBJ_INVALID;
+    out = fiobj_str_buf(out_len);
+    if (!BrotliEncoderCompress(level, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                               len, data, &out_len,
+                               (uint8_t *)fiobj_obj2cstr(out).data))
+      out_len = len; /* marks failure */
+    break;
+#endif
+#if HAVE_ZSTD
+  case HTTP_ENCODING_ZSTD: {
+    out_len = ZSTD_compressBound(len);
+    out = fiobj_str_buf(out_len);
+    const size_t result =
+        ZSTD_compress(fiobj_obj2cstr(out).data, out_len, data, len, level);
+    out_len = ZSTD_isError(result) ? len /* marks failure */ : result;
+    break;
+  }
+#endif
+  default:
+    return FIOBJ_INVALID;
+  }
+  if (out_len >= len) {
+    fiobj_free(out);
+    return FIOBJ_INVALID;
+  }
+  fiobj_str_resize(out, out_len);
+  return out;
+}
+
+/* a cached compressed response body */
+typedef struct {
+  uint64_t check; /* a second hash, so collisions require both to collide */
+  size_t len;     /* the uncompressed length */
+  uint8_t encoding;
+  uint8_t level;
+  FIOBJ data;
+} http_compress_entry_s;
+
+#define FIO_FORCE_MALLOC_TMP 1 /* cache entries outlive the allocator tasks */
+#define FIO_SET_NAME http_compress_cache
+#define FIO_SET_OBJ_TYPE http_compress_entry_s *
+#define FIO_SET_OBJ_COMPARE(o1, o2)                                            \
+  ((o1)->check == (o2)->check && (o1)->len == (o2)->len &&                     \
+   (o1)->encoding == (o2)->encoding && (o1)->level == (o2)->level)
+#define FIO_SET_OBJ_DESTROY(o)                                                 \
+  do {                                                                         \
+    fiobj_free((o)->data);                                                     \
+    free((o));                                                                 \
+  } while (0)
+#include <fio.h>
+
+static http_compress_cache_s http_compress_cache = FIO_SET_INIT;
+static fio_lock_i http_compress_lock = FIO_LOCK_INIT;
+
+static void http_compress_cache_clear(void *ignr_) {
+  fio_lock(&http_compress_lock);
+  http_compress_cache_free(&http_compress_cache);
+  fio_unlock(&http_compress_lock);
+  (void)ignr_;
+}
+
+/**
+ * Returns a compressed copy of `data`, using the cache for identical bodies.
+ *
+ * Returns FIOBJ_INVALID if compression doesn't reduce the body's size.
+ */
+static FIOBJ http_compress_data_cached(http_encoding_e encoding, uint8_t level,
+                                       void *data, size_t len) {
+  const uint64_t seed = ((uint64_t)encoding << 8) | level;
+  http_compress_entry_s needle = {
+      .check = fio_risky_hash(data, len, ~seed),
+      .len = len,
+      .encoding = encoding,
+      .level = level,
+  };
+  const uint64_t hash = fio_risky_hash(data, len, seed);
+  FIOBJ out = FIOBJ_INVALID;
+  fio_lock(&http_compress_lock);
+  http_compress_entry_s *e =
+      http_compress_cache_find(&http_compress_cache, hash, &needle);
+  if (e)
+    out = fiobj_dup(e->data);
+  fio_unlock(&http_compress_lock);
+  if (e)
+    return out;
+
+  out = http_compress_data(encoding, level, data, len);
+  if (!out || !HTTP_COMPRESS_CACHE_LIMIT ||
+      fiobj_obj2cstr(out).len > HTTP_COMPRESS_CACHE_MAX_SIZE)
+    return out;
+
+  e = malloc(sizeof(*e));
+  FIO_ASSERT_ALLOC(e);
+  *e = needle;
+  e->data = fiobj_dup(out);
+  fio_lock(&http_compress_lock);
+  {
+    static uint8_t registered;
+    if (!registered) {
+      registered = 1;
+      fio_state_callback_add(FIO_CALL_AT_EXIT, http_compress_cache_clear,
+                             NULL);
+    }
+  }
+  if (http_compress_cache_count(&http_compress_cache) >=
+      HTTP_COMPRESS_CACHE_LIMIT) {
+    /* evict the oldest entry (insertion order) */
+    FIO_SET_FOR_LOOP(&http_compress_cache, pos) {
+      if (!pos->hash)
+        continue;
+      http_compress_cache_remove(&http_compress_cache, pos->hash, pos->obj,
+                                 NULL);
+      break;
+    }
+  }
+  http_compress_cache_overwrite(&http_compress_cache, hash, e, NULL);
+  fio_unlock(&http_compress_lock);
+  return out;
+}
+
+/**
+ * Compresses a response body when the settings, response headers and the
+ * client's `Accept-Encoding` allow it.
+ *
+ * Sets the response headers and returns the compressed body (or
+ * FIOBJ_INVALID when the body should be sent as is).
+ */
+static FIOBJ http_compress_body(http_s *h, void *data, uintptr_t length) {
+  http_settings_s *settings = http2protocol(h)->settings;
+  if (!settings->compress_level || settings->is_client ||
+      length < settings->compress_min_size || h->status == 206 ||
+      fiobj_hash_get(h->private_data.out_headers,
+                     HTTP_HEADER_CONTENT_ENCODING) ||
+      fiobj_hash_get(h->private_data.out_headers,
+                     HTTP_HEADER_CONTENT_LENGTH) ||
+      !http_compress_mime(h))
+    return FIOBJ_INVALID;
+  /* the response depends on the request's Accept-Encoding header */
+  http_set_header(h, HTTP_HEADER_VARY, fiobj_dup(HTTP_HEADER_ACCEPT_ENCODING));
+  const http_encoding_e encoding = http_encoding_negotiate(h);
+  if (!encoding)
+    return FIOBJ_INVALID;
+  FIOBJ out = http_compress_data_cached(encoding, settings->compress_level,
+                                        data, length);
+  if (!out)
+    return FIOBJ_INVALID;
+  FIOBJ value = HTTP_HVALUE_GZIP;
+  if (encoding == HTTP_ENCODING_BR)
+    value = HTTP_HVALUE_BR;
+  else if (encoding == HTTP_ENCODING_ZSTD)
+    value = HTTP_HVALUE_ZSTD;
+  http_set_header(h, HTTP_HEADER_CONTENT_ENCODING, fiobj_dup(value));
+  return out;
+}
+#else
+static inline FIOBJ http_compress_body(http_s *h, void *data,
+                                       uintptr_t length) {
+  return FIOBJ_INVALID;
+  (void)h;
+  (void)data;
+  (void)length;
+}
+#endif
+
 /**
  * Sends the response headers and body.
  *
@@ -332,11 +623,19 @@ int http_send_body(http_s *r, void *data, uintptr_t length) {
     http_finish(r);
     return 0;
   }
+  FIOBJ compressed = http_compress_body(r, data, length);
+  if (compressed) {
+    fio_str_info_s tmp = fiobj_obj2cstr(compressed);
+    data = tmp.data;
+    length = tmp.len;
+  }
   add_content_length(r, length);
   // add_content_type(r);
   add_date(r);
-  return ((http_vtable_s *)r->private_data.vtbl)
-      ->http_send_body(r, data, length);
+  int ret =
+      ((http_vtable_s *)r->private_data.vtbl)->http_send_body(r, data, length);
+  fiobj_free(compressed);
+  return ret;
 }
 /**
  * Sends the response headers and the specified file (the response's body).
@@ -769,6 +1068,13 @@ void http_pause(http_s *h, void (*task)(http_pause_handle_s *http)) {
       .h = h,
       .udata = h->udata,
   };
+  /* the paused request may be accessed by other threads */
+  fiobj_share(h->method);
+  fiobj_share(h->status_str);
+  fiobj_share(h->version);
+  fiobj_share(h->path);
+  fiobj_share(h->query);
+  fiobj_share(h->headers);
   vtbl->http_on_pause(h, p);
   fio_defer(http_pause_wrapper, http, (void *)((uintptr_t)task));
 }
@@ -827,6 +1133,10 @@ static http_settings_s *http_settings_new(http_settings_s arg_settings) {
     arg_settings.ws_timeout = 40; /* defaults to 40 seconds */
   if (!arg_settings.max_header_size)
     arg_settings.max_header_size = 32 * 1024; /* defaults to 32Kib seconds */
+  if (!arg_settings.compress_min_size)
+    arg_settings.compress_min_size = HTTP_COMPRESS_MIN_SIZE;
+  if (arg_settings.compress_level > 9)
+    arg_settings.compress_level = 9;
   if (arg_settings.max_clients <= 0 ||
       (size_t)(arg_settings.max_clients + HTTP_BUSY_UNLESS_HAS_FDS) >
           fio_capa()) {
@@ -1154,6 +1464,493 @@ on_error:
   return -1;
 }
 
+/* *****************************************************************************
+HTTP client connection pool
+***************************************************************************** */
+
+typedef struct http_pool_s http_pool_s;
+
+/* a pooled client request, waiting for (or sent over) a connection */
+typedef struct {
+  fio_ls_embd_s node; /* the pool's waiting list or a connection's FIFO */
+  http_settings_s args;
+  http_pool_s *pool;
+  FIOBJ path;
+  FIOBJ host;
+  uint8_t retried;
+} http_pool_req_s;
+
+/* a pooled (keep-alive) client connection */
+typedef struct {
+  fio_ls_embd_s node;     /* the pool's idle / busy list */
+  fio_ls_embd_s requests; /* requests sent, in the order they were written */
+  http_pool_s *pool;
+  intptr_t uuid;
+  size_t in_flight; /* requests assigned to the connection (sent or not) */
+  uint8_t pipeline; /* set while all requests in flight allow pipelining */
+  uint8_t closing;  /* set once the connection can't be reused */
+  uint8_t reused;   /* taken from the idle list, no response since */
+} http_pool_conn_s;
+
+/* the connections (and waiting requests) for a scheme, host and port */
+struct http_pool_s {
+  fio_ls_embd_s idle;       /* connections without requests in flight */
+  fio_ls_embd_s busy;       /* connections with requests in flight */
+  fio_ls_embd_s waiting;    /* requests waiting for a connection */
+  http_settings_s settings; /* settings for new connections */
+  char *address;
+  char *port;
+  size_t open;  /* open (and connecting) connections */
+  size_t limit; /* the maximal number of connections */
+  size_t key_len;
+  char *key;
+};
+
+#define FIO_FORCE_MALLOC_TMP 1 /* pools are never freed before exit */
+#define FIO_SET_NAME http_pool_map
+#define FIO_SET_OBJ_TYPE http_pool_s *
+#define FIO_SET_OBJ_COMPARE(o1, o2)                                            \
+  ((o1)->key_len == (o2)->key_len &&                                           \
+   !memcmp((o1)->key, (o2)->key, (o1)->key_len))
+#include <fio.h>
+
+static http_pool_map_s http_pools = FIO_SET_INIT;
+static fio_lock_i http_pools_lock = FIO_LOCK_INIT;
+static uint8_t http_pools_stopping;
+
+static void http_pool_dispatch(http_pool_s *pool);
+
+/* calls the request's `on_finish` callback and frees the request */
+static void http_pool_req_finish(http_pool_req_s *r) {
+  if (r->args.on_finish)
+    r->args.on_finish(&r->args);
+  fiobj_free(r->path);
+  fiobj_free(r->host);
+  free(r);
+}
+
+/* finishes (fails) all the requests in the list */
+static void http_pool_req_finish_all(fio_ls_embd_s *list) {
+  while (fio_ls_embd_any(list))
+    http_pool_req_finish(
+        FIO_LS_EMBD_OBJ(http_pool_req_s, node, fio_ls_embd_shift(list)));
+}
+
+/* tests if the server allows the connection to be reused after `h` */
+static uint8_t http_pool_keep_alive(http_s *h) {
+  if (h->status == 101)
+    return 0;
+  FIOBJ tmp = fiobj_hash_get(h->headers, HTTP_HEADER_CONNECTION);
+  fio_str_info_s t;
+  if (tmp) {
+    t = fiobj_obj2cstr(tmp);
+    return !t.len || (t.data[0] | 32) != 'c';
+  }
+  t = fiobj_obj2cstr(h->version);
+  return t.len > 7 && t.data[5] == '1' && t.data[6] == '.' && t.data[7] == '1';
+}
+
+/* writes the request, runs within the connection's lock */
+static void http_pool_perform(intptr_t uuid, fio_protocol_s *pr, void *r_) {
+  http_pool_req_s *r = r_;
+  http_pool_conn_s *c = ((http_fio_protocol_s *)pr)->settings->udata;
+  http_s *h = fio_malloc(sizeof(*h));
+  FIO_ASSERT_ALLOC(h);
+  http_s_new(h, (http_fio_protocol_s *)pr, http1_vtable());
+  h->udata = r->args.udata;
+  h->status = 0;
+  /* the request keeps its path and host, in case it's retried */
+  h->path = fiobj_dup(r->path);
+  http_set_header(h, HTTP_HEADER_HOST, fiobj_dup(r->host));
+  /* responses arrive in the order requests are written */
+  fio_lock(&http_pools_lock);
+  fio_ls_embd_push(&c->requests, &r->node);
+  if (c->node.next == &c->node && !c->closing) {
+    /* a new connection, other requests are written after the first one */
+    fio_ls_embd_push(&c->pool->busy, &c->node);
+  }
+  fio_unlock(&http_pools_lock);
+  r->args.on_response(h);
+  (void)uuid;
+}
+
+/* the connection was lost before the request was written, try again */
+static void http_pool_requeue(intptr_t uuid, void *r_) {
+  http_pool_req_s *r = r_;
+  if (r->retried) {
+    http_pool_req_finish(r);
+    return;
+  }
+  r->retried = 1;
+  fio_lock(&http_pools_lock);
+  fio_ls_embd_unshift(&r->pool->waiting, &r->node);
+  fio_unlock(&http_pools_lock);
+  http_pool_dispatch(r->pool);
+  (void)uuid;
+}
+
+static void http_pool_on_response(http_s *h) {
+  http_pool_conn_s *c = h->udata;
+  http_pool_req_s *r = NULL;
+  fio_lock(&http_pools_lock);
+  if (fio_ls_embd_any(&c->requests)) {
+    r = FIO_LS_EMBD_OBJ(http_pool_req_s, node,
+                        fio_ls_embd_shift(&c->requests));
+    --c->in_flight;
+  }
+  c->reused = 0;
+  if (!r || !http_pool_keep_alive(h)) {
+    /* requests in flight will fail once the connection closes */
+    c->closing = 1;
+    fio_ls_embd_remove(&c->node);
+  } else if (!c->in_flight && !c->closing) {
+    fio_ls_embd_remove(&c->node);
+    fio_ls_embd_push(&c->pool->idle, &c->node);
+    c->pipeline = 1;
+  }
+  fio_unlock(&http_pools_lock);
+  if (!r) {
+    FIO_LOG_WARNING("(HTTP client) unexpected response, closing connection.");
+    fio_close(c->uuid);
+    return;
+  }
+  h->udata = r->args.udata;
+  r->args.on_response(h);
+  http_pool_req_finish(r);
+  if (c->closing)
+    fio_close(c->uuid);
+  else
+    http_pool_dispatch(c->pool);
+}
+
+static void http_pool_on_upgrade(http_s *h, char *proto, size_t len) {
+  http_pool_on_response(h);
+  (void)proto;
+  (void)len;
+}
+
+static void http_pool_on_close(intptr_t uuid, fio_protocol_s *protocol) {
+  http_settings_s *set = ((http_fio_protocol_s *)protocol)->settings;
+  http_pool_conn_s *c = set->udata;
+  http_pool_s *pool = c->pool;
+  void (**original)(intptr_t, fio_protocol_s *) =
+      (void (**)(intptr_t, fio_protocol_s *))(set + 1);
+  fio_ls_embd_s lost = FIO_LS_INIT(lost);
+  fio_ls_embd_s retry = FIO_LS_INIT(retry);
+  fio_lock(&http_pools_lock);
+  fio_ls_embd_remove(&c->node);
+  --pool->open;
+  /*
+   * unanswered requests fail, unless pipelined (idempotent) or sent over a
+   * stale idle connection (the server closed it before reading the request)
+   */
+  while (fio_ls_embd_any(&c->requests)) {
+    http_pool_req_s *r = FIO_LS_EMBD_OBJ(http_pool_req_s, node,
+                                         fio_ls_embd_shift(&c->requests));
+    if ((r->args.pipeline || c->reused) && !r->retried &&
+        !http_pools_stopping) {
+      r->retried = 1;
+      fio_ls_embd_push(&retry, &r->node);
+    } else {
+      fio_ls_embd_push(&lost, &r->node);
+    }
+  }
+  while (fio_ls_embd_any(&retry))
+    fio_ls_embd_unshift(&pool->waiting, fio_ls_embd_pop(&retry));
+  fio_unlock(&http_pools_lock);
+  http_pool_req_finish_all(&lost);
+  original[0](uuid, protocol);
+  http_settings_free(set);
+  free(c);
+  http_pool_dispatch(pool);
+}
+
+static void http_pool_on_fail(intptr_t uuid, void *r_) {
+  http_pool_req_s *r = r_;
+  http_pool_s *pool = r->pool;
+  fio_lock(&http_pools_lock);
+  --pool->open;
+  fio_unlock(&http_pools_lock);
+  http_pool_req_finish(r);
+  http_pool_dispatch(pool);
+  (void)uuid;
+}
+
+static void http_pool_on_open(intptr_t uuid, void *r_) {
+  http_pool_req_s *r = r_;
+  http_pool_s *pool = r->pool;
+  http_settings_s *set = http_settings_new(pool->settings);
+  http_pool_conn_s *c = malloc(sizeof(*c));
+  FIO_ASSERT_ALLOC(c);
+  *c = (http_pool_conn_s){
+      .node = FIO_LS_INIT(c->node),
+      .requests = FIO_LS_INIT(c->requests),
+      .pool = pool,
+      .uuid = uuid,
+      .in_flight = 1,
+      .pipeline = r->args.pipeline,
+  };
+  set->is_client = 1;
+  set->udata = c;
+  fio_timeout_set(uuid, set->timeout);
+  fio_protocol_s *pr = http1_new(uuid, set, NULL, 0);
+  if (!pr) {
+    free(c);
+    http_settings_free(set);
+    fio_close(uuid);
+    http_pool_on_fail(uuid, r);
+    return;
+  }
+  { /* store the original on_close at the end of the struct, we wrap it. */
+    void (**original)(intptr_t, fio_protocol_s *) =
+        (void (**)(intptr_t, fio_protocol_s *))(set + 1);
+    *original = pr->on_close;
+    pr->on_close = http_pool_on_close;
+  }
+  fio_defer_io_task(uuid, .task = http_pool_perform,
+                    .fallback = http_pool_requeue, .udata = r);
+}
+
+/* assigns waiting requests to connections, opening connections if needed */
+static void http_pool_dispatch(http_pool_s *pool) {
+  for (;;) {
+    http_pool_req_s *r = NULL;
+    http_pool_conn_s *c = NULL;
+    intptr_t uuid = -1;
+    uint8_t connect = 0;
+    fio_lock(&http_pools_lock);
+    if (fio_ls_embd_is_empty(&pool->waiting))
+      goto unlock;
+    r = FIO_LS_EMBD_OBJ(http_pool_req_s, node, pool->waiting.next);
+    if (http_pools_stopping) {
+      /* fail the request */
+    } else if (fio_ls_embd_any(&pool->idle)) {
+      /* the most recently used connection is the least likely to time out */
+      c = FIO_LS_EMBD_OBJ(http_pool_conn_s, node,
+                          fio_ls_embd_pop(&pool->idle));
+      fio_ls_embd_push(&pool->busy, &c->node);
+      c->reused = 1;
+    } else if (pool->open < pool->limit) {
+      ++pool->open;
+      connect = 1;
+    } else if (r->args.pipeline && !r->retried) {
+      FIO_LS_EMBD_FOR(&pool->busy, node) {
+        http_pool_conn_s *tmp = FIO_LS_EMBD_OBJ(http_pool_conn_s, node, node);
+        if (tmp->pipeline && tmp->in_flight < HTTP_POOL_PIPELINE_DEPTH &&
+            (!c || tmp->in_flight < c->in_flight))
+          c = tmp;
+      }
+      if (!c) {
+        r = NULL;
+        goto unlock;
+      }
+    } else {
+      r = NULL;
+      goto unlock;
+    }
+    fio_ls_embd_remove(&r->node);
+    if (c) {
+      ++c->in_flight;
+      c->pipeline &= r->args.pipeline;
+      uuid = c->uuid; /* `c` might be freed once the lock is released */
+    }
+  unlock:
+    fio_unlock(&http_pools_lock);
+    if (!r)
+      return;
+    if (c)
+      fio_defer_io_task(uuid, .task = http_pool_perform,
+                        .fallback = http_pool_requeue, .udata = r);
+    else if (connect)
+      fio_connect(.address = pool->address, .port = pool->port,
+                  .on_connect = http_pool_on_open,
+                  .on_fail = http_pool_on_fail, .udata = r,
+                  .tls = pool->settings.tls);
+    else
+      http_pool_req_finish(r);
+  }
+}
+
+/* stop dispatching requests and fail any requests still waiting */
+static void http_pool_on_shutdown(void *ignr_) {
+  fio_ls_embd_s lost = FIO_LS_INIT(lost);
+  fio_lock(&http_pools_lock);
+  http_pools_stopping = 1;
+  FIO_SET_FOR_LOOP(&http_pools, pos) {
+    if (!pos->hash)
+      continue;
+    while (fio_ls_embd_any(&pos->obj->waiting))
+      fio_ls_embd_push(&lost, fio_ls_embd_shift(&pos->obj->waiting));
+  }
+  fio_unlock(&http_pools_lock);
+  http_pool_req_finish_all(&lost);
+  (void)ignr_;
+}
+
+static void http_pool_on_start(void *ignr_) {
+  http_pools_stopping = 0;
+  (void)ignr_;
+}
+
+static void http_pool_in_child(void *ignr_) {
+  http_pools_lock = FIO_LOCK_INIT;
+  (void)ignr_;
+}
+
+static void http_pool_at_exit(void *ignr_) {
+  http_pool_on_shutdown(NULL);
+  FIO_SET_FOR_LOOP(&http_pools, pos) {
+    if (pos->hash)
+      free(pos->obj);
+  }
+  http_pool_map_free(&http_pools);
+  (void)ignr_;
+}
+
+/* returns the pool for the key, creating a new pool if missing (locked) */
+static http_pool_s *http_pool_get(char *key, size_t key_len,
+                                  fio_str_info_s address, fio_str_info_s port,
+                                  http_settings_s *settings) {
+  const uint64_t hash = fio_risky_hash(key, key_len, 0);
+  http_pool_s needle = {.key = key, .key_len = key_len};
+  http_pool_s *pool = http_pool_map_find(&http_pools, hash, &needle);
+  if (pool)
+    return pool;
+  if (!http_pool_map_count(&http_pools)) {
+    fio_state_callback_add(FIO_CALL_PRE_START, http_pool_on_start, NULL);
+    fio_state_callback_add(FIO_CALL_ON_SHUTDOWN, http_pool_on_shutdown, NULL);
+    fio_state_callback_add(FIO_CALL_IN_CHILD, http_pool_in_child, NULL);
+    fio_state_callback_add(FIO_CALL_AT_EXIT, http_pool_at_exit, NULL);
+  }
+  pool = malloc(sizeof(*pool) + key_len + address.len + port.len + 3);
+  FIO_ASSERT_ALLOC(pool);
+  *pool = (http_pool_s){
+      .idle = FIO_LS_INIT(pool->idle),
+      .busy = FIO_LS_INIT(pool->busy),
+      .waiting = FIO_LS_INIT(pool->waiting),
+      .settings = *settings,
+      .limit = HTTP_POOL_MAX_PER_HOST,
+      .key_len = key_len,
+  };
+  pool->key = (char *)(pool + 1);
+  memcpy(pool->key, key, key_len);
+  pool->key[key_len] = 0;
+  pool->address = pool->key + key_len + 1;
+  memcpy(pool->address, address.data, address.len);
+  pool->address[address.len] = 0;
+  if (port.data) {
+    pool->port = pool->address + address.len + 1;
+    memcpy(pool->port, port.data, port.len);
+    pool->port[port.len] = 0;
+  }
+  /* connections dispatch responses to the requests in flight */
+  pool->settings.on_response = http_pool_on_response;
+  pool->settings.on_upgrade = http_pool_on_upgrade;
+  pool->settings.on_finish = NULL;
+  pool->settings.udata = NULL;
+  pool->settings.max_clients = 0;
+  if (!pool->settings.timeout)
+    pool->settings.timeout = 30;
+  http_pool_map_insert(&http_pools, hash, pool);
+  return pool;
+}
+
+intptr_t http_connect_pooled__(void); /* sublime text marker */
+/**
+ * Sends an HTTP request using a pooled keep-alive connection.
+ *
+ * See the `http_connect_pooled` documentation in `http.h`.
+ *
+ * Returns -1 on error and 0 on success. the `on_finish` callback is always
+ * called.
+ */
+intptr_t http_connect_pooled FIO_IGNORE_MACRO(const char *url,
+                                              const char *unix_address,
+                                              struct http_settings_s args) {
+  fio_url_s u = {.host = {.data = NULL}};
+  fio_str_info_s address = {.data = (char *)unix_address}, port = {.len = 0};
+  fio_str_info_s host = {.len = 0};
+  char key[640];
+  int key_len, key_settings;
+  uint8_t is_secure = 0;
+  if (!args.on_response) {
+    FIO_LOG_ERROR("http_connect_pooled requires an on_response callback.");
+    errno = EINVAL;
+    goto on_error;
+  }
+  if (url)
+    u = fio_url_parse(url, strlen(url));
+  if (u.scheme.len >= 2 && u.scheme.data[0] == 'w' &&
+      u.scheme.data[1] == 's') {
+    FIO_LOG_ERROR("http_connect_pooled can't be used for WebSockets.");
+    errno = EINVAL;
+    goto on_error;
+  }
+  is_secure = (u.scheme.len == 5 && u.scheme.data[4] == 's');
+  if (is_secure && !args.tls) {
+    FIO_LOG_ERROR("Secure connections (%.*s) require a TLS object.",
+                  (int)u.scheme.len, u.scheme.data);
+    errno = EINVAL;
+    goto on_error;
+  }
+  if (u.host.data) {
+    host = (fio_str_info_s){.data = u.host.data, .len = u.host.len};
+  }
+  /* connections with different connection settings aren't shared */
+  key_settings = snprintf(key, sizeof(key), "%p|%u|%zu|%zu|%u|", args.tls,
+                          (unsigned)args.timeout, args.max_header_size,
+                          args.max_body_size, (unsigned)args.log);
+  if (unix_address) {
+    address.len = strlen(unix_address);
+    if (!u.host.data)
+      host = address;
+    key_len = key_settings + snprintf(key + key_settings,
+                                      sizeof(key) - key_settings, "%s",
+                                      unix_address);
+  } else if (u.host.data) {
+    address = host;
+    port = (fio_str_info_s){.data = u.port.data, .len = u.port.len};
+    if (!port.data)
+      port = is_secure ? (fio_str_info_s){.data = "443", .len = 3}
+                       : (fio_str_info_s){.data = "80", .len = 2};
+    key_len = key_settings + snprintf(key + key_settings,
+                                      sizeof(key) - key_settings, "%.*s:%.*s",
+                                      (int)address.len, address.data,
+                                      (int)port.len, port.data);
+  } else {
+    FIO_LOG_ERROR("http_connect_pooled requires a valid address.");
+    errno = EINVAL;
+    goto on_error;
+  }
+  if (key_len < 0 || (size_t)key_len >= sizeof(key)) {
+    FIO_LOG_ERROR("http_connect_pooled address too long.");
+    errno = ENAMETOOLONG;
+    goto on_error;
+  }
+
+  http_pool_req_s *r = malloc(sizeof(*r));
+  FIO_ASSERT_ALLOC(r);
+  *r = (http_pool_req_s){
+      .node = FIO_LS_INIT(r->node),
+      .args = args,
+      .path = u.path.data ? fiobj_str_new(u.path.data, strlen(u.path.data))
+                          : fiobj_str_new("/", 1),
+      .host = fiobj_str_new(host.data, host.len),
+  };
+  fio_lock(&http_pools_lock);
+  r->pool = http_pool_get(key, key_len, address, port, &args);
+  if (args.max_clients > 0)
+    r->pool->limit = args.max_clients;
+  fio_ls_embd_push(&r->pool->waiting, &r->node);
+  fio_unlock(&http_pools_lock);
+  http_pool_dispatch(r->pool);
+  return 0;
+on_error:
+  if (args.on_finish)
+    args.on_finish(&args);
+  return -1;
+}
+
 /* *****************************************************************************
 HTTP Websocket Connect
 ***************************************************************************** */
@@ -2476,26 +3273,49 @@ Lookup Tables / functions
 #include <fio.h>
 
 static fio_mime_set_s fio_http_mime_types = FIO_SET_INIT;
+/* replaced frozen mime-types, readers might still be using them */
+static FIOBJ fio_http_mime_retired = FIOBJ_INVALID;
 
 #define LONGEST_FILE_EXTENSION_LENGTH 15
 
+/* releases a mime-type that was removed from the registry */
+static void http_mimetype_retire(FIOBJ old) {
+  if (old == FIOBJ_INVALID)
+    return;
+  if (!FIOBJECT2HEAD(old)->frozen) {
+    fiobj_free(old);
+    return;
+  }
+  /* frozen objects aren't reference counted, free them during cleanup */
+  if (fio_http_mime_retired == FIOBJ_INVALID)
+    fio_http_mime_retired = fiobj_ary_new();
+  fiobj_ary_push(fio_http_mime_retired, old);
+}
+
 /** Registers a Mime-Type to be associated with the file extension. */
 void http_mimetype_register(char *file_ext, size_t file_ext_len,
                             FIOBJ mime_type_str) {
   uintptr_t hash = FIO_HASH_FN(file_ext, file_ext_len, 0, 0);
+  FIOBJ old = FIOBJ_INVALID;
   if (mime_type_str == FIOBJ_INVALID) {
-    fio_mime_set_remove(&fio_http_mime_types, hash, FIOBJ_INVALID, NULL);
+    fio_mime_set_remove(&fio_http_mime_types, hash, FIOBJ_INVALID, &old);
   } else {
-    FIOBJ old = FIOBJ_INVALID;
     fio_mime_set_overwrite(&fio_http_mime_types, hash, mime_type_str, &old);
     if (old != FIOBJ_INVALID) {
       FIO_LOG_WARNING("mime-type collision: %.*s was %s, now %s",
                       (int)file_ext_len, file_ext, fiobj_obj2cstr(old).data,
                       fiobj_obj2cstr(mime_type_str).data);
-      fiobj_free(old);
     }
     fiobj_free(mime_type_str); /* move ownership to the registry */
   }
+  http_mimetype_retire(old);
+}
+
+/* registers a default mime-type before forking (shared by the workers) */
+void http_mimetype_register_frozen(char *file_ext, size_t file_ext_len,
+                                   FIOBJ mime_type_str) {
+  http_mimetype_register(file_ext, file_ext_len,
+                         fiobj_freeze(mime_type_str));
 }
 
 /** Registers a Mime-Type to be associated with the file extension. */
@@ -2555,7 +3375,14 @@ finish:
 
 /** Clears the Mime-Type registry (it will be empty afterthis call). */
 void http_mimetype_clear(void) {
+  /* no more readers, frozen mime-types can be freed */
+  FIO_SET_FOR_LOOP(&fio_http_mime_types, pos) {
+    if (pos->hash)
+      fiobj_thaw(pos->obj);
+  }
   fio_mime_set_free(&fio_http_mime_types);
+  fiobj_free(fiobj_thaw(fio_http_mime_retired));
+  fio_http_mime_retired = FIOBJ_INVALID;
   fiobj_free(current_date);
   current_date = FIOBJ_INVALID;
   last_date_added = 0;
@@ -2684,11 +3511,499 @@ fio_str_info_s http_status2str(uintptr_t status) {
 #undef HTTP_SET_STATUS_STR
 
 #if DEBUG
+/* *****************************************************************************
+Testing the HTTP client connection pool (over the loopback interface)
+***************************************************************************** */
+
+#define HTTP_POOL_TEST_URL "http://127.0.0.1:8778"
+
+static struct {
+  intptr_t server[8]; /* the server connection for each request, by index */
+  size_t responses;
+  size_t finished;
+  size_t failed;
+  uint8_t stage;
+} http_pool_test_state;
+
+/* server: echo the path and remember the connection serving each request */
+static void http_pool_test_on_request(http_s *h) {
+  fio_str_info_s path = fiobj_obj2cstr(h->path);
+  size_t i = (size_t)(path.data[path.len - 1] - '0');
+  if (i < 8)
+    http_pool_test_state.server[i] =
+        ((http_fio_protocol_s *)h->private_data.flag)->uuid;
+  http_send_body(h, path.data, path.len);
+}
+
+/* client: send the request, then validate the response */
+static void http_pool_test_on_response(http_s *h) {
+  if (!h->status) {
+    http_finish(h);
+    return;
+  }
+  fio_str_info_s body = fiobj_obj2cstr(h->body);
+  fio_str_info_s expected = {.data = h->udata, .len = strlen(h->udata)};
+  FIO_ASSERT(h->status == 200 && body.len == expected.len &&
+                 !memcmp(body.data, expected.data, body.len),
+             "pooled response mismatch (expected %s, got %.*s)",
+             expected.data, (int)body.len, body.data);
+  ++http_pool_test_state.responses;
+}
+
+static void http_pool_test_on_finish(http_settings_s *s);
+
+static void http_pool_test_request(const char *path, uint8_t pipeline) {
+  char url[64];
+  snprintf(url, sizeof(url), HTTP_POOL_TEST_URL "%s", path);
+  http_connect_pooled(url, NULL, .on_response = http_pool_test_on_response,
+                      .on_finish = http_pool_test_on_finish,
+                      .udata = (void *)path, .pipeline = pipeline,
+                      .max_clients = 1, .timeout = 1);
+}
+
+/* returns the pool used by the test (the lock is released) */
+static http_pool_s *http_pool_test_pool(void) {
+  http_pool_s *pool = NULL;
+  fio_lock(&http_pools_lock);
+  FIO_SET_FOR_LOOP(&http_pools, pos) {
+    if (pos->hash)
+      pool = pos->obj;
+  }
+  fio_unlock(&http_pools_lock);
+  return pool;
+}
+
+/* waits for the idle connection to be evicted by its timeout */
+static void http_pool_test_eviction(void *ignr_) {
+  http_pool_s *pool = http_pool_test_pool();
+  if (http_pool_test_state.stage == 3 && !pool->open &&
+      fio_ls_embd_is_empty(&pool->idle)) {
+    http_pool_test_state.stage = 5;
+    fio_stop();
+  }
+  (void)ignr_;
+}
+
+/* the server closes the idle connection while the client is reusing it */
+static void http_pool_test_stale(void *ignr_, void *ignr2_) {
+  fio_force_close(http_pool_test_state.server[5]);
+  http_pool_test_request("/stale6", 0);
+  (void)ignr_;
+  (void)ignr2_;
+}
+
+static void http_pool_test_on_finish(http_settings_s *s) {
+  if (http_pool_test_state.responses == http_pool_test_state.finished)
+    ++http_pool_test_state.failed;
+  ++http_pool_test_state.finished;
+  switch (http_pool_test_state.finished) {
+  case 1: /* a second request reuses the keep-alive connection */
+    http_pool_test_request("/2", 0);
+    break;
+  case 2: /* pipelined requests share the (single) connection */
+    http_pool_test_state.stage = 1;
+    http_pool_test_request("/3", 1);
+    http_pool_test_request("/4", 1);
+    http_pool_test_request("/5", 1);
+    break;
+  case 5:
+    http_pool_test_state.stage = 2;
+    fio_defer(http_pool_test_stale, NULL, NULL);
+    break;
+  case 6:
+    http_pool_test_state.stage = 3;
+    fio_run_every(100, 40, http_pool_test_eviction, NULL, NULL);
+    break;
+  }
+  (void)s;
+}
+
+static void http_pool_test_start(void *ignr_) {
+  http_pool_test_request("/1", 0);
+  (void)ignr_;
+}
+
+static void http_pool_test_timeout(void *ignr_) {
+  if (http_pool_test_state.stage == 5)
+    return;
+  FIO_LOG_ERROR("HTTP pool test timed out at stage %d.",
+                (int)http_pool_test_state.stage);
+  fio_stop();
+  (void)ignr_;
+}
+
+static void http_pool_test(void) {
+  fprintf(stderr, "=== Testing HTTP client connection pool\n");
+  intptr_t listener =
+      (http_listen)("8778", "127.0.0.1",
+                    (struct http_settings_s){
+                        .on_request = http_pool_test_on_request});
+  FIO_ASSERT(listener != -1, "HTTP pool test couldn't listen");
+  fio_run_every(10, 1, http_pool_test_start, NULL, NULL);
+  fio_run_every(8000, 1, http_pool_test_timeout, NULL, NULL);
+  fio_start(.threads = 1, .workers = 1);
+  FIO_ASSERT(http_pool_test_state.stage == 5,
+             "HTTP pool test didn't complete (stage %d)",
+             (int)http_pool_test_state.stage);
+  FIO_ASSERT(http_pool_test_state.finished == 6 &&
+                 http_pool_test_state.responses == 6 &&
+                 !http_pool_test_state.failed,
+             "HTTP pool requests failed (%zu/%zu responses, %zu failed)",
+             http_pool_test_state.responses, http_pool_test_state.finished,
+             http_pool_test_state.failed);
+  FIO_ASSERT(http_pool_test_state.server[1] == http_pool_test_state.server[2],
+             "the keep-alive connection wasn't reused");
+  FIO_ASSERT(http_pool_test_state.server[3] == http_pool_test_state.server[1] &&
+                 http_pool_test_state.server[4] ==
+                     http_pool_test_state.server[1] &&
+                 http_pool_test_state.server[5] ==
+                     http_pool_test_state.server[1],
+             "pipelined requests should share the connection");
+  FIO_ASSERT(http_pool_test_state.server[6] != http_pool_test_state.server[5],
+             "a request on a stale connection should retry on a new one");
+  fprintf(stderr, "* passed.\n");
+}
+
+/* *****************************************************************************
+Testing WebSocket streaming (over the loopback interface)
+***************************************************************************** */
+
+#define HTTP_WS_TEST_LARGE 20000 /* sent without copying (WS_ZERO_COPY_MIN) */
+
+static struct {
+  size_t messages;
+  size_t fragments;
+  FIOBJ fragmented;
+  uint8_t done;
+} http_ws_test_state;
+
+/* server: streams a message while other messages are written */
+static void http_ws_test_server_open(ws_s *ws) {
+  char *large = malloc(HTTP_WS_TEST_LARGE);
+  FIO_ASSERT_ALLOC(large);
+  memset(large, 'x', HTTP_WS_TEST_LARGE);
+  FIO_ASSERT(!websocket_write_stream_begin(ws, 1),
+             "websocket_write_stream_begin failed");
+  FIO_ASSERT(websocket_write_stream_begin(ws, 1) == -1,
+             "a message is already streamed, begin should fail");
+  websocket_write_stream(ws, .data = {.data = "stream-1", .len = 8},
+                         .dealloc = FIO_DEALLOC_NOOP);
+  websocket_write(ws, (fio_str_info_s){.data = "held", .len = 4}, 1);
+  websocket_write_stream(ws, .data = {.data = large, .len = HTTP_WS_TEST_LARGE});
+  websocket_write2(ws, .data = {.data = "held2", .len = 5},
+                   .dealloc = FIO_DEALLOC_NOOP);
+  websocket_write_stream(ws, .data = {.data = "stream-2", .len = 8},
+                         .dealloc = FIO_DEALLOC_NOOP);
+  websocket_write_stream_end(ws);
+  websocket_write(ws, (fio_str_info_s){.data = "after", .len = 5}, 0);
+}
+
+static void http_ws_test_on_request(http_s *h) { http_send_error(h, 400); }
+
+static void http_ws_test_on_upgrade(http_s *h, char *proto, size_t len) {
+  http_upgrade2ws(h, (websocket_settings_s){
+                         .on_open = http_ws_test_server_open,
+                     });
+  (void)proto;
+  (void)len;
+}
+
+/* client: the streamed message arrives first, held messages follow it */
+static void http_ws_test_on_message(ws_s *ws, fio_str_info_s msg,
+                                    uint8_t is_text) {
+  switch (http_ws_test_state.messages++) {
+  case 0:
+    FIO_ASSERT(is_text && msg.len == HTTP_WS_TEST_LARGE + 16 &&
+                   !memcmp(msg.data, "stream-1x", 9) &&
+                   !memcmp(msg.data + msg.len - 9, "xstream-2", 9),
+               "streamed WebSocket message error (%zu bytes)", msg.len);
+    break;
+  case 1:
+    FIO_ASSERT(is_text && msg.len == 4 && !memcmp(msg.data, "held", 4),
+               "held WebSocket message out of order (%.*s)", (int)msg.len,
+               msg.data);
+    break;
+  case 2:
+    FIO_ASSERT(!is_text && msg.len == 5 && !memcmp(msg.data, "held2", 5),
+               "second held WebSocket message out of order (%.*s)",
+               (int)msg.len, msg.data);
+    break;
+  case 3:
+    FIO_ASSERT(!is_text && msg.len == 5 && !memcmp(msg.data, "after", 5),
+               "WebSocket message after the stream is out of order (%.*s)",
+               (int)msg.len, msg.data);
+    http_ws_test_state.done = 1;
+    websocket_close(ws);
+    fio_stop();
+    break;
+  }
+}
+
+/* client: fragments are collected and checked as a whole message */
+static void http_ws_test_on_fragment(ws_s *ws, fio_str_info_s data,
+                                     uint8_t is_text, uint8_t is_last) {
+  if (!http_ws_test_state.fragmented)
+    http_ws_test_state.fragmented = fiobj_str_buf(HTTP_WS_TEST_LARGE + 16);
+  ++http_ws_test_state.fragments;
+  if (http_ws_test_state.messages == 0) {
+    /* continuation frames carry the text state of the first frame */
+    FIO_ASSERT(is_text, "WebSocket fragment %zu lost its text state",
+               http_ws_test_state.fragments);
+    FIO_ASSERT(is_last == (http_ws_test_state.fragments == 4),
+               "WebSocket fragment %zu has the wrong final flag",
+               http_ws_test_state.fragments);
+    FIO_ASSERT(http_ws_test_state.fragments != 1 ||
+                   (data.len == 8 && !memcmp(data.data, "stream-1", 8)),
+               "first WebSocket fragment error (%.*s)", (int)data.len,
+               data.data);
+  } else {
+    FIO_ASSERT(is_last, "a whole WebSocket message was fragmented");
+  }
+  fiobj_str_write(http_ws_test_state.fragmented, data.data, data.len);
+  if (!is_last)
+    return;
+  http_ws_test_state.fragments = 0;
+  fio_str_info_s msg = fiobj_obj2cstr(http_ws_test_state.fragmented);
+  http_ws_test_on_message(ws, msg, is_text);
+  fiobj_str_resize(http_ws_test_state.fragmented, 0);
+}
+
+static void http_ws_test_timeout(void *ignr_) {
+  if (http_ws_test_state.done)
+    return;
+  FIO_LOG_ERROR("WebSocket test timed out (%zu messages).",
+                http_ws_test_state.messages);
+  fio_stop();
+  (void)ignr_;
+}
+
+/* runs the reactor until the client received all the messages */
+static void http_ws_test_run(websocket_settings_s client) {
+  memset(&http_ws_test_state, 0, sizeof(http_ws_test_state));
+  FIO_ASSERT((http_listen)("8779", "127.0.0.1",
+                           (struct http_settings_s){
+                               .on_request = http_ws_test_on_request,
+                               .on_upgrade = http_ws_test_on_upgrade}) != -1,
+             "WebSocket test couldn't listen");
+  FIO_ASSERT((websocket_connect)("ws://127.0.0.1:8779/", client) != -1,
+             "WebSocket test couldn't connect");
+  fio_run_every(5000, 1, http_ws_test_timeout, NULL, NULL);
+  fio_start(.threads = 1, .workers = 1);
+  FIO_ASSERT(http_ws_test_state.done,
+             "WebSocket test didn't complete (%zu messages)",
+             http_ws_test_state.messages);
+}
+
+static void http_ws_test(void) {
+  fprintf(stderr, "=== Testing WebSocket streaming (held messages)\n");
+  http_ws_test_run(
+      (websocket_settings_s){.on_message = http_ws_test_on_message});
+  fprintf(stderr, "* passed.\n");
+  fprintf(stderr, "=== Testing WebSocket fragments (on_fragment)\n");
+  http_ws_test_run(
+      (websocket_settings_s){.on_fragment = http_ws_test_on_fragment});
+  fiobj_free(http_ws_test_state.fragmented);
+  fprintf(stderr, "* passed.\n");
+}
+
+/* *****************************************************************************
+Testing HTTP/1.1 corking (over the loopback interface)
+***************************************************************************** */
+
+static struct {
+  FIOBJ received;
+  char *big;
+  uint8_t done;
+} http_cork_test_state;
+
+/* server: responses are held back while the pipelined batch is parsed */
+static void http_cork_test_on_request(http_s *h) {
+  fio_str_info_s path = fiobj_obj2cstr(h->path);
+  if (path.len == 4 && !memcmp(path.data, "/big", 4)) {
+    /* passes the cork limit, flushing the batch before it's done */
+    http_send_body(h, http_cork_test_state.big, HTTP1_CORK_LIMIT + 8);
+    return;
+  }
+  char body[16];
+  size_t len = (size_t)snprintf(body, sizeof(body), "body-%.*s", 1,
+                                path.data + 1);
+  http_send_body(h, body, len);
+}
+
+static void http_cork_test_on_data(intptr_t uuid, fio_protocol_s *pr) {
+  char buf[4096];
+  ssize_t len;
+  while ((len = fio_read(uuid, buf, sizeof(buf))) > 0)
+    fiobj_str_write(http_cork_test_state.received, buf, (size_t)len);
+  (void)pr;
+}
+
+/* client: the server closes the connection after the last response */
+static void http_cork_test_on_close(intptr_t uuid, fio_protocol_s *pr) {
+  fio_str_info_s r = fiobj_obj2cstr(http_cork_test_state.received);
+  char *pos[4] = {strstr(r.data, "body-1"), strstr(r.data, "bbbbody-big"),
+                  strstr(r.data, "body-2"), strstr(r.data, "body-3")};
+  for (size_t i = 0; i < 4; ++i) {
+    FIO_ASSERT(pos[i], "corked response %zu missing (%zu bytes received)", i,
+               r.len);
+    FIO_ASSERT(!i || pos[i - 1] < pos[i], "corked response %zu out of order",
+               i);
+  }
+  http_cork_test_state.done = 1;
+  fio_stop();
+  fio_free(pr);
+  (void)uuid;
+}
+
+static void http_cork_test_on_connect(intptr_t uuid, void *udata) {
+  static const char requests[] =
+      "GET /1 HTTP/1.1\r\nHost: localhost\r\n\r\n"
+      "GET /big HTTP/1.1\r\nHost: localhost\r\n\r\n"
+      "GET /2 HTTP/1.1\r\nHost: localhost\r\n\r\n"
+      "GET /3 HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+  fio_protocol_s *pr = fio_malloc(sizeof(*pr));
+  FIO_ASSERT_ALLOC(pr);
+  *pr = (fio_protocol_s){
+      .on_data = http_cork_test_on_data,
+      .on_close = http_cork_test_on_close,
+  };
+  fio_attach(uuid, pr);
+  /* a single write, so the server reads the requests as one batch */
+  fio_write2(uuid, .data.buffer = requests, .length = sizeof(requests) - 1,
+             .after.dealloc = FIO_DEALLOC_NOOP);
+  (void)udata;
+}
+
+static void http_cork_test_on_fail(intptr_t uuid, void *udata) {
+  FIO_LOG_ERROR("HTTP/1.1 corking test couldn't connect.");
+  fio_stop();
+  (void)uuid;
+  (void)udata;
+}
+
+static void http_cork_test_timeout(void *ignr_) {
+  if (http_cork_test_state.done)
+    return;
+  FIO_LOG_ERROR("HTTP/1.1 corking test timed out.");
+  fio_stop();
+  (void)ignr_;
+}
+
+static void http_cork_test(void) {
+  fprintf(stderr, "=== Testing HTTP/1.1 corking (pipelined responses)\n");
+  http_cork_test_state.received = fiobj_str_buf(HTTP1_CORK_LIMIT + 1024);
+  http_cork_test_state.big = malloc(HTTP1_CORK_LIMIT + 8);
+  FIO_ASSERT_ALLOC(http_cork_test_state.big);
+  memset(http_cork_test_state.big, 'b', HTTP1_CORK_LIMIT);
+  memcpy(http_cork_test_state.big + HTTP1_CORK_LIMIT, "body-big", 8);
+  FIO_ASSERT((http_listen)("8780", "127.0.0.1",
+                           (struct http_settings_s){
+                               .on_request = http_cork_test_on_request}) !=
+                 -1,
+             "HTTP/1.1 corking test couldn't listen");
+  FIO_ASSERT(fio_connect(.address = "127.0.0.1", .port = "8780",
+                         .on_connect = http_cork_test_on_connect,
+                         .on_fail = http_cork_test_on_fail) != -1,
+             "HTTP/1.1 corking test couldn't connect");
+  fio_run_every(5000, 1, http_cork_test_timeout, NULL, NULL);
+  fio_start(.threads = 1, .workers = 1);
+  FIO_ASSERT(http_cork_test_state.done, "HTTP/1.1 corking test didn't complete");
+  fiobj_free(http_cork_test_state.received);
+  free(http_cork_test_state.big);
+  fprintf(stderr, "* passed.\n");
+}
+
 void http_tests(void) {
+  http_pool_test();
+  http_ws_test();
+  http_cork_test();
   fprintf(stderr, "=== Testing HTTP helpers\n");
   FIOBJ html_mime = http_mimetype_find("html", 4);
   FIO_ASSERT(html_mime,
              "HTML mime-type not found! Mime-Type registry invalid!\n");
   fiobj_free(html_mime);
+#if HAVE_ZLIB || HAVE_BROTLI || HAVE_ZSTD
+  fprintf(stderr, "=== Testing HTTP response compression\n");
+  {
+    struct {
+      char *ae;
+      int gzip;
+    } accept_tests[] = {
+        {"gzip", 1},
+        {"deflate, gzip;q=1.0, *;q=0.5", 1},
+        {"GZIP", 1},
+        {"gzip;q=0", 0},
+        {"br, gzip ; q=0.000", 0},
+        {"x-gzip, identity", 0},
+        {"gzip;q=0.5,br", 1},
+        {"", 0},
+    };
+    for (size_t i = 0; i < sizeof(accept_tests) / sizeof(accept_tests[0]);
+         ++i) {
+      fio_str_info_s ae = {.data = accept_tests[i].ae,
+                           .len = strlen(accept_tests[i].ae)};
+      FIO_ASSERT(http_encoding_accepted(ae, "gzip", 4) == accept_tests[i].gzip,
+                 "Accept-Encoding test failed for: %s", accept_tests[i].ae);
+    }
+  }
+  {
+    char body[4096];
+    for (size_t i = 0; i < sizeof(body); ++i)
+      body[i] = "{\"key\": \"value\"}, "[i % 18];
+    FIO_ASSERT(!http_compress_data(HTTP_ENCODING_NONE, 6, body, sizeof(body)),
+               "identity encoding shouldn't compress");
+#if HAVE_ZLIB
+    const http_encoding_e encoding = HTTP_ENCODING_GZIP;
+#elif HAVE_BROTLI
+    const http_encoding_e encoding = HTTP_ENCODING_BR;
+#else
+    const http_encoding_e encoding = HTTP_ENCODING_ZSTD;
+#endif
+    FIO_ASSERT(!http_compress_data_cached(encoding, 6, "ab", 2),
+               "tiny bodies should be sent as is");
+    FIOBJ c1 = http_compress_data_cached(encoding, 6, body, sizeof(body));
+    FIOBJ c2 = http_compress_data_cached(encoding, 6, body, sizeof(body));
+    FIO_ASSERT(c1 && fiobj_obj2cstr(c1).len < sizeof(body),
+               "compression failed");
+    FIO_ASSERT(c1 == c2, "compressed body should have been cached");
+    body[7] = 'x';
+    FIOBJ c3 = http_compress_data_cached(encoding, 6, body, sizeof(body));
+    FIO_ASSERT(c3 && c3 != c1, "cache collision for different bodies");
+#if HAVE_ZLIB
+    {
+      char tmp[sizeof(body)];
+      fio_str_info_s c = fiobj_obj2cstr(c3);
+      z_stream z = {.next_in = (Bytef *)c.data,
+                    .avail_in = c.len,
+                    .next_out = (Bytef *)tmp,
+                    .avail_out = sizeof(tmp)};
+      FIO_ASSERT(inflateInit2(&z, 15 + 16) == Z_OK, "inflateInit2 failed");
+      FIO_ASSERT(inflate(&z, Z_FINISH) == Z_STREAM_END &&
+                     z.total_out == sizeof(body) &&
+                     !memcmp(tmp, body, sizeof(body)),
+                 "gzip round-trip failed");
+      inflateEnd(&z);
+    }
+#endif
+#if HAVE_ZSTD
+    {
+      char tmp[sizeof(body)];
+      FIOBJ z = http_compress_data(HTTP_ENCODING_ZSTD, 6, body, sizeof(body));
+      FIO_ASSERT(z, "zstd compression failed");
+      fio_str_info_s c = fiobj_obj2cstr(z);
+      FIO_ASSERT(ZSTD_decompress(tmp, sizeof(tmp), c.data, c.len) ==
+                         sizeof(body) &&
+                     !memcmp(tmp, body, sizeof(body)),
+                 "zstd round-trip failed");
+      fiobj_free(z);
+    }
+#endif
+    fiobj_free(c1);
+    fiobj_free(c2);
+    fiobj_free(c3);
+    http_compress_cache_clear(NULL);
+  }
+  fprintf(stderr, "* passed.\n");
+#endif
 }
 #endif
@@ -42,6 +42,45 @@ Compile Time Settings
 #define HTTP_MAX_HEADER_LENGTH 8192
 #endif
 
+#ifndef HTTP_POOL_MAX_PER_HOST
+/** the default connection limit per host for `http_connect_pooled` */
+#define HTTP_POOL_MAX_PER_HOST 8
+#endif
+
+#ifndef HTTP_POOL_PIPELINE_DEPTH
+/** the maximal number of pipelined requests per pooled client connection */
+#define HTTP_POOL_PIPELINE_DEPTH 8
+#endif
+
+#ifndef HTTP_COMPRESS_MIN_SIZE
+/** the default minimal body size for dynamic response compression */
+#define HTTP_COMPRESS_MIN_SIZE 1024
+#endif
+
+#ifndef HTTP_COMPRESS_CACHE_LIMIT
+/** the maximal number of compressed responses cached (0 disables caching) */
+#define HTTP_COMPRESS_CACHE_LIMIT 256
+#endif
+
+#ifndef HTTP_COMPRESS_CACHE_MAX_SIZE
+/** compressed responses larger than this (in bytes) are never cached */
+#define HTTP_COMPRESS_CACHE_MAX_SIZE 65536
+#endif
+
+#ifndef HTTP_LOCAL_OBJECTS
+/**
+ * When true, parsed request data (method, path, query, version and headers)
+ * uses thread confined FIOBJ objects with non-atomic reference counting (see
+ * `fiobj_local`). Defaults to 0 (disabled).
+ *
+ * Request objects are promoted by `http_pause` and `fiobj_send_free`. Before
+ * enabling, make sure that any code keeping a request object beyond the
+ * request (a cache, a pub/sub message or a deferred task) calls `fiobj_share`
+ * first.
+ */
+#define HTTP_LOCAL_OBJECTS 0
+#endif
+
 #ifndef FIO_HTTP_EXACT_LOGGING
 /**
  * By default, facil.io logs the HTTP request cycle using a fuzzy starting point
@@ -368,6 +407,9 @@ struct http_settings_s {
    * Note: clients, by the nature of socket programming, are counted according
    *       to their internal file descriptor (`fd`) value. Open files and other
    *       sockets count towards a server's limit.
+   *
+   * `http_connect_pooled` uses this value as the maximum number of connections
+   * per host (defaults to HTTP_POOL_MAX_PER_HOST).
    */
   intptr_t max_clients;
   /** SSL/TLS support. */
@@ -383,6 +425,12 @@ struct http_settings_s {
    * connections. Defaults to ~250KB.
    */
   size_t ws_max_msg_size;
+  /**
+   * The minimal body size (in bytes) for dynamic response compression.
+   *
+   * Defaults to HTTP_COMPRESS_MIN_SIZE (1Kb). See `compress_level`.
+   */
+  size_t compress_min_size;
   /**
    * An HTTP/1.x connection timeout.
    *
@@ -401,8 +449,30 @@ struct http_settings_s {
   uint8_t ws_timeout;
   /** Logging flag - set to TRUE to log HTTP requests. */
   uint8_t log;
+  /**
+   * Compression level (1-9) for `http_send_body` responses. 0 (default)
+   * disables dynamic compression.
+   *
+   * When set, bodies of at least `compress_min_size` bytes with a textual (or
+   * missing) content-type are compressed using the best encoding the client
+   * accepts (`br` when built with `HAVE_BROTLI`, `zstd` when built with
+   * `HAVE_ZSTD`, `gzip` when built with `HAVE_ZLIB`). Compressed results for
+   * identical bodies are cached.
+   *
+   * Only `http_send_body` (and helpers using it, such as `http_send_error`)
+   * compresses. `http_sendfile` and `http_finish` send the body as is.
+   */
+  uint8_t compress_level;
   /** a read only flag set automatically to indicate the protocol's mode. */
   uint8_t is_client;
+  /**
+   * `http_connect_pooled` only: allows the request to be pipelined on a busy
+   * connection when the host's connection limit was reached.
+   *
+   * Only set this flag for idempotent requests (i.e., GET), since pipelined
+   * requests are retried (once) if an earlier response closes the connection.
+   */
+  uint8_t pipeline;
 };
 
 /**
@@ -452,6 +522,44 @@ intptr_t http_connect(const char *url, const char *unix_address,
 #define http_connect(url, unix_address, ...)                                   \
   http_connect((url), (unix_address), (struct http_settings_s){__VA_ARGS__})
 
+/**
+ * Sends an HTTP request using a pooled keep-alive connection.
+ *
+ * Connections are pooled by scheme, host and port (or `unix_address`) as well
+ * as the `tls` object and the connection settings (`timeout`,
+ * `max_header_size`, `max_body_size` and `log`), so requests with different
+ * connection settings never share a connection. Idle connections are reused,
+ * new connections are opened up to the `max_clients` limit (defaults to
+ * HTTP_POOL_MAX_PER_HOST) and any other requests wait for a connection to
+ * become available (or, if the `pipeline` flag is set, are pipelined on a busy
+ * connection).
+ *
+ * `max_clients` applies to the whole pool, the most recent request setting it
+ * updates the limit.
+ *
+ * Once a connection is available, the `on_response` callback is called with an
+ * empty `http_s*` handler (status == 0). Set it's content and call
+ * `http_finish` before returning from the callback. The next `on_response`
+ * will contain the response.
+ *
+ * The `on_finish` callback is called once the request is complete. If the
+ * connection was lost, `on_finish` is called without a response.
+ *
+ * Idle connections are closed after `timeout` seconds (defaults to ~30s). A
+ * request sent over an idle connection that the server closed before
+ * responding is retried (once) on a new connection.
+ *
+ * Only HTTP/1.1 is supported (WebSocket URLs are an error).
+ *
+ * Returns -1 on error and 0 on success. The `on_finish` callback is always
+ * called.
+ */
+intptr_t http_connect_pooled(const char *url, const char *unix_address,
+                             struct http_settings_s);
+#define http_connect_pooled(url, unix_address, ...)                            \
+  http_connect_pooled((url), (unix_address),                                   \
+                      (struct http_settings_s){__VA_ARGS__})
+
 /**
  * Returns the settings used to setup the connection or NULL on error.
  */
@@ -510,6 +618,19 @@ typedef struct {
    * can be copied).
    */
   void (*on_message)(ws_s *ws, fio_str_info_s msg, uint8_t is_text);
+  /**
+   * The (optional) on_fragment callback will be called for every data frame
+   * received, allowing large (fragmented) messages to be processed as they
+   * arrive, without collecting the whole message in memory.
+   *
+   * When set, `on_message` isn't called. A message that wasn't fragmented is
+   * received as a single fragment (`is_last` is set).
+   *
+   * The data points to the frame's (unmasked) payload in the read buffer and it
+   * will be overwritten once the function exits.
+   */
+  void (*on_fragment)(ws_s *ws, fio_str_info_s data, uint8_t is_text,
+                      uint8_t is_last);
   /**
    * The (optional) on_open callback will be called once the websocket
    * connection is established and before is is registered with `facil`, so no
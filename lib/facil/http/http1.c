@@ -25,9 +25,11 @@ typedef struct http1pr_s {
   uintptr_t buf_len;
   uintptr_t max_header_size;
   uintptr_t header_size;
+  FIOBJ corked; /* responses held back until the pipelined batch is done */
   uint8_t close;
   uint8_t is_client;
   uint8_t stop;
+  uint8_t cork;
   uint8_t buf[];
 } http1pr_s;
 
@@ -42,11 +44,42 @@ Internal Helpers
 
 inline static void h1_reset(http1pr_s *p) { p->header_size = 0; }
 
+/*
+ * The `close` flag is also set by the shutdown (draining) task, which might
+ * run while a response is finished by another thread.
+ */
+#define http1_is_closing(p) fio_atomic_add(&(p)->close, 0)
+#define http1_set_closing(p) ((void)fio_atomic_xchange(&(p)->close, 1))
+
 #define http1_pr2handle(pr) (((http1pr_s *)(pr))->request)
 #define handle2pr(h) ((http1pr_s *)h->private_data.flag)
 
 static fio_str_info_s http1pr_status2str(uintptr_t status);
 
+/* sends any responses held back while draining a pipelined batch */
+static inline void http1_uncork(http1pr_s *p) {
+  if (!p->corked)
+    return;
+  fiobj_send_free(p->p.uuid, p->corked);
+  p->corked = FIOBJ_INVALID;
+}
+
+/* sends (or holds back, while corked) a response packet, freeing the packet */
+static inline void http1_send_packet(http1pr_s *p, FIOBJ packet) {
+  if (!p->cork) {
+    fiobj_send_free(p->p.uuid, packet);
+    return;
+  }
+  if (!p->corked) {
+    p->corked = packet;
+  } else {
+    fiobj_str_join(p->corked, packet);
+    fiobj_free(packet);
+  }
+  if (fiobj_obj2cstr(p->corked).len >= HTTP1_CORK_LIMIT)
+    http1_uncork(p);
+}
+
 /* cleanup an HTTP/1.1 handler object */
 static inline void http1_after_finish(http_s *h) {
   http1pr_s *p = handle2pr(h);
@@ -57,8 +90,10 @@ static inline void http1_after_finish(http_s *h) {
   } else {
     http_s_clear(h, p->p.settings->log);
   }
-  if (p->close)
+  if (http1_is_closing(p)) {
+    http1_uncork(p);
     fio_close(p->p.uuid);
+  }
 }
 
 /* *****************************************************************************
@@ -118,7 +153,11 @@ static FIOBJ headers2str(http_s *h, uintptr_t padding) {
     if (tmp) {
       t = fiobj_obj2cstr(tmp);
       if (t.data[0] == 'c' || t.data[0] == 'C')
-        p->close = 1;
+        http1_set_closing(p);
+    } else if (http1_is_closing(p) || !fio_is_running()) {
+      /* the connection is closing (i.e., draining during shutdown) */
+      fiobj_str_write(w.dest, "connection:close\r\n", 18);
+      http1_set_closing(p);
     } else {
       tmp = fiobj_hash_get2(h->headers, connection_hash);
       if (tmp) {
@@ -127,16 +166,16 @@ static FIOBJ headers2str(http_s *h, uintptr_t padding) {
           fiobj_str_write(w.dest, "connection:keep-alive\r\n", 23);
         else {
           fiobj_str_write(w.dest, "connection:close\r\n", 18);
-          p->close = 1;
+          http1_set_closing(p);
         }
       } else {
         t = fiobj_obj2cstr(h->version);
-        if (!p->close && t.len > 7 && t.data && t.data[5] == '1' &&
+        if (!http1_is_closing(p) && t.len > 7 && t.data && t.data[5] == '1' &&
             t.data[6] == '.' && t.data[7] == '1')
           fiobj_str_write(w.dest, "connection:keep-alive\r\n", 23);
         else {
           fiobj_str_write(w.dest, "connection:close\r\n", 18);
-          p->close = 1;
+          http1_set_closing(p);
         }
       }
     }
@@ -182,7 +221,7 @@ static int http1_send_body(http_s *h, void *data, uintptr_t length) {
     return -1;
   }
   fiobj_str_write(packet, data, length);
-  fiobj_send_free((handle2pr(h)->p.uuid), packet);
+  http1_send_packet(handle2pr(h), packet);
   http1_after_finish(h);
   return 0;
 }
@@ -203,16 +242,18 @@ static int http1_sendfile(http_s *h, int fd, uintptr_t length,
     intptr_t i = pread(fd, s.data + s.len, length, offset);
     if (i < 0) {
       close(fd);
+      http1_uncork(handle2pr(h));
       fiobj_send_free((handle2pr(h)->p.uuid), packet);
       fio_close((handle2pr(h)->p.uuid));
       return -1;
     }
     close(fd);
     fiobj_str_resize(packet, s.len + i);
-    fiobj_send_free((handle2pr(h)->p.uuid), packet);
+    http1_send_packet(handle2pr(h), packet);
     http1_after_finish(h);
     return 0;
   }
+  http1_uncork(handle2pr(h));
   fiobj_send_free((handle2pr(h)->p.uuid), packet);
   fio_sendfile((handle2pr(h)->p.uuid), fd, offset, length);
   http1_after_finish(h);
@@ -223,7 +264,7 @@ static int http1_sendfile(http_s *h, int fd, uintptr_t length,
 static void htt1p_finish(http_s *h) {
   FIOBJ packet = headers2str(h, 0);
   if (packet)
-    fiobj_send_free((handle2pr(h)->p.uuid), packet);
+    http1_send_packet(handle2pr(h), packet);
   else {
     // fprintf(stderr, "WARNING: invalid call to `htt1p_finish`\n");
   }
@@ -251,6 +292,7 @@ static int http1_push_file(http_s *h, FIOBJ filename, FIOBJ mime_type) {
  */
 static void http1_on_pause(http_s *h, http_fio_protocol_s *pr) {
   ((http1pr_s *)pr)->stop = 1;
+  http1_uncork((http1pr_s *)pr);
   fio_suspend(pr->uuid);
   (void)h;
 }
@@ -279,6 +321,7 @@ static intptr_t http1_hijack(http_s *h, fio_str_info_s *leftover) {
   }
 
   handle2pr(h)->stop = 3;
+  http1_uncork(handle2pr(h));
   intptr_t uuid = handle2pr(h)->p.uuid;
   fio_attach(uuid, NULL);
   return uuid;
@@ -297,6 +340,7 @@ static void http1_websocket_client_on_upgrade(http_s *h, char *proto,
   set->udata = NULL;
   http_finish(h);
   p->stop = 1;
+  http1_uncork(p);
   websocket_attach(uuid, set, args, p->parser.state.next,
                    p->buf_len - (intptr_t)(p->parser.state.next - p->buf));
   fio_free(args);
@@ -358,6 +402,7 @@ static int http1_http2websocket_server(http_s *h, websocket_settings_s *args) {
   http_settings_s *set = handle2pr(h)->p.settings;
   http_finish(h);
   pr->stop = 1;
+  http1_uncork(pr);
   websocket_attach(uuid, set, args, pr->parser.state.next,
                    pr->buf_len - (intptr_t)(pr->parser.state.next - pr->buf));
   return 0;
@@ -437,6 +482,7 @@ static uint8_t http1_sse_on_shutdown(intptr_t uuid, fio_protocol_s *p_) {
   http1_sse_fio_protocol_s *p = (http1_sse_fio_protocol_s *)p_;
   if (p->sse->sse.on_shutdown)
     p->sse->sse.on_shutdown(&p->sse->sse);
+  /* close now, EventSource clients will reconnect (to a live process) */
   return 0;
   (void)uuid;
 }
@@ -471,6 +517,7 @@ static int http1_upgrade2sse(http_s *h, http_sse_s *sse) {
                   fiobj_str_new("identity", 8));
   handle2pr(h)->stop = 1;
   htt1p_finish(h); /* avoid the enforced content length in http_finish */
+  http1_uncork(handle2pr(h));
 
   /* switch protocol to SSE */
   http1_sse_fio_protocol_s *sse_pr = fio_malloc(sizeof(*sse_pr));
@@ -565,11 +612,18 @@ static int http1_on_response(http1_parser_s *parser) {
   h1_reset(p);
   return fio_is_closed(p->p.uuid);
 }
+/* request data is confined to the parsing thread unless shared explicitly */
+#if HTTP_LOCAL_OBJECTS
+#define http1_local(o) fiobj_local((o))
+#else
+#define http1_local(o) (o)
+#endif
+
 /** called when a request method is parsed. */
 static int http1_on_method(http1_parser_s *parser, char *method,
                            size_t method_len) {
   http1_pr2handle(parser2http(parser)).method =
-      fiobj_str_new(method, method_len);
+      http1_local(fiobj_str_new(method, method_len));
   parser2http(parser)->header_size += method_len;
   return 0;
 }
@@ -579,7 +633,7 @@ static int http1_on_method(http1_parser_s *parser, char *method,
 static int http1_on_status(http1_parser_s *parser, size_t status,
                            char *status_str, size_t len) {
   http1_pr2handle(parser2http(parser)).status_str =
-      fiobj_str_new(status_str, len);
+      http1_local(fiobj_str_new(status_str, len));
   http1_pr2handle(parser2http(parser)).status = status;
   parser2http(parser)->header_size += len;
   return 0;
@@ -587,20 +641,23 @@ static int http1_on_status(http1_parser_s *parser, size_t status,
 
 /** called when a request path (excluding query) is parsed. */
 static int http1_on_path(http1_parser_s *parser, char *path, size_t len) {
-  http1_pr2handle(parser2http(parser)).path = fiobj_str_new(path, len);
+  http1_pr2handle(parser2http(parser)).path =
+      http1_local(fiobj_str_new(path, len));
   parser2http(parser)->header_size += len;
   return 0;
 }
 
 /** called when a request path (excluding query) is parsed. */
 static int http1_on_query(http1_parser_s *parser, char *query, size_t len) {
-  http1_pr2handle(parser2http(parser)).query = fiobj_str_new(query, len);
+  http1_pr2handle(parser2http(parser)).query =
+      http1_local(fiobj_str_new(query, len));
   parser2http(parser)->header_size += len;
   return 0;
 }
 /** called when a the HTTP/1.x version is parsed. */
 static int http1_on_version(http1_parser_s *parser, char *version, size_t len) {
-  http1_pr2handle(parser2http(parser)).version = fiobj_str_new(version, len);
+  http1_pr2handle(parser2http(parser)).version =
+      http1_local(fiobj_str_new(version, len));
   parser2http(parser)->header_size += len;
 /* start counting - occurs on the first line of both requests and responses */
 #if FIO_HTTP_EXACT_LOGGING
@@ -635,8 +692,8 @@ static int http1_on_header(http1_parser_s *parser, char *name, size_t name_len,
     http_send_error(&http1_pr2handle(parser2http(parser)), 413);
     return -1;
   }
-  sym = fiobj_str_new(name, name_len);
-  obj = fiobj_str_new(data, data_len);
+  sym = http1_local(fiobj_str_new(name, name_len));
+  obj = http1_local(fiobj_str_new(data, data_len));
   set_header_add(http1_pr2handle(parser2http(parser)).headers, sym, obj);
   fiobj_free(sym);
   return 0;
@@ -665,9 +722,10 @@ static int http1_on_body_chunk(http1_parser_s *parser, char *data,
 
 /** called when a protocol error occurred. */
 static int http1_on_error(http1_parser_s *parser) {
-  if (parser2http(parser)->close)
+  if (http1_is_closing(parser2http(parser)))
     return -1;
   FIO_LOG_DEBUG("HTTP parser error.");
+  http1_uncork(parser2http(parser));
   fio_close(parser2http(parser)->p.uuid);
   return -1;
 }
@@ -685,11 +743,15 @@ static inline void http1_consume_data(intptr_t uuid, http1pr_s *p) {
   int pipeline_limit = 8;
   if (!p->buf_len)
     return;
+  /* hold back responses, so a pipelined batch is sent using a single write */
+  p->cork = 1;
   do {
     i = http1_parse(&p->parser, p->buf + (org_len - p->buf_len), p->buf_len);
     p->buf_len -= i;
     --pipeline_limit;
   } while (i && p->buf_len && pipeline_limit && !p->stop);
+  p->cork = 0;
+  http1_uncork(p);
 
   if (p->buf_len && org_len != p->buf_len) {
     memmove(p->buf, p->buf + (org_len - p->buf_len), p->buf_len);
@@ -741,6 +803,23 @@ static void http1_on_close(intptr_t uuid, fio_protocol_s *protocol) {
   (void)uuid;
 }
 
+/**
+ * called when the server is shutting down (drains the connection).
+ *
+ * Idle connections are closed immediately, while requests in progress are
+ * allowed to complete - their response is sent with `connection: close`.
+ */
+static uint8_t http1_on_shutdown(intptr_t uuid, fio_protocol_s *protocol) {
+  http1pr_s *p = (http1pr_s *)protocol;
+  http1_set_closing(p);
+  if (p->is_client || (!p->stop && !p->buf_len && !p->request.method))
+    return 0;
+  if (!p->p.settings->timeout || p->p.settings->timeout == 255)
+    return 254;
+  return p->p.settings->timeout;
+  (void)uuid;
+}
+
 /** called when the connection was closed, but will not run concurrently */
 static void http1_on_ready(intptr_t uuid, fio_protocol_s *protocol) {
   /* resume slow clients from suspension */
@@ -794,6 +873,7 @@ fio_protocol_s *http1_new(uintptr_t uuid, http_settings_s *settings,
               .on_data = http1_on_data_first_time,
               .on_close = http1_on_close,
               .on_ready = http1_on_ready,
+              .on_shutdown = http1_on_shutdown,
           },
       .p.uuid = uuid,
       .p.settings = settings,
@@ -817,6 +897,7 @@ void http1_destroy(fio_protocol_s *pr) {
   http1pr_s *p = (http1pr_s *)pr;
   http1_pr2handle(p).status = 0;
   http_s_destroy(&http1_pr2handle(p), 0);
+  fiobj_free(p->corked);
   fio_free(p);
   // FIO_LOG_DEBUG("Deallocated HTTP/1.1 protocol at. %p", (void *)p);
 }
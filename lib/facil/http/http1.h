@@ -15,6 +15,14 @@ License: MIT
 #define HTTP1_READ_BUFFER (8 * 1024) /* ~8kb */
 #endif
 
+#ifndef HTTP1_CORK_LIMIT
+/**
+ * Responses to pipelined requests are coalesced into a single write, until
+ * the pending data reaches this size (in bytes).
+ */
+#define HTTP1_CORK_LIMIT (64 * 1024) /* ~64kb */
+#endif
+
 /** Creates an HTTP1 protocol object and handles any unread data in the buffer
  * (if any). */
 fio_protocol_s *http1_new(uintptr_t uuid, http_settings_s *settings,
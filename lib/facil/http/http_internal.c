@@ -110,6 +110,7 @@ Library initialization
 ***************************************************************************** */
 
 FIOBJ HTTP_HEADER_ACCEPT;
+FIOBJ HTTP_HEADER_ACCEPT_ENCODING;
 FIOBJ HTTP_HEADER_ACCEPT_RANGES;
 FIOBJ HTTP_HEADER_CACHE_CONTROL;
 FIOBJ HTTP_HEADER_CONNECTION;
@@ -127,6 +128,8 @@ FIOBJ HTTP_HEADER_SET_COOKIE;
 FIOBJ HTTP_HEADER_UPGRADE;
 FIOBJ HTTP_HEADER_WS_SEC_CLIENT_KEY;
 FIOBJ HTTP_HEADER_WS_SEC_KEY;
+FIOBJ HTTP_HEADER_VARY;
+FIOBJ HTTP_HVALUE_BR;
 FIOBJ HTTP_HVALUE_BYTES;
 FIOBJ HTTP_HVALUE_CLOSE;
 FIOBJ HTTP_HVALUE_CONTENT_TYPE_DEFAULT;
@@ -139,6 +142,7 @@ FIOBJ HTTP_HVALUE_WEBSOCKET;
 FIOBJ HTTP_HVALUE_WS_SEC_VERSION;
 FIOBJ HTTP_HVALUE_WS_UPGRADE;
 FIOBJ HTTP_HVALUE_WS_VERSION;
+FIOBJ HTTP_HVALUE_ZSTD;
 
 static void http_lib_init(void *ignr_);
 static void http_lib_cleanup(void *ignr_);
@@ -153,9 +157,10 @@ static void http_lib_cleanup(void *ignr_) {
   (void)ignr_;
   http_mimetype_clear();
 #define HTTPLIB_RESET(x)                                                       \
-  fiobj_free(x);                                                               \
+  fiobj_free(fiobj_thaw(x));                                                   \
   x = FIOBJ_INVALID;
   HTTPLIB_RESET(HTTP_HEADER_ACCEPT);
+  HTTPLIB_RESET(HTTP_HEADER_ACCEPT_ENCODING);
   HTTPLIB_RESET(HTTP_HEADER_ACCEPT_RANGES);
   HTTPLIB_RESET(HTTP_HEADER_CACHE_CONTROL);
   HTTPLIB_RESET(HTTP_HEADER_CONNECTION);
@@ -173,6 +178,8 @@ static void http_lib_cleanup(void *ignr_) {
   HTTPLIB_RESET(HTTP_HEADER_UPGRADE);
   HTTPLIB_RESET(HTTP_HEADER_WS_SEC_CLIENT_KEY);
   HTTPLIB_RESET(HTTP_HEADER_WS_SEC_KEY);
+  HTTPLIB_RESET(HTTP_HEADER_VARY);
+  HTTPLIB_RESET(HTTP_HVALUE_BR);
   HTTPLIB_RESET(HTTP_HVALUE_BYTES);
   HTTPLIB_RESET(HTTP_HVALUE_CLOSE);
   HTTPLIB_RESET(HTTP_HVALUE_CONTENT_TYPE_DEFAULT);
@@ -185,6 +192,7 @@ static void http_lib_cleanup(void *ignr_) {
   HTTPLIB_RESET(HTTP_HVALUE_WS_SEC_VERSION);
   HTTPLIB_RESET(HTTP_HVALUE_WS_UPGRADE);
   HTTPLIB_RESET(HTTP_HVALUE_WS_VERSION);
+  HTTPLIB_RESET(HTTP_HVALUE_ZSTD);
 
 #undef HTTPLIB_RESET
   http_mimetype_stats();
@@ -197,6 +205,7 @@ static void http_lib_init(void *ignr_) {
   if (HTTP_HEADER_ACCEPT_RANGES)
     return;
   HTTP_HEADER_ACCEPT = fiobj_str_new("accept", 6);
+  HTTP_HEADER_ACCEPT_ENCODING = fiobj_str_new("accept-encoding", 15);
   HTTP_HEADER_ACCEPT_RANGES = fiobj_str_new("accept-ranges", 13);
   HTTP_HEADER_CACHE_CONTROL = fiobj_str_new("cache-control", 13);
   HTTP_HEADER_CONNECTION = fiobj_str_new("connection", 10);
@@ -214,6 +223,8 @@ static void http_lib_init(void *ignr_) {
   HTTP_HEADER_UPGRADE = fiobj_str_new("upgrade", 7);
   HTTP_HEADER_WS_SEC_CLIENT_KEY = fiobj_str_new("sec-websocket-key", 17);
   HTTP_HEADER_WS_SEC_KEY = fiobj_str_new("sec-websocket-accept", 20);
+  HTTP_HEADER_VARY = fiobj_str_new("vary", 4);
+  HTTP_HVALUE_BR = fiobj_str_new("br", 2);
   HTTP_HVALUE_BYTES = fiobj_str_new("bytes", 5);
   HTTP_HVALUE_CLOSE = fiobj_str_new("close", 5);
   HTTP_HVALUE_CONTENT_TYPE_DEFAULT =
@@ -227,40 +238,48 @@ static void http_lib_init(void *ignr_) {
   HTTP_HVALUE_WS_SEC_VERSION = fiobj_str_new("sec-websocket-version", 21);
   HTTP_HVALUE_WS_UPGRADE = fiobj_str_new("Upgrade", 7);
   HTTP_HVALUE_WS_VERSION = fiobj_str_new("13", 2);
+  HTTP_HVALUE_ZSTD = fiobj_str_new("zstd", 4);
 
-  fiobj_obj2hash(HTTP_HEADER_ACCEPT_RANGES);
-  fiobj_obj2hash(HTTP_HEADER_CACHE_CONTROL);
-  fiobj_obj2hash(HTTP_HEADER_CONNECTION);
-  fiobj_obj2hash(HTTP_HEADER_CONTENT_ENCODING);
-  fiobj_obj2hash(HTTP_HEADER_CONTENT_LENGTH);
-  fiobj_obj2hash(HTTP_HEADER_CONTENT_RANGE);
-  fiobj_obj2hash(HTTP_HEADER_CONTENT_TYPE);
-  fiobj_obj2hash(HTTP_HEADER_COOKIE);
-  fiobj_obj2hash(HTTP_HEADER_DATE);
-  fiobj_obj2hash(HTTP_HEADER_ETAG);
-  fiobj_obj2hash(HTTP_HEADER_HOST);
-  fiobj_obj2hash(HTTP_HEADER_LAST_MODIFIED);
-  fiobj_obj2hash(HTTP_HEADER_ORIGIN);
-  fiobj_obj2hash(HTTP_HEADER_SET_COOKIE);
-  fiobj_obj2hash(HTTP_HEADER_UPGRADE);
-  fiobj_obj2hash(HTTP_HEADER_WS_SEC_CLIENT_KEY);
-  fiobj_obj2hash(HTTP_HEADER_WS_SEC_KEY);
-  fiobj_obj2hash(HTTP_HVALUE_BYTES);
-  fiobj_obj2hash(HTTP_HVALUE_CLOSE);
-  fiobj_obj2hash(HTTP_HVALUE_CONTENT_TYPE_DEFAULT);
-  fiobj_obj2hash(HTTP_HVALUE_GZIP);
-  fiobj_obj2hash(HTTP_HVALUE_KEEP_ALIVE);
-  fiobj_obj2hash(HTTP_HVALUE_MAX_AGE);
-  fiobj_obj2hash(HTTP_HVALUE_NO_CACHE);
-  fiobj_obj2hash(HTTP_HVALUE_SSE_MIME);
-  fiobj_obj2hash(HTTP_HVALUE_WEBSOCKET);
-  fiobj_obj2hash(HTTP_HVALUE_WS_SEC_VERSION);
-  fiobj_obj2hash(HTTP_HVALUE_WS_UPGRADE);
-  fiobj_obj2hash(HTTP_HVALUE_WS_VERSION);
+  /* immortal, frozen, copies stay shared by the worker processes */
+  HTTP_HEADER_ACCEPT = fiobj_freeze(HTTP_HEADER_ACCEPT);
+  HTTP_HEADER_ACCEPT_ENCODING = fiobj_freeze(HTTP_HEADER_ACCEPT_ENCODING);
+  HTTP_HEADER_ACCEPT_RANGES = fiobj_freeze(HTTP_HEADER_ACCEPT_RANGES);
+  HTTP_HEADER_CACHE_CONTROL = fiobj_freeze(HTTP_HEADER_CACHE_CONTROL);
+  HTTP_HEADER_CONNECTION = fiobj_freeze(HTTP_HEADER_CONNECTION);
+  HTTP_HEADER_CONTENT_ENCODING = fiobj_freeze(HTTP_HEADER_CONTENT_ENCODING);
+  HTTP_HEADER_CONTENT_LENGTH = fiobj_freeze(HTTP_HEADER_CONTENT_LENGTH);
+  HTTP_HEADER_CONTENT_RANGE = fiobj_freeze(HTTP_HEADER_CONTENT_RANGE);
+  HTTP_HEADER_CONTENT_TYPE = fiobj_freeze(HTTP_HEADER_CONTENT_TYPE);
+  HTTP_HEADER_COOKIE = fiobj_freeze(HTTP_HEADER_COOKIE);
+  HTTP_HEADER_DATE = fiobj_freeze(HTTP_HEADER_DATE);
+  HTTP_HEADER_ETAG = fiobj_freeze(HTTP_HEADER_ETAG);
+  HTTP_HEADER_HOST = fiobj_freeze(HTTP_HEADER_HOST);
+  HTTP_HEADER_LAST_MODIFIED = fiobj_freeze(HTTP_HEADER_LAST_MODIFIED);
+  HTTP_HEADER_ORIGIN = fiobj_freeze(HTTP_HEADER_ORIGIN);
+  HTTP_HEADER_SET_COOKIE = fiobj_freeze(HTTP_HEADER_SET_COOKIE);
+  HTTP_HEADER_UPGRADE = fiobj_freeze(HTTP_HEADER_UPGRADE);
+  HTTP_HEADER_WS_SEC_CLIENT_KEY = fiobj_freeze(HTTP_HEADER_WS_SEC_CLIENT_KEY);
+  HTTP_HEADER_WS_SEC_KEY = fiobj_freeze(HTTP_HEADER_WS_SEC_KEY);
+  HTTP_HEADER_VARY = fiobj_freeze(HTTP_HEADER_VARY);
+  HTTP_HVALUE_BR = fiobj_freeze(HTTP_HVALUE_BR);
+  HTTP_HVALUE_BYTES = fiobj_freeze(HTTP_HVALUE_BYTES);
+  HTTP_HVALUE_CLOSE = fiobj_freeze(HTTP_HVALUE_CLOSE);
+  HTTP_HVALUE_CONTENT_TYPE_DEFAULT =
+      fiobj_freeze(HTTP_HVALUE_CONTENT_TYPE_DEFAULT);
+  HTTP_HVALUE_GZIP = fiobj_freeze(HTTP_HVALUE_GZIP);
+  HTTP_HVALUE_KEEP_ALIVE = fiobj_freeze(HTTP_HVALUE_KEEP_ALIVE);
+  HTTP_HVALUE_MAX_AGE = fiobj_freeze(HTTP_HVALUE_MAX_AGE);
+  HTTP_HVALUE_NO_CACHE = fiobj_freeze(HTTP_HVALUE_NO_CACHE);
+  HTTP_HVALUE_SSE_MIME = fiobj_freeze(HTTP_HVALUE_SSE_MIME);
+  HTTP_HVALUE_WEBSOCKET = fiobj_freeze(HTTP_HVALUE_WEBSOCKET);
+  HTTP_HVALUE_WS_SEC_VERSION = fiobj_freeze(HTTP_HVALUE_WS_SEC_VERSION);
+  HTTP_HVALUE_WS_UPGRADE = fiobj_freeze(HTTP_HVALUE_WS_UPGRADE);
+  HTTP_HVALUE_WS_VERSION = fiobj_freeze(HTTP_HVALUE_WS_VERSION);
+  HTTP_HVALUE_ZSTD = fiobj_freeze(HTTP_HVALUE_ZSTD);
 
 #define REGISTER_MIME(ext, type)                                               \
-  http_mimetype_register((char *)ext, sizeof(ext) - 1,                         \
-                         fiobj_str_new((char *)type, sizeof(type) - 1))
+  http_mimetype_register_frozen((char *)ext, sizeof(ext) - 1,                  \
+                                fiobj_str_new((char *)type, sizeof(type) - 1))
 
   REGISTER_MIME("123", "application/vnd.lotus-1-2-3");
   REGISTER_MIME("3dml", "text/vnd.in3d.3dml");
@@ -70,9 +70,12 @@ struct http_fio_protocol_s {
 Constants that shouldn't be accessed by the users (`fiobj_dup` required).
 ***************************************************************************** */
 
+extern FIOBJ HTTP_HEADER_ACCEPT_ENCODING;
 extern FIOBJ HTTP_HEADER_ACCEPT_RANGES;
 extern FIOBJ HTTP_HEADER_WS_SEC_CLIENT_KEY;
+extern FIOBJ HTTP_HEADER_VARY;
 extern FIOBJ HTTP_HEADER_WS_SEC_KEY;
+extern FIOBJ HTTP_HVALUE_BR;
 extern FIOBJ HTTP_HVALUE_BYTES;
 extern FIOBJ HTTP_HVALUE_CLOSE;
 extern FIOBJ HTTP_HVALUE_CONTENT_TYPE_DEFAULT;
@@ -85,6 +88,7 @@ extern FIOBJ HTTP_HVALUE_WEBSOCKET;
 extern FIOBJ HTTP_HVALUE_WS_SEC_VERSION;
 extern FIOBJ HTTP_HVALUE_WS_UPGRADE;
 extern FIOBJ HTTP_HVALUE_WS_VERSION;
+extern FIOBJ HTTP_HVALUE_ZSTD;
 
 /* *****************************************************************************
 HTTP request/response object management
@@ -148,6 +152,10 @@ void http_on_response_handler______internal(http_s *h,
                                             http_settings_s *settings);
 int http_send_error2(size_t error, intptr_t uuid, http_settings_s *settings);
 
+/** Registers a frozen (immortal) Mime-Type, called before the server forks. */
+void http_mimetype_register_frozen(char *file_ext, size_t file_ext_len,
+                                   FIOBJ mime_type_str);
+
 /* *****************************************************************************
 EventSource Support (SSE)
 ***************************************************************************** */
@@ -59,6 +59,21 @@ websocket_server_wrap(void *target, void *msg, uint64_t len,
                       unsigned char opcode, unsigned char first,
                       unsigned char last, unsigned char rsv);
 
+/**
+ * Writes a WebSocket server frame header (without the payload) to the target
+ * buffer (at least 10 bytes long).
+ *
+ * This allows the payload to be sent without copying it (see
+ * `websocket_server_wrap` for the arguments).
+ *
+ * Returns the number of bytes written. Always `websocket_wrapped_len(len) -
+ * len`
+ */
+inline static uint8_t __attribute__((unused))
+websocket_server_wrap_head(void *target, uint64_t len, unsigned char opcode,
+                           unsigned char first, unsigned char last,
+                           unsigned char rsv);
+
 /**
  * Wraps a WebSocket client message and writes it to the target buffer.
  *
@@ -293,26 +308,41 @@ static inline uint64_t websocket_wrapped_len(uint64_t len) {
 static uint64_t websocket_server_wrap(void *target, void *msg, uint64_t len,
                                       unsigned char opcode, unsigned char first,
                                       unsigned char last, unsigned char rsv) {
+  const uint8_t head =
+      websocket_server_wrap_head(target, len, opcode, first, last, rsv);
+  memcpy(((uint8_t *)target) + head, msg, len);
+  return len + head;
+}
+
+/**
+ * Writes a WebSocket server frame header (without the payload) to the target
+ * buffer (at least 10 bytes long).
+ *
+ * Returns the number of bytes written. Always `websocket_wrapped_len(len) -
+ * len`
+ */
+static uint8_t websocket_server_wrap_head(void *target, uint64_t len,
+                                          unsigned char opcode,
+                                          unsigned char first,
+                                          unsigned char last,
+                                          unsigned char rsv) {
   ((uint8_t *)target)[0] = 0 |
                            /* opcode */ (((first ? opcode : 0) & 15)) |
                            /* rsv */ ((rsv & 7) << 4) |
                            /*fin*/ ((last & 1) << 7);
   if (len < 126) {
     ((uint8_t *)target)[1] = len;
-    memcpy(((uint8_t *)target) + 2, msg, len);
-    return len + 2;
+    return 2;
   } else if (len < (1UL << 16)) {
     /* head is 4 bytes */
     ((uint8_t *)target)[1] = 126;
     websocket_u2str16(((uint8_t *)target + 2), len);
-    memcpy((uint8_t *)target + 4, msg, len);
-    return len + 4;
+    return 4;
   }
   /* Really Long Message  */
   ((uint8_t *)target)[1] = 127;
   websocket_u2str64(((uint8_t *)target + 2), len);
-  memcpy((uint8_t *)target + 10, msg, len);
-  return len + 10;
+  return 10;
 }
 
 /**
@@ -7,11 +7,6 @@ Feel free to copy, use and enjoy according to the license provided.
 #define FIO_INCLUDE_STR
 #include <fio.h>
 
-/* subscription lists have a long lifetime */
-#define FIO_FORCE_MALLOC_TMP 1
-#define FIO_INCLUDE_LINKED_LIST
-#include <fio.h>
-
 #include <fiobj.h>
 
 #include <http.h>
@@ -57,20 +52,43 @@ void free_ws_buffer(ws_s *owner, struct buffer_s);
 /** Sets the initial buffer size. (4Kb)*/
 #define WS_INITIAL_BUFFER_SIZE 4096UL
 
+/** The maximal number of (initial size) buffers kept in the shared pool. */
+#ifndef WS_BUFFER_POOL_LIMIT
+#define WS_BUFFER_POOL_LIMIT 1024
+#endif
+
 /*******************************************************************************
 Buffer management - simple implementation...
-Since Websocket connections have a long life expectancy, optimizing this part of
-the code probably wouldn't offer a high performance boost.
+
+Websocket connections have a long life expectancy, but are mostly idle. A read
+buffer is borrowed when data arrives and returned once no partial frame remains,
+so memory follows the number of active connections, not open connections.
+
+Initial size buffers are recycled using a shared pool.
 */
 
 // buffer increments by 4,096 Bytes (4Kb)
 #define round_up_buffer_size(size) (((size) >> 12) + 1) << 12
 
+static struct {
+  void *head; /* each pooled buffer stores the next pooled buffer */
+  size_t count;
+  fio_lock_i lock;
+} ws_buffer_pool = {.lock = FIO_LOCK_INIT};
+
 struct buffer_s create_ws_buffer(ws_s *owner) {
   (void)(owner);
   struct buffer_s buff;
   buff.size = WS_INITIAL_BUFFER_SIZE;
-  buff.data = malloc(buff.size);
+  fio_lock(&ws_buffer_pool.lock);
+  buff.data = ws_buffer_pool.head;
+  if (buff.data) {
+    ws_buffer_pool.head = *(void **)buff.data;
+    --ws_buffer_pool.count;
+  }
+  fio_unlock(&ws_buffer_pool.lock);
+  if (!buff.data)
+    buff.data = malloc(buff.size);
   return buff;
 }
 
@@ -87,11 +105,108 @@ struct buffer_s resize_ws_buffer(ws_s *owner, struct buffer_s buff) {
 }
 void free_ws_buffer(ws_s *owner, struct buffer_s buff) {
   (void)(owner);
+  if (buff.data && buff.size == WS_INITIAL_BUFFER_SIZE) {
+    fio_lock(&ws_buffer_pool.lock);
+    if (ws_buffer_pool.count < WS_BUFFER_POOL_LIMIT) {
+      *(void **)buff.data = ws_buffer_pool.head;
+      ws_buffer_pool.head = buff.data;
+      ++ws_buffer_pool.count;
+      buff.data = NULL;
+    }
+    fio_unlock(&ws_buffer_pool.lock);
+  }
   free(buff.data);
 }
 
+static void __attribute__((destructor)) ws_buffer_pool_destroy(void) {
+  while (ws_buffer_pool.head) {
+    void *tmp = ws_buffer_pool.head;
+    ws_buffer_pool.head = *(void **)tmp;
+    free(tmp);
+  }
+  ws_buffer_pool.count = 0;
+}
+
 #undef round_up_buffer_size
 
+/*******************************************************************************
+Subscription lists - a compact array (a single subscription is kept inline).
+
+The array is kept until the list is empty (or mostly empty), so a connection
+that keeps subscribing and unsubscribing doesn't reallocate the array.
+*/
+
+typedef struct {
+  uint32_t count;
+  uint32_t capa; /* 0 while the (single) subscription is kept inline */
+  union {
+    subscription_s *one;
+    subscription_s **ary;
+  } u;
+} ws_sub_list_s;
+
+#define ws_sub_list_items(l) ((l)->capa ? (l)->u.ary : &(l)->u.one)
+
+static void ws_sub_list_push(ws_sub_list_s *l, subscription_s *sub) {
+  if (!l->count && !l->capa) {
+    l->u.one = sub;
+    l->count = 1;
+    return;
+  }
+  if (l->count == l->capa || !l->capa) {
+    const uint32_t capa = l->capa ? (l->capa << 1) : 4;
+    subscription_s **tmp = malloc(sizeof(*tmp) * capa);
+    FIO_ASSERT_ALLOC(tmp);
+    memcpy(tmp, ws_sub_list_items(l), sizeof(*tmp) * l->count);
+    if (l->capa)
+      free(l->u.ary);
+    l->u.ary = tmp;
+    l->capa = capa;
+  }
+  l->u.ary[l->count++] = sub;
+}
+
+/* releases the array once empty and shrinks it once mostly empty */
+static void ws_sub_list_compact(ws_sub_list_s *l) {
+  if (!l->capa)
+    return;
+  if (!l->count) {
+    free(l->u.ary);
+    l->u.one = NULL;
+    l->capa = 0;
+    return;
+  }
+  if (l->capa <= 4 || l->count > (l->capa >> 2))
+    return;
+  /* halving leaves room for twice the remaining subscriptions */
+  subscription_s **tmp = realloc(l->u.ary, sizeof(*tmp) * (l->capa >> 1));
+  if (!tmp)
+    return;
+  l->u.ary = tmp;
+  l->capa >>= 1;
+}
+
+/* removes a subscription from the list, returns -1 if it wasn't found */
+static int ws_sub_list_remove(ws_sub_list_s *l, subscription_s *sub) {
+  subscription_s **items = ws_sub_list_items(l);
+  for (uint32_t i = 0; i < l->count; ++i) {
+    if (items[i] != sub)
+      continue;
+    items[i] = items[--l->count];
+    ws_sub_list_compact(l);
+    return 0;
+  }
+  return -1;
+}
+
+static subscription_s *ws_sub_list_pop(ws_sub_list_s *l) {
+  if (!l->count)
+    return NULL;
+  subscription_s *sub = ws_sub_list_items(l)[--l->count];
+  ws_sub_list_compact(l);
+  return sub;
+}
+
 /*******************************************************************************
 Create/Destroy the websocket object (prototypes)
 */
@@ -109,6 +224,8 @@ struct ws_s {
   intptr_t fd;
   /** callbacks */
   void (*on_message)(ws_s *ws, fio_str_info_s msg, uint8_t is_text);
+  void (*on_fragment)(ws_s *ws, fio_str_info_s data, uint8_t is_text,
+                      uint8_t is_last);
   void (*on_shutdown)(ws_s *ws);
   void (*on_ready)(ws_s *ws);
   void (*on_open)(ws_s *ws);
@@ -118,7 +235,7 @@ struct ws_s {
   /** The maximum websocket message size */
   size_t max_msg_size;
   /** active pub/sub subscriptions */
-  fio_ls_s subscriptions;
+  ws_sub_list_s subscriptions;
   fio_lock_i sub_lock;
   /** socket buffer. */
   struct buffer_s buffer;
@@ -126,10 +243,18 @@ struct ws_s {
   size_t length;
   /** message buffer. */
   FIOBJ msg;
+  /** frames written while a message is streamed (sent once it ends). */
+  FIOBJ held;
+  /** keeps frames whole (header and payload) and in order. */
+  fio_lock_i write_lock;
   /** latest text state. */
   uint8_t is_text;
   /** websocket connection type. */
   uint8_t is_client;
+  /** streamed message state (1 == started, 2 == first frame sent). */
+  uint8_t stream;
+  /** streamed message text state. */
+  uint8_t stream_text;
 };
 
 /* *****************************************************************************
@@ -137,9 +262,10 @@ Create/Destroy the websocket subscription objects
 ***************************************************************************** */
 
 static inline void clear_subscriptions(ws_s *ws) {
+  subscription_s *sub;
   fio_lock(&ws->sub_lock);
-  while (fio_ls_any(&ws->subscriptions)) {
-    fio_unsubscribe(fio_ls_pop(&ws->subscriptions));
+  while ((sub = ws_sub_list_pop(&ws->subscriptions))) {
+    fio_unsubscribe(sub);
   }
   fio_unlock(&ws->sub_lock);
 }
@@ -152,6 +278,14 @@ static void websocket_on_unwrapped(void *ws_p, void *msg, uint64_t len,
                                    char first, char last, char text,
                                    unsigned char rsv) {
   ws_s *ws = ws_p;
+  if (ws->on_fragment) {
+    /* streaming - no reassembly, the payload is in the read buffer */
+    if (first)
+      ws->is_text = (uint8_t)text;
+    ws->on_fragment(ws, (fio_str_info_s){.data = msg, .len = len},
+                    ws->is_text, (uint8_t)last);
+    return;
+  }
   if (last && first) {
     ws->on_message(ws, (fio_str_info_s){.data = msg, .len = len},
                    (uint8_t)text);
@@ -172,6 +306,7 @@ static void websocket_on_unwrapped(void *ws_p, void *msg, uint64_t len,
 }
 static void websocket_on_protocol_ping(void *ws_p, void *msg_, uint64_t len) {
   ws_s *ws = ws_p;
+  fio_lock(&ws->write_lock);
   if (msg_) {
     void *buff = malloc(len + 16);
     len = (((ws_s *)ws)->is_client
@@ -187,6 +322,7 @@ static void websocket_on_protocol_ping(void *ws_p, void *msg_, uint64_t len) {
                  .after.dealloc = FIO_DEALLOC_NOOP);
     }
   }
+  fio_unlock(&ws->write_lock);
 }
 static void websocket_on_protocol_pong(void *ws_p, void *msg, uint64_t len) {
   (void)len;
@@ -209,7 +345,7 @@ The Websocket Protocol implementation
 #define ws_protocol(fd) ((ws_s *)(server_get_protocol(fd)))
 
 static void ws_ping(intptr_t fd, fio_protocol_s *ws) {
-  (void)(ws);
+  fio_lock(&((ws_s *)ws)->write_lock);
   if (((ws_s *)ws)->is_client) {
     fio_write2(fd, .data.buffer = "\x89\x80MASK", .length = 6,
                .after.dealloc = FIO_DEALLOC_NOOP);
@@ -217,6 +353,7 @@ static void ws_ping(intptr_t fd, fio_protocol_s *ws) {
     fio_write2(fd, .data.buffer = "\x89\x00", .length = 2,
                .after.dealloc = FIO_DEALLOC_NOOP);
   }
+  fio_unlock(&((ws_s *)ws)->write_lock);
 }
 
 static void on_close(intptr_t uuid, fio_protocol_s *_ws) {
@@ -234,20 +371,40 @@ static uint8_t on_shutdown(intptr_t fd, fio_protocol_s *ws) {
   (void)(fd);
   if (ws && ((ws_s *)ws)->on_shutdown)
     ((ws_s *)ws)->on_shutdown((ws_s *)ws);
+  /* send a close frame with status 1001 (going away) */
+  fio_lock(&((ws_s *)ws)->write_lock);
   if (((ws_s *)ws)->is_client) {
-    fio_write2(fd, .data.buffer = "\x8a\x80MASK", .length = 6,
+    fio_write2(fd, .data.buffer = "\x88\x82MASK\x4e\xa8", .length = 8,
                .after.dealloc = FIO_DEALLOC_NOOP);
   } else {
-    fio_write2(fd, .data.buffer = "\x8a\x00", .length = 2,
+    fio_write2(fd, .data.buffer = "\x88\x02\x03\xe9", .length = 4,
                .after.dealloc = FIO_DEALLOC_NOOP);
   }
+  fio_unlock(&((ws_s *)ws)->write_lock);
   return 0;
 }
 
+/* returns an idle connection's read buffer (no partial frame remains) */
+static inline void ws_buffer_release(ws_s *ws) {
+  if (ws->length || !ws->buffer.data)
+    return;
+  free_ws_buffer(ws, ws->buffer);
+  ws->buffer = (struct buffer_s){.data = NULL};
+}
+
 static void on_data(intptr_t sockfd, fio_protocol_s *ws_) {
   ws_s *const ws = (ws_s *)ws_;
   if (ws == NULL)
     return;
+  /* borrow a read buffer (idle connections don't keep one) */
+  if (!ws->buffer.data) {
+    ws->buffer = create_ws_buffer(ws);
+    if (!ws->buffer.data) {
+      // no memory.
+      websocket_close(ws);
+      return;
+    }
+  }
   struct websocket_packet_info_s info =
       websocket_buffer_peek(ws->buffer.data, ws->length);
   const uint64_t raw_length = info.packet_length + info.head_length;
@@ -271,10 +428,12 @@ static void on_data(intptr_t sockfd, fio_protocol_s *ws_) {
   const ssize_t len = fio_read(sockfd, (uint8_t *)ws->buffer.data + ws->length,
                                ws->buffer.size - ws->length);
   if (len <= 0) {
+    ws_buffer_release(ws);
     return;
   }
   ws->length = websocket_consume(ws->buffer.data, ws->length + len, ws,
                                  (~(ws->is_client) & 1));
+  ws_buffer_release(ws);
 
   fio_force_event(sockfd, FIO_EVENT_ON_DATA);
 }
@@ -290,13 +449,11 @@ static void on_data_first(intptr_t sockfd, fio_protocol_s *ws_) {
     ws->length = websocket_consume(ws->buffer.data, ws->length, ws,
                                    (~(ws->is_client) & 1));
   }
+  ws_buffer_release(ws);
   fio_force_event(sockfd, FIO_EVENT_ON_DATA);
   fio_force_event(sockfd, FIO_EVENT_ON_READY);
 }
 
-/* later */
-static void websocket_write_impl(intptr_t fd, void *data, size_t len, char text,
-                                 char first, char last, char client);
 
 /*******************************************************************************
 Create/Destroy the websocket object
@@ -311,7 +468,6 @@ static ws_s *new_websocket(intptr_t uuid) {
       .protocol.on_close = on_close,
       .protocol.on_ready = NULL /* filled in after `on_open` */,
       .protocol.on_shutdown = on_shutdown,
-      .subscriptions = FIO_LS_INIT(ws->subscriptions),
       .is_client = 0,
       .fd = uuid,
   };
@@ -322,6 +478,7 @@ static void destroy_ws(ws_s *ws) {
     ws->on_close(ws->fd, ws->udata);
   if (ws->msg)
     fiobj_free(ws->msg);
+  fiobj_free(ws->held);
   clear_subscriptions(ws);
   free_ws_buffer(ws, ws->buffer);
   free(ws);
@@ -331,12 +488,11 @@ void websocket_attach(intptr_t uuid, http_settings_s *http_settings,
                       websocket_settings_s *args, void *data, size_t length) {
   ws_s *ws = new_websocket(uuid);
   FIO_ASSERT_ALLOC(ws);
-  // we have an active websocket connection - prep the connection buffer
-  ws->buffer = create_ws_buffer(ws);
   // Setup ws callbacks
   ws->on_open = args->on_open;
   ws->on_close = args->on_close;
   ws->on_message = args->on_message;
+  ws->on_fragment = args->on_fragment;
   ws->on_ready = args->on_ready;
   ws->on_shutdown = args->on_shutdown;
   // setup any user data
@@ -354,6 +510,8 @@ void websocket_attach(intptr_t uuid, http_settings_s *http_settings,
   }
 
   if (data && length) {
+    // unread data - prep the connection buffer (borrowed until consumed)
+    ws->buffer = create_ws_buffer(ws);
     if (length > ws->buffer.size) {
       ws->buffer.size = length;
       ws->buffer = resize_ws_buffer(ws, ws->buffer);
@@ -379,29 +537,91 @@ Writing to the Websocket
 #define WS_MAX_FRAME_SIZE                                                      \
   (FIO_MEMORY_BLOCK_ALLOC_LIMIT - 4096) // should be less then `unsigned short`
 
-static void websocket_write_impl(intptr_t fd, void *data, size_t len, char text,
-                                 char first, char last, char client) {
+/**
+ * Server frames with a payload at least this long are sent by
+ * `websocket_write2` without copying the payload (smaller payloads are cheaper
+ * to copy than to send as a separate packet).
+ */
+#ifndef WS_ZERO_COPY_MIN
+#define WS_ZERO_COPY_MIN 16384
+#endif
+
+/* holds back a frame while a message is streamed. Call with the write lock. */
+static void websocket_hold(ws_s *ws, void *data, size_t len, char text) {
+  if (!ws->held)
+    ws->held = fiobj_str_buf(len + 16);
+  fiobj_str_capa_assert(ws->held, fiobj_obj2cstr(ws->held).len + len + 16);
+  fio_str_info_s i = fiobj_obj2cstr(ws->held);
+  i.len += (ws->is_client ? websocket_client_wrap(i.data + i.len, data, len,
+                                                  (text ? 1 : 2), 1, 1, 0)
+                          : websocket_server_wrap(i.data + i.len, data, len,
+                                                  (text ? 1 : 2), 1, 1, 0));
+  fiobj_str_resize(ws->held, i.len);
+}
+
+/* copies and sends the data as frames. Call with the write lock. */
+static void websocket_write_impl(ws_s *ws, void *data, size_t len, char text,
+                                 char first, char last) {
   if (len <= WS_MAX_FRAME_SIZE) {
     void *buff = fio_malloc(len + 16);
-    len = (client ? websocket_client_wrap(buff, data, len, (text ? 1 : 2),
-                                          first, last, 0)
-                  : websocket_server_wrap(buff, data, len, (text ? 1 : 2),
-                                          first, last, 0));
-    fio_write2(fd, .data.buffer = buff, .length = len,
+    len = (ws->is_client ? websocket_client_wrap(buff, data, len,
+                                                 (text ? 1 : 2), first, last, 0)
+                         : websocket_server_wrap(buff, data, len,
+                                                 (text ? 1 : 2), first, last,
+                                                 0));
+    fio_write2(ws->fd, .data.buffer = buff, .length = len,
                .after.dealloc = fio_free);
   } else {
     /* frame fragmentation is better for large data then large frames */
     while (len > WS_MAX_FRAME_SIZE) {
-      websocket_write_impl(fd, data, WS_MAX_FRAME_SIZE, text, first, 0, client);
+      websocket_write_impl(ws, data, WS_MAX_FRAME_SIZE, text, first, 0);
       data = ((uint8_t *)data) + WS_MAX_FRAME_SIZE;
       first = 0;
       len -= WS_MAX_FRAME_SIZE;
     }
-    websocket_write_impl(fd, data, len, text, first, 1, client);
+    websocket_write_impl(ws, data, len, text, first, last);
   }
   return;
 }
 
+static void websocket_fiobj_dealloc(void *o) { fiobj_free((FIOBJ)o); }
+
+/* releases the data passed to `websocket_write2` / `websocket_write_stream` */
+static void websocket_write_release(struct websocket_write_args_s *a) {
+  if (a->fiobj)
+    fiobj_free(a->fiobj);
+  else
+    (a->dealloc ? a->dealloc : free)(a->data.data);
+}
+
+/* sends a frame without copying the payload, if possible. Call with the lock */
+static void websocket_write_frame(ws_s *ws, struct websocket_write_args_s *a,
+                                  char text, char first, char last) {
+  void *buffer = a->data.data;
+  uintptr_t offset = 0;
+  void (*dealloc)(void *) = (a->dealloc ? a->dealloc : free);
+  if (a->fiobj) {
+    a->data = fiobj_obj2cstr(a->fiobj);
+    buffer = (void *)a->fiobj;
+    offset = (uintptr_t)a->data.data - (uintptr_t)a->fiobj;
+    dealloc = websocket_fiobj_dealloc;
+  }
+  if (ws->is_client || a->data.len < WS_ZERO_COPY_MIN) {
+    /* client data is masked (and small data is cheaper to copy) */
+    websocket_write_impl(ws, a->data.data, a->data.len, text, first, last);
+    websocket_write_release(a);
+    return;
+  }
+  uint8_t *head = fio_malloc(16);
+  FIO_ASSERT_ALLOC(head);
+  const uint8_t head_len = websocket_server_wrap_head(
+      head, a->data.len, (text ? 1 : 2), first, last, 0);
+  fio_write2(ws->fd, .data.buffer = head, .length = head_len,
+             .after.dealloc = fio_free);
+  fio_write2(ws->fd, .data.buffer = buffer, .offset = offset,
+             .length = a->data.len, .after.dealloc = dealloc);
+}
+
 /* *****************************************************************************
 Multi-client broadcast optimizations
 ***************************************************************************** */
@@ -561,7 +781,16 @@ static inline void websocket_on_pubsub_message_direct_internal(fio_msg_s *msg,
     if (pre_wrapped) {
       // FIO_LOG_DEBUG(
       //     "pub/sub WebSocket optimization route for pre-wrapped message.");
-      fiobj_send_free((intptr_t)msg->udata1, fiobj_dup(pre_wrapped));
+      ws_s *ws = (ws_s *)pr;
+      fio_lock(&ws->write_lock);
+      if (ws->stream) {
+        if (!ws->held)
+          ws->held = fiobj_str_buf(0);
+        fiobj_str_concat(ws->held, pre_wrapped);
+      } else {
+        fiobj_send_free((intptr_t)msg->udata1, fiobj_dup(pre_wrapped));
+      }
+      fio_unlock(&ws->write_lock);
       goto finish;
     }
   }
@@ -664,12 +893,11 @@ uintptr_t websocket_subscribe(struct websocket_subscribe_s args) {
     /* don't free `d`, return (`d` freed by fio_subscribe) */
     return 0;
   }
-  fio_ls_s *pos;
   fio_lock(&args.ws->sub_lock);
-  pos = fio_ls_push(&args.ws->subscriptions, sub);
+  ws_sub_list_push(&args.ws->subscriptions, sub);
   fio_unlock(&args.ws->sub_lock);
 
-  return (uintptr_t)pos;
+  return (uintptr_t)sub;
 error:
   if (args.on_unsubscribe)
     args.on_unsubscribe(args.udata);
@@ -680,12 +908,12 @@ error:
  * Unsubscribes from a channel.
  */
 void websocket_unsubscribe(ws_s *ws, uintptr_t subscription_id) {
-  fio_unsubscribe((subscription_s *)((fio_ls_s *)subscription_id)->obj);
   fio_lock(&ws->sub_lock);
-  fio_ls_remove((fio_ls_s *)subscription_id);
+  int missing = ws_sub_list_remove(&ws->subscriptions,
+                                   (subscription_s *)subscription_id);
   fio_unlock(&ws->sub_lock);
-
-  (void)ws;
+  if (!missing)
+    fio_unsubscribe((subscription_s *)subscription_id);
 }
 
 /*******************************************************************************
@@ -716,16 +944,116 @@ uint8_t websocket_is_client(ws_s *ws) { return ws->is_client; }
 /** Writes data to the websocket. Returns -1 on failure (0 on success). */
 int websocket_write(ws_s *ws, fio_str_info_s msg, uint8_t is_text) {
   if (fio_is_valid(ws->fd)) {
-    websocket_write_impl(ws->fd, msg.data, msg.len, is_text, 1, 1,
-                         ws->is_client);
+    fio_lock(&ws->write_lock);
+    if (ws->stream)
+      websocket_hold(ws, msg.data, msg.len, is_text);
+    else
+      websocket_write_impl(ws, msg.data, msg.len, is_text, 1, 1);
+    fio_unlock(&ws->write_lock);
     return 0;
   }
   return -1;
 }
+
+/**
+ * Writes data to the websocket without copying it (when possible), releasing
+ * the data once it was sent. Returns -1 on failure (0 on success).
+ */
+#undef websocket_write2
+int websocket_write2(struct websocket_write_args_s args) {
+  ws_s *ws = args.ws;
+  if (!ws || !fio_is_valid(ws->fd)) {
+    websocket_write_release(&args);
+    return -1;
+  }
+  fio_lock(&ws->write_lock);
+  if (ws->stream) {
+    /* a message is being streamed, send this message once it ends */
+    if (args.fiobj)
+      args.data = fiobj_obj2cstr(args.fiobj);
+    websocket_hold(ws, args.data.data, args.data.len, args.is_text);
+    websocket_write_release(&args);
+  } else {
+    /* a single frame, large payloads aren't copied */
+    websocket_write_frame(ws, &args, args.is_text, 1, 1);
+  }
+  fio_unlock(&ws->write_lock);
+  return 0;
+}
+
+/**
+ * Starts a streamed (fragmented) message. Returns -1 on failure (0 on success).
+ */
+int websocket_write_stream_begin(ws_s *ws, uint8_t is_text) {
+  int ret = -1;
+  fio_lock(&ws->write_lock);
+  if (!ws->stream && fio_is_valid(ws->fd)) {
+    ws->stream = 1;
+    ws->stream_text = is_text;
+    ret = 0;
+  }
+  fio_unlock(&ws->write_lock);
+  return ret;
+}
+
+/**
+ * Sends the next part of a streamed message as a frame, releasing the data
+ * once it was sent. Returns -1 on failure (0 on success).
+ */
+#undef websocket_write_stream
+int websocket_write_stream(struct websocket_write_args_s args) {
+  ws_s *ws = args.ws;
+  int ret = -1;
+  if (!ws)
+    goto finish;
+  fio_lock(&ws->write_lock);
+  if (!ws->stream || !fio_is_valid(ws->fd)) {
+    fio_unlock(&ws->write_lock);
+    goto finish;
+  }
+  ret = 0;
+  if (args.fiobj)
+    args.data = fiobj_obj2cstr(args.fiobj);
+  if (args.data.len) {
+    websocket_write_frame(ws, &args, ws->stream_text, (ws->stream == 1), 0);
+    ws->stream = 2;
+    fio_unlock(&ws->write_lock);
+    return ret;
+  }
+  fio_unlock(&ws->write_lock);
+finish:
+  websocket_write_release(&args);
+  return ret;
+}
+
+/**
+ * Ends a streamed message, sending any messages written in the meantime.
+ * Returns -1 on failure (0 on success).
+ */
+int websocket_write_stream_end(ws_s *ws) {
+  fio_lock(&ws->write_lock);
+  if (!ws->stream) {
+    fio_unlock(&ws->write_lock);
+    return -1;
+  }
+  /* an empty final frame (a complete, empty, message if nothing was sent) */
+  websocket_write_impl(ws, (void *)"", 0, ws->stream_text, (ws->stream == 1),
+                       1);
+  ws->stream = 0;
+  if (ws->held) {
+    fiobj_send_free(ws->fd, ws->held);
+    ws->held = FIOBJ_INVALID;
+  }
+  fio_unlock(&ws->write_lock);
+  return 0;
+}
+
 /** Closes a websocket connection. */
 void websocket_close(ws_s *ws) {
+  fio_lock(&ws->write_lock);
   fio_write2(ws->fd, .data.buffer = "\x88\x00", .length = 2,
              .after.dealloc = FIO_DEALLOC_NOOP);
+  fio_unlock(&ws->write_lock);
   fio_close(ws->fd);
   return;
 }
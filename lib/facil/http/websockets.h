@@ -53,6 +53,74 @@ Websocket Connection Management (write / close)
 
 /** Writes data to the websocket. Returns -1 on failure (0 on success). */
 int websocket_write(ws_s *ws, fio_str_info_s msg, uint8_t is_text);
+
+/** Named arguments for the {websocket_write2} and {websocket_write_stream}. */
+struct websocket_write_args_s {
+  /** the websocket. REQUIRED. */
+  ws_s *ws;
+  /** the data to be sent. */
+  fio_str_info_s data;
+  /**
+   * Called with `data.data` once the data was sent (or the write failed).
+   *
+   * Defaults to `free`. Use `FIO_DEALLOC_NOOP` for static data.
+   */
+  void (*dealloc)(void *data);
+  /**
+   * A FIOBJ String to be sent instead of `data`. The object is freed once it
+   * was sent (use `fiobj_dup` to keep a reference).
+   */
+  FIOBJ fiobj;
+  /** set to 1 for a UTF-8 text message (ignored when streaming). */
+  uint8_t is_text;
+};
+
+/**
+ * Writes data to the websocket without copying the data, when possible.
+ *
+ * The data is owned by the WebSocket until it was sent (even on error), at
+ * which point it's released using `dealloc` (or `fiobj_free`).
+ *
+ * Server messages (at least `WS_ZERO_COPY_MIN` bytes long) are sent as a single
+ * frame: a small header packet followed by the payload. Smaller messages and
+ * client messages (which are masked) are copied.
+ *
+ * Returns -1 on failure (0 on success).
+ */
+int websocket_write2(struct websocket_write_args_s args);
+#define websocket_write2(wbsckt, ...)                                          \
+  websocket_write2((struct websocket_write_args_s){.ws = wbsckt, __VA_ARGS__})
+
+/**
+ * Starts a streamed (fragmented) message, allowing a large message to be sent
+ * as it's produced, using {websocket_write_stream} for each part and
+ * {websocket_write_stream_end} to finish the message.
+ *
+ * Messages written while a message is streamed are held back (copied) and sent
+ * once the streamed message ends.
+ *
+ * Returns -1 on failure (0 on success), i.e., if a message is already streamed.
+ */
+int websocket_write_stream_begin(ws_s *ws, uint8_t is_text);
+
+/**
+ * Sends the next part of a streamed message as a continuation frame.
+ *
+ * The data is released the same as it is for {websocket_write2} (large parts
+ * aren't copied).
+ *
+ * Returns -1 on failure (0 on success).
+ */
+int websocket_write_stream(struct websocket_write_args_s args);
+#define websocket_write_stream(wbsckt, ...)                                    \
+  websocket_write_stream(                                                      \
+      (struct websocket_write_args_s){.ws = wbsckt, __VA_ARGS__})
+
+/**
+ * Ends a streamed message. Returns -1 on failure (0 on success).
+ */
+int websocket_write_stream_end(ws_s *ws);
+
 /** Closes a websocket connection. */
 void websocket_close(ws_s *ws);
 
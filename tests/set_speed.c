@@ -0,0 +1,97 @@
+/*
+Copyright: Boaz Segev, 2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+
+/**
+ * This program compares the default Set / Hash Map mapping (cuckoo steps)
+ * with the opt-in group probing mapping (FIO_SET_GROUP_PROBING).
+ *
+ * Lookups are tested for both existing (hit) and missing (miss) keys.
+ */
+#include <fio.h>
+#include <fio_cli.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define FIO_SET_NAME cuckoo_map
+#define FIO_SET_KEY_TYPE uint64_t
+#define FIO_SET_OBJ_TYPE uint64_t
+#include <fio.h>
+
+#define FIO_SET_NAME group_map
+#define FIO_SET_KEY_TYPE uint64_t
+#define FIO_SET_OBJ_TYPE uint64_t
+#define FIO_SET_GROUP_PROBING 1
+#include <fio.h>
+
+/* the minimal number of lookups per test, so small maps can be measured */
+#define MIN_LOOKUPS (1UL << 22)
+
+static inline uint64_t key_hash(uint64_t key) {
+  return fio_risky_hash(&key, sizeof(key), 0);
+}
+
+static double time_diff(struct timespec *start, struct timespec *end) {
+  return ((end->tv_sec - start->tv_sec) * 1000000000.0 +
+          (end->tv_nsec - start->tv_nsec));
+}
+
+/* each test defines `insert` and `find` for a specific map type */
+#define SET_SPEED_TEST(map_name, count)                                        \
+  do {                                                                         \
+    map_name##_s m = FIO_SET_INIT;                                             \
+    struct timespec start, end;                                                \
+    uint64_t found = 0;                                                        \
+    const size_t rounds = (count) < MIN_LOOKUPS ? (MIN_LOOKUPS / (count)) : 1; \
+    clock_gettime(CLOCK_MONOTONIC, &start);                                    \
+    for (uint64_t i = 1; i <= (count); ++i) {                                  \
+      map_name##_insert(&m, key_hash(i), i, i, NULL);                          \
+    }                                                                          \
+    clock_gettime(CLOCK_MONOTONIC, &end);                                      \
+    fprintf(stderr, "\t%-10s insert: %8.2f ns/op", #map_name,                  \
+            time_diff(&start, &end) / (count));                                \
+    clock_gettime(CLOCK_MONOTONIC, &start);                                    \
+    for (size_t r = 0; r < rounds; ++r) {                                      \
+      for (uint64_t i = 1; i <= (count); ++i) {                                \
+        found += (map_name##_find(&m, key_hash(i), i) == i);                   \
+      }                                                                        \
+    }                                                                          \
+    clock_gettime(CLOCK_MONOTONIC, &end);                                      \
+    FIO_ASSERT(found == (count)*rounds, "lookup failed for " #map_name);       \
+    fprintf(stderr, "\thit: %8.2f ns/op",                                      \
+            time_diff(&start, &end) / ((count)*rounds));                       \
+    found = 0;                                                                 \
+    clock_gettime(CLOCK_MONOTONIC, &start);                                    \
+    for (size_t r = 0; r < rounds; ++r) {                                      \
+      for (uint64_t i = (count) + 1; i <= ((count) << 1); ++i) {               \
+        found += (map_name##_find(&m, key_hash(i), i) != 0);                   \
+      }                                                                        \
+    }                                                                          \
+    clock_gettime(CLOCK_MONOTONIC, &end);                                      \
+    FIO_ASSERT(!found, "missing keys found in " #map_name);                    \
+    fprintf(stderr, "\tmiss: %8.2f ns/op\n",                                   \
+            time_diff(&start, &end) / ((count)*rounds));                       \
+    map_name##_free(&m);                                                       \
+  } while (0)
+
+int main(int argc, char const **argv) {
+  fio_cli_start(argc, argv, 0, 0,
+                "This program compares the Set / Hash Map lookup speeds for "
+                "the default mapping and the group probing mapping.",
+                FIO_CLI_INT("-max -m the maximal number of entries tested "
+                            "(defaults to 10,000,000)."));
+  fio_cli_set_default("-m", "10000000");
+  const size_t max = (size_t)fio_cli_get_i("-m");
+  for (size_t count = 1000; count <= max; count *= 10) {
+    fprintf(stderr, "* Testing %zu entries:\n", count);
+    SET_SPEED_TEST(cuckoo_map, count);
+    SET_SPEED_TEST(group_map, count);
+  }
+  fio_cli_end();
+  return 0;
+}
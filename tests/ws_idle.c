@@ -0,0 +1,143 @@
+/*
+Copyright: Boaz Segev, 2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+
+/**
+ * This program measures the memory used by idle WebSocket connections.
+ *
+ * The program opens a number of WebSocket connections to itself (each
+ * connection has a server and a client side, both are WebSockets), exchanges a
+ * message on each connection (so read buffers were used) and reports the
+ * resident memory growth per idle WebSocket.
+ */
+#include <fio.h>
+#include <fio_cli.h>
+#include <http.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static size_t connections;
+static size_t subscriptions;
+static size_t opened;
+static size_t replies;
+static size_t rss_start;
+
+/* returns the resident memory (in bytes), using the Linux proc file system */
+static size_t rss_bytes(void) {
+  size_t pages = 0, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (!f)
+    return 0;
+  if (fscanf(f, "%zu %zu", &pages, &resident) != 2)
+    resident = 0;
+  fclose(f);
+  return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static void on_server_open(ws_s *ws) {
+  for (size_t i = 0; i < subscriptions; ++i) {
+    char buf[32];
+    size_t len = (size_t)snprintf(buf, sizeof(buf), "channel %zu", i);
+    websocket_subscribe(ws, .channel = {.data = buf, .len = len});
+  }
+}
+
+static void on_server_message(ws_s *ws, fio_str_info_s msg, uint8_t is_text) {
+  websocket_write(ws, msg, is_text);
+}
+
+static void on_client_open(ws_s *ws) {
+  websocket_write(ws, (fio_str_info_s){.data = "ping", .len = 4}, 1);
+  fio_atomic_add(&opened, 1);
+}
+
+static void on_client_message(ws_s *ws, fio_str_info_s msg, uint8_t is_text) {
+  fio_atomic_add(&replies, 1);
+  (void)ws;
+  (void)msg;
+  (void)is_text;
+}
+
+static void on_http_request(http_s *h) { http_send_error(h, 400); }
+
+static void on_http_upgrade(http_s *h, char *target, size_t len) {
+  http_upgrade2ws(h, .on_open = on_server_open,
+                  .on_message = on_server_message);
+  (void)target;
+  (void)len;
+}
+
+static void report_when_idle(void *ignr) {
+  static size_t idle_reviews;
+  if (replies < connections) {
+    fprintf(stderr, "* %zu/%zu connections answered.\n", replies, connections);
+    return;
+  }
+  /* allow the last messages to settle, so all connections are idle */
+  if (++idle_reviews < 3)
+    return;
+  const size_t rss = rss_bytes();
+  fprintf(stderr,
+          "* %zu idle WebSocket connections (%zu subscriptions each):\n"
+          "\tresident memory growth: %zu bytes\n"
+          "\tper connection (server and client sides): %zu bytes\n"
+          "\tper WebSocket: %zu bytes\n",
+          connections, subscriptions, rss - rss_start,
+          (rss - rss_start) / connections,
+          (rss - rss_start) / (connections << 1));
+  fio_stop();
+  (void)ignr;
+}
+
+static void connect_clients(void *url) {
+  rss_start = rss_bytes();
+  for (size_t i = 0; i < connections; ++i) {
+    if (websocket_connect(url, .on_open = on_client_open,
+                          .on_message = on_client_message) == -1) {
+      FIO_LOG_FATAL("couldn't open connection %zu", i);
+      fio_stop();
+      return;
+    }
+  }
+  fio_run_every(500, 0, report_when_idle, NULL, NULL);
+}
+
+int main(int argc, char const **argv) {
+  fio_cli_start(argc, argv, 0, 0,
+                "This program measures the memory used by idle WebSocket "
+                "connections (both sides of each connection are local).",
+                FIO_CLI_INT("-connections -c the number of connections "
+                            "(defaults to 5,000)."),
+                FIO_CLI_INT("-subscriptions -s the number of pub/sub "
+                            "subscriptions per server side connection "
+                            "(defaults to 1)."),
+                FIO_CLI_STRING("-port -p the port to use (defaults to 3030)."));
+  fio_cli_set_default("-c", "5000");
+  fio_cli_set_default("-s", "1");
+  fio_cli_set_default("-p", "3030");
+  connections = (size_t)fio_cli_get_i("-c");
+  subscriptions = (size_t)fio_cli_get_i("-s");
+  if (!connections || (connections << 1) + 64 > fio_capa()) {
+    FIO_LOG_FATAL("the connection count must be positive and below %zu (the "
+                  "open file limit is shared by both sides).",
+                  (fio_capa() - 64) >> 1);
+    exit(-1);
+  }
+  static char url[64];
+  snprintf(url, sizeof(url), "ws://localhost:%s/", fio_cli_get("-p"));
+  if (http_listen(fio_cli_get("-p"), NULL, .on_request = on_http_request,
+                  .on_upgrade = on_http_upgrade) == -1) {
+    FIO_LOG_FATAL("couldn't listen to port %s", fio_cli_get("-p"));
+    exit(-1);
+  }
+  fio_state_callback_add(FIO_CALL_ON_START,
+                         (void (*)(void *))connect_clients, url);
+  fio_start(.threads = 1, .workers = 1);
+  fio_cli_end();
+  return 0;
+}